@@ -2,6 +2,9 @@
  * inMemDb CLI Client
  * Connects to the inMemDb server via TCP and provides a REPL interface.
  */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L /* strndup() under -std=c11 */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -0,0 +1,532 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L /* fdatasync() and truncate() under -std=c11 */
+#endif
+
+#include "aof.h"
+#include "command.h"
+#include "config.h"
+#include "persist.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define aof_write _write
+#define aof_sync _commit
+#define AOF_OPEN_FLAGS (_O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY)
+#else
+#include <unistd.h>
+#include <pthread.h>
+#define aof_write write
+#ifdef __linux__
+#define aof_sync fdatasync
+#else
+#define aof_sync fsync
+#endif
+#define AOF_OPEN_FLAGS (O_WRONLY | O_APPEND | O_CREAT)
+#endif
+
+#define AOF_LOAD_CHUNK (1024 * 1024)
+#define AOF_BUF_KEEP (4 * 1024 * 1024)  /* larger buffers are released once empty */
+#define AOF_FSYNC_INTERVAL_MS 1000
+#define AOF_FSYNC_MAX_DELAY_MS 2000     /* then the event loop waits for the sync */
+
+#define AOF_MANIFEST AOF_FILENAME ".manifest"
+#define AOF_REWRITE_TMP "temp-rewriteaof.rdb"
+#define AOF_NAME_MAX 256
+
+typedef struct {
+    char name[AOF_NAME_MAX];
+    int seq;
+    char type;               /* 'b' base, 'i' incremental */
+    uint64_t size;
+} aof_file_t;
+
+static struct {
+    int fd;                  /* the open incremental file, -1 while closed */
+    resp_buf_t buf;
+    uint64_t size;           /* bytes in the open file */
+    int last_write_ok;
+    int unsynced;            /* written since the last sync was requested */
+    int64_t last_fsync;      /* ms timestamp of the last sync request */
+    uint64_t delayed_fsync;
+
+    aof_file_t *files;       /* the manifest: an optional base, then incrementals */
+    size_t nfiles;
+    int base_seq, incr_seq;  /* highest sequence numbers used */
+    size_t rewrite_keep;     /* first file a running rewrite does not cover */
+    int rewriting;
+    uint64_t rewrite_base_size; /* total size after the last load or rewrite */
+} aof = { .fd = -1, .last_write_ok = 1 };
+
+/* ---- Background fsync ---- */
+
+#ifndef _WIN32
+static pthread_t fsync_thread;
+static pthread_mutex_t fsync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fsync_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t fsync_done = PTHREAD_COND_INITIALIZER;
+static int fsync_pending, fsync_running, fsync_stop, fsync_started;
+
+static void *fsync_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&fsync_lock);
+    for (;;) {
+        while (!fsync_pending && !fsync_stop) pthread_cond_wait(&fsync_cond, &fsync_lock);
+        if (!fsync_pending) break;
+        fsync_pending = 0;
+        fsync_running = 1;
+        int fd = aof.fd;
+        pthread_mutex_unlock(&fsync_lock);
+        aof_sync(fd);
+        pthread_mutex_lock(&fsync_lock);
+        fsync_running = 0;
+        pthread_cond_broadcast(&fsync_done);
+    }
+    pthread_mutex_unlock(&fsync_lock);
+    return NULL;
+}
+
+/* Hand a sync to the thread. While the previous one is still running the
+ * request is retried on a later iteration, unless that one has taken so
+ * long that the unsynced tail would exceed the policy's bound. */
+static void request_fsync(int64_t now) {
+    pthread_mutex_lock(&fsync_lock);
+    if (fsync_pending || fsync_running) {
+        if (now - aof.last_fsync < AOF_FSYNC_MAX_DELAY_MS) {
+            pthread_mutex_unlock(&fsync_lock);
+            return;
+        }
+        aof.delayed_fsync++;
+        while (fsync_pending || fsync_running) pthread_cond_wait(&fsync_done, &fsync_lock);
+    }
+    fsync_pending = 1;
+    aof.last_fsync = now;
+    aof.unsynced = 0;
+    pthread_cond_signal(&fsync_cond);
+    pthread_mutex_unlock(&fsync_lock);
+}
+
+/* Wait until the thread holds no reference to the open file */
+static void fsync_wait_idle(void) {
+    pthread_mutex_lock(&fsync_lock);
+    while (fsync_pending || fsync_running) pthread_cond_wait(&fsync_done, &fsync_lock);
+    pthread_mutex_unlock(&fsync_lock);
+}
+#else
+static void fsync_wait_idle(void) {
+}
+
+static void request_fsync(int64_t now) {
+    aof_sync(aof.fd);
+    aof.last_fsync = now;
+    aof.unsynced = 0;
+}
+#endif
+
+/* ---- Files and manifest ----
+ *
+ * appendonly.aof.manifest lists the files to load, in order, one per line:
+ *   file appendonly.aof.2.base.rdb seq 2 type b
+ *   file appendonly.aof.5.incr.aof seq 5 type i
+ * It is replaced with an atomic rename, so it always names a complete set.
+ */
+
+static uint64_t file_size(const char *name) {
+    FILE *f = fopen(name, "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    long end = ftell(f);
+    fclose(f);
+    return end > 0 ? (uint64_t)end : 0;
+}
+
+static int file_exists(const char *name) {
+    FILE *f = fopen(name, "rb");
+    if (f) fclose(f);
+    return f != NULL;
+}
+
+static aof_file_t *add_file(const char *name, int seq, char type) {
+    aof.files = imdb_realloc(aof.files, (aof.nfiles + 1) * sizeof(aof_file_t));
+    aof_file_t *af = &aof.files[aof.nfiles++];
+    snprintf(af->name, sizeof(af->name), "%s", name);
+    af->seq = seq;
+    af->type = type;
+    af->size = file_size(name);
+    if (type == 'b' && seq > aof.base_seq) aof.base_seq = seq;
+    if (type == 'i' && seq > aof.incr_seq) aof.incr_seq = seq;
+    return af;
+}
+
+/* Bytes across all files; the open one's size is tracked in aof.size */
+static uint64_t total_size(void) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < aof.nfiles; i++) {
+        int open_file = aof.fd >= 0 && i == aof.nfiles - 1;
+        total += open_file ? aof.size : aof.files[i].size;
+    }
+    return total;
+}
+
+static int write_manifest(void) {
+    const char *tmp_name = AOF_MANIFEST ".tmp";
+    FILE *f = fopen(tmp_name, "w");
+    if (!f) return -1;
+    int rc = 0;
+    for (size_t i = 0; i < aof.nfiles; i++) {
+        if (fprintf(f, "file %s seq %d type %c\n", aof.files[i].name, aof.files[i].seq,
+                    aof.files[i].type) < 0) rc = -1;
+    }
+    if (fflush(f) != 0 || aof_sync(fileno(f)) != 0) rc = -1;
+    if (fclose(f) != 0) rc = -1;
+    if (rc != 0 || (remove(AOF_MANIFEST), rename(tmp_name, AOF_MANIFEST)) != 0) {
+        remove(tmp_name);
+        return -1;
+    }
+    return 0;
+}
+
+static int read_manifest(void) {
+    FILE *f = fopen(AOF_MANIFEST, "r");
+    if (!f) return 0;
+    char line[AOF_NAME_MAX + 64], name[AOF_NAME_MAX];
+    int rc = 1;
+    while (fgets(line, sizeof(line), f)) {
+        int seq;
+        char type;
+        if (line[0] == '\n' || line[0] == '#') continue;
+        if (sscanf(line, "file %255s seq %d type %c", name, &seq, &type) != 3 ||
+            (type != 'b' && type != 'i') || (type == 'b' && aof.nfiles > 0)) {
+            fprintf(stderr, "Error: invalid line in %s: %s", AOF_MANIFEST, line);
+            rc = -1;
+            break;
+        }
+        add_file(name, seq, type);
+    }
+    fclose(f);
+    return rc;
+}
+
+/* Start a new incremental file and make it the one appended to */
+static int open_incr(void) {
+    char name[AOF_NAME_MAX];
+    snprintf(name, sizeof(name), "%s.%d.incr.aof", AOF_FILENAME, aof.incr_seq + 1);
+    int fd = open(name, AOF_OPEN_FLAGS | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    if (aof.fd >= 0) {
+        fsync_wait_idle();
+        aof_sync(aof.fd);
+        close(aof.fd);
+        aof.files[aof.nfiles - 1].size = aof.size;
+    }
+    add_file(name, aof.incr_seq + 1, 'i');
+    aof.fd = fd;
+    aof.size = 0;
+    aof.unsynced = 0;
+    return 0;
+}
+
+int aof_open(database_t *db) {
+    /* Nothing was loaded from an AOF: the dataset so far becomes the base */
+    if (aof.nfiles == 0 && db_size(db) > 0) {
+        char name[AOF_NAME_MAX];
+        snprintf(name, sizeof(name), "%s.%d.base.rdb", AOF_FILENAME, 1);
+        if (persist_save(db, name) != 0) return -1;
+        add_file(name, 1, 'b');
+    }
+
+    aof_file_t *last = aof.nfiles ? &aof.files[aof.nfiles - 1] : NULL;
+    if (last && last->type == 'i') {
+        aof.fd = open(last->name, AOF_OPEN_FLAGS, 0644);
+        aof.size = last->size;
+    } else if (open_incr() != 0) {
+        aof.fd = -1;
+    }
+    if (aof.fd < 0 || write_manifest() != 0) return -1;
+
+    resp_buf_init(&aof.buf);
+    aof.last_write_ok = 1;
+    aof.unsynced = 0;
+    aof.last_fsync = imdb_mstime();
+    aof.rewrite_base_size = total_size();
+#ifndef _WIN32
+    fsync_stop = 0;
+    fsync_started = g_config.appendfsync == AOF_FSYNC_EVERYSEC &&
+                    pthread_create(&fsync_thread, NULL, fsync_main, NULL) == 0;
+#endif
+    return 0;
+}
+
+void aof_close(void) {
+    if (aof.fd < 0) return;
+    aof_flush();
+#ifndef _WIN32
+    if (fsync_started) {
+        pthread_mutex_lock(&fsync_lock);
+        fsync_stop = 1;
+        pthread_cond_signal(&fsync_cond);
+        pthread_mutex_unlock(&fsync_lock);
+        pthread_join(fsync_thread, NULL);
+        fsync_started = 0;
+    }
+#endif
+    aof_sync(aof.fd);
+    close(aof.fd);
+    aof.fd = -1;
+    resp_buf_free(&aof.buf);
+    imdb_free(aof.files);
+    aof.files = NULL;
+    aof.nfiles = 0;
+}
+
+/* ---- Rewrite ---- */
+
+const char *aof_rewrite_start(void) {
+    if (aof.fd < 0 || aof.rewriting) return NULL;
+    /* Everything logged so far is in the files the new base replaces */
+    aof_flush();
+    if (open_incr() != 0) return NULL;
+    if (write_manifest() != 0) {
+        fprintf(stderr, "Warning: could not update %s\n", AOF_MANIFEST);
+    }
+    aof.rewrite_keep = aof.nfiles - 1;
+    aof.rewriting = 1;
+    return AOF_REWRITE_TMP;
+}
+
+void aof_rewrite_done(int ok) {
+    if (!aof.rewriting) return;
+    aof.rewriting = 0;
+    if (!ok) {
+        remove(AOF_REWRITE_TMP);
+        return;
+    }
+
+    char name[AOF_NAME_MAX];
+    snprintf(name, sizeof(name), "%s.%d.base.rdb", AOF_FILENAME, aof.base_seq + 1);
+    if (rename(AOF_REWRITE_TMP, name) != 0) {
+        remove(AOF_REWRITE_TMP);
+        return;
+    }
+
+    /* New manifest: the new base, then the files opened since the rewrite began */
+    size_t old_count = aof.rewrite_keep;
+    aof_file_t *old = aof.files;
+    size_t keep = aof.nfiles - old_count;
+    aof.files = NULL;
+    aof.nfiles = 0;
+    add_file(name, aof.base_seq + 1, 'b');
+    aof.files = imdb_realloc(aof.files, (1 + keep) * sizeof(aof_file_t));
+    memcpy(aof.files + 1, old + old_count, keep * sizeof(aof_file_t));
+    aof.nfiles = 1 + keep;
+    aof.files[aof.nfiles - 1].size = aof.size;
+
+    if (write_manifest() != 0) {
+        /* Keep loading the old set; the new base is just an unused file */
+        fprintf(stderr, "Warning: could not update %s\n", AOF_MANIFEST);
+        imdb_free(aof.files);
+        aof.files = old;
+        aof.nfiles = old_count + keep;
+        remove(name);
+        return;
+    }
+    for (size_t i = 0; i < old_count; i++) remove(old[i].name);
+    imdb_free(old);
+    aof.rewrite_base_size = total_size();
+}
+
+int aof_rewrite_needed(void) {
+    if (aof.fd < 0 || aof.rewriting || g_config.auto_aof_rewrite_percentage == 0) return 0;
+    uint64_t total = total_size();
+    uint64_t base = aof.rewrite_base_size ? aof.rewrite_base_size : 1;
+    if (total < g_config.auto_aof_rewrite_min_size || total <= base) return 0;
+    return (total - base) * 100 / base >= g_config.auto_aof_rewrite_percentage;
+}
+
+static void feed_arg(const char *s, size_t len) {
+    resp_write_bulk_string(&aof.buf, s, len);
+}
+
+void aof_feed_command(const resp_value_t *cmd) {
+    if (aof.fd < 0) return;
+    resp_write_array_header(&aof.buf, cmd->data.array.count);
+    for (size_t i = 0; i < cmd->data.array.count; i++) {
+        const resp_value_t *v = cmd->data.array.items[i];
+        if (v->type == RESP_INTEGER) {
+            char num[32];
+            int n = snprintf(num, sizeof(num), "%lld", (long long)v->data.num);
+            feed_arg(num, (size_t)n);
+        } else {
+            feed_arg(v->data.str ? v->data.str : "", v->data.str ? v->len : 0);
+        }
+    }
+}
+
+void aof_feed_argv(int argc, const char **argv, const size_t *lens) {
+    if (aof.fd < 0) return;
+    resp_write_array_header(&aof.buf, (size_t)argc);
+    for (int i = 0; i < argc; i++) feed_arg(argv[i], lens ? lens[i] : strlen(argv[i]));
+}
+
+void aof_flush(void) {
+    if (aof.fd < 0) return;
+    size_t written = 0;
+    while (written < aof.buf.len) {
+        size_t chunk = aof.buf.len - written;
+        if (chunk > (1u << 30)) chunk = 1u << 30;
+        long n = (long)aof_write(aof.fd, aof.buf.buf + written, (unsigned)chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (aof.last_write_ok)
+                fprintf(stderr, "Error: writing to the AOF failed: %s\n", strerror(errno));
+            aof.last_write_ok = 0;
+            break;
+        }
+        written += (size_t)n;
+    }
+    if (written > 0) {
+        /* Keep whatever could not be written for the next attempt */
+        memmove(aof.buf.buf, aof.buf.buf + written, aof.buf.len - written);
+        aof.buf.len -= written;
+        aof.size += written;
+        aof.unsynced = 1;
+        if (aof.buf.len == 0) aof.last_write_ok = 1;
+    }
+    if (aof.buf.len == 0 && aof.buf.cap > AOF_BUF_KEEP) {
+        resp_buf_free(&aof.buf);
+        resp_buf_init(&aof.buf);
+    }
+
+    if (!aof.unsynced) return;
+    if (g_config.appendfsync == AOF_FSYNC_ALWAYS) {
+        aof_sync(aof.fd);
+        aof.unsynced = 0;
+    } else if (g_config.appendfsync == AOF_FSYNC_EVERYSEC) {
+        int64_t now = imdb_mstime();
+        if (now - aof.last_fsync >= AOF_FSYNC_INTERVAL_MS) request_fsync(now);
+    }
+}
+
+void aof_get_stats(aof_stats_t *out) {
+    out->enabled = aof.fd >= 0;
+    out->current_size = total_size();
+    out->base_size = aof.rewrite_base_size;
+    out->files = aof.nfiles;
+    out->rewriting = aof.rewriting;
+    out->buffer_length = aof.fd >= 0 ? aof.buf.len : 0;
+    out->last_write_ok = aof.last_write_ok;
+    out->delayed_fsync = aof.delayed_fsync;
+}
+
+/* ---- Loading ---- */
+
+static void truncate_file(const char *filename, long long size) {
+#ifdef _WIN32
+    int fd = _open(filename, _O_RDWR | _O_BINARY);
+    if (fd >= 0) {
+        _chsize_s(fd, size);
+        _close(fd);
+    }
+#else
+    if (truncate(filename, (off_t)size) != 0)
+        fprintf(stderr, "Warning: could not truncate %s: %s\n", filename, strerror(errno));
+#endif
+}
+
+/* Replay one file; only the last may end in a torn command */
+static long long load_file(database_t *db, const char *filename, int last) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open %s\n", filename);
+        return -1;
+    }
+
+    /* Optional snapshot preamble */
+    uint64_t end = 0;
+    int preamble = persist_read(db, filename, &end);
+    if (preamble == -2) {
+        fprintf(stderr, "Error: the snapshot in %s is damaged\n", filename);
+        fclose(f);
+        return -1;
+    }
+    long long valid = preamble >= 0 ? (long long)end : 0;
+    if (preamble >= 0) printf("Loaded %d keys from %s\n", preamble, filename);
+    fseek(f, (long)valid, SEEK_SET);
+
+    size_t cap = AOF_LOAD_CHUNK, len = 0;
+    char *buf = imdb_malloc(cap);
+    resp_buf_t reply;
+    resp_buf_init(&reply);
+    long long commands = 0;
+    int corrupt = 0;
+
+    for (;;) {
+        if (len == cap) {
+            cap *= 2;
+            buf = imdb_realloc(buf, cap);
+        }
+        size_t n = fread(buf + len, 1, cap - len, f);
+        len += n;
+
+        size_t pos = 0;
+        while (pos < len) {
+            resp_value_t *cmd = NULL;
+            int consumed = resp_parse(buf + pos, len - pos, &cmd);
+            if (consumed == 0) break;
+            if (consumed < 0 || cmd->type != RESP_ARRAY || cmd->data.array.count == 0) {
+                resp_free(cmd);
+                corrupt = 1;
+                break;
+            }
+            command_execute(db, NULL, cmd, &reply);
+            reply.len = 0;
+            resp_free(cmd);
+            pos += (size_t)consumed;
+            valid += consumed;
+            commands++;
+        }
+        memmove(buf, buf + pos, len - pos);
+        len -= pos;
+        if (corrupt || n == 0) break;
+    }
+
+    fclose(f);
+    imdb_free(buf);
+    resp_buf_free(&reply);
+
+    if (corrupt) {
+        fprintf(stderr, "Error: %s is corrupt at offset %lld\n", filename, valid);
+        return -1;
+    }
+    if (len > 0) {
+        if (!last) {
+            fprintf(stderr, "Error: %s ends with an incomplete command\n", filename);
+            return -1;
+        }
+        fprintf(stderr, "Warning: %s ends with an incomplete command; truncating %zu bytes\n",
+                filename, len);
+        truncate_file(filename, valid);
+    }
+    if (commands) printf("Replayed %lld commands from %s\n", commands, filename);
+    return commands;
+}
+
+int aof_load(database_t *db) {
+    int rc = read_manifest();
+    if (rc == 0 && file_exists(AOF_FILENAME)) {
+        /* A single-file AOF from an older version */
+        add_file(AOF_FILENAME, 0, 'b');
+        rc = 1;
+    }
+    if (rc <= 0) return rc;
+    for (size_t i = 0; i < aof.nfiles; i++) {
+        if (load_file(db, aof.files[i].name, i == aof.nfiles - 1) < 0) return -1;
+        aof.files[i].size = file_size(aof.files[i].name);
+    }
+    return 1;
+}
@@ -0,0 +1,78 @@
+#ifndef AOF_H
+#define AOF_H
+
+#include "db.h"
+#include "resp.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Append-only file. Write commands are appended in RESP form to an
+ * in-memory buffer as they execute; the event loop flushes the buffer
+ * with one write() per iteration, before any reply of that iteration is
+ * sent, and then syncs it according to the appendfsync policy:
+ *
+ *   always    fdatasync inline, so one sync covers every command of the
+ *             batch (group commit) and no acknowledged write is lost
+ *   everysec  a background thread syncs once a second; if a sync is still
+ *             running two seconds after it was requested, the event loop
+ *             waits for it rather than let the unsynced tail grow
+ *   no        the operating system decides
+ *
+ * The log is split into files listed by appendonly.aof.manifest: an
+ * optional base holding the dataset in the snapshot format, then
+ * incremental files of commands, replayed in order at startup. A rewrite
+ * starts a new incremental file for the writes that follow, lets a forked
+ * child write the dataset to a new base, and on success replaces the
+ * manifest with the new base plus that incremental file, so disk use and
+ * restart time follow the live dataset rather than its history.
+ */
+
+#define AOF_FILENAME "appendonly.aof"
+
+typedef struct {
+    int enabled;
+    uint64_t current_size;   /* bytes across all files */
+    uint64_t base_size;      /* size after the last load or rewrite */
+    size_t files;
+    int rewriting;
+    size_t buffer_length;    /* bytes waiting for the next flush */
+    int last_write_ok;
+    uint64_t delayed_fsync;  /* times the event loop waited for a slow fsync */
+} aof_stats_t;
+
+/* Load the files named by the manifest (or a single-file appendonly.aof
+ * from an older version). A command cut short by a crash at the end of
+ * the last file is truncated away with a warning. Returns 1 if loaded, 0
+ * if there is no AOF, -1 if a file is missing or corrupt. */
+int aof_load(database_t *db);
+
+/* Open the last incremental file for appending (starting one if needed)
+ * and the fsync thread. Without a loaded AOF, a non-empty dataset is
+ * first written out as the base. Returns 0 on success. */
+int aof_open(database_t *db);
+
+/* Flush, sync and close the AOF */
+void aof_close(void);
+
+/* Append a command to the buffer (no-op while the AOF is closed) */
+void aof_feed_command(const resp_value_t *cmd);
+void aof_feed_argv(int argc, const char **argv, const size_t *lens);
+
+/* Write the buffer out and sync per policy; called once per event-loop
+ * iteration */
+void aof_flush(void);
+
+/* Begin a rewrite: switch appends to a new incremental file and return the
+ * name the child should save the new base to (NULL if the AOF is closed
+ * or a rewrite is running). aof_rewrite_done installs or discards it. */
+const char *aof_rewrite_start(void);
+void aof_rewrite_done(int ok);
+
+/* Whether the files have grown by auto-aof-rewrite-percentage since the
+ * last rewrite and past auto-aof-rewrite-min-size */
+int aof_rewrite_needed(void);
+
+void aof_get_stats(aof_stats_t *out);
+
+#endif /* AOF_H */
@@ -0,0 +1,109 @@
+#include "bitops.h"
+#include "simd.h"
+#include <string.h>
+
+/* Mask of bits [from, to] of one byte, numbered from the most significant */
+static uint8_t byte_mask(unsigned from, unsigned to) {
+    return (uint8_t)((0xFFu >> from) & (0xFFu << (7 - to)));
+}
+
+int bitops_getbit(const uint8_t *p, size_t len, uint64_t offset) {
+    uint64_t byte = offset >> 3;
+    if (byte >= len) return 0;
+    return (p[byte] >> (7 - (offset & 7))) & 1;
+}
+
+int bitops_setbit(uint8_t *p, uint64_t offset, int value) {
+    uint8_t *b = p + (offset >> 3);
+    uint8_t bit = (uint8_t)(1u << (7 - (offset & 7)));
+    int old = (*b & bit) != 0;
+    if (value) *b |= bit;
+    else *b &= (uint8_t)~bit;
+    return old;
+}
+
+uint64_t bitops_count(const uint8_t *p, uint64_t start, uint64_t end) {
+    uint64_t first = start >> 3, last = end >> 3;
+    unsigned from = (unsigned)(start & 7), to = (unsigned)(end & 7);
+    if (first == last) return (uint64_t)__builtin_popcount(p[first] & byte_mask(from, to));
+
+    uint64_t total = (uint64_t)__builtin_popcount(p[first] & byte_mask(from, 7));
+    total += simd_popcount(p + first + 1, (size_t)(last - first - 1));
+    total += (uint64_t)__builtin_popcount(p[last] & byte_mask(0, to));
+    return total;
+}
+
+int64_t bitops_pos(const uint8_t *p, uint64_t start, uint64_t end, int bit) {
+    const uint8_t skip = bit ? 0x00 : 0xFF;
+    const uint64_t skip_word = bit ? 0 : UINT64_MAX;
+    uint64_t i = start;
+    while (i <= end) {
+        if ((i & 7) == 0) {
+            /* Byte aligned: skip words, then bytes, that cannot hold the bit */
+            uint64_t b = i >> 3;
+            while ((b + 8) * 8 - 1 <= end) {
+                uint64_t w;
+                memcpy(&w, p + b, 8);
+                if (w != skip_word) break;
+                b += 8;
+            }
+            while ((b + 1) * 8 - 1 <= end && p[b] == skip) b++;
+            i = b * 8;
+            if (i > end) break;
+        }
+        if (((p[i >> 3] >> (7 - (i & 7))) & 1) == bit) return (int64_t)i;
+        i++;
+    }
+    return -1;
+}
+
+uint64_t bitops_get_field(const uint8_t *p, size_t len, uint64_t offset, int bits) {
+    uint64_t v = 0;
+    for (int i = 0; i < bits; i++) {
+        v = (v << 1) | (uint64_t)bitops_getbit(p, len, offset + (uint64_t)i);
+    }
+    return v;
+}
+
+void bitops_set_field(uint8_t *p, uint64_t offset, int bits, uint64_t value) {
+    for (int i = 0; i < bits; i++) {
+        bitops_setbit(p, offset + (uint64_t)i, (int)((value >> (bits - 1 - i)) & 1));
+    }
+}
+
+int64_t bitops_sign_extend(uint64_t value, int bits) {
+    if (bits < 64) {
+        uint64_t mask = (1ULL << bits) - 1;
+        value &= mask;
+        if (value & (1ULL << (bits - 1))) value |= ~mask;
+    }
+    return (int64_t)value;
+}
+
+int bitops_field_add(int is_signed, int bits, int64_t value, int64_t incr, int mode, int64_t *out) {
+    if (is_signed) {
+        int64_t max = bits == 64 ? INT64_MAX : (int64_t)((1ULL << (bits - 1)) - 1);
+        int64_t min = -max - 1;
+        int up = incr > 0 && value > max - incr;
+        int down = incr < 0 && value < min - incr;
+        if (!up && !down) {
+            *out = value + incr;
+            return 0;
+        }
+        if (mode == BITFIELD_SAT) *out = up ? max : min;
+        else *out = bitops_sign_extend((uint64_t)value + (uint64_t)incr, bits);
+        return 1;
+    }
+
+    uint64_t max = (1ULL << bits) - 1; /* unsigned fields are at most 63 bits */
+    uint64_t v = (uint64_t)value;
+    int up = incr > 0 && (uint64_t)incr > max - v;
+    int down = incr < 0 && (0 - (uint64_t)incr) > v;
+    if (!up && !down) {
+        *out = (int64_t)(v + (uint64_t)incr);
+        return 0;
+    }
+    if (mode == BITFIELD_SAT) *out = up ? (int64_t)max : 0;
+    else *out = (int64_t)((v + (uint64_t)incr) & max);
+    return 1;
+}
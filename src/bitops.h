@@ -0,0 +1,44 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bit-level access to string values. Bit 0 is the most significant bit of
+ * the first byte. Readers treat bits past the end of the buffer as zero;
+ * writers expect the caller to have zero-extended the buffer first.
+ */
+
+int bitops_getbit(const uint8_t *p, size_t len, uint64_t offset);
+
+/* Set or clear one bit; returns its previous value */
+int bitops_setbit(uint8_t *p, uint64_t offset, int value);
+
+/* Set bits in [start, end] (inclusive bit positions inside the buffer) */
+uint64_t bitops_count(const uint8_t *p, uint64_t start, uint64_t end);
+
+/* First bit equal to `bit` in [start, end]; -1 if none */
+int64_t bitops_pos(const uint8_t *p, uint64_t start, uint64_t end, int bit);
+
+/* Read / write an unsigned field of 1-64 bits starting at a bit offset */
+uint64_t bitops_get_field(const uint8_t *p, size_t len, uint64_t offset, int bits);
+void bitops_set_field(uint8_t *p, uint64_t offset, int bits, uint64_t value);
+
+/* Sign-extend the low `bits` bits of a field */
+int64_t bitops_sign_extend(uint64_t value, int bits);
+
+/* BITFIELD overflow behaviours */
+#define BITFIELD_WRAP 0
+#define BITFIELD_SAT  1
+#define BITFIELD_FAIL 2
+
+/*
+ * Add `incr` to `value` in a field of `bits` bits (signed or unsigned).
+ * Returns 1 if the exact result does not fit; *out then receives the
+ * wrapped or saturated result according to `mode` (FAIL wraps, the caller
+ * discards it).
+ */
+int bitops_field_add(int is_signed, int bits, int64_t value, int64_t incr, int mode, int64_t *out);
+
+#endif /* BITOPS_H */
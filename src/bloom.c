@@ -0,0 +1,409 @@
+#include "bloom.h"
+#include "util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILTER_HASH_SEED 0x5f3759dfULL
+#define FILTER_BATCH 16   /* items hashed and prefetched together by the *_exists_many calls */
+
+/* ---- Bloom filter ---- */
+
+/* Block of a layer from the high half of the hash (nblocks < 2^32) */
+static uint64_t *bloom_block(const bloom_layer_t *l, uint64_t h) {
+    uint64_t b = ((h >> 32) * l->nblocks) >> 32;
+    return l->blocks + b * BLOOM_BLOCK_WORDS;
+}
+
+/* Bit i of an item within its block: double hashing on the low half, whose
+ * odd step keeps the first 512 positions distinct */
+static uint32_t bloom_bit(uint64_t h, uint32_t i) {
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)((h * 0x9e3779b97f4a7c15ULL) >> 32) | 1;
+    return (h1 + i * h2) & (BLOOM_BLOCK_WORDS * 64 - 1);
+}
+
+static int layer_test(const bloom_layer_t *l, uint64_t h) {
+    const uint64_t *b = bloom_block(l, h);
+    for (uint32_t i = 0; i < l->hashes; i++) {
+        uint32_t bit = bloom_bit(h, i);
+        if (!(b[bit >> 6] & (1ULL << (bit & 63)))) return 0;
+    }
+    return 1;
+}
+
+static void layer_set(bloom_layer_t *l, uint64_t h) {
+    uint64_t *b = bloom_block(l, h);
+    for (uint32_t i = 0; i < l->hashes; i++) {
+        uint32_t bit = bloom_bit(h, i);
+        b[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+static int bloom_test(const bloom_t *bf, uint64_t h) {
+    for (uint32_t i = 0; i < bf->nlayers; i++) {
+        if (layer_test(&bf->layers[i], h)) return 1;
+    }
+    return 0;
+}
+
+/* Bits per item for an error rate: the classic Bloom filter figure plus
+ * BLOOM_BLOCK_OVERHEAD, since items crowd unevenly into 512-bit blocks */
+#define BLOOM_BLOCK_OVERHEAD 1.1
+static double bits_per_item(double error) {
+    double ln2 = log(2.0);
+    return -log(error) / (ln2 * ln2) * BLOOM_BLOCK_OVERHEAD;
+}
+
+static bloom_layer_t *push_layer(bloom_t *bf, uint64_t capacity, uint64_t count, uint32_t hashes,
+                                 double error, uint64_t nblocks) {
+    bf->layers = imdb_realloc(bf->layers, (bf->nlayers + 1) * sizeof(bloom_layer_t));
+    bloom_layer_t *l = &bf->layers[bf->nlayers++];
+    l->capacity = capacity;
+    l->count = count;
+    l->nblocks = nblocks;
+    l->hashes = hashes;
+    l->error = error;
+    l->raw = imdb_calloc(1, (size_t)nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t) + 63);
+    l->blocks = (uint64_t *)(((uintptr_t)l->raw + 63) & ~(uintptr_t)63);
+    return l;
+}
+
+/* Add a layer sized for capacity at the error rate; with `clamp` a capacity
+ * that does not fit is cut down to the largest layer allowed */
+static bloom_layer_t *add_layer(bloom_t *bf, uint64_t capacity, double error, int clamp) {
+    double bits = ceil((double)capacity * bits_per_item(error));
+    double max_bits = (double)BLOOM_MAX_LAYER_BYTES * 8;
+    if (bits > max_bits) {
+        if (!clamp) return NULL;
+        bits = max_bits;
+        capacity = (uint64_t)(max_bits / bits_per_item(error));
+    }
+    uint64_t nblocks = ((uint64_t)bits + BLOOM_BLOCK_WORDS * 64 - 1) / (BLOOM_BLOCK_WORDS * 64);
+    double k = ceil(-log2(error));
+    uint32_t hashes = k < 1 ? 1 : k > BLOOM_MAX_HASHES ? BLOOM_MAX_HASHES : (uint32_t)k;
+    return push_layer(bf, capacity, 0, hashes, error, nblocks ? nblocks : 1);
+}
+
+bloom_t *bloom_restore(uint32_t expansion) {
+    bloom_t *bf = imdb_calloc(1, sizeof(bloom_t));
+    bf->expansion = expansion;
+    return bf;
+}
+
+bloom_t *bloom_create(uint64_t capacity, double error, uint32_t expansion) {
+    bloom_t *bf = bloom_restore(expansion);
+    if (!add_layer(bf, capacity, error, 0)) {
+        bloom_destroy(bf);
+        return NULL;
+    }
+    return bf;
+}
+
+void bloom_destroy(bloom_t *bf) {
+    if (!bf) return;
+    for (uint32_t i = 0; i < bf->nlayers; i++) imdb_free(bf->layers[i].raw);
+    imdb_free(bf->layers);
+    imdb_free(bf);
+}
+
+int bloom_add(bloom_t *bf, const char *item, size_t len) {
+    uint64_t h = imdb_hash64(item, len, FILTER_HASH_SEED);
+    if (bloom_test(bf, h)) return 0;
+    bloom_layer_t *l = &bf->layers[bf->nlayers - 1];
+    if (l->count >= l->capacity) {
+        if (!bf->expansion) return -1;
+        uint64_t next = l->capacity > UINT64_MAX / bf->expansion ? UINT64_MAX : l->capacity * bf->expansion;
+        l = add_layer(bf, next, l->error / 2, 1);
+    }
+    layer_set(l, h);
+    l->count++;
+    return 1;
+}
+
+int bloom_exists(const bloom_t *bf, const char *item, size_t len) {
+    return bloom_test(bf, imdb_hash64(item, len, FILTER_HASH_SEED));
+}
+
+void bloom_exists_many(const bloom_t *bf, const char **items, const size_t *lens, size_t n, int *out) {
+    uint64_t h[FILTER_BATCH];
+    for (size_t base = 0; base < n; base += FILTER_BATCH) {
+        size_t m = n - base < FILTER_BATCH ? n - base : FILTER_BATCH;
+        for (size_t i = 0; i < m; i++) {
+            h[i] = imdb_hash64(items[base + i], lens[base + i], FILTER_HASH_SEED);
+            for (uint32_t j = 0; j < bf->nlayers; j++) __builtin_prefetch(bloom_block(&bf->layers[j], h[i]));
+        }
+        for (size_t i = 0; i < m; i++) out[base + i] = bloom_test(bf, h[i]);
+    }
+}
+
+uint64_t bloom_count(const bloom_t *bf) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < bf->nlayers; i++) total += bf->layers[i].count;
+    return total;
+}
+
+uint64_t bloom_capacity(const bloom_t *bf) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < bf->nlayers; i++) total += bf->layers[i].capacity;
+    return total;
+}
+
+size_t bloom_layer_bytes(const bloom_layer_t *l) {
+    return (size_t)l->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+}
+
+bloom_layer_t *bloom_restore_layer(bloom_t *bf, uint64_t capacity, uint64_t count, uint32_t hashes,
+                                   double error, uint64_t nblocks) {
+    if (nblocks == 0 || nblocks > BLOOM_MAX_LAYER_BYTES / (BLOOM_BLOCK_WORDS * 8) || hashes == 0 ||
+        hashes > BLOOM_MAX_HASHES || !(error > 0 && error < 1)) return NULL;
+    return push_layer(bf, capacity, count, hashes, error, nblocks);
+}
+
+size_t bloom_mem_usage(const bloom_t *bf) {
+    size_t total = imdb_malloc_size((void *)bf) + imdb_malloc_size(bf->layers);
+    for (uint32_t i = 0; i < bf->nlayers; i++) total += imdb_malloc_size(bf->layers[i].raw);
+    return total;
+}
+
+/* ---- Cuckoo filter ---- */
+
+typedef struct {
+    uint64_t bucket;
+    uint32_t slot;
+} cuckoo_pos_t;
+
+static uint8_t cuckoo_fp(uint64_t h) {
+    uint8_t fp = (uint8_t)(h >> 56);
+    return fp ? fp : 1;
+}
+
+static uint64_t primary_bucket(const cuckoo_layer_t *l, uint64_t h) {
+    return (uint64_t)(((unsigned __int128)(uint32_t)h * l->nbuckets) >> 32);
+}
+
+/* i2 = (hash(fp) - i1) mod n maps each bucket to its partner and back for
+ * any n, so a layer need not be rounded up to a power of two */
+static uint64_t alt_bucket(const cuckoo_layer_t *l, uint64_t i, uint8_t fp) {
+    uint64_t hf = ((uint64_t)fp * 0x5bd1e995ULL) % l->nbuckets;
+    return hf >= i ? hf - i : hf + l->nbuckets - i;
+}
+
+static uint8_t *bucket_at(const cuckoo_t *cf, const cuckoo_layer_t *l, uint64_t i) {
+    return l->slots + i * cf->bucket_size;
+}
+
+/* Put fp in a free slot of bucket i; returns 0 if the bucket is full */
+static int bucket_insert(const cuckoo_t *cf, cuckoo_layer_t *l, uint64_t i, uint8_t fp) {
+    uint8_t *b = bucket_at(cf, l, i);
+    for (uint32_t s = 0; s < cf->bucket_size; s++) {
+        if (!b[s]) {
+            b[s] = fp;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t bucket_count(const cuckoo_t *cf, const cuckoo_layer_t *l, uint64_t i, uint8_t fp) {
+    const uint8_t *b = bucket_at(cf, l, i);
+    uint32_t n = 0;
+    for (uint32_t s = 0; s < cf->bucket_size; s++) n += b[s] == fp;
+    return n;
+}
+
+static int bucket_delete(const cuckoo_t *cf, cuckoo_layer_t *l, uint64_t i, uint8_t fp) {
+    uint8_t *b = bucket_at(cf, l, i);
+    for (uint32_t s = 0; s < cf->bucket_size; s++) {
+        if (b[s] == fp) {
+            b[s] = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t cuckoo_rand(cuckoo_t *cf) {
+    cf->rng ^= cf->rng >> 12;
+    cf->rng ^= cf->rng << 25;
+    cf->rng ^= cf->rng >> 27;
+    return cf->rng * 0x2545f4914f6cdd1dULL;
+}
+
+/* Insert into one layer, displacing fingerprints along a random walk if
+ * both buckets are full. A walk that runs out of iterations is undone, so
+ * a failed insert leaves the layer exactly as it was. */
+static int layer_insert(cuckoo_t *cf, cuckoo_layer_t *l, uint64_t h) {
+    uint8_t fp = cuckoo_fp(h);
+    uint64_t i1 = primary_bucket(l, h), i2 = alt_bucket(l, i1, fp);
+    if (bucket_insert(cf, l, i1, fp) || bucket_insert(cf, l, i2, fp)) {
+        l->count++;
+        return 1;
+    }
+    cuckoo_pos_t *path = imdb_malloc(cf->max_iterations * sizeof(cuckoo_pos_t));
+    uint64_t i = cuckoo_rand(cf) & 1 ? i1 : i2;
+    uint8_t cur = fp;
+    for (uint32_t n = 0; n < cf->max_iterations; n++) {
+        uint32_t s = (uint32_t)(cuckoo_rand(cf) % cf->bucket_size);
+        uint8_t *b = bucket_at(cf, l, i);
+        uint8_t victim = b[s];
+        b[s] = cur;
+        path[n].bucket = i;
+        path[n].slot = s;
+        cur = victim;
+        i = alt_bucket(l, i, cur);
+        if (bucket_insert(cf, l, i, cur)) {
+            imdb_free(path);
+            l->count++;
+            return 1;
+        }
+    }
+    for (uint32_t n = cf->max_iterations; n > 0; n--) {
+        uint8_t *b = bucket_at(cf, l, path[n - 1].bucket);
+        uint8_t placed = b[path[n - 1].slot];
+        b[path[n - 1].slot] = cur;
+        cur = placed;
+    }
+    imdb_free(path);
+    return 0;
+}
+
+/* Most buckets a layer may have within CUCKOO_MAX_LAYER_BYTES */
+static uint64_t max_buckets(const cuckoo_t *cf) {
+    return CUCKOO_MAX_LAYER_BYTES / cf->bucket_size;
+}
+
+/* Fraction of slots a table can fill before insertions start failing
+ * within a few hundred displacements (Fan et al.); small buckets leave more
+ * room unusable */
+static double max_load(uint32_t bucket_size) {
+    if (bucket_size == 1) return 0.5;
+    if (bucket_size < 4) return 0.8;
+    if (bucket_size < 8) return 0.95;
+    return 0.98;
+}
+
+static cuckoo_layer_t *push_cuckoo_layer(cuckoo_t *cf, uint64_t nbuckets, uint64_t count) {
+    cf->layers = imdb_realloc(cf->layers, (cf->nlayers + 1) * sizeof(cuckoo_layer_t));
+    cuckoo_layer_t *l = &cf->layers[cf->nlayers++];
+    l->nbuckets = nbuckets;
+    l->count = count;
+    l->slots = imdb_calloc((size_t)nbuckets, cf->bucket_size);
+    return l;
+}
+
+cuckoo_t *cuckoo_restore(uint32_t bucket_size, uint32_t max_iterations, uint32_t expansion) {
+    cuckoo_t *cf = imdb_calloc(1, sizeof(cuckoo_t));
+    cf->bucket_size = bucket_size;
+    cf->max_iterations = max_iterations;
+    cf->expansion = expansion;
+    cf->rng = 0x9e3779b97f4a7c15ULL;
+    return cf;
+}
+
+cuckoo_t *cuckoo_create(uint64_t capacity, uint32_t bucket_size, uint32_t max_iterations, uint32_t expansion) {
+    cuckoo_t *cf = cuckoo_restore(bucket_size, max_iterations, expansion);
+    double want = ceil((double)capacity / max_load(bucket_size) / bucket_size);
+    if (want > (double)max_buckets(cf)) {
+        cuckoo_destroy(cf);
+        return NULL;
+    }
+    push_cuckoo_layer(cf, want < 1 ? 1 : (uint64_t)want, 0);
+    return cf;
+}
+
+void cuckoo_destroy(cuckoo_t *cf) {
+    if (!cf) return;
+    for (uint32_t i = 0; i < cf->nlayers; i++) imdb_free(cf->layers[i].slots);
+    imdb_free(cf->layers);
+    imdb_free(cf);
+}
+
+int cuckoo_add(cuckoo_t *cf, const char *item, size_t len) {
+    uint64_t h = imdb_hash64(item, len, FILTER_HASH_SEED);
+    cuckoo_layer_t *l = &cf->layers[cf->nlayers - 1];
+    if (layer_insert(cf, l, h)) return 1;
+    if (!cf->expansion) return -1;
+    uint64_t cap = max_buckets(cf);
+    uint64_t next = l->nbuckets > cap / cf->expansion ? cap : l->nbuckets * cf->expansion;
+    l = push_cuckoo_layer(cf, next, 0);
+    return layer_insert(cf, l, h) ? 1 : -1;
+}
+
+static uint64_t cuckoo_test(const cuckoo_t *cf, uint64_t h, int count_all) {
+    uint8_t fp = cuckoo_fp(h);
+    uint64_t total = 0;
+    for (uint32_t j = 0; j < cf->nlayers; j++) {
+        const cuckoo_layer_t *l = &cf->layers[j];
+        uint64_t i1 = primary_bucket(l, h), i2 = alt_bucket(l, i1, fp);
+        total += bucket_count(cf, l, i1, fp);
+        if (i2 != i1) total += bucket_count(cf, l, i2, fp);
+        if (total && !count_all) return 1;
+    }
+    return total;
+}
+
+int cuckoo_exists(const cuckoo_t *cf, const char *item, size_t len) {
+    return cuckoo_test(cf, imdb_hash64(item, len, FILTER_HASH_SEED), 0) != 0;
+}
+
+void cuckoo_exists_many(const cuckoo_t *cf, const char **items, const size_t *lens, size_t n, int *out) {
+    uint64_t h[FILTER_BATCH];
+    for (size_t base = 0; base < n; base += FILTER_BATCH) {
+        size_t m = n - base < FILTER_BATCH ? n - base : FILTER_BATCH;
+        for (size_t i = 0; i < m; i++) {
+            h[i] = imdb_hash64(items[base + i], lens[base + i], FILTER_HASH_SEED);
+            uint8_t fp = cuckoo_fp(h[i]);
+            for (uint32_t j = 0; j < cf->nlayers; j++) {
+                const cuckoo_layer_t *l = &cf->layers[j];
+                uint64_t i1 = primary_bucket(l, h[i]);
+                __builtin_prefetch(bucket_at(cf, l, i1));
+                __builtin_prefetch(bucket_at(cf, l, alt_bucket(l, i1, fp)));
+            }
+        }
+        for (size_t i = 0; i < m; i++) out[base + i] = cuckoo_test(cf, h[i], 0) != 0;
+    }
+}
+
+uint64_t cuckoo_count_item(const cuckoo_t *cf, const char *item, size_t len) {
+    return cuckoo_test(cf, imdb_hash64(item, len, FILTER_HASH_SEED), 1);
+}
+
+int cuckoo_delete(cuckoo_t *cf, const char *item, size_t len) {
+    uint64_t h = imdb_hash64(item, len, FILTER_HASH_SEED);
+    uint8_t fp = cuckoo_fp(h);
+    /* Newest layer first: that is where the latest copy went */
+    for (uint32_t j = cf->nlayers; j > 0; j--) {
+        cuckoo_layer_t *l = &cf->layers[j - 1];
+        uint64_t i1 = primary_bucket(l, h);
+        if (bucket_delete(cf, l, i1, fp) || bucket_delete(cf, l, alt_bucket(l, i1, fp), fp)) {
+            l->count--;
+            cf->deletes++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint64_t cuckoo_count(const cuckoo_t *cf) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < cf->nlayers; i++) total += cf->layers[i].count;
+    return total;
+}
+
+uint64_t cuckoo_buckets(const cuckoo_t *cf) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < cf->nlayers; i++) total += cf->layers[i].nbuckets;
+    return total;
+}
+
+cuckoo_layer_t *cuckoo_restore_layer(cuckoo_t *cf, uint64_t nbuckets, uint64_t count) {
+    if (nbuckets == 0 || nbuckets > max_buckets(cf) ||
+        count > nbuckets * cf->bucket_size) return NULL;
+    return push_cuckoo_layer(cf, nbuckets, count);
+}
+
+size_t cuckoo_mem_usage(const cuckoo_t *cf) {
+    size_t total = imdb_malloc_size((void *)cf) + imdb_malloc_size(cf->layers);
+    for (uint32_t i = 0; i < cf->nlayers; i++) total += imdb_malloc_size(cf->layers[i].slots);
+    return total;
+}
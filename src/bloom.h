@@ -0,0 +1,141 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Approximate membership filters: "definitely not present" or "probably
+ * present" in about ten bits per item. Both hash an item once; every
+ * layer derives its positions from that one 64-bit hash.
+ */
+
+/* ---- Scalable blocked Bloom filter ----
+ *
+ * Each layer is an array of 512-bit blocks, one cache line each. An item
+ * sets all of its bits inside a single block, so a lookup costs one cache
+ * miss per layer. Blocking makes the false positive rate slightly higher
+ * than a classic Bloom filter of the same size.
+ *
+ * When the newest layer reaches its capacity a new one is added, `expansion`
+ * times larger and with half the error rate, so the combined rate stays
+ * below twice the first layer's. A non-scaling filter (expansion 0)
+ * refuses items once full instead.
+ */
+#define BLOOM_BLOCK_WORDS 8   /* 64-bit words per block */
+#define BLOOM_MAX_LAYER_BYTES ((uint64_t)UINT32_MAX - 63)
+#define BLOOM_MAX_HASHES 64
+
+typedef struct {
+    uint64_t capacity;   /* items the layer is sized for */
+    uint64_t count;      /* items added to it */
+    uint64_t nblocks;
+    uint32_t hashes;     /* bits set per item */
+    double error;
+    void *raw;           /* allocation holding the blocks */
+    uint64_t *blocks;    /* nblocks * BLOOM_BLOCK_WORDS, 64-byte aligned */
+} bloom_layer_t;
+
+typedef struct {
+    uint32_t nlayers;
+    uint32_t expansion;  /* 0 = non-scaling */
+    bloom_layer_t *layers;
+} bloom_t;
+
+/* Returns NULL if one layer of that capacity would exceed BLOOM_MAX_LAYER_BYTES */
+bloom_t *bloom_create(uint64_t capacity, double error, uint32_t expansion);
+/* A filter without layers, for a snapshot loader to fill with bloom_restore_layer */
+bloom_t *bloom_restore(uint32_t expansion);
+void bloom_destroy(bloom_t *bf);
+
+/* Returns 1 if added, 0 if (probably) already present, -1 if a non-scaling filter is full */
+int bloom_add(bloom_t *bf, const char *item, size_t len);
+
+/* Returns 1 if the item may be present */
+int bloom_exists(const bloom_t *bf, const char *item, size_t len);
+
+/* bloom_exists for n items into out[]; hashes a batch first and prefetches
+ * every block it will probe, so the cache misses overlap */
+void bloom_exists_many(const bloom_t *bf, const char **items, const size_t *lens, size_t n, int *out);
+
+/* Items added across all layers */
+uint64_t bloom_count(const bloom_t *bf);
+uint64_t bloom_capacity(const bloom_t *bf);
+
+/* Bytes of one layer's blocks */
+size_t bloom_layer_bytes(const bloom_layer_t *l);
+
+/* Append a layer while loading a snapshot; its blocks are zeroed for the
+ * caller to fill. Returns NULL if the dimensions are out of range. */
+bloom_layer_t *bloom_restore_layer(bloom_t *bf, uint64_t capacity, uint64_t count, uint32_t hashes,
+                                   double error, uint64_t nblocks);
+
+/* Estimated bytes held by the filter */
+size_t bloom_mem_usage(const bloom_t *bf);
+
+/* ---- Cuckoo filter ----
+ *
+ * Buckets of `bucket_size` 8-bit fingerprints (0 marks an empty slot). An
+ * item lives in one of two buckets, i1 = hash and i2 = hash(fp) - i1 (mod
+ * the bucket count), so either can be found from the other and the
+ * fingerprint alone; that lets items be moved during insertion and deleted
+ * later. The first layer is sized so `capacity` items fit at the load a
+ * table of that bucket size can reach. When an insertion
+ * still fails after `max_iterations` displacements they are undone and a
+ * larger layer is added (or, without expansion, the filter reports full).
+ */
+#define CUCKOO_MAX_BUCKET_SIZE 255
+#define CUCKOO_MAX_ITERATIONS 65535
+#define CUCKOO_MAX_LAYER_BYTES ((uint64_t)UINT32_MAX)
+
+typedef struct {
+    uint64_t nbuckets;
+    uint64_t count;
+    uint8_t *slots;      /* nbuckets * bucket_size */
+} cuckoo_layer_t;
+
+typedef struct {
+    uint32_t nlayers;
+    uint32_t bucket_size;
+    uint32_t max_iterations;
+    uint32_t expansion;  /* 0 = non-scaling */
+    uint64_t deletes;
+    uint64_t rng;
+    cuckoo_layer_t *layers;
+} cuckoo_t;
+
+/* Returns NULL if the first layer would exceed CUCKOO_MAX_LAYER_BYTES */
+cuckoo_t *cuckoo_create(uint64_t capacity, uint32_t bucket_size, uint32_t max_iterations, uint32_t expansion);
+/* A filter without layers, for a snapshot loader to fill with cuckoo_restore_layer */
+cuckoo_t *cuckoo_restore(uint32_t bucket_size, uint32_t max_iterations, uint32_t expansion);
+void cuckoo_destroy(cuckoo_t *cf);
+
+/* Returns 1 if added, -1 if the filter is full. Duplicates are stored
+ * again, so that each copy can be deleted once. */
+int cuckoo_add(cuckoo_t *cf, const char *item, size_t len);
+
+/* Returns 1 if the item may be present */
+int cuckoo_exists(const cuckoo_t *cf, const char *item, size_t len);
+
+/* cuckoo_exists for n items into out[], prefetching both buckets of a batch first */
+void cuckoo_exists_many(const cuckoo_t *cf, const char **items, const size_t *lens, size_t n, int *out);
+
+/* Upper bound on the times an item was added (and not deleted) */
+uint64_t cuckoo_count_item(const cuckoo_t *cf, const char *item, size_t len);
+
+/* Delete one copy of an item; returns 1 if a matching fingerprint was found.
+ * Deleting an item that was never added may remove another one. */
+int cuckoo_delete(cuckoo_t *cf, const char *item, size_t len);
+
+/* Items stored across all layers, and buckets */
+uint64_t cuckoo_count(const cuckoo_t *cf);
+uint64_t cuckoo_buckets(const cuckoo_t *cf);
+
+/* Append a layer while loading a snapshot, zeroed for the caller to fill;
+ * NULL if the dimensions are out of range */
+cuckoo_layer_t *cuckoo_restore_layer(cuckoo_t *cf, uint64_t nbuckets, uint64_t count);
+
+/* Estimated bytes held by the filter */
+size_t cuckoo_mem_usage(const cuckoo_t *cf);
+
+#endif /* BLOOM_H */
@@ -1,12 +1,24 @@
 #include "command.h"
 #include "server.h"
 #include "persist.h"
+#include "aof.h"
+#include "hyperloglog.h"
+#include "bitops.h"
+#include "simd.h"
+#include "stream.h"
+#include "vfilter.h"
 #include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#define MEMORY_USAGE_DEFAULT_SAMPLES 5
 
 /* Helper to get string from RESP value */
 static const char *get_arg(resp_value_t *cmd, int index) {
@@ -18,11 +30,152 @@ static const char *get_arg(resp_value_t *cmd, int index) {
     return NULL;
 }
 
+/* Length of an argument, which may contain NULs */
+static size_t get_arg_len(resp_value_t *cmd, int index) {
+    if (!get_arg(cmd, index)) return 0;
+    return cmd->data.array.items[index]->len;
+}
+
 static size_t arg_count(resp_value_t *cmd) {
     if (!cmd || cmd->type != RESP_ARRAY) return 0;
     return cmd->data.array.count;
 }
 
+/* Parse an integer argument; writes the error reply and returns 0 on failure */
+static int get_int_arg(resp_value_t *cmd, int index, resp_buf_t *reply, int64_t *out) {
+    if (!obj_try_parse_int(get_arg(cmd, index), out)) {
+        resp_write_error(reply, "ERR value is not an integer or out of range");
+        return 0;
+    }
+    return 1;
+}
+
+static int parse_long_double(const char *s, size_t len, long double *out) {
+    char buf[128];
+    if (len == 0 || len >= sizeof(buf)) return 0;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    char *end;
+    long double v = strtold(buf, &end);
+    if (end != buf + len || isspace((unsigned char)buf[0]) || isnan(v)) return 0;
+    *out = v;
+    return 1;
+}
+
+/* Largest blocking timeout; its ms count still fits an int64 with room for the clock */
+#define TIMEOUT_MAX_SECS 1e15
+
+/* Parse a blocking timeout in (fractional) seconds into an absolute ms deadline, 0 = forever */
+static int get_timeout_arg(resp_value_t *cmd, int index, resp_buf_t *reply, int64_t *deadline) {
+    const char *s = get_arg(cmd, index);
+    char *end;
+    double secs = s ? strtod(s, &end) : 0;
+    if (!s || *s == '\0' || *end != '\0' || secs != secs) {
+        resp_write_error(reply, "ERR timeout is not a float or out of range");
+        return 0;
+    }
+    if (secs < 0) {
+        resp_write_error(reply, "ERR timeout is negative");
+        return 0;
+    }
+    int64_t now = imdb_mstime(), ms = secs > TIMEOUT_MAX_SECS ? INT64_MAX : (int64_t)(secs * 1000);
+    if (ms > INT64_MAX - now) {
+        resp_write_error(reply, "ERR timeout is out of range");
+        return 0;
+    }
+    *deadline = ms > 0 ? now + ms : 0;
+    return 1;
+}
+
+/* Write the standard arity error for `name` */
+static void wrong_args(resp_buf_t *reply, const char *name) {
+    char err[96];
+    snprintf(err, sizeof(err), "ERR wrong number of arguments for '%s' command", name);
+    resp_write_error(reply, err);
+}
+
+#define WRONGTYPE_ERR "WRONGTYPE Operation against a key holding the wrong kind of value"
+
+/* Bytes of a string or integer object; integers are formatted into buf (32 bytes) */
+static const char *string_bytes(dbobj_t *obj, char *buf, size_t *len) {
+    if (obj->type == OBJ_INT) {
+        *len = (size_t)snprintf(buf, 32, "%" PRId64, obj->data.num);
+        return buf;
+    }
+    *len = obj->data.str.len;
+    return obj->data.str.buf;
+}
+
+/* Reply with a string value, nil if missing; returns 0 after a WRONGTYPE error */
+static int write_string_value(resp_buf_t *reply, dbobj_t *obj) {
+    if (!obj) {
+        resp_write_nil(reply);
+    } else if (obj->type == OBJ_STRING || obj->type == OBJ_INT) {
+        char buf[32];
+        size_t len;
+        const char *s = string_bytes(obj, buf, &len);
+        resp_write_bulk_string(reply, s, len);
+    } else {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return 0;
+    }
+    return 1;
+}
+
+/* ---- AOF propagation ----
+ *
+ * A write command that succeeds is logged as received, unless its handler
+ * logs something else in its place: commands whose effect depends on the
+ * clock (relative TTLs, generated stream IDs) log the absolute outcome so
+ * that replaying them later reproduces it. A write that finds nothing to
+ * change (DEL of a missing key, LPOP of an empty list) logs nothing.
+ */
+
+static int propagate_overridden;
+static int propagate_unchanged;  /* the keyspace was left as it was */
+
+/* Log these commands instead of the one executing */
+static void propagate(int argc, const char **argv, const size_t *lens) {
+    aof_feed_argv(argc, argv, lens);
+    propagate_overridden = 1;
+    propagate_unchanged = 0;
+}
+
+/* Log nothing for the executing command, e.g. because it changed nothing */
+static void propagate_nothing(void) {
+    propagate_overridden = 1;
+    propagate_unchanged = 1;
+}
+
+/* Log a key's current TTL as PEXPIREAT, PERSIST, or DEL once it is gone */
+static void propagate_ttl(database_t *db, const char *key) {
+    db_entry_t *entry = db_get_entry(db, key);
+    char ms[32];
+    const char *argv[3] = {"DEL", key, ms};
+    if (entry && entry->expire >= 0) {
+        argv[0] = "PEXPIREAT";
+        snprintf(ms, sizeof(ms), "%lld", (long long)entry->expire);
+        propagate(3, argv, NULL);
+    } else {
+        if (entry) argv[0] = "PERSIST";
+        propagate(2, argv, NULL);
+    }
+}
+
+/* Log the executing command with argument i replaced */
+static void propagate_replacing(resp_value_t *cmd, size_t i, const char *arg, size_t len) {
+    size_t argc = arg_count(cmd);
+    const char **argv = imdb_malloc(argc * sizeof(char *));
+    size_t *lens = imdb_malloc(argc * sizeof(size_t));
+    for (size_t k = 0; k < argc; k++) {
+        argv[k] = k == i ? arg : get_arg(cmd, (int)k);
+        lens[k] = k == i ? len : get_arg_len(cmd, (int)k);
+    }
+    propagate((int)argc, argv, lens);
+    imdb_free(argv);
+    imdb_free(lens);
+}
+
 /* ---- Command handlers ---- */
 
 static void cmd_ping(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
@@ -42,20 +195,26 @@ static void cmd_set(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t
         return;
     }
     const char *key = get_arg(cmd, 1);
-    const char *val = get_arg(cmd, 2);
-    db_set(db, key, val);
+    db_set(db, key, get_arg(cmd, 2), get_arg_len(cmd, 2));
 
     /* Handle optional EX argument */
     size_t argc = arg_count(cmd);
+    int ttl = 0;
     for (size_t i = 3; i + 1 < argc; i += 2) {
         const char *opt = get_arg(cmd, (int)i);
         const char *optval = get_arg(cmd, (int)(i + 1));
         if (opt && optval && imdb_strcasecmp(opt, "EX") == 0) {
             int64_t secs = strtoll(optval, NULL, 10);
-            if (secs > 0) db_expire(db, key, secs);
+            if (secs > 0) ttl = db_expire(db, key, secs);
         }
     }
 
+    if (ttl) {
+        const char *argv[3] = {"SET", key, get_arg(cmd, 2)};
+        size_t lens[3] = {3, get_arg_len(cmd, 1), get_arg_len(cmd, 2)};
+        propagate(3, argv, lens);
+        propagate_ttl(db, key);
+    }
     resp_write_simple_string(reply, "OK");
 }
 
@@ -65,18 +224,7 @@ static void cmd_get(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t
         resp_write_error(reply, "ERR wrong number of arguments for 'GET' command");
         return;
     }
-    dbobj_t *obj = db_get(db, get_arg(cmd, 1));
-    if (!obj) {
-        resp_write_nil(reply);
-    } else if (obj->type == OBJ_STRING) {
-        resp_write_bulk_string(reply, obj->data.str, strlen(obj->data.str));
-    } else if (obj->type == OBJ_INT) {
-        char buf[32];
-        snprintf(buf, sizeof(buf), "%" PRId64, obj->data.num);
-        resp_write_bulk_string(reply, buf, strlen(buf));
-    } else {
-        resp_write_error(reply, "WRONGTYPE Operation against a key holding the wrong kind of value");
-    }
+    write_string_value(reply, db_get(db, get_arg(cmd, 1)));
 }
 
 static void cmd_del(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
@@ -90,6 +238,7 @@ static void cmd_del(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t
     for (size_t i = 1; i < argc; i++) {
         deleted += db_del(db, get_arg(cmd, (int)i));
     }
+    if (!deleted) propagate_nothing();
     resp_write_integer(reply, deleted);
 }
 
@@ -102,18 +251,21 @@ static void cmd_exists(database_t *db, server_t *srv, resp_value_t *cmd, resp_bu
     resp_write_integer(reply, db_exists(db, get_arg(cmd, 1)));
 }
 
+static void incr_generic(database_t *db, const char *key, int64_t delta, resp_buf_t *reply) {
+    int64_t val;
+    int rc = db_incr(db, key, delta, &val);
+    if (rc > 0) resp_write_integer(reply, val);
+    else if (rc < 0) resp_write_error(reply, "ERR increment or decrement would overflow");
+    else resp_write_error(reply, "ERR value is not an integer or out of range");
+}
+
 static void cmd_incr(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     (void)srv;
     if (arg_count(cmd) < 2) {
         resp_write_error(reply, "ERR wrong number of arguments for 'INCR' command");
         return;
     }
-    int64_t val = db_incr(db, get_arg(cmd, 1), 1);
-    if (val == INT64_MIN) {
-        resp_write_error(reply, "ERR value is not an integer or out of range");
-    } else {
-        resp_write_integer(reply, val);
-    }
+    incr_generic(db, get_arg(cmd, 1), 1, reply);
 }
 
 static void cmd_decr(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
@@ -122,12 +274,75 @@ static void cmd_decr(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_
         resp_write_error(reply, "ERR wrong number of arguments for 'DECR' command");
         return;
     }
-    int64_t val = db_incr(db, get_arg(cmd, 1), -1);
-    if (val == INT64_MIN) {
-        resp_write_error(reply, "ERR value is not an integer or out of range");
-    } else {
-        resp_write_integer(reply, val);
+    incr_generic(db, get_arg(cmd, 1), -1, reply);
+}
+
+/* INCRBY key delta */
+static void cmd_incrby(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    int64_t delta;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "INCRBY");
+        return;
+    }
+    if (!get_int_arg(cmd, 2, reply, &delta)) return;
+    incr_generic(db, get_arg(cmd, 1), delta, reply);
+}
+
+/* DECRBY key delta */
+static void cmd_decrby(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    int64_t delta;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "DECRBY");
+        return;
+    }
+    if (!get_int_arg(cmd, 2, reply, &delta)) return;
+    if (delta == INT64_MIN) {
+        resp_write_error(reply, "ERR decrement would overflow");
+        return;
+    }
+    incr_generic(db, get_arg(cmd, 1), -delta, reply);
+}
+
+/* INCRBYFLOAT key delta: the result is stored back into the same object */
+static void cmd_incrbyfloat(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "INCRBYFLOAT");
+        return;
+    }
+    long double delta, cur = 0;
+    if (!parse_long_double(get_arg(cmd, 2), get_arg_len(cmd, 2), &delta)) {
+        resp_write_error(reply, "ERR value is not a valid float");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    dbobj_t *obj = db_get(db, key);
+    if (obj && obj->type != OBJ_STRING && obj->type != OBJ_INT) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (obj) {
+        char buf[32];
+        size_t len;
+        const char *s = string_bytes(obj, buf, &len);
+        if (!parse_long_double(s, len, &cur)) {
+            resp_write_error(reply, "ERR value is not a valid float");
+            return;
+        }
+    }
+    cur += delta;
+    if (isnan(cur) || isinf(cur)) {
+        resp_write_error(reply, "ERR increment would produce NaN or Infinity");
+        return;
     }
+
+    char out[64];
+    int n = snprintf(out, sizeof(out), "%.17Lg", cur);
+    if (obj) obj_set_value(obj, out, (size_t)n);
+    else db_set(db, key, out, (size_t)n);
+    resp_write_bulk_string(reply, out, (size_t)n);
 }
 
 static void cmd_mset(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
@@ -138,7 +353,7 @@ static void cmd_mset(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_
         return;
     }
     for (size_t i = 1; i + 1 < argc; i += 2) {
-        db_set(db, get_arg(cmd, (int)i), get_arg(cmd, (int)(i + 1)));
+        db_set(db, get_arg(cmd, (int)i), get_arg(cmd, (int)(i + 1)), get_arg_len(cmd, (int)(i + 1)));
     }
     resp_write_simple_string(reply, "OK");
 }
@@ -153,84 +368,332 @@ static void cmd_mget(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_
     resp_write_array_header(reply, argc - 1);
     for (size_t i = 1; i < argc; i++) {
         dbobj_t *obj = db_get(db, get_arg(cmd, (int)i));
-        if (!obj) {
-            resp_write_nil(reply);
-        } else if (obj->type == OBJ_STRING) {
-            resp_write_bulk_string(reply, obj->data.str, strlen(obj->data.str));
-        } else if (obj->type == OBJ_INT) {
-            char buf[32];
-            snprintf(buf, sizeof(buf), "%" PRId64, obj->data.num);
-            resp_write_bulk_string(reply, buf, strlen(buf));
-        } else {
-            resp_write_nil(reply);
-        }
+        if (obj && obj->type != OBJ_STRING && obj->type != OBJ_INT) obj = NULL;
+        write_string_value(reply, obj);
     }
 }
 
-/* ---- List commands ---- */
+/* SETNX key value */
+static void cmd_setnx(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "SETNX");
+        return;
+    }
+    int set = db_setnx(db, get_arg(cmd, 1), get_arg(cmd, 2), get_arg_len(cmd, 2));
+    if (!set) propagate_nothing();
+    resp_write_integer(reply, set);
+}
 
-static void cmd_lpush(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+/* MSETNX key value [key value ...]: sets all keys, or none if any exists */
+static void cmd_msetnx(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     (void)srv;
     size_t argc = arg_count(cmd);
-    if (argc < 3) {
-        resp_write_error(reply, "ERR wrong number of arguments for 'LPUSH' command");
+    if (argc < 3 || (argc - 1) % 2 != 0) {
+        wrong_args(reply, "MSETNX");
         return;
     }
-    int result = 0;
-    for (size_t i = 2; i < argc; i++) {
-        result = db_lpush(db, get_arg(cmd, 1), get_arg(cmd, (int)i));
-        if (result < 0) {
-            resp_write_error(reply, "WRONGTYPE Operation against a key holding the wrong kind of value");
+    for (size_t i = 1; i < argc; i += 2) {
+        if (db_exists(db, get_arg(cmd, (int)i))) {
+            propagate_nothing();
+            resp_write_integer(reply, 0);
             return;
         }
     }
-    resp_write_integer(reply, result);
+    for (size_t i = 1; i < argc; i += 2) {
+        db_set(db, get_arg(cmd, (int)i), get_arg(cmd, (int)(i + 1)), get_arg_len(cmd, (int)(i + 1)));
+    }
+    resp_write_integer(reply, 1);
 }
 
-static void cmd_rpush(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+/* GETSET key value: the old value is written out before it is overwritten in place */
+static void cmd_getset(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "GETSET");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    db_entry_t *entry = db_get_entry(db, key);
+    if (!entry) {
+        resp_write_nil(reply);
+        db_set(db, key, get_arg(cmd, 2), get_arg_len(cmd, 2));
+        return;
+    }
+    if (!write_string_value(reply, entry->obj)) return;
+    obj_set_value(entry->obj, get_arg(cmd, 2), get_arg_len(cmd, 2));
+    entry->expire = -1;
+}
+
+/* GETDEL key */
+static void cmd_getdel(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "GETDEL");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    dbobj_t *obj = db_get(db, key);
+    if (!obj) propagate_nothing();
+    if (!write_string_value(reply, obj) || !obj) return;
+    obj_free(db_take(db, key));
+}
+
+/* GETEX key [EX seconds|PX ms|EXAT unix-seconds|PXAT unix-ms|PERSIST] */
+static void cmd_getex(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     (void)srv;
     size_t argc = arg_count(cmd);
-    if (argc < 3) {
-        resp_write_error(reply, "ERR wrong number of arguments for 'RPUSH' command");
+    if (argc < 2) {
+        wrong_args(reply, "GETEX");
         return;
     }
-    int result = 0;
-    for (size_t i = 2; i < argc; i++) {
-        result = db_rpush(db, get_arg(cmd, 1), get_arg(cmd, (int)i));
-        if (result < 0) {
-            resp_write_error(reply, "WRONGTYPE Operation against a key holding the wrong kind of value");
+    int64_t expire = -2;   /* -2 = leave the TTL alone, -1 = PERSIST */
+    if (argc == 3 && imdb_strcasecmp(get_arg(cmd, 2), "PERSIST") == 0) {
+        expire = -1;
+    } else if (argc == 4) {
+        const char *opt = get_arg(cmd, 2);
+        int64_t v, now = imdb_mstime();
+        if (!get_int_arg(cmd, 3, reply, &v)) return;
+        if (v <= 0 || v > INT64_MAX / 1000) {
+            resp_write_error(reply, "ERR invalid expire time in 'getex' command");
             return;
         }
+        if (imdb_strcasecmp(opt, "EX") == 0) expire = now + v * 1000;
+        else if (imdb_strcasecmp(opt, "PX") == 0) expire = now + v;
+        else if (imdb_strcasecmp(opt, "EXAT") == 0) expire = v * 1000;
+        else if (imdb_strcasecmp(opt, "PXAT") == 0) expire = v;
+    }
+    if (argc > 2 && expire == -2) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    db_entry_t *entry = db_get_entry(db, get_arg(cmd, 1));
+    propagate_nothing();
+    if (!write_string_value(reply, entry ? entry->obj : NULL) || !entry) return;
+    if (expire != -2) {
+        entry->expire = expire;
+        propagate_ttl(db, get_arg(cmd, 1));
+    }
+}
+
+/* APPEND key value: grows the value in place; returns the new length */
+static void cmd_append(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "APPEND");
+        return;
+    }
+    int wrongtype;
+    dbobj_t *obj = db_get_or_create_string(db, get_arg(cmd, 1), &wrongtype);
+    if (!obj) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    obj_string_append(obj, get_arg(cmd, 2), get_arg_len(cmd, 2));
+    resp_write_integer(reply, (int64_t)obj->data.str.len);
+}
+
+#define STRING_MAX_BYTES (512LL * 1024 * 1024)
+
+/* SETRANGE key offset value: overwrite from offset, zero-padding as needed */
+static void cmd_setrange(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "SETRANGE");
+        return;
+    }
+    int64_t offset;
+    if (!get_int_arg(cmd, 2, reply, &offset)) return;
+    size_t len = get_arg_len(cmd, 3);
+    if (offset < 0 || offset + (int64_t)len > STRING_MAX_BYTES) {
+        resp_write_error(reply, "ERR offset is out of range");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    dbobj_t *obj = db_get(db, key);
+    if (obj && obj->type != OBJ_STRING && obj->type != OBJ_INT) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (len == 0) {
+        /* Nothing to write: report the length without creating or converting the value */
+        char buf[32];
+        size_t cur = 0;
+        if (obj) string_bytes(obj, buf, &cur);
+        propagate_nothing();
+        resp_write_integer(reply, (int64_t)cur);
+        return;
+    }
+    int wrongtype;
+    obj = db_get_or_create_string(db, key, &wrongtype);
+    obj_string_grow(obj, (size_t)offset + len);
+    memcpy(obj->data.str.buf + offset, get_arg(cmd, 3), len);
+    resp_write_integer(reply, (int64_t)obj->data.str.len);
+}
+
+/* Clamp a start/end pair (negative counts from the end) to [0, total); 0 if empty */
+static int clamp_range(int64_t start, int64_t end, int64_t total, int64_t *from, int64_t *to) {
+    if (start < 0 && end < 0 && start > end) return 0;
+    if (start < 0) start += total;
+    if (end < 0) end += total;
+    if (start < 0) start = 0;
+    if (end < 0) end = 0;
+    if (end >= total) end = total - 1;
+    if (total == 0 || start > end) return 0;
+    *from = start;
+    *to = end;
+    return 1;
+}
+
+/* GETRANGE key start end (inclusive, negative counts from the end) */
+static void cmd_getrange(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "GETRANGE");
+        return;
+    }
+    int64_t start, end;
+    if (!get_int_arg(cmd, 2, reply, &start) || !get_int_arg(cmd, 3, reply, &end)) return;
+    dbobj_t *obj = db_get(db, get_arg(cmd, 1));
+    if (obj && obj->type != OBJ_STRING && obj->type != OBJ_INT) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    char buf[32];
+    size_t len = 0;
+    const char *s = obj ? string_bytes(obj, buf, &len) : "";
+    int64_t from, to;
+    if (!clamp_range(start, end, (int64_t)len, &from, &to)) {
+        resp_write_bulk_string(reply, "", 0);
+        return;
+    }
+    resp_write_bulk_string(reply, s + from, (size_t)(to - from + 1));
+}
+
+/* STRLEN key: integers are measured without converting them */
+static void cmd_strlen(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "STRLEN");
+        return;
+    }
+    dbobj_t *obj = db_get(db, get_arg(cmd, 1));
+    if (obj && obj->type != OBJ_STRING && obj->type != OBJ_INT) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    char buf[32];
+    size_t len = 0;
+    if (obj) string_bytes(obj, buf, &len);
+    resp_write_integer(reply, (int64_t)len);
+}
+
+/* ---- List commands ---- */
+
+/* LPUSH/RPUSH key value [value ...]: one key lookup for the whole batch */
+static void push_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply, int head) {
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        resp_write_error(reply, head ? "ERR wrong number of arguments for 'LPUSH' command"
+                                     : "ERR wrong number of arguments for 'RPUSH' command");
+        return;
+    }
+    size_t count = argc - 2;
+    const char **values = imdb_malloc(count * sizeof(char *));
+    size_t *lens = imdb_malloc(count * sizeof(size_t));
+    for (size_t i = 0; i < count; i++) {
+        values[i] = get_arg(cmd, (int)(i + 2));
+        lens[i] = get_arg_len(cmd, (int)(i + 2));
+    }
+    int64_t result = head ? db_lpush_many(db, get_arg(cmd, 1), values, lens, count)
+                          : db_rpush_many(db, get_arg(cmd, 1), values, lens, count);
+    imdb_free(values);
+    imdb_free(lens);
+
+    if (result < 0) resp_write_error(reply, WRONGTYPE_ERR);
+    else resp_write_integer(reply, result);
+}
+
+static void cmd_lpush(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    push_generic(db, cmd, reply, 1);
+}
+
+static void cmd_rpush(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    push_generic(db, cmd, reply, 0);
+}
+
+static void write_popped(void *ctx, const char *value, size_t len) {
+    resp_write_bulk_string((resp_buf_t *)ctx, value, len);
+}
+
+/* LPOP/RPOP key count: pop up to count entries into an array reply */
+static void pop_count(database_t *db, resp_value_t *cmd, resp_buf_t *reply, int head) {
+    int64_t count;
+    if (!get_int_arg(cmd, 2, reply, &count)) return;
+    if (count < 0) {
+        resp_write_error(reply, "ERR value is out of range, must be positive");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+
+    /* Elements stream into a side buffer; the header needs the final count */
+    resp_buf_t items;
+    resp_buf_init(&items);
+    int64_t popped = head ? db_lpop_count(db, key, (size_t)count, write_popped, &items)
+                          : db_rpop_count(db, key, (size_t)count, write_popped, &items);
+    if (popped < 0) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+    } else if (popped == 0 && (count > 0 || !db_exists(db, key))) {
+        propagate_nothing();
+        resp_write_null_array(reply);
+    } else {
+        if (popped == 0) propagate_nothing();
+        resp_write_array_header(reply, (size_t)popped);
+        resp_write_raw(reply, items.buf, items.len);
     }
-    resp_write_integer(reply, result);
+    resp_buf_free(&items);
 }
 
 static void cmd_lpop(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     (void)srv;
-    if (arg_count(cmd) < 2) {
+    if (arg_count(cmd) < 2 || arg_count(cmd) > 3) {
         resp_write_error(reply, "ERR wrong number of arguments for 'LPOP' command");
         return;
     }
-    char *val = db_lpop(db, get_arg(cmd, 1));
+    if (arg_count(cmd) > 2) {
+        pop_count(db, cmd, reply, 1);
+        return;
+    }
+    size_t len;
+    char *val = db_lpop(db, get_arg(cmd, 1), &len);
     if (!val) {
+        propagate_nothing();
         resp_write_nil(reply);
     } else {
-        resp_write_bulk_string(reply, val, strlen(val));
+        resp_write_bulk_string(reply, val, len);
         imdb_free(val);
     }
 }
 
 static void cmd_rpop(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     (void)srv;
-    if (arg_count(cmd) < 2) {
+    if (arg_count(cmd) < 2 || arg_count(cmd) > 3) {
         resp_write_error(reply, "ERR wrong number of arguments for 'RPOP' command");
         return;
     }
-    char *val = db_rpop(db, get_arg(cmd, 1));
+    if (arg_count(cmd) > 2) {
+        pop_count(db, cmd, reply, 0);
+        return;
+    }
+    size_t len;
+    char *val = db_rpop(db, get_arg(cmd, 1), &len);
     if (!val) {
+        propagate_nothing();
         resp_write_nil(reply);
     } else {
-        resp_write_bulk_string(reply, val, strlen(val));
+        resp_write_bulk_string(reply, val, len);
         imdb_free(val);
     }
 }
@@ -243,7 +706,7 @@ static void cmd_llen(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_
     }
     int64_t len = db_llen(db, get_arg(cmd, 1));
     if (len < 0) {
-        resp_write_error(reply, "WRONGTYPE Operation against a key holding the wrong kind of value");
+        resp_write_error(reply, WRONGTYPE_ERR);
     } else {
         resp_write_integer(reply, len);
     }
@@ -255,85 +718,3679 @@ static void cmd_lrange(database_t *db, server_t *srv, resp_value_t *cmd, resp_bu
         resp_write_error(reply, "ERR wrong number of arguments for 'LRANGE' command");
         return;
     }
-    int start = atoi(get_arg(cmd, 2));
-    int stop = atoi(get_arg(cmd, 3));
-    size_t count = 0;
-    char **items = db_lrange(db, get_arg(cmd, 1), start, stop, &count);
+    long start = atol(get_arg(cmd, 2));
+    long stop = atol(get_arg(cmd, 3));
+    int wrongtype;
+    list_t *list = db_get_list(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    size_t count = list ? list_normalize_range(list, &start, &stop) : 0;
 
     resp_write_array_header(reply, count);
-    for (size_t i = 0; i < count; i++) {
-        resp_write_bulk_string(reply, items[i], strlen(items[i]));
+    if (count == 0) return;
+
+    list_iter_t it;
+    const char *val;
+    size_t len;
+    list_iter_init(&it, list, (size_t)start, 1);
+    for (size_t i = 0; i < count && list_iter_next(&it, &val, &len); i++) {
+        resp_write_bulk_string(reply, val, len);
     }
-    if (items) imdb_free(items);
+    list_iter_release(&it);
 }
 
-/* ---- TTL commands ---- */
-
-static void cmd_expire(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+static void cmd_lindex(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     (void)srv;
-    if (arg_count(cmd) < 3) {
-        resp_write_error(reply, "ERR wrong number of arguments for 'EXPIRE' command");
+    if (arg_count(cmd) != 3) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'LINDEX' command");
         return;
     }
-    int64_t secs = strtoll(get_arg(cmd, 2), NULL, 10);
-    resp_write_integer(reply, db_expire(db, get_arg(cmd, 1), secs));
-}
-
-static void cmd_ttl(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
-    (void)srv;
-    if (arg_count(cmd) < 2) {
-        resp_write_error(reply, "ERR wrong number of arguments for 'TTL' command");
+    int64_t index;
+    if (!get_int_arg(cmd, 2, reply, &index)) return;
+    int wrongtype;
+    list_t *list = db_get_list(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
         return;
     }
-    resp_write_integer(reply, db_ttl(db, get_arg(cmd, 1)));
+    size_t len;
+    char *val = list ? list_index(list, (long)index, &len) : NULL;
+    if (!val) {
+        resp_write_nil(reply);
+    } else {
+        resp_write_bulk_string(reply, val, len);
+        imdb_free(val);
+    }
 }
 
-static void cmd_persist(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+static void cmd_lset(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     (void)srv;
-    if (arg_count(cmd) < 2) {
-        resp_write_error(reply, "ERR wrong number of arguments for 'PERSIST' command");
+    if (arg_count(cmd) != 4) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'LSET' command");
+        return;
+    }
+    int64_t index;
+    if (!get_int_arg(cmd, 2, reply, &index)) return;
+    int wrongtype;
+    list_t *list = db_get_list(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (!list) {
+        resp_write_error(reply, "ERR no such key");
+        return;
+    }
+    const char *val = get_arg(cmd, 3);
+    if (list_set(list, (long)index, val, get_arg_len(cmd, 3)) != 0) {
+        resp_write_error(reply, "ERR index out of range");
         return;
     }
-    resp_write_integer(reply, db_persist(db, get_arg(cmd, 1)));
-}
-
-/* ---- Server commands ---- */
-
-static void cmd_dbsize(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
-    (void)srv; (void)cmd;
-    resp_write_integer(reply, (int64_t)db_size(db));
-}
-
-static void cmd_flushdb(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
-    (void)srv; (void)cmd;
-    db_flush(db);
     resp_write_simple_string(reply, "OK");
 }
 
-static void cmd_info(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
-    (void)srv; (void)cmd;
-    char info[512];
-    snprintf(info, sizeof(info),
-        "# Server\r\n"
-        "inmemdb_version:1.0.0\r\n"
-        "# Keyspace\r\n"
-        "db0:keys=%zu\r\n",
-        db_size(db));
-    resp_write_bulk_string(reply, info, strlen(info));
-}
-
-static void cmd_save(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
-    (void)srv; (void)cmd;
-    if (persist_save(db, "dump.rdb") == 0) {
-        resp_write_simple_string(reply, "OK");
+static void cmd_ltrim(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'LTRIM' command");
+        return;
+    }
+    int64_t start, stop;
+    if (!get_int_arg(cmd, 2, reply, &start) || !get_int_arg(cmd, 3, reply, &stop)) return;
+    const char *key = get_arg(cmd, 1);
+    int wrongtype;
+    list_t *list = db_get_list(db, key, &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (list) {
+        list_trim(list, (long)start, (long)stop);
+        if (list_length(list) == 0) db_del(db, key);
     } else {
-        resp_write_error(reply, "ERR failed to save database");
+        propagate_nothing();
     }
+    resp_write_simple_string(reply, "OK");
 }
 
-static void cmd_shutdown(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+static void cmd_linsert(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 5) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'LINSERT' command");
+        return;
+    }
+    const char *where = get_arg(cmd, 2);
+    int after;
+    if (imdb_strcasecmp(where, "BEFORE") == 0) after = 0;
+    else if (imdb_strcasecmp(where, "AFTER") == 0) after = 1;
+    else {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    int wrongtype;
+    list_t *list = db_get_list(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (!list) {
+        propagate_nothing();
+        resp_write_integer(reply, 0);
+        return;
+    }
+    const char *pivot = get_arg(cmd, 3);
+    const char *val = get_arg(cmd, 4);
+    int64_t len = list_insert(list, pivot, get_arg_len(cmd, 3), val, get_arg_len(cmd, 4), after);
+    if (len < 0) propagate_nothing();
+    resp_write_integer(reply, len);
+}
+
+static void cmd_lrem(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'LREM' command");
+        return;
+    }
+    int64_t count;
+    if (!get_int_arg(cmd, 2, reply, &count)) return;
+    const char *key = get_arg(cmd, 1);
+    int wrongtype;
+    list_t *list = db_get_list(db, key, &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (!list) {
+        propagate_nothing();
+        resp_write_integer(reply, 0);
+        return;
+    }
+    const char *val = get_arg(cmd, 3);
+    size_t removed = list_remove(list, val, get_arg_len(cmd, 3), (long)count);
+    if (!removed) propagate_nothing();
+    if (list_length(list) == 0) db_del(db, key);
+    resp_write_integer(reply, (int64_t)removed);
+}
+
+/* LPOS key element [RANK rank] [COUNT num] [MAXLEN len] */
+static void cmd_lpos(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'LPOS' command");
+        return;
+    }
+    int64_t rank = 1, count = -1, maxlen = 0;
+    for (size_t i = 3; i < argc; i += 2) {
+        const char *opt = get_arg(cmd, (int)i);
+        int64_t v;
+        if (i + 1 >= argc) {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+        if (!get_int_arg(cmd, (int)i + 1, reply, &v)) return;
+        if (imdb_strcasecmp(opt, "RANK") == 0) {
+            if (v == 0) {
+                resp_write_error(reply, "ERR RANK can't be zero");
+                return;
+            }
+            rank = v;
+        } else if (imdb_strcasecmp(opt, "COUNT") == 0 && v >= 0) {
+            count = v;
+        } else if (imdb_strcasecmp(opt, "MAXLEN") == 0 && v >= 0) {
+            maxlen = v;
+        } else {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+    }
+
+    int wrongtype;
+    list_t *list = db_get_list(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+
+    const char *elem = get_arg(cmd, 2);
+    size_t elen = get_arg_len(cmd, 2);
+    size_t want = count < 0 ? 1 : (count == 0 ? (size_t)-1 : (size_t)count);
+    int64_t skip = (rank < 0 ? -rank : rank) - 1;
+    int64_t *matches = NULL;
+    size_t nmatches = 0, cap = 0;
+
+    if (list && list_length(list) > 0) {
+        int forward = rank > 0;
+        size_t len = list_length(list);
+        list_iter_t it;
+        const char *val;
+        size_t vlen;
+        size_t scanned = 0;
+        list_iter_init(&it, list, forward ? 0 : len - 1, forward);
+        while (nmatches < want && (maxlen == 0 || scanned < (size_t)maxlen) &&
+               list_iter_next(&it, &val, &vlen)) {
+            if (vlen == elen && memcmp(val, elem, elen) == 0) {
+                if (skip > 0) {
+                    skip--;
+                } else {
+                    if (nmatches == cap) {
+                        cap = cap ? cap * 2 : 8;
+                        matches = imdb_realloc(matches, cap * sizeof(int64_t));
+                    }
+                    matches[nmatches++] = (int64_t)(forward ? scanned : len - 1 - scanned);
+                }
+            }
+            scanned++;
+        }
+        list_iter_release(&it);
+    }
+
+    if (count < 0) {
+        if (nmatches) resp_write_integer(reply, matches[0]);
+        else resp_write_nil(reply);
+    } else {
+        resp_write_array_header(reply, nmatches);
+        for (size_t i = 0; i < nmatches; i++) resp_write_integer(reply, matches[i]);
+    }
+    imdb_free(matches);
+}
+
+/*
+ * Move one element between lists. Returns 1 when moved (reply written),
+ * 0 when the source is empty (nothing written), -1 on error (reply written).
+ */
+static int list_move(database_t *db, const char *src, const char *dst,
+                     int from_left, int to_left, resp_buf_t *reply) {
+    int wrongtype;
+    list_t *list = db_get_list(db, src, &wrongtype);
+    if (!wrongtype) db_get_list(db, dst, &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return -1;
+    }
+    if (!list) return 0;
+
+    size_t len;
+    char *val = from_left ? list_lpop(list, &len) : list_rpop(list, &len);
+    if (to_left) db_lpush(db, dst, val, len);
+    else db_rpush(db, dst, val, len);
+    if (list_length(list) == 0) db_del(db, src);
+    resp_write_bulk_string(reply, val, len);
+    imdb_free(val);
+    return 1;
+}
+
+static int parse_list_side(const char *s, int *left) {
+    if (imdb_strcasecmp(s, "LEFT") == 0) *left = 1;
+    else if (imdb_strcasecmp(s, "RIGHT") == 0) *left = 0;
+    else return 0;
+    return 1;
+}
+
+static void cmd_lmove(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 5) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'LMOVE' command");
+        return;
+    }
+    int from_left, to_left;
+    if (!parse_list_side(get_arg(cmd, 3), &from_left) || !parse_list_side(get_arg(cmd, 4), &to_left)) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    if (list_move(db, get_arg(cmd, 1), get_arg(cmd, 2), from_left, to_left, reply) == 0) {
+        propagate_nothing();
+        resp_write_nil(reply);
+    }
+}
+
+static void cmd_blmove(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    if (arg_count(cmd) != 6) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'BLMOVE' command");
+        return;
+    }
+    int from_left, to_left;
+    if (!parse_list_side(get_arg(cmd, 3), &from_left) || !parse_list_side(get_arg(cmd, 4), &to_left)) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    int64_t deadline;
+    if (!get_timeout_arg(cmd, 5, reply, &deadline)) return;
+
+    const char *src = get_arg(cmd, 1);
+    if (list_move(db, src, get_arg(cmd, 2), from_left, to_left, reply) != 0) return;
+    propagate_nothing();
+    if (srv && srv->current_client) server_block_client(srv, &src, 1, deadline, BLOCK_REPLY_NIL);
+    else resp_write_nil(reply);
+}
+
+/* BLPOP/BRPOP key [key ...] timeout: pop from the first non-empty list or block */
+static void blocking_pop(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply,
+                         int head, const char *name) {
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, name);
+        return;
+    }
+    int64_t deadline;
+    if (!get_timeout_arg(cmd, (int)argc - 1, reply, &deadline)) return;
+
+    size_t nkeys = argc - 2;
+    for (size_t i = 0; i < nkeys; i++) {
+        const char *key = get_arg(cmd, (int)i + 1);
+        int wrongtype;
+        list_t *list = db_get_list(db, key, &wrongtype);
+        if (wrongtype) {
+            resp_write_error(reply, WRONGTYPE_ERR);
+            return;
+        }
+        if (!list) continue;
+
+        size_t len;
+        char *val = head ? list_lpop(list, &len) : list_rpop(list, &len);
+        resp_write_array_header(reply, 2);
+        resp_write_bulk_string(reply, key, strlen(key));
+        resp_write_bulk_string(reply, val, len);
+        imdb_free(val);
+        if (list_length(list) == 0) db_del(db, key);
+        return;
+    }
+
+    propagate_nothing();
+    if (srv && srv->current_client) {
+        const char **keys = imdb_malloc(nkeys * sizeof(char *));
+        for (size_t i = 0; i < nkeys; i++) keys[i] = get_arg(cmd, (int)i + 1);
+        server_block_client(srv, keys, nkeys, deadline, BLOCK_REPLY_NULL_ARRAY);
+        imdb_free(keys);
+    } else {
+        resp_write_null_array(reply);
+    }
+}
+
+static void cmd_blpop(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    blocking_pop(db, srv, cmd, reply, 1, "BLPOP");
+}
+
+static void cmd_brpop(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    blocking_pop(db, srv, cmd, reply, 0, "BRPOP");
+}
+
+/* ---- Hash commands ---- */
+
+/* HSET/HMSET key field value [field value ...]; returns fields added or -1 (reply written) */
+static int64_t hash_set_pairs(database_t *db, resp_value_t *cmd, resp_buf_t *reply, const char *name) {
+    size_t argc = arg_count(cmd);
+    if (argc < 4 || argc % 2 != 0) {
+        wrong_args(reply, name);
+        return -1;
+    }
+    int wrongtype;
+    hash_t *hash = db_get_or_create_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return -1;
+    }
+    int64_t added = 0;
+    for (size_t i = 2; i < argc; i += 2) {
+        const char *field = get_arg(cmd, (int)i);
+        const char *val = get_arg(cmd, (int)i + 1);
+        added += hash_set(hash, field, get_arg_len(cmd, (int)i), val, get_arg_len(cmd, (int)i + 1));
+    }
+    return added;
+}
+
+static void cmd_hset(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    int64_t added = hash_set_pairs(db, cmd, reply, "HSET");
+    if (added >= 0) resp_write_integer(reply, added);
+}
+
+static void cmd_hmset(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (hash_set_pairs(db, cmd, reply, "HMSET") >= 0) resp_write_simple_string(reply, "OK");
+}
+
+static void cmd_hsetnx(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "HSETNX");
+        return;
+    }
+    int wrongtype;
+    hash_t *hash = db_get_or_create_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *field = get_arg(cmd, 2), *val = get_arg(cmd, 3), *old;
+    size_t old_len;
+    if (hash_get(hash, field, get_arg_len(cmd, 2), &old, &old_len)) {
+        propagate_nothing();
+        resp_write_integer(reply, 0);
+        return;
+    }
+    hash_set(hash, field, get_arg_len(cmd, 2), val, get_arg_len(cmd, 3));
+    resp_write_integer(reply, 1);
+}
+
+static void cmd_hget(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "HGET");
+        return;
+    }
+    int wrongtype;
+    hash_t *hash = db_get_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *field = get_arg(cmd, 2), *val;
+    size_t len;
+    if (hash && hash_get(hash, field, get_arg_len(cmd, 2), &val, &len)) {
+        resp_write_bulk_string(reply, val, len);
+    } else {
+        resp_write_nil(reply);
+    }
+}
+
+static void cmd_hmget(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "HMGET");
+        return;
+    }
+    int wrongtype;
+    hash_t *hash = db_get_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    resp_write_array_header(reply, argc - 2);
+    for (size_t i = 2; i < argc; i++) {
+        const char *field = get_arg(cmd, (int)i), *val;
+        size_t len;
+        if (hash && hash_get(hash, field, get_arg_len(cmd, (int)i), &val, &len)) {
+            resp_write_bulk_string(reply, val, len);
+        } else {
+            resp_write_nil(reply);
+        }
+    }
+}
+
+static void cmd_hdel(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "HDEL");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    int wrongtype;
+    hash_t *hash = db_get_hash(db, key, &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    int64_t deleted = 0;
+    for (size_t i = 2; hash && i < argc; i++) {
+        const char *field = get_arg(cmd, (int)i);
+        deleted += hash_delete(hash, field, get_arg_len(cmd, (int)i));
+    }
+    if (hash && hash_length(hash) == 0) db_del(db, key);
+    if (!deleted) propagate_nothing();
+    resp_write_integer(reply, deleted);
+}
+
+static void cmd_hlen(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "HLEN");
+        return;
+    }
+    int wrongtype;
+    hash_t *hash = db_get_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) resp_write_error(reply, WRONGTYPE_ERR);
+    else resp_write_integer(reply, hash ? (int64_t)hash_length(hash) : 0);
+}
+
+/* HEXISTS and HSTRLEN: look up one field and reply with an integer */
+static void hash_field_int(database_t *db, resp_value_t *cmd, resp_buf_t *reply,
+                           const char *name, int want_len) {
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, name);
+        return;
+    }
+    int wrongtype;
+    hash_t *hash = db_get_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *field = get_arg(cmd, 2), *val;
+    size_t len = 0;
+    int found = hash && hash_get(hash, field, get_arg_len(cmd, 2), &val, &len);
+    resp_write_integer(reply, want_len ? (int64_t)len : found);
+}
+
+static void cmd_hexists(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    hash_field_int(db, cmd, reply, "HEXISTS", 0);
+}
+
+static void cmd_hstrlen(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    hash_field_int(db, cmd, reply, "HSTRLEN", 1);
+}
+
+#define HASH_REPLY_FIELDS 1
+#define HASH_REPLY_VALUES 2
+
+/* HGETALL/HKEYS/HVALS */
+static void hash_reply_all(database_t *db, resp_value_t *cmd, resp_buf_t *reply,
+                           const char *name, int what) {
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, name);
+        return;
+    }
+    int wrongtype;
+    hash_t *hash = db_get_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (!hash) {
+        resp_write_array_header(reply, 0);
+        return;
+    }
+    size_t per_field = (what & HASH_REPLY_FIELDS ? 1 : 0) + (what & HASH_REPLY_VALUES ? 1 : 0);
+    resp_write_array_header(reply, hash_length(hash) * per_field);
+
+    hash_iter_t it;
+    const char *field, *val;
+    size_t flen, vlen;
+    hash_iter_init(&it, hash);
+    while (hash_iter_next(&it, &field, &flen, &val, &vlen)) {
+        if (what & HASH_REPLY_FIELDS) resp_write_bulk_string(reply, field, flen);
+        if (what & HASH_REPLY_VALUES) resp_write_bulk_string(reply, val, vlen);
+    }
+}
+
+static void cmd_hgetall(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    hash_reply_all(db, cmd, reply, "HGETALL", HASH_REPLY_FIELDS | HASH_REPLY_VALUES);
+}
+
+static void cmd_hkeys(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    hash_reply_all(db, cmd, reply, "HKEYS", HASH_REPLY_FIELDS);
+}
+
+static void cmd_hvals(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    hash_reply_all(db, cmd, reply, "HVALS", HASH_REPLY_VALUES);
+}
+
+static void cmd_hincrby(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "HINCRBY");
+        return;
+    }
+    int64_t delta;
+    if (!get_int_arg(cmd, 3, reply, &delta)) return;
+    int wrongtype;
+    hash_t *hash = db_get_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *field = get_arg(cmd, 2), *val;
+    size_t len;
+    int64_t cur = 0;
+    if (hash && hash_get(hash, field, get_arg_len(cmd, 2), &val, &len)) {
+        char buf[32];
+        int ok = len < sizeof(buf);
+        if (ok) {
+            memcpy(buf, val, len);
+            buf[len] = '\0';
+            ok = obj_try_parse_int(buf, &cur);
+        }
+        if (!ok) {
+            resp_write_error(reply, "ERR hash value is not an integer");
+            return;
+        }
+    }
+    if ((delta > 0 && cur > INT64_MAX - delta) || (delta < 0 && cur < INT64_MIN - delta)) {
+        resp_write_error(reply, "ERR increment or decrement would overflow");
+        return;
+    }
+    cur += delta;
+
+    char out[32];
+    int n = snprintf(out, sizeof(out), "%" PRId64, cur);
+    if (!hash) hash = db_get_or_create_hash(db, get_arg(cmd, 1), &wrongtype);
+    hash_set(hash, field, get_arg_len(cmd, 2), out, (size_t)n);
+    resp_write_integer(reply, cur);
+}
+
+static void cmd_hincrbyfloat(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "HINCRBYFLOAT");
+        return;
+    }
+    const char *incr = get_arg(cmd, 3);
+    long double delta, cur = 0;
+    if (!parse_long_double(incr, get_arg_len(cmd, 3), &delta)) {
+        resp_write_error(reply, "ERR value is not a valid float");
+        return;
+    }
+    int wrongtype;
+    hash_t *hash = db_get_hash(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *field = get_arg(cmd, 2), *val;
+    size_t len;
+    if (hash && hash_get(hash, field, get_arg_len(cmd, 2), &val, &len) &&
+        !parse_long_double(val, len, &cur)) {
+        resp_write_error(reply, "ERR hash value is not a float");
+        return;
+    }
+    cur += delta;
+    if (isnan(cur) || isinf(cur)) {
+        resp_write_error(reply, "ERR increment would produce NaN or Infinity");
+        return;
+    }
+
+    char out[64];
+    int n = snprintf(out, sizeof(out), "%.17Lg", cur);
+    if (!hash) hash = db_get_or_create_hash(db, get_arg(cmd, 1), &wrongtype);
+    hash_set(hash, field, get_arg_len(cmd, 2), out, (size_t)n);
+    resp_write_bulk_string(reply, out, (size_t)n);
+}
+
+/* ---- Sorted set commands ---- */
+
+/* Shortest decimal form that reads back as the same double */
+static int format_double(char *buf, size_t cap, double v) {
+    if (isinf(v)) return snprintf(buf, cap, "%s", v > 0 ? "inf" : "-inf");
+    int n = 0;
+    for (int prec = 15; prec <= 17; prec++) {
+        n = snprintf(buf, cap, "%.*g", prec, v);
+        if (strtod(buf, NULL) == v) break;
+    }
+    return n;
+}
+
+static void write_score(resp_buf_t *reply, double score) {
+    char buf[64];
+    int n = format_double(buf, sizeof(buf), score);
+    resp_write_bulk_string(reply, buf, (size_t)n);
+}
+
+/* Parse a score; "inf", "+inf" and "-inf" are accepted, NaN is not */
+static int parse_score(const char *s, double *out) {
+    if (!s || *s == '\0' || isspace((unsigned char)*s)) return 0;
+    char *end;
+    double v = strtod(s, &end);
+    if (*end != '\0' || isnan(v)) return 0;
+    *out = v;
+    return 1;
+}
+
+/* Score range endpoint: "1.5" (inclusive) or "(1.5" (exclusive) */
+static int parse_score_bound(const char *s, double *out, int *exclusive) {
+    *exclusive = s && *s == '(';
+    return parse_score(*exclusive ? s + 1 : s, out);
+}
+
+#define LEX_NEG_INF 1  /* "-" */
+#define LEX_POS_INF 2  /* "+" */
+
+/* Lex range endpoint: "-", "+", "[member" (inclusive) or "(member" (exclusive) */
+static int parse_lex_bound(const char *s, int *inf, int *exclusive, const char **member) {
+    *inf = 0;
+    *exclusive = 0;
+    *member = NULL;
+    if (!s) return 0;
+    if (strcmp(s, "-") == 0) *inf = LEX_NEG_INF;
+    else if (strcmp(s, "+") == 0) *inf = LEX_POS_INF;
+    else if (*s == '[' || *s == '(') {
+        *exclusive = *s == '(';
+        *member = s + 1;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* Members before a lex endpoint of len bytes used as a lower (lower = 1) or
+ * upper bound */
+static size_t lex_rank(zset_t *zs, const char *s, size_t len, int lower) {
+    int inf, exclusive;
+    const char *member;
+    parse_lex_bound(s, &inf, &exclusive, &member);
+    if (inf == LEX_NEG_INF) return 0;
+    if (inf == LEX_POS_INF) return zset_length(zs);
+    int inclusive = lower ? exclusive : !exclusive;
+    return zset_count_below_lex(zs, member, len - 1, inclusive);
+}
+
+static void cmd_zadd(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 4) {
+        wrong_args(reply, "ZADD");
+        return;
+    }
+    int flags = 0, ch = 0;
+    size_t i = 2;
+    for (; i < argc; i++) {
+        const char *opt = get_arg(cmd, (int)i);
+        if (imdb_strcasecmp(opt, "NX") == 0) flags |= ZADD_NX;
+        else if (imdb_strcasecmp(opt, "XX") == 0) flags |= ZADD_XX;
+        else if (imdb_strcasecmp(opt, "GT") == 0) flags |= ZADD_GT;
+        else if (imdb_strcasecmp(opt, "LT") == 0) flags |= ZADD_LT;
+        else if (imdb_strcasecmp(opt, "CH") == 0) ch = 1;
+        else if (imdb_strcasecmp(opt, "INCR") == 0) flags |= ZADD_INCR;
+        else break;
+    }
+    size_t pairs = (argc - i) / 2;
+    if (pairs == 0 || (argc - i) % 2 != 0) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    if ((flags & ZADD_NX) && (flags & ZADD_XX)) {
+        resp_write_error(reply, "ERR XX and NX options at the same time are not compatible");
+        return;
+    }
+    if (((flags & ZADD_GT) && (flags & ZADD_LT)) ||
+        ((flags & ZADD_NX) && (flags & (ZADD_GT | ZADD_LT)))) {
+        resp_write_error(reply, "ERR GT, LT, and/or NX options at the same time are not compatible");
+        return;
+    }
+    if ((flags & ZADD_INCR) && pairs > 1) {
+        resp_write_error(reply, "ERR INCR option supports a single increment-element pair");
+        return;
+    }
+
+    /* Validate every score before touching the set */
+    double *scores = imdb_malloc(pairs * sizeof(double));
+    for (size_t j = 0; j < pairs; j++) {
+        if (!parse_score(get_arg(cmd, (int)(i + 2 * j)), &scores[j])) {
+            imdb_free(scores);
+            resp_write_error(reply, "ERR value is not a valid float");
+            return;
+        }
+    }
+
+    const char *key = get_arg(cmd, 1);
+    int wrongtype;
+    zset_t *zs = db_get_zset(db, key, &wrongtype);
+    if (wrongtype) {
+        imdb_free(scores);
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (!zs && (flags & ZADD_XX)) {
+        imdb_free(scores);
+        propagate_nothing();
+        if (flags & ZADD_INCR) resp_write_nil(reply);
+        else resp_write_integer(reply, 0);
+        return;
+    }
+    if (!zs) zs = db_get_or_create_zset(db, key, &wrongtype);
+
+    int64_t added = 0, updated = 0;
+    double newscore = 0;
+    int out = 0;
+    for (size_t j = 0; j < pairs; j++) {
+        int arg = (int)(i + 2 * j + 1);
+        if (!zset_add(zs, scores[j], get_arg(cmd, arg), get_arg_len(cmd, arg), flags, &out, &newscore)) {
+            resp_write_error(reply, "ERR resulting score is not a number (NaN)");
+            imdb_free(scores);
+            return;
+        }
+        if (out & ZADD_OUT_ADDED) added++;
+        if (out & ZADD_OUT_UPDATED) updated++;
+    }
+    imdb_free(scores);
+    if (!added && !updated) propagate_nothing();
+
+    if (flags & ZADD_INCR) {
+        if (out & ZADD_OUT_NOP) resp_write_nil(reply);
+        else write_score(reply, newscore);
+    } else {
+        resp_write_integer(reply, ch ? added + updated : added);
+    }
+}
+
+static void cmd_zincrby(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "ZINCRBY");
+        return;
+    }
+    double delta, newscore;
+    if (!parse_score(get_arg(cmd, 2), &delta)) {
+        resp_write_error(reply, "ERR value is not a valid float");
+        return;
+    }
+    int wrongtype, out;
+    zset_t *zs = db_get_or_create_zset(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *member = get_arg(cmd, 3);
+    if (!zset_add(zs, delta, member, get_arg_len(cmd, 3), ZADD_INCR, &out, &newscore)) {
+        resp_write_error(reply, "ERR resulting score is not a number (NaN)");
+        return;
+    }
+    write_score(reply, newscore);
+}
+
+static void cmd_zscore(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "ZSCORE");
+        return;
+    }
+    int wrongtype;
+    zset_t *zs = db_get_zset(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *member = get_arg(cmd, 2);
+    double score;
+    if (zs && zset_score(zs, member, get_arg_len(cmd, 2), &score)) write_score(reply, score);
+    else resp_write_nil(reply);
+}
+
+static void zrank_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply,
+                          const char *name, int reverse) {
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, name);
+        return;
+    }
+    int wrongtype;
+    zset_t *zs = db_get_zset(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *member = get_arg(cmd, 2);
+    long rank = zs ? zset_rank(zs, member, get_arg_len(cmd, 2), reverse) : -1;
+    if (rank < 0) resp_write_nil(reply);
+    else resp_write_integer(reply, rank);
+}
+
+static void cmd_zrank(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    zrank_generic(db, cmd, reply, "ZRANK", 0);
+}
+
+static void cmd_zrevrank(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    zrank_generic(db, cmd, reply, "ZREVRANK", 1);
+}
+
+static void cmd_zcard(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "ZCARD");
+        return;
+    }
+    int wrongtype;
+    zset_t *zs = db_get_zset(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) resp_write_error(reply, WRONGTYPE_ERR);
+    else resp_write_integer(reply, zs ? (int64_t)zset_length(zs) : 0);
+}
+
+static void cmd_zcount(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "ZCOUNT");
+        return;
+    }
+    double min, max;
+    int minex, maxex;
+    if (!parse_score_bound(get_arg(cmd, 2), &min, &minex) ||
+        !parse_score_bound(get_arg(cmd, 3), &max, &maxex)) {
+        resp_write_error(reply, "ERR min or max is not a float");
+        return;
+    }
+    int wrongtype;
+    zset_t *zs = db_get_zset(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    int64_t count = 0;
+    if (zs) {
+        size_t first = zset_count_below(zs, min, minex);
+        size_t end = zset_count_below(zs, max, !maxex);
+        if (end > first) count = (int64_t)(end - first);
+    }
+    resp_write_integer(reply, count);
+}
+
+static void cmd_zrem(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "ZREM");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    int wrongtype;
+    zset_t *zs = db_get_zset(db, key, &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    int64_t removed = 0;
+    for (size_t i = 2; zs && i < argc; i++) {
+        const char *member = get_arg(cmd, (int)i);
+        removed += zset_delete(zs, member, get_arg_len(cmd, (int)i));
+    }
+    if (zs && zset_length(zs) == 0) db_del(db, key);
+    if (!removed) propagate_nothing();
+    resp_write_integer(reply, removed);
+}
+
+/* ZPOPMIN/ZPOPMAX key [count]: flat member, score array */
+static void zpop_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply,
+                         const char *name, int max) {
+    size_t argc = arg_count(cmd);
+    if (argc < 2 || argc > 3) {
+        wrong_args(reply, name);
+        return;
+    }
+    int64_t count = 1;
+    if (argc == 3) {
+        if (!get_int_arg(cmd, 2, reply, &count)) return;
+        if (count < 0) {
+            resp_write_error(reply, "ERR value is out of range, must be positive");
+            return;
+        }
+    }
+    const char *key = get_arg(cmd, 1);
+    int wrongtype;
+    zset_t *zs = db_get_zset(db, key, &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    size_t len = zs ? zset_length(zs) : 0;
+    size_t n = (size_t)count < len ? (size_t)count : len;
+    if (!n) propagate_nothing();
+    resp_write_array_header(reply, n * 2);
+    for (size_t i = 0; i < n; i++) {
+        zset_iter_t it;
+        const char *member;
+        size_t mlen;
+        double score;
+        zset_iter_init(&it, zs, max ? zset_length(zs) - 1 : 0, max);
+        zset_iter_next(&it, &member, &mlen, &score);
+        resp_write_bulk_string(reply, member, mlen);
+        write_score(reply, score);
+        /* The member may live inside the set; copy before deleting */
+        char *copy = imdb_memdup(member, mlen);
+        zset_delete(zs, copy, mlen);
+        imdb_free(copy);
+    }
+    if (zs && zset_length(zs) == 0) db_del(db, key);
+}
+
+static void cmd_zpopmin(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    zpop_generic(db, cmd, reply, "ZPOPMIN", 0);
+}
+
+static void cmd_zpopmax(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    zpop_generic(db, cmd, reply, "ZPOPMAX", 1);
+}
+
+#define ZRANGE_RANK  0
+#define ZRANGE_SCORE 1
+#define ZRANGE_LEX   2
+
+/*
+ * Shared by ZRANGE, ZREVRANGE, ZRANGEBYSCORE and ZREVRANGEBYSCORE.
+ * Arguments 2 and 3 are the range (max first when reversed by score or lex);
+ * options start at argument 4. `flexible` accepts BYSCORE/BYLEX/REV there.
+ */
+static void zrange_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply,
+                           const char *name, int mode, int rev, int flexible) {
+    size_t argc = arg_count(cmd);
+    if (argc < 4) {
+        wrong_args(reply, name);
+        return;
+    }
+    int withscores = 0, limit = 0;
+    int64_t offset = 0, count = -1;
+    for (size_t i = 4; i < argc; i++) {
+        const char *opt = get_arg(cmd, (int)i);
+        if (imdb_strcasecmp(opt, "WITHSCORES") == 0) {
+            withscores = 1;
+        } else if (imdb_strcasecmp(opt, "LIMIT") == 0 && i + 2 < argc) {
+            if (!get_int_arg(cmd, (int)i + 1, reply, &offset) ||
+                !get_int_arg(cmd, (int)i + 2, reply, &count)) return;
+            limit = 1;
+            i += 2;
+        } else if (flexible && imdb_strcasecmp(opt, "BYSCORE") == 0) {
+            mode = ZRANGE_SCORE;
+        } else if (flexible && imdb_strcasecmp(opt, "BYLEX") == 0) {
+            mode = ZRANGE_LEX;
+        } else if (flexible && imdb_strcasecmp(opt, "REV") == 0) {
+            rev = 1;
+        } else {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+    }
+    if (limit && mode == ZRANGE_RANK) {
+        resp_write_error(reply, "ERR syntax error, LIMIT is only supported in combination with either BYSCORE or BYLEX");
+        return;
+    }
+    if (withscores && mode == ZRANGE_LEX) {
+        resp_write_error(reply, "ERR syntax error, WITHSCORES not supported in combination with BYLEX");
+        return;
+    }
+
+    /* Validate the range before looking at the key */
+    int lo_arg = rev && mode != ZRANGE_RANK ? 3 : 2, hi_arg = rev && mode != ZRANGE_RANK ? 2 : 3;
+    const char *lo = get_arg(cmd, lo_arg);
+    const char *hi = get_arg(cmd, hi_arg);
+    int64_t start = 0, stop = 0;
+    double min = 0, max = 0;
+    int minex = 0, maxex = 0;
+    if (mode == ZRANGE_RANK) {
+        if (!get_int_arg(cmd, 2, reply, &start) || !get_int_arg(cmd, 3, reply, &stop)) return;
+    } else if (mode == ZRANGE_SCORE) {
+        if (!parse_score_bound(lo, &min, &minex) || !parse_score_bound(hi, &max, &maxex)) {
+            resp_write_error(reply, "ERR min or max is not a float");
+            return;
+        }
+    } else {
+        int inf, ex;
+        const char *m;
+        if (!parse_lex_bound(lo, &inf, &ex, &m) || !parse_lex_bound(hi, &inf, &ex, &m)) {
+            resp_write_error(reply, "ERR min or max not valid string range item");
+            return;
+        }
+    }
+
+    int wrongtype;
+    zset_t *zs = db_get_zset(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (!zs) {
+        resp_write_array_header(reply, 0);
+        return;
+    }
+
+    /* Resolve to the ascending rank window [first, end) */
+    int64_t len = (int64_t)zset_length(zs), first, end;
+    if (mode == ZRANGE_RANK) {
+        if (start < 0) start += len;
+        if (stop < 0) stop += len;
+        if (start < 0) start = 0;
+        if (stop >= len) stop = len - 1;
+        if (rev) {
+            int64_t s = len - 1 - stop;
+            stop = len - 1 - start;
+            start = s;
+        }
+        first = start;
+        end = stop + 1;
+    } else if (mode == ZRANGE_SCORE) {
+        first = (int64_t)zset_count_below(zs, min, minex);
+        end = (int64_t)zset_count_below(zs, max, !maxex);
+    } else {
+        first = (int64_t)lex_rank(zs, lo, get_arg_len(cmd, lo_arg), 1);
+        end = (int64_t)lex_rank(zs, hi, get_arg_len(cmd, hi_arg), 0);
+    }
+
+    int64_t n = end - first;
+    if (limit) {
+        if (offset < 0) n = 0;
+        else n -= offset;
+        if (count >= 0 && n > count) n = count;
+    }
+    if (n <= 0) {
+        resp_write_array_header(reply, 0);
+        return;
+    }
+
+    resp_write_array_header(reply, (size_t)n * (withscores ? 2 : 1));
+    zset_iter_t it;
+    const char *member;
+    size_t mlen;
+    double score;
+    zset_iter_init(&it, zs, (size_t)(rev ? end - 1 - offset : first + offset), rev);
+    for (int64_t i = 0; i < n && zset_iter_next(&it, &member, &mlen, &score); i++) {
+        resp_write_bulk_string(reply, member, mlen);
+        if (withscores) write_score(reply, score);
+    }
+}
+
+static void cmd_zrange(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    zrange_generic(db, cmd, reply, "ZRANGE", ZRANGE_RANK, 0, 1);
+}
+
+static void cmd_zrevrange(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    zrange_generic(db, cmd, reply, "ZREVRANGE", ZRANGE_RANK, 1, 0);
+}
+
+static void cmd_zrangebyscore(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    zrange_generic(db, cmd, reply, "ZRANGEBYSCORE", ZRANGE_SCORE, 0, 0);
+}
+
+static void cmd_zrevrangebyscore(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    zrange_generic(db, cmd, reply, "ZREVRANGEBYSCORE", ZRANGE_SCORE, 1, 0);
+}
+
+/* ---- Set commands ---- */
+
+static void cmd_sadd(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "SADD");
+        return;
+    }
+    int wrongtype;
+    set_t *set = db_get_or_create_set(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    size_t count = argc - 2;
+    const char **members = imdb_malloc(count * sizeof(char *));
+    size_t *lens = imdb_malloc(count * sizeof(size_t));
+    for (size_t i = 0; i < count; i++) {
+        members[i] = get_arg(cmd, (int)(i + 2));
+        lens[i] = get_arg_len(cmd, (int)(i + 2));
+    }
+    size_t added = set_add_many(set, members, lens, count);
+    if (!added) propagate_nothing();
+    resp_write_integer(reply, (int64_t)added);
+    imdb_free(members);
+    imdb_free(lens);
+}
+
+static void cmd_srem(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "SREM");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    int wrongtype;
+    set_t *set = db_get_set(db, key, &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    int64_t removed = 0;
+    for (size_t i = 2; set && i < argc; i++) {
+        const char *member = get_arg(cmd, (int)i);
+        removed += set_remove(set, member, get_arg_len(cmd, (int)i));
+    }
+    if (set && set_length(set) == 0) db_del(db, key);
+    if (!removed) propagate_nothing();
+    resp_write_integer(reply, removed);
+}
+
+static void cmd_sismember(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "SISMEMBER");
+        return;
+    }
+    int wrongtype;
+    set_t *set = db_get_set(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    const char *member = get_arg(cmd, 2);
+    resp_write_integer(reply, set && set_contains(set, member, get_arg_len(cmd, 2)));
+}
+
+static void cmd_smismember(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "SMISMEMBER");
+        return;
+    }
+    int wrongtype;
+    set_t *set = db_get_set(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    resp_write_array_header(reply, argc - 2);
+    for (size_t i = 2; i < argc; i++) {
+        const char *member = get_arg(cmd, (int)i);
+        resp_write_integer(reply, set && set_contains(set, member, get_arg_len(cmd, (int)i)));
+    }
+}
+
+static void cmd_scard(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "SCARD");
+        return;
+    }
+    int wrongtype;
+    set_t *set = db_get_set(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    resp_write_integer(reply, set ? (int64_t)set_length(set) : 0);
+}
+
+static void write_set_members(resp_buf_t *reply, set_t *set) {
+    if (!set) {
+        resp_write_array_header(reply, 0);
+        return;
+    }
+    resp_write_array_header(reply, set_length(set));
+    set_iter_t it;
+    const char *member;
+    size_t len;
+    set_iter_init(&it, set);
+    while (set_iter_next(&it, &member, &len)) resp_write_bulk_string(reply, member, len);
+}
+
+static void cmd_smembers(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "SMEMBERS");
+        return;
+    }
+    int wrongtype;
+    set_t *set = db_get_set(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    write_set_members(reply, set);
+}
+
+/* Look up n source keys starting at argument `first`; missing keys are NULL.
+ * Returns NULL (with the error written) if any key holds another type. */
+static set_t **lookup_sets(database_t *db, resp_value_t *cmd, size_t first, size_t n,
+                           resp_buf_t *reply) {
+    set_t **sets = imdb_malloc(n * sizeof(set_t *));
+    for (size_t i = 0; i < n; i++) {
+        int wrongtype;
+        sets[i] = db_get_set(db, get_arg(cmd, (int)(first + i)), &wrongtype);
+        if (wrongtype) {
+            resp_write_error(reply, WRONGTYPE_ERR);
+            imdb_free(sets);
+            return NULL;
+        }
+    }
+    return sets;
+}
+
+#define SET_OP_INTER 0
+#define SET_OP_UNION 1
+#define SET_OP_DIFF  2
+
+/* SINTER/SUNION/SDIFF and their *STORE variants, which write to the first key */
+static void set_op_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply,
+                           const char *name, int op, int store) {
+    size_t argc = arg_count(cmd);
+    size_t first = store ? 2 : 1;
+    if (argc < first + 1) {
+        wrong_args(reply, name);
+        return;
+    }
+    size_t n = argc - first;
+    set_t **sets = lookup_sets(db, cmd, first, n, reply);
+    if (!sets) return;
+
+    set_t *result;
+    switch (op) {
+        case SET_OP_INTER: result = set_inter(sets, n); break;
+        case SET_OP_UNION: result = set_union(sets, n); break;
+        default:           result = set_diff(sets, n); break;
+    }
+    imdb_free(sets);
+
+    if (store) {
+        size_t len = set_length(result);
+        db_store_set(db, get_arg(cmd, 1), result);
+        resp_write_integer(reply, (int64_t)len);
+    } else {
+        write_set_members(reply, result);
+        set_destroy(result);
+    }
+}
+
+static void cmd_sinter(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    set_op_generic(db, cmd, reply, "SINTER", SET_OP_INTER, 0);
+}
+
+static void cmd_sunion(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    set_op_generic(db, cmd, reply, "SUNION", SET_OP_UNION, 0);
+}
+
+static void cmd_sdiff(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    set_op_generic(db, cmd, reply, "SDIFF", SET_OP_DIFF, 0);
+}
+
+static void cmd_sinterstore(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    set_op_generic(db, cmd, reply, "SINTERSTORE", SET_OP_INTER, 1);
+}
+
+static void cmd_sunionstore(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    set_op_generic(db, cmd, reply, "SUNIONSTORE", SET_OP_UNION, 1);
+}
+
+static void cmd_sdiffstore(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    set_op_generic(db, cmd, reply, "SDIFFSTORE", SET_OP_DIFF, 1);
+}
+
+/* SINTERCARD numkeys key [key ...] [LIMIT limit] */
+static void cmd_sintercard(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    int64_t numkeys, limit = 0;
+    if (argc < 3) {
+        wrong_args(reply, "SINTERCARD");
+        return;
+    }
+    if (!get_int_arg(cmd, 1, reply, &numkeys)) return;
+    if (numkeys <= 0) {
+        resp_write_error(reply, "ERR numkeys should be greater than 0");
+        return;
+    }
+    if ((uint64_t)numkeys > argc - 2) {
+        resp_write_error(reply, "ERR Number of keys can't be greater than number of args");
+        return;
+    }
+    size_t rest = 2 + (size_t)numkeys;
+    if (rest < argc) {
+        if (rest + 2 != argc || imdb_strcasecmp(get_arg(cmd, (int)rest), "LIMIT") != 0) {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+        if (!get_int_arg(cmd, (int)rest + 1, reply, &limit)) return;
+        if (limit < 0) {
+            resp_write_error(reply, "ERR LIMIT can't be negative");
+            return;
+        }
+    }
+    set_t **sets = lookup_sets(db, cmd, 2, (size_t)numkeys, reply);
+    if (!sets) return;
+    resp_write_integer(reply, (int64_t)set_inter_card(sets, (size_t)numkeys, (size_t)limit));
+    imdb_free(sets);
+}
+
+/* ---- Bitmap commands ---- */
+
+#define BIT_OFFSET_ERR "ERR bit offset is not an integer or out of range"
+#define BIT_MAX_OFFSET ((1ULL << 32) - 1) /* 512MB strings */
+
+/* Read-only bytes of a string value; integers are formatted into `tmp`.
+ * Returns 0 if the object is not a string. */
+static int string_view(dbobj_t *obj, char *tmp, size_t cap, const uint8_t **p, size_t *len) {
+    if (obj->type == OBJ_INT) {
+        *len = (size_t)snprintf(tmp, cap, "%" PRId64, obj->data.num);
+        *p = (const uint8_t *)tmp;
+        return 1;
+    }
+    if (obj->type != OBJ_STRING) return 0;
+    *p = (const uint8_t *)obj->data.str.buf;
+    *len = obj->data.str.len;
+    return 1;
+}
+
+/* Bit offset argument; "#n" counts in units of `width` bits when width > 0 */
+static int get_bit_offset(resp_value_t *cmd, int index, int width, resp_buf_t *reply, uint64_t *out) {
+    const char *s = get_arg(cmd, index);
+    int64_t v;
+    int scaled = width > 0 && s && s[0] == '#';
+    if (!obj_try_parse_int(scaled ? s + 1 : s, &v) || v < 0 ||
+        (scaled && (uint64_t)v > BIT_MAX_OFFSET / (uint64_t)width) ||
+        (uint64_t)v * (scaled ? (uint64_t)width : 1) > BIT_MAX_OFFSET) {
+        resp_write_error(reply, BIT_OFFSET_ERR);
+        return 0;
+    }
+    *out = (uint64_t)v * (scaled ? (uint64_t)width : 1);
+    return 1;
+}
+
+/* Optional trailing BYTE|BIT unit; returns -1 (error written) on anything else */
+static int parse_bit_unit(resp_value_t *cmd, size_t index, resp_buf_t *reply) {
+    if (index >= arg_count(cmd)) return 0;
+    const char *unit = get_arg(cmd, (int)index);
+    if (imdb_strcasecmp(unit, "BIT") == 0) return 1;
+    if (imdb_strcasecmp(unit, "BYTE") == 0) return 0;
+    resp_write_error(reply, "ERR syntax error");
+    return -1;
+}
+
+static void cmd_setbit(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "SETBIT");
+        return;
+    }
+    uint64_t offset;
+    if (!get_bit_offset(cmd, 2, 0, reply, &offset)) return;
+    const char *bit = get_arg(cmd, 3);
+    if (strcmp(bit, "0") != 0 && strcmp(bit, "1") != 0) {
+        resp_write_error(reply, "ERR bit is not an integer or out of range");
+        return;
+    }
+    int wrongtype;
+    dbobj_t *obj = db_get_or_create_string(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    obj_string_grow(obj, (size_t)(offset >> 3) + 1);
+    resp_write_integer(reply, bitops_setbit((uint8_t *)obj->data.str.buf, offset, bit[0] == '1'));
+}
+
+static void cmd_getbit(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "GETBIT");
+        return;
+    }
+    uint64_t offset;
+    if (!get_bit_offset(cmd, 2, 0, reply, &offset)) return;
+    dbobj_t *obj = db_get(db, get_arg(cmd, 1));
+    char tmp[32];
+    const uint8_t *p;
+    size_t len;
+    if (!obj) {
+        resp_write_integer(reply, 0);
+    } else if (!string_view(obj, tmp, sizeof(tmp), &p, &len)) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+    } else {
+        resp_write_integer(reply, bitops_getbit(p, len, offset));
+    }
+}
+
+static void cmd_bitcount(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc != 2 && argc != 4 && argc != 5) {
+        if (argc == 3) resp_write_error(reply, "ERR syntax error");
+        else wrong_args(reply, "BITCOUNT");
+        return;
+    }
+    int64_t start = 0, end = -1;
+    int bits = 0;
+    if (argc >= 4) {
+        if (!get_int_arg(cmd, 2, reply, &start) || !get_int_arg(cmd, 3, reply, &end)) return;
+        if ((bits = parse_bit_unit(cmd, 4, reply)) < 0) return;
+    }
+    dbobj_t *obj = db_get(db, get_arg(cmd, 1));
+    char tmp[32];
+    const uint8_t *p;
+    size_t len;
+    if (!obj) {
+        resp_write_integer(reply, 0);
+        return;
+    }
+    if (!string_view(obj, tmp, sizeof(tmp), &p, &len)) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    int64_t total = (int64_t)len * (bits ? 8 : 1), from, to;
+    if (!clamp_range(start, end, total, &from, &to)) {
+        resp_write_integer(reply, 0);
+        return;
+    }
+    if (!bits) {
+        from *= 8;
+        to = to * 8 + 7;
+    }
+    resp_write_integer(reply, (int64_t)bitops_count(p, (uint64_t)from, (uint64_t)to));
+}
+
+static void cmd_bitpos(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3 || argc > 6) {
+        wrong_args(reply, "BITPOS");
+        return;
+    }
+    const char *b = get_arg(cmd, 2);
+    if (strcmp(b, "0") != 0 && strcmp(b, "1") != 0) {
+        resp_write_error(reply, "ERR The bit argument must be 1 or 0.");
+        return;
+    }
+    int bit = b[0] == '1';
+    int64_t start = 0, end = -1;
+    int bits = 0, end_given = argc >= 5;
+    if (argc >= 4 && !get_int_arg(cmd, 3, reply, &start)) return;
+    if (argc >= 5 && !get_int_arg(cmd, 4, reply, &end)) return;
+    if (argc == 6 && (bits = parse_bit_unit(cmd, 5, reply)) < 0) return;
+
+    dbobj_t *obj = db_get(db, get_arg(cmd, 1));
+    char tmp[32];
+    const uint8_t *p;
+    size_t len;
+    if (!obj) {
+        resp_write_integer(reply, bit ? -1 : 0);
+        return;
+    }
+    if (!string_view(obj, tmp, sizeof(tmp), &p, &len)) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    int64_t total = (int64_t)len * (bits ? 8 : 1), from, to;
+    if (!clamp_range(start, end, total, &from, &to)) {
+        resp_write_integer(reply, -1);
+        return;
+    }
+    if (!bits) {
+        from *= 8;
+        to = to * 8 + 7;
+    }
+    int64_t pos = bitops_pos(p, (uint64_t)from, (uint64_t)to, bit);
+    /* Looking for a clear bit with no explicit end: the string continues with zeros */
+    if (pos < 0 && !bit && !end_given) pos = to + 1;
+    resp_write_integer(reply, pos);
+}
+
+static void cmd_bitop(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 4) {
+        wrong_args(reply, "BITOP");
+        return;
+    }
+    const char *name = get_arg(cmd, 1);
+    int op;
+    if (imdb_strcasecmp(name, "AND") == 0) op = SIMD_BITOP_AND;
+    else if (imdb_strcasecmp(name, "OR") == 0) op = SIMD_BITOP_OR;
+    else if (imdb_strcasecmp(name, "XOR") == 0) op = SIMD_BITOP_XOR;
+    else if (imdb_strcasecmp(name, "NOT") == 0) op = SIMD_BITOP_NOT;
+    else {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    size_t n = argc - 3;
+    if (op == SIMD_BITOP_NOT && n != 1) {
+        resp_write_error(reply, "ERR BITOP NOT must be called with a single source key.");
+        return;
+    }
+
+    /* Views of every source; missing keys are empty strings */
+    const uint8_t **srcs = imdb_malloc(n * sizeof(uint8_t *));
+    size_t *lens = imdb_malloc(n * sizeof(size_t));
+    char (*tmps)[32] = imdb_malloc(n * sizeof(*tmps));
+    size_t maxlen = 0;
+    for (size_t i = 0; i < n; i++) {
+        dbobj_t *obj = db_get(db, get_arg(cmd, (int)(i + 3)));
+        srcs[i] = NULL;
+        lens[i] = 0;
+        if (obj && !string_view(obj, tmps[i], sizeof(tmps[i]), &srcs[i], &lens[i])) {
+            resp_write_error(reply, WRONGTYPE_ERR);
+            goto done;
+        }
+        if (lens[i] > maxlen) maxlen = lens[i];
+    }
+
+    uint8_t *res = imdb_calloc(maxlen + 1, 1);
+    if (lens[0]) {
+        if (op == SIMD_BITOP_NOT) simd_bitop(op, res, srcs[0], lens[0]);
+        else memcpy(res, srcs[0], lens[0]);
+    }
+    for (size_t i = 1; i < n; i++) {
+        if (lens[i]) simd_bitop(op, res, srcs[i], lens[i]);
+        /* AND against the implicit zero tail of a shorter source */
+        if (op == SIMD_BITOP_AND) memset(res + lens[i], 0, maxlen - lens[i]);
+    }
+
+    /* Sources are no longer needed, so the destination may be one of them */
+    const char *dest = get_arg(cmd, 2);
+    db_del(db, dest);
+    if (maxlen > 0) {
+        int wrongtype;
+        dbobj_t *obj = db_get_or_create_string(db, dest, &wrongtype);
+        imdb_free(obj->data.str.buf);
+        obj->data.str.buf = (char *)res;
+        obj->data.str.len = maxlen;
+    } else {
+        imdb_free(res);
+    }
+    resp_write_integer(reply, (int64_t)maxlen);
+
+done:
+    imdb_free(srcs);
+    imdb_free(lens);
+    imdb_free(tmps);
+}
+
+#define BITFIELD_GET    0
+#define BITFIELD_SET    1
+#define BITFIELD_INCRBY 2
+
+typedef struct {
+    int op;
+    int is_signed;
+    int bits;
+    int overflow;
+    uint64_t offset;
+    int64_t arg;
+} bitfield_op_t;
+
+/* "i1".."i64" or "u1".."u63" */
+static int parse_bitfield_type(const char *s, int *is_signed, int *bits) {
+    int64_t n;
+    if (!s || (s[0] != 'i' && s[0] != 'u' && s[0] != 'I' && s[0] != 'U')) return 0;
+    *is_signed = s[0] == 'i' || s[0] == 'I';
+    if (!obj_try_parse_int(s + 1, &n) || n < 1 || n > (*is_signed ? 64 : 63)) return 0;
+    *bits = (int)n;
+    return 1;
+}
+
+static void cmd_bitfield(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 2) {
+        wrong_args(reply, "BITFIELD");
+        return;
+    }
+    bitfield_op_t *ops = imdb_malloc(argc * sizeof(bitfield_op_t));
+    size_t nops = 0;
+    int overflow = BITFIELD_WRAP, writes = 0;
+
+    for (size_t i = 2; i < argc;) {
+        const char *sub = get_arg(cmd, (int)i);
+        if (imdb_strcasecmp(sub, "OVERFLOW") == 0 && i + 1 < argc) {
+            const char *mode = get_arg(cmd, (int)i + 1);
+            if (imdb_strcasecmp(mode, "WRAP") == 0) overflow = BITFIELD_WRAP;
+            else if (imdb_strcasecmp(mode, "SAT") == 0) overflow = BITFIELD_SAT;
+            else if (imdb_strcasecmp(mode, "FAIL") == 0) overflow = BITFIELD_FAIL;
+            else {
+                resp_write_error(reply, "ERR Invalid OVERFLOW type specified");
+                goto done;
+            }
+            i += 2;
+            continue;
+        }
+        bitfield_op_t *o = &ops[nops];
+        if (imdb_strcasecmp(sub, "GET") == 0 && i + 2 < argc) o->op = BITFIELD_GET;
+        else if (imdb_strcasecmp(sub, "SET") == 0 && i + 3 < argc) o->op = BITFIELD_SET;
+        else if (imdb_strcasecmp(sub, "INCRBY") == 0 && i + 3 < argc) o->op = BITFIELD_INCRBY;
+        else {
+            resp_write_error(reply, "ERR syntax error");
+            goto done;
+        }
+        if (!parse_bitfield_type(get_arg(cmd, (int)i + 1), &o->is_signed, &o->bits)) {
+            resp_write_error(reply, "ERR Invalid bitfield type. Use something like i16 u8. "
+                                    "Note that u64 is not supported but i64 is.");
+            goto done;
+        }
+        if (!get_bit_offset(cmd, (int)i + 2, o->bits, reply, &o->offset)) goto done;
+        if (o->offset + (uint64_t)o->bits - 1 > BIT_MAX_OFFSET) {
+            resp_write_error(reply, BIT_OFFSET_ERR);
+            goto done;
+        }
+        if (o->op != BITFIELD_GET) {
+            if (!get_int_arg(cmd, (int)i + 3, reply, &o->arg)) goto done;
+            writes = 1;
+        }
+        o->overflow = overflow;
+        i += o->op == BITFIELD_GET ? 3 : 4;
+        nops++;
+    }
+
+    const char *key = get_arg(cmd, 1);
+    dbobj_t *obj;
+    char tmp[32];
+    const uint8_t *p = NULL;
+    size_t len = 0;
+    if (writes) {
+        int wrongtype;
+        obj = db_get_or_create_string(db, key, &wrongtype);
+        if (wrongtype) {
+            resp_write_error(reply, WRONGTYPE_ERR);
+            goto done;
+        }
+    } else {
+        propagate_nothing();
+        obj = db_get(db, key);
+        if (obj && !string_view(obj, tmp, sizeof(tmp), &p, &len)) {
+            resp_write_error(reply, WRONGTYPE_ERR);
+            goto done;
+        }
+    }
+
+    resp_write_array_header(reply, nops);
+    for (size_t i = 0; i < nops; i++) {
+        bitfield_op_t *o = &ops[i];
+        if (writes) {
+            p = (const uint8_t *)obj->data.str.buf;
+            len = obj->data.str.len;
+        }
+        uint64_t raw = bitops_get_field(p, len, o->offset, o->bits);
+        int64_t old = o->is_signed ? bitops_sign_extend(raw, o->bits) : (int64_t)raw;
+        if (o->op == BITFIELD_GET) {
+            resp_write_integer(reply, old);
+            continue;
+        }
+        /* SET is an add to zero so both share the overflow rules */
+        int64_t val;
+        int over = bitops_field_add(o->is_signed, o->bits, o->op == BITFIELD_SET ? 0 : old,
+                                    o->arg, o->overflow, &val);
+        if (over && o->overflow == BITFIELD_FAIL) {
+            resp_write_nil(reply);
+            continue;
+        }
+        obj_string_grow(obj, (size_t)((o->offset + (uint64_t)o->bits - 1) >> 3) + 1);
+        bitops_set_field((uint8_t *)obj->data.str.buf, o->offset, o->bits, (uint64_t)val);
+        resp_write_integer(reply, o->op == BITFIELD_SET ? old : val);
+    }
+
+done:
+    imdb_free(ops);
+}
+
+/* ---- HyperLogLog commands ---- */
+
+#define HLL_INVALID_ERR "WRONGTYPE Key is not a valid HyperLogLog string value."
+
+/* Estimator stored at key, or NULL if the key is missing. Writes the error
+ * reply and sets *err if the key holds anything other than an estimator. */
+static dbobj_t *lookup_hll(database_t *db, const char *key, resp_buf_t *reply, int *err) {
+    *err = 0;
+    dbobj_t *obj = db_get(db, key);
+    if (!obj) return NULL;
+    if (obj->type != OBJ_STRING && obj->type != OBJ_INT) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        *err = 1;
+        return NULL;
+    }
+    if (obj->type == OBJ_INT || !hll_validate(obj->data.str.buf, obj->data.str.len)) {
+        resp_write_error(reply, HLL_INVALID_ERR);
+        *err = 1;
+        return NULL;
+    }
+    return obj;
+}
+
+static void cmd_pfadd(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 2) {
+        wrong_args(reply, "PFADD");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    int err, changed = 0;
+    dbobj_t *obj = lookup_hll(db, key, reply, &err);
+    if (err) return;
+    if (!obj) {
+        size_t len;
+        char *buf = hll_create(&len);
+        db_set(db, key, buf, len);
+        imdb_free(buf);
+        obj = db_get(db, key);
+        changed = 1;
+    }
+    for (size_t i = 2; i < argc; i++) {
+        changed |= hll_add(&obj->data.str.buf, &obj->data.str.len,
+                           get_arg(cmd, (int)i), get_arg_len(cmd, (int)i));
+    }
+    if (!changed) propagate_nothing();
+    resp_write_integer(reply, changed);
+}
+
+static void cmd_pfcount(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 2) {
+        wrong_args(reply, "PFCOUNT");
+        return;
+    }
+    int err;
+    if (argc == 2) {
+        dbobj_t *obj = lookup_hll(db, get_arg(cmd, 1), reply, &err);
+        if (err) return;
+        resp_write_integer(reply, obj ? (int64_t)hll_count(obj->data.str.buf, obj->data.str.len) : 0);
+        return;
+    }
+    /* Several keys: estimate the union without storing it */
+    uint8_t regs[HLL_REGISTERS] = {0};
+    for (size_t i = 1; i < argc; i++) {
+        dbobj_t *obj = lookup_hll(db, get_arg(cmd, (int)i), reply, &err);
+        if (err) return;
+        if (obj) hll_merge_raw(regs, obj->data.str.buf, obj->data.str.len);
+    }
+    resp_write_integer(reply, (int64_t)hll_count_raw(regs));
+}
+
+static void cmd_pfmerge(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 2) {
+        wrong_args(reply, "PFMERGE");
+        return;
+    }
+    const char *dest = get_arg(cmd, 1);
+    uint8_t regs[HLL_REGISTERS] = {0};
+    int err;
+    /* The destination's own registers take part in the merge */
+    for (size_t i = 1; i < argc; i++) {
+        dbobj_t *obj = lookup_hll(db, get_arg(cmd, (int)i), reply, &err);
+        if (err) return;
+        if (obj) hll_merge_raw(regs, obj->data.str.buf, obj->data.str.len);
+    }
+    size_t len;
+    char *buf = hll_from_raw(regs, &len);
+    dbobj_t *obj = db_get(db, dest);
+    if (obj) {
+        /* Replace in place so the key keeps its TTL */
+        imdb_free(obj->data.str.buf);
+        obj->data.str.buf = buf;
+        obj->data.str.len = len;
+    } else {
+        db_set(db, dest, buf, len);
+        imdb_free(buf);
+    }
+    resp_write_simple_string(reply, "OK");
+}
+
+/* ---- Stream commands ---- */
+
+#define STREAM_ID_ERR "ERR Invalid stream ID specified as stream command argument"
+
+static const stream_id_t STREAM_ID_MIN = {0, 0};
+static const stream_id_t STREAM_ID_MAX = {UINT64_MAX, UINT64_MAX};
+
+static void write_stream_id(resp_buf_t *reply, stream_id_t id) {
+    char buf[48];
+    int n = stream_format_id(id, buf);
+    resp_write_bulk_string(reply, buf, (size_t)n);
+}
+
+/* Entry as [id, [field, value, ...]] */
+static int write_stream_entry(void *ctx, stream_entry_t *e) {
+    resp_buf_t *reply = ctx;
+    const char *field, *value;
+    size_t flen, vlen;
+    resp_write_array_header(reply, 2);
+    write_stream_id(reply, e->id);
+    resp_write_array_header(reply, e->nfields * 2);
+    while (stream_entry_field(e, &field, &flen, &value, &vlen)) {
+        resp_write_bulk_string(reply, field, flen);
+        resp_write_bulk_string(reply, value, vlen);
+    }
+    return 1;
+}
+
+static int stream_id_incr(stream_id_t *id) {
+    if (id->seq != UINT64_MAX) id->seq++;
+    else if (id->ms != UINT64_MAX) id->ms++, id->seq = 0;
+    else return 0;
+    return 1;
+}
+
+static int stream_id_decr(stream_id_t *id) {
+    if (id->seq != 0) id->seq--;
+    else if (id->ms != 0) id->ms--, id->seq = UINT64_MAX;
+    else return 0;
+    return 1;
+}
+
+/* MAXLEN|MINID [=|~] threshold */
+typedef struct {
+    int kind;       /* 0 none, 1 MAXLEN, 2 MINID */
+    int approx;
+    size_t maxlen;
+    stream_id_t minid;
+} stream_trim_t;
+
+/* Parse a trimming clause starting at *i and advance past it; 0 with an error written */
+static int parse_stream_trim(resp_value_t *cmd, size_t *i, resp_buf_t *reply, stream_trim_t *trim) {
+    size_t argc = arg_count(cmd), j = *i + 1;
+    trim->kind = imdb_strcasecmp(get_arg(cmd, (int)*i), "MAXLEN") == 0 ? 1 : 2;
+    trim->approx = 0;
+    if (j < argc && (strcmp(get_arg(cmd, (int)j), "~") == 0 || strcmp(get_arg(cmd, (int)j), "=") == 0)) {
+        trim->approx = get_arg(cmd, (int)j)[0] == '~';
+        j++;
+    }
+    if (j >= argc) {
+        resp_write_error(reply, "ERR syntax error");
+        return 0;
+    }
+    if (trim->kind == 1) {
+        int64_t maxlen;
+        if (!get_int_arg(cmd, (int)j, reply, &maxlen)) return 0;
+        if (maxlen < 0) {
+            resp_write_error(reply, "ERR The MAXLEN argument must be >= 0.");
+            return 0;
+        }
+        trim->maxlen = (size_t)maxlen;
+    } else if (!stream_parse_id(get_arg(cmd, (int)j), 0, &trim->minid)) {
+        resp_write_error(reply, STREAM_ID_ERR);
+        return 0;
+    }
+    *i = j + 1;
+    return 1;
+}
+
+static size_t apply_stream_trim(stream_t *s, const stream_trim_t *trim) {
+    if (trim->kind == 1) return stream_trim_maxlen(s, trim->maxlen, trim->approx);
+    if (trim->kind == 2) return stream_trim_minid(s, trim->minid, trim->approx);
+    return 0;
+}
+
+static int is_trim_option(const char *s) {
+    return imdb_strcasecmp(s, "MAXLEN") == 0 || imdb_strcasecmp(s, "MINID") == 0;
+}
+
+/* XADD key [NOMKSTREAM] [MAXLEN|MINID [=|~] threshold] *|ms-*|id field value [field value ...] */
+static void cmd_xadd(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd), i = 2;
+    stream_trim_t trim = {0};
+    int nomkstream = 0;
+    while (i < argc) {
+        const char *opt = get_arg(cmd, (int)i);
+        if (imdb_strcasecmp(opt, "NOMKSTREAM") == 0) {
+            nomkstream = 1;
+            i++;
+        } else if (is_trim_option(opt)) {
+            if (!parse_stream_trim(cmd, &i, reply, &trim)) return;
+        } else {
+            break;
+        }
+    }
+    if (argc < i + 3 || (argc - i - 1) % 2 != 0) {
+        wrong_args(reply, "XADD");
+        return;
+    }
+
+    const char *key = get_arg(cmd, 1);
+    int wrongtype;
+    stream_t *s = db_get_stream(db, key, &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+
+    /* Resolve the ID against the current top item before touching the keyspace */
+    stream_id_t last = s ? s->last_id : STREAM_ID_MIN, id;
+    const char *arg = get_arg(cmd, (int)i);
+    size_t alen = get_arg_len(cmd, (int)i);
+    if (strcmp(arg, "*") == 0) {
+        uint64_t now = (uint64_t)imdb_mstime();
+        id = last;
+        if (now > last.ms) {
+            id.ms = now;
+            id.seq = 0;
+        } else if (!stream_id_incr(&id)) {
+            resp_write_error(reply, "ERR The stream has exhausted the last possible ID, unable to add more items");
+            return;
+        }
+    } else if (alen > 2 && alen < 24 && strcmp(arg + alen - 2, "-*") == 0) {
+        char ms[24];
+        memcpy(ms, arg, alen - 2);
+        ms[alen - 2] = '\0';
+        if (!stream_parse_id(ms, 0, &id) || strchr(ms, '-')) {
+            resp_write_error(reply, STREAM_ID_ERR);
+            return;
+        }
+        if (id.ms < last.ms || (id.ms == last.ms && last.seq == UINT64_MAX)) {
+            resp_write_error(reply, "ERR The ID specified in XADD is equal or smaller than the target stream top item");
+            return;
+        }
+        id.seq = id.ms == last.ms ? last.seq + 1 : 0;
+    } else {
+        if (!stream_parse_id(arg, 0, &id)) {
+            resp_write_error(reply, STREAM_ID_ERR);
+            return;
+        }
+        if (stream_id_cmp(id, STREAM_ID_MIN) == 0) {
+            resp_write_error(reply, "ERR The ID specified in XADD must be greater than 0-0");
+            return;
+        }
+        if (stream_id_cmp(id, last) <= 0) {
+            resp_write_error(reply, "ERR The ID specified in XADD is equal or smaller than the target stream top item");
+            return;
+        }
+    }
+
+    if (!s) {
+        if (nomkstream) {
+            propagate_nothing();
+            resp_write_nil(reply);
+            return;
+        }
+        s = db_get_or_create_stream(db, key, &wrongtype);
+    }
+    size_t n = argc - i - 1;
+    const char **argv = imdb_malloc(n * sizeof(char *));
+    size_t *lens = imdb_malloc(n * sizeof(size_t));
+    for (size_t k = 0; k < n; k++) {
+        argv[k] = get_arg(cmd, (int)(i + 1 + k));
+        lens[k] = get_arg_len(cmd, (int)(i + 1 + k));
+    }
+    stream_append(s, id, argv, lens, n / 2);
+    imdb_free(argv);
+    imdb_free(lens);
+    apply_stream_trim(s, &trim);
+    db_signal_ready(db, key);
+    write_stream_id(reply, id);
+
+    /* A generated ID is logged as the one it resolved to */
+    if (strchr(arg, '*')) {
+        char buf[48];
+        int idlen = stream_format_id(id, buf);
+        propagate_replacing(cmd, i, buf, (size_t)idlen);
+    }
+}
+
+static void cmd_xlen(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "XLEN");
+        return;
+    }
+    int wrongtype;
+    stream_t *s = db_get_stream(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) resp_write_error(reply, WRONGTYPE_ERR);
+    else resp_write_integer(reply, s ? (int64_t)stream_length(s) : 0);
+}
+
+/* Range bound: "-", "+", an ID, or a bare ms (seq 0 as a start, the last seq
+ * as an end); a "(" prefix excludes the ID itself */
+static int parse_range_bound(const char *arg, int is_end, stream_id_t *out, resp_buf_t *reply) {
+    if (strcmp(arg, "-") == 0) {
+        *out = STREAM_ID_MIN;
+        return 1;
+    }
+    if (strcmp(arg, "+") == 0) {
+        *out = STREAM_ID_MAX;
+        return 1;
+    }
+    int exclusive = arg[0] == '(';
+    if (!stream_parse_id(arg + exclusive, is_end ? UINT64_MAX : 0, out)) {
+        resp_write_error(reply, STREAM_ID_ERR);
+        return 0;
+    }
+    if (exclusive && !(is_end ? stream_id_decr(out) : stream_id_incr(out))) {
+        resp_write_error(reply, is_end ? "ERR invalid end ID for the interval"
+                                       : "ERR invalid start ID for the interval");
+        return 0;
+    }
+    return 1;
+}
+
+/* XRANGE key start end [COUNT n] / XREVRANGE key end start [COUNT n] */
+static void stream_range_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply,
+                                 int rev, const char *name) {
+    size_t argc = arg_count(cmd);
+    if (argc != 4 && argc != 6) {
+        wrong_args(reply, name);
+        return;
+    }
+    stream_id_t start, end;
+    if (!parse_range_bound(get_arg(cmd, rev ? 3 : 2), 0, &start, reply) ||
+        !parse_range_bound(get_arg(cmd, rev ? 2 : 3), 1, &end, reply)) return;
+    int64_t count = 0;
+    if (argc == 6) {
+        if (imdb_strcasecmp(get_arg(cmd, 4), "COUNT") != 0) {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+        if (!get_int_arg(cmd, 5, reply, &count)) return;
+        if (count <= 0) {
+            resp_write_array_header(reply, 0);
+            return;
+        }
+    }
+    int wrongtype;
+    stream_t *s = db_get_stream(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    if (!s) {
+        resp_write_array_header(reply, 0);
+        return;
+    }
+    resp_buf_t items;
+    resp_buf_init(&items);
+    size_t n = stream_range(s, start, end, (size_t)count, rev, write_stream_entry, &items);
+    resp_write_array_header(reply, n);
+    resp_write_raw(reply, items.buf, items.len);
+    resp_buf_free(&items);
+}
+
+static void cmd_xrange(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    stream_range_generic(db, cmd, reply, 0, "XRANGE");
+}
+
+static void cmd_xrevrange(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    stream_range_generic(db, cmd, reply, 1, "XREVRANGE");
+}
+
+/* XTRIM key MAXLEN|MINID [=|~] threshold */
+static void cmd_xtrim(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd), i = 2;
+    if (argc < 4) {
+        wrong_args(reply, "XTRIM");
+        return;
+    }
+    stream_trim_t trim;
+    if (!is_trim_option(get_arg(cmd, 2))) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    if (!parse_stream_trim(cmd, &i, reply, &trim)) return;
+    if (i != argc) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    int wrongtype;
+    stream_t *s = db_get_stream(db, get_arg(cmd, 1), &wrongtype);
+    if (wrongtype) {
+        resp_write_error(reply, WRONGTYPE_ERR);
+        return;
+    }
+    size_t trimmed = s ? apply_stream_trim(s, &trim) : 0;
+    if (!trimmed) propagate_nothing();
+    resp_write_integer(reply, (int64_t)trimmed);
+}
+
+/* Replace a command argument (used to pin "$" before a command is parked) */
+static void set_arg(resp_value_t *cmd, int index, const char *value, size_t len) {
+    resp_value_t *item = cmd->data.array.items[index];
+    imdb_free(item->data.str);
+    item->data.str = imdb_memdup(value, len);
+    item->len = len;
+}
+
+/* XREAD [COUNT n] [BLOCK ms] STREAMS key [key ...] id [id ...] */
+static void cmd_xread(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    size_t argc = arg_count(cmd), i = 1;
+    int64_t count = 0, block = -1;
+    int streams = 0;
+    while (i < argc && !streams) {
+        const char *opt = get_arg(cmd, (int)i);
+        if (imdb_strcasecmp(opt, "COUNT") == 0 && i + 1 < argc) {
+            if (!get_int_arg(cmd, (int)i + 1, reply, &count)) return;
+            if (count < 0) count = 0;
+            i += 2;
+        } else if (imdb_strcasecmp(opt, "BLOCK") == 0 && i + 1 < argc) {
+            if (!get_int_arg(cmd, (int)i + 1, reply, &block)) return;
+            if (block < 0) {
+                resp_write_error(reply, "ERR timeout is negative");
+                return;
+            }
+            i += 2;
+        } else if (imdb_strcasecmp(opt, "STREAMS") == 0) {
+            streams = 1;
+            i++;
+        } else {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+    }
+    if (!streams) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    if (i == argc || (argc - i) % 2 != 0) {
+        resp_write_error(reply, "ERR Unbalanced 'xread' list of streams: for each stream key an ID or '$' must be specified.");
+        return;
+    }
+
+    size_t n = (argc - i) / 2;
+    stream_t **sources = imdb_malloc(n * sizeof(stream_t *));
+    stream_id_t *after = imdb_malloc(n * sizeof(stream_id_t));
+    for (size_t k = 0; k < n; k++) {
+        int wrongtype;
+        sources[k] = db_get_stream(db, get_arg(cmd, (int)(i + k)), &wrongtype);
+        if (wrongtype) {
+            resp_write_error(reply, WRONGTYPE_ERR);
+            goto done;
+        }
+        const char *arg = get_arg(cmd, (int)(i + n + k));
+        if (strcmp(arg, "$") == 0) {
+            after[k] = sources[k] ? sources[k]->last_id : STREAM_ID_MIN;
+        } else if (!stream_parse_id(arg, 0, &after[k])) {
+            resp_write_error(reply, STREAM_ID_ERR);
+            goto done;
+        }
+    }
+
+    resp_buf_t items;
+    resp_buf_init(&items);
+    size_t found = 0;
+    for (size_t k = 0; k < n; k++) {
+        stream_id_t start = after[k];
+        if (!sources[k] || stream_id_cmp(start, sources[k]->last_id) >= 0 || !stream_id_incr(&start)) continue;
+        resp_buf_t entries;
+        resp_buf_init(&entries);
+        size_t got = stream_range(sources[k], start, STREAM_ID_MAX, (size_t)count, 0, write_stream_entry, &entries);
+        if (got > 0) {
+            const char *key = get_arg(cmd, (int)(i + k));
+            resp_write_array_header(&items, 2);
+            resp_write_bulk_string(&items, key, get_arg_len(cmd, (int)(i + k)));
+            resp_write_array_header(&items, got);
+            resp_write_raw(&items, entries.buf, entries.len);
+            found++;
+        }
+        resp_buf_free(&entries);
+    }
+
+    if (found > 0) {
+        resp_write_array_header(reply, found);
+        resp_write_raw(reply, items.buf, items.len);
+    } else if (block >= 0 && srv && srv->current_client) {
+        /* "$" means entries added from now on, so pin it to the current top item */
+        const char **keys = imdb_malloc(n * sizeof(char *));
+        for (size_t k = 0; k < n; k++) {
+            keys[k] = get_arg(cmd, (int)(i + k));
+            if (strcmp(get_arg(cmd, (int)(i + n + k)), "$") == 0) {
+                char buf[48];
+                int len = stream_format_id(after[k], buf);
+                set_arg(cmd, (int)(i + n + k), buf, (size_t)len);
+            }
+        }
+        server_block_client(srv, keys, n, block > 0 ? imdb_mstime() + block : 0, BLOCK_REPLY_NULL_ARRAY);
+        imdb_free(keys);
+    } else {
+        resp_write_null_array(reply);
+    }
+    resp_buf_free(&items);
+
+done:
+    imdb_free(sources);
+    imdb_free(after);
+}
+
+/* ---- Count-min sketch and Top-K commands ---- */
+
+/* Existing sketch at key; writes the error reply and returns NULL otherwise */
+static cms_t *lookup_cms(database_t *db, const char *key, resp_buf_t *reply) {
+    int wrongtype;
+    cms_t *cms = db_get_cms(db, key, &wrongtype);
+    if (wrongtype) resp_write_error(reply, WRONGTYPE_ERR);
+    else if (!cms) resp_write_error(reply, "ERR key does not exist");
+    return cms;
+}
+
+static topk_t *lookup_topk(database_t *db, const char *key, resp_buf_t *reply) {
+    int wrongtype;
+    topk_t *tk = db_get_topk(db, key, &wrongtype);
+    if (wrongtype) resp_write_error(reply, WRONGTYPE_ERR);
+    else if (!tk) resp_write_error(reply, "ERR key does not exist");
+    return tk;
+}
+
+/* Parse a count in [min, max]; writes `err` and returns 0 on failure */
+static int get_u32_arg(resp_value_t *cmd, int index, uint32_t min, uint32_t max,
+                       const char *err, resp_buf_t *reply, uint32_t *out) {
+    int64_t v;
+    if (!obj_try_parse_int(get_arg(cmd, index), &v) || v < (int64_t)min || v > (int64_t)max) {
+        resp_write_error(reply, err);
+        return 0;
+    }
+    *out = (uint32_t)v;
+    return 1;
+}
+
+/* Parse a probability strictly between 0 and 1 (or up to 1 with `closed`) */
+static int get_ratio_arg(resp_value_t *cmd, int index, int closed, const char *err,
+                         resp_buf_t *reply, double *out) {
+    const char *s = get_arg(cmd, index);
+    char *end;
+    double v = s ? strtod(s, &end) : 0;
+    if (!s || *s == '\0' || *end != '\0' || !(v > 0) || v > 1 || (v == 1 && !closed)) {
+        resp_write_error(reply, err);
+        return 0;
+    }
+    *out = v;
+    return 1;
+}
+
+/* Validate sketch dimensions; writes the error reply and returns 0 if they are out of range */
+static int check_sketch_dims(uint32_t width, uint32_t depth, resp_buf_t *reply) {
+    if (depth > SKETCH_MAX_DEPTH) {
+        resp_write_error(reply, "ERR depth must be at most 64");
+        return 0;
+    }
+    if ((uint64_t)width * depth > SKETCH_MAX_CELLS) {
+        resp_write_error(reply, "ERR sketch too large (width * depth must be at most 268435456)");
+        return 0;
+    }
+    return 1;
+}
+
+static int reserve_check(database_t *db, const char *key, resp_buf_t *reply) {
+    if (db_exists(db, key)) {
+        resp_write_error(reply, "ERR key already exists");
+        return 0;
+    }
+    return 1;
+}
+
+/* CMS.INITBYDIM key width depth */
+static void cmd_cms_initbydim(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "CMS.INITBYDIM");
+        return;
+    }
+    uint32_t width, depth;
+    if (!get_u32_arg(cmd, 2, 1, UINT32_MAX, "ERR invalid width", reply, &width) ||
+        !get_u32_arg(cmd, 3, 1, UINT32_MAX, "ERR invalid depth", reply, &depth) ||
+        !check_sketch_dims(width, depth, reply) || !reserve_check(db, get_arg(cmd, 1), reply)) return;
+    db_store_cms(db, get_arg(cmd, 1), cms_create(width, depth));
+    resp_write_simple_string(reply, "OK");
+}
+
+/* CMS.INITBYPROB key error probability: overestimates stay within error * total
+ * with the given probability of failure */
+static void cmd_cms_initbyprob(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "CMS.INITBYPROB");
+        return;
+    }
+    double error, prob;
+    if (!get_ratio_arg(cmd, 2, 0, "ERR invalid overestimation value", reply, &error) ||
+        !get_ratio_arg(cmd, 3, 0, "ERR invalid prob value", reply, &prob)) return;
+    double w = ceil(2.0 / error), d = ceil(log(prob) / log(0.5));
+    if (d < 1) d = 1;
+    if (w > UINT32_MAX || d > SKETCH_MAX_DEPTH) {
+        resp_write_error(reply, "ERR sketch too large (width * depth must be at most 268435456)");
+        return;
+    }
+    uint32_t width = (uint32_t)w, depth = (uint32_t)d;
+    if (!check_sketch_dims(width, depth, reply) || !reserve_check(db, get_arg(cmd, 1), reply)) return;
+    db_store_cms(db, get_arg(cmd, 1), cms_create(width, depth));
+    resp_write_simple_string(reply, "OK");
+}
+
+/* CMS.INCRBY key item increment [item increment ...] */
+static void cmd_cms_incrby(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 4 || (argc - 2) % 2 != 0) {
+        wrong_args(reply, "CMS.INCRBY");
+        return;
+    }
+    size_t n = (argc - 2) / 2;
+    cms_t *cms = lookup_cms(db, get_arg(cmd, 1), reply);
+    if (!cms) return;
+    /* Validate every increment before applying any */
+    uint32_t *incr = imdb_malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        if (!get_u32_arg(cmd, (int)(3 + 2 * i), 0, UINT32_MAX, "ERR cannot parse number", reply, &incr[i])) {
+            imdb_free(incr);
+            return;
+        }
+    }
+    resp_write_array_header(reply, n);
+    for (size_t i = 0; i < n; i++) {
+        int idx = (int)(2 + 2 * i);
+        resp_write_integer(reply, cms_incrby(cms, get_arg(cmd, idx), get_arg_len(cmd, idx), incr[i]));
+    }
+    imdb_free(incr);
+}
+
+/* CMS.QUERY key item [item ...] */
+static void cmd_cms_query(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "CMS.QUERY");
+        return;
+    }
+    cms_t *cms = lookup_cms(db, get_arg(cmd, 1), reply);
+    if (!cms) return;
+    resp_write_array_header(reply, argc - 2);
+    for (size_t i = 2; i < argc; i++) {
+        resp_write_integer(reply, cms_query(cms, get_arg(cmd, (int)i), get_arg_len(cmd, (int)i)));
+    }
+}
+
+/* CMS.MERGE dest numkeys src [src ...] [WEIGHTS weight [weight ...]] */
+static void cmd_cms_merge(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 4) {
+        wrong_args(reply, "CMS.MERGE");
+        return;
+    }
+    int64_t numkeys;
+    if (!get_int_arg(cmd, 2, reply, &numkeys)) return;
+    if (numkeys < 1 || (size_t)numkeys > argc - 3) {
+        resp_write_error(reply, "ERR invalid numkeys");
+        return;
+    }
+    size_t n = (size_t)numkeys, wpos = 3 + n;
+    if (wpos != argc && (imdb_strcasecmp(get_arg(cmd, (int)wpos), "WEIGHTS") != 0 || argc - wpos - 1 != n)) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    cms_t *dst = lookup_cms(db, get_arg(cmd, 1), reply);
+    if (!dst) return;
+
+    const cms_t **srcs = imdb_malloc(n * sizeof(cms_t *));
+    uint32_t *weights = imdb_malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        if (!(srcs[i] = lookup_cms(db, get_arg(cmd, (int)(3 + i)), reply))) goto done;
+        if (srcs[i]->width != dst->width || srcs[i]->depth != dst->depth) {
+            resp_write_error(reply, "ERR width/depth is not equal");
+            goto done;
+        }
+        weights[i] = 1;
+        if (wpos != argc &&
+            !get_u32_arg(cmd, (int)(wpos + 1 + i), 0, UINT32_MAX, "ERR cannot parse weight", reply, &weights[i])) goto done;
+    }
+    /* Merge into a scratch sketch so dest may also be a source */
+    cms_t *tmp = cms_create(dst->width, dst->depth);
+    for (size_t i = 0; i < n; i++) cms_merge(tmp, srcs[i], weights[i]);
+    memcpy(dst->counters, tmp->counters, cms_counters_bytes(dst));
+    dst->count = tmp->count;
+    cms_destroy(tmp);
+    resp_write_simple_string(reply, "OK");
+
+done:
+    imdb_free(srcs);
+    imdb_free(weights);
+}
+
+/* CMS.INFO key */
+static void cmd_cms_info(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "CMS.INFO");
+        return;
+    }
+    cms_t *cms = lookup_cms(db, get_arg(cmd, 1), reply);
+    if (!cms) return;
+    resp_write_array_header(reply, 6);
+    resp_write_bulk_string(reply, "width", 5);
+    resp_write_integer(reply, cms->width);
+    resp_write_bulk_string(reply, "depth", 5);
+    resp_write_integer(reply, cms->depth);
+    resp_write_bulk_string(reply, "count", 5);
+    resp_write_integer(reply, (int64_t)cms->count);
+}
+
+/* TOPK.RESERVE key k [width depth decay] */
+static void cmd_topk_reserve(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc != 3 && argc != 6) {
+        wrong_args(reply, "TOPK.RESERVE");
+        return;
+    }
+    uint32_t k, width = 8, depth = 7;
+    double decay = 0.9;
+    if (!get_u32_arg(cmd, 2, 1, TOPK_MAX_K, "ERR k must be an integer between 1 and 100000", reply, &k)) return;
+    if (argc == 6) {
+        if (!get_u32_arg(cmd, 3, 1, UINT32_MAX, "ERR invalid width", reply, &width) ||
+            !get_u32_arg(cmd, 4, 1, UINT32_MAX, "ERR invalid depth", reply, &depth) ||
+            !get_ratio_arg(cmd, 5, 1, "ERR decay must be a number in (0, 1]", reply, &decay) ||
+            !check_sketch_dims(width, depth, reply)) return;
+    }
+    if (!reserve_check(db, get_arg(cmd, 1), reply)) return;
+    db_store_topk(db, get_arg(cmd, 1), topk_create(k, width, depth, decay));
+    resp_write_simple_string(reply, "OK");
+}
+
+/* Shared by TOPK.ADD (every increment 1) and TOPK.INCRBY (item/increment pairs) */
+static void topk_add_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply, int with_incr) {
+    size_t argc = arg_count(cmd), step = with_incr ? 2 : 1;
+    if (argc < 3 || (argc - 2) % step != 0) {
+        wrong_args(reply, with_incr ? "TOPK.INCRBY" : "TOPK.ADD");
+        return;
+    }
+    size_t n = (argc - 2) / step;
+    topk_t *tk = lookup_topk(db, get_arg(cmd, 1), reply);
+    if (!tk) return;
+    uint32_t *incr = imdb_malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        incr[i] = 1;
+        if (with_incr && !get_u32_arg(cmd, (int)(3 + 2 * i), 1, 100000,
+                                      "ERR increment must be an integer between 1 and 100000", reply, &incr[i])) {
+            imdb_free(incr);
+            return;
+        }
+    }
+    resp_write_array_header(reply, n);
+    for (size_t i = 0; i < n; i++) {
+        int idx = (int)(2 + step * i);
+        size_t elen;
+        char *expelled = topk_add(tk, get_arg(cmd, idx), get_arg_len(cmd, idx), incr[i], &elen);
+        if (expelled) {
+            resp_write_bulk_string(reply, expelled, elen);
+            imdb_free(expelled);
+        } else {
+            resp_write_nil(reply);
+        }
+    }
+    imdb_free(incr);
+}
+
+/* TOPK.ADD key item [item ...] */
+static void cmd_topk_add(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    topk_add_generic(db, cmd, reply, 0);
+}
+
+/* TOPK.INCRBY key item increment [item increment ...] */
+static void cmd_topk_incrby(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    topk_add_generic(db, cmd, reply, 1);
+}
+
+/* TOPK.QUERY key item [item ...] */
+static void cmd_topk_query(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "TOPK.QUERY");
+        return;
+    }
+    topk_t *tk = lookup_topk(db, get_arg(cmd, 1), reply);
+    if (!tk) return;
+    resp_write_array_header(reply, argc - 2);
+    for (size_t i = 2; i < argc; i++) {
+        resp_write_integer(reply, topk_query(tk, get_arg(cmd, (int)i), get_arg_len(cmd, (int)i)));
+    }
+}
+
+/* TOPK.COUNT key item [item ...] */
+static void cmd_topk_count(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "TOPK.COUNT");
+        return;
+    }
+    topk_t *tk = lookup_topk(db, get_arg(cmd, 1), reply);
+    if (!tk) return;
+    resp_write_array_header(reply, argc - 2);
+    for (size_t i = 2; i < argc; i++) {
+        resp_write_integer(reply, topk_count(tk, get_arg(cmd, (int)i), get_arg_len(cmd, (int)i)));
+    }
+}
+
+/* TOPK.LIST key [WITHCOUNT] */
+static void cmd_topk_list(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc != 2 && argc != 3) {
+        wrong_args(reply, "TOPK.LIST");
+        return;
+    }
+    int withcount = argc == 3;
+    if (withcount && imdb_strcasecmp(get_arg(cmd, 2), "WITHCOUNT") != 0) {
+        resp_write_error(reply, "ERR syntax error");
+        return;
+    }
+    topk_t *tk = lookup_topk(db, get_arg(cmd, 1), reply);
+    if (!tk) return;
+    const topk_entry_t **list = imdb_malloc((tk->heap_len ? tk->heap_len : 1) * sizeof(*list));
+    size_t n = topk_list(tk, list);
+    resp_write_array_header(reply, withcount ? n * 2 : n);
+    for (size_t i = 0; i < n; i++) {
+        resp_write_bulk_string(reply, list[i]->item, list[i]->len);
+        if (withcount) resp_write_integer(reply, list[i]->count);
+    }
+    imdb_free(list);
+}
+
+/* TOPK.INFO key */
+static void cmd_topk_info(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "TOPK.INFO");
+        return;
+    }
+    topk_t *tk = lookup_topk(db, get_arg(cmd, 1), reply);
+    if (!tk) return;
+    resp_write_array_header(reply, 8);
+    resp_write_bulk_string(reply, "k", 1);
+    resp_write_integer(reply, tk->k);
+    resp_write_bulk_string(reply, "width", 5);
+    resp_write_integer(reply, tk->width);
+    resp_write_bulk_string(reply, "depth", 5);
+    resp_write_integer(reply, tk->depth);
+    resp_write_bulk_string(reply, "decay", 5);
+    write_score(reply, tk->decay);
+}
+
+/* ---- Vector set commands ---- */
+
+#define VSIM_DEFAULT_COUNT 10
+#define VSIM_DEFAULT_EF 100
+#define VSET_MAX_EF 100000
+
+/* Parse `FP32 blob` or `VALUES n v1 .. vn` at *i into a new float array
+ * (caller frees); writes the error reply and returns NULL on failure */
+static float *parse_vector_arg(resp_value_t *cmd, size_t *i, resp_buf_t *reply, uint32_t *dim) {
+    size_t argc = arg_count(cmd);
+    const char *kind = get_arg(cmd, (int)*i);
+    if (imdb_strcasecmp(kind, "FP32") == 0 && *i + 1 < argc) {
+        size_t len = get_arg_len(cmd, (int)*i + 1);
+        if (len == 0 || len % sizeof(float) != 0 || len / sizeof(float) > VSET_MAX_DIM) {
+            resp_write_error(reply, "ERR invalid vector blob");
+            return NULL;
+        }
+        *dim = (uint32_t)(len / sizeof(float));
+        float *vec = imdb_malloc(len);
+        memcpy(vec, get_arg(cmd, (int)*i + 1), len);
+        for (uint32_t k = 0; k < *dim; k++) {
+            if (!isfinite(vec[k])) {
+                imdb_free(vec);
+                resp_write_error(reply, "ERR invalid vector blob");
+                return NULL;
+            }
+        }
+        *i += 2;
+        return vec;
+    }
+    if (imdb_strcasecmp(kind, "VALUES") == 0 && *i + 1 < argc) {
+        int64_t n;
+        if (!get_int_arg(cmd, (int)*i + 1, reply, &n)) return NULL;
+        if (n < 1 || n > VSET_MAX_DIM || (size_t)n > argc - *i - 2) {
+            resp_write_error(reply, "ERR invalid vector dimension");
+            return NULL;
+        }
+        float *vec = imdb_malloc((size_t)n * sizeof(float));
+        for (int64_t k = 0; k < n; k++) {
+            const char *s = get_arg(cmd, (int)(*i + 2 + (size_t)k));
+            char *end;
+            double v = strtod(s, &end);
+            if (*s == '\0' || *end != '\0' || !isfinite((float)v)) {
+                imdb_free(vec);
+                resp_write_error(reply, "ERR invalid vector value");
+                return NULL;
+            }
+            vec[k] = (float)v;
+        }
+        *dim = (uint32_t)n;
+        *i += 2 + (size_t)n;
+        return vec;
+    }
+    resp_write_error(reply, "ERR syntax error");
+    return NULL;
+}
+
+static int get_vset(database_t *db, const char *key, resp_buf_t *reply, vset_t **out) {
+    int wrongtype;
+    *out = db_get_vset(db, key, &wrongtype);
+    if (wrongtype) resp_write_error(reply, WRONGTYPE_ERR);
+    return !wrongtype;
+}
+
+/* VADD key FP32 blob|VALUES n v ... element [NOQUANT|Q8] [METRIC COSINE|L2|IP] [M n] [EF n] [SETATTR json] */
+static void cmd_vadd(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd), i = 2;
+    if (argc < 5) {
+        wrong_args(reply, "VADD");
+        return;
+    }
+    uint32_t dim;
+    float *vec = parse_vector_arg(cmd, &i, reply, &dim);
+    if (!vec) return;
+    if (i >= argc) {
+        imdb_free(vec);
+        wrong_args(reply, "VADD");
+        return;
+    }
+    const char *element = get_arg(cmd, (int)i++);
+    int quant = -1, metric = -1;
+    int64_t m = 0, ef = 0;
+    const char *attr = NULL;
+    size_t attr_len = 0;
+    for (; i < argc; i++) {
+        const char *opt = get_arg(cmd, (int)i);
+        int has_val = i + 1 < argc;
+        if (imdb_strcasecmp(opt, "NOQUANT") == 0) {
+            quant = VSET_FP32;
+        } else if (imdb_strcasecmp(opt, "Q8") == 0) {
+            quant = VSET_Q8;
+        } else if (imdb_strcasecmp(opt, "METRIC") == 0 && has_val) {
+            const char *name = get_arg(cmd, (int)++i);
+            if (imdb_strcasecmp(name, "COSINE") == 0) metric = VSET_COSINE;
+            else if (imdb_strcasecmp(name, "L2") == 0) metric = VSET_L2;
+            else if (imdb_strcasecmp(name, "IP") == 0) metric = VSET_IP;
+            else goto syntax;
+        } else if (imdb_strcasecmp(opt, "M") == 0 && has_val) {
+            if (!get_int_arg(cmd, (int)++i, reply, &m)) goto done;
+            if (m < 2 || m > VSET_MAX_M) {
+                resp_write_error(reply, "ERR M must be between 2 and 128");
+                goto done;
+            }
+        } else if (imdb_strcasecmp(opt, "EF") == 0 && has_val) {
+            if (!get_int_arg(cmd, (int)++i, reply, &ef)) goto done;
+            if (ef < 1 || ef > VSET_MAX_EF) {
+                resp_write_error(reply, "ERR EF must be between 1 and 100000");
+                goto done;
+            }
+        } else if (imdb_strcasecmp(opt, "SETATTR") == 0 && has_val) {
+            attr = get_arg(cmd, (int)++i);
+            attr_len = get_arg_len(cmd, (int)i);
+            if (attr_len > 0 && !vfilter_json_valid(attr, attr_len)) {
+                resp_write_error(reply, "ERR attributes must be a JSON object");
+                goto done;
+            }
+        } else {
+            goto syntax;
+        }
+    }
+
+    const char *key = get_arg(cmd, 1);
+    vset_t *vs;
+    if (!get_vset(db, key, reply, &vs)) goto done;
+    if (!vs) {
+        vs = vset_create(dim, metric < 0 ? VSET_COSINE : (vset_metric_t)metric,
+                         quant < 0 ? VSET_FP32 : (vset_quant_t)quant, m ? (uint32_t)m : VSET_DEFAULT_M,
+                         ef ? (uint32_t)ef : VSET_DEFAULT_EF_CONSTRUCTION);
+        db_store_vset(db, key, vs);
+    } else if (vs->dim != dim) {
+        char err[96];
+        snprintf(err, sizeof(err), "ERR vector dimension mismatch - got %u but set has %u", dim, vs->dim);
+        resp_write_error(reply, err);
+        goto done;
+    } else if ((quant >= 0 && (vset_quant_t)quant != vs->quant) ||
+               (metric >= 0 && (vset_metric_t)metric != vs->metric)) {
+        resp_write_error(reply, "ERR quantization or metric does not match the existing vector set");
+        goto done;
+    }
+    int added = vset_add(vs, element, vec, (uint32_t)ef);
+    if (attr) vset_set_attr(vs, element, attr, attr_len);
+    resp_write_integer(reply, added);
+    goto done;
+
+syntax:
+    resp_write_error(reply, "ERR syntax error");
+done:
+    imdb_free(vec);
+}
+
+/* VREM key element */
+static void cmd_vrem(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "VREM");
+        return;
+    }
+    const char *key = get_arg(cmd, 1);
+    vset_t *vs;
+    if (!get_vset(db, key, reply, &vs)) return;
+    int removed = vs ? vset_remove(vs, get_arg(cmd, 2)) : 0;
+    if (vs && vs->count == 0) db_del(db, key);
+    if (!removed) propagate_nothing();
+    resp_write_integer(reply, removed);
+}
+
+/* VCARD key */
+static void cmd_vcard(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "VCARD");
+        return;
+    }
+    vset_t *vs;
+    if (!get_vset(db, get_arg(cmd, 1), reply, &vs)) return;
+    resp_write_integer(reply, vs ? vs->count : 0);
+}
+
+/* VDIM key */
+static void cmd_vdim(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "VDIM");
+        return;
+    }
+    vset_t *vs;
+    if (!get_vset(db, get_arg(cmd, 1), reply, &vs)) return;
+    if (vs) resp_write_integer(reply, vs->dim);
+    else resp_write_error(reply, "ERR key does not exist");
+}
+
+/* VSETATTR key element json ("" clears the attributes) */
+static void cmd_vsetattr(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 4) {
+        wrong_args(reply, "VSETATTR");
+        return;
+    }
+    const char *attr = get_arg(cmd, 3);
+    size_t len = get_arg_len(cmd, 3);
+    if (len > 0 && !vfilter_json_valid(attr, len)) {
+        resp_write_error(reply, "ERR attributes must be a JSON object");
+        return;
+    }
+    vset_t *vs;
+    if (!get_vset(db, get_arg(cmd, 1), reply, &vs)) return;
+    int set = vs ? vset_set_attr(vs, get_arg(cmd, 2), attr, len) : 0;
+    if (!set) propagate_nothing();
+    resp_write_integer(reply, set);
+}
+
+/* VGETATTR key element */
+static void cmd_vgetattr(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "VGETATTR");
+        return;
+    }
+    vset_t *vs;
+    if (!get_vset(db, get_arg(cmd, 1), reply, &vs)) return;
+    long slot = vs ? vset_find(vs, get_arg(cmd, 2)) : -1;
+    if (slot < 0 || !vs->nodes[slot].attr) resp_write_nil(reply);
+    else resp_write_bulk_string(reply, vs->nodes[slot].attr, vs->nodes[slot].attr_len);
+}
+
+static int vsim_filter(void *ctx, const char *attr, size_t len) {
+    return vfilter_match(ctx, attr, len);
+}
+
+/* VSIM key ELE element|FP32 blob|VALUES n v ... [WITHSCORES] [COUNT k] [EF n]
+ *      [FILTER expr] [FILTER-EF n] [TRUTH] */
+static void cmd_vsim(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd), i = 2;
+    if (argc < 4) {
+        wrong_args(reply, "VSIM");
+        return;
+    }
+    const char *ele = NULL;
+    float *vec = NULL;
+    uint32_t dim = 0;
+    if (imdb_strcasecmp(get_arg(cmd, 2), "ELE") == 0) {
+        ele = get_arg(cmd, 3);
+        i = 4;
+    } else if (!(vec = parse_vector_arg(cmd, &i, reply, &dim))) {
+        return;
+    }
+
+    int withscores = 0;
+    int64_t count = VSIM_DEFAULT_COUNT, ef = VSIM_DEFAULT_EF, filter_ef = -1;
+    vset_query_t q = {0};
+    vfilter_t *filter = NULL;
+    vset_result_t *results = NULL;
+    for (; i < argc; i++) {
+        const char *opt = get_arg(cmd, (int)i);
+        int has_val = i + 1 < argc;
+        if (imdb_strcasecmp(opt, "WITHSCORES") == 0) {
+            withscores = 1;
+        } else if (imdb_strcasecmp(opt, "TRUTH") == 0) {
+            q.exact = 1;
+        } else if (imdb_strcasecmp(opt, "COUNT") == 0 && has_val) {
+            if (!get_int_arg(cmd, (int)++i, reply, &count)) goto done;
+            if (count < 1) {
+                resp_write_error(reply, "ERR COUNT must be positive");
+                goto done;
+            }
+        } else if (imdb_strcasecmp(opt, "EF") == 0 && has_val) {
+            if (!get_int_arg(cmd, (int)++i, reply, &ef)) goto done;
+            if (ef < 1 || ef > VSET_MAX_EF) {
+                resp_write_error(reply, "ERR EF must be between 1 and 100000");
+                goto done;
+            }
+        } else if (imdb_strcasecmp(opt, "FILTER-EF") == 0 && has_val) {
+            if (!get_int_arg(cmd, (int)++i, reply, &filter_ef)) goto done;
+            if (filter_ef < 0) {
+                resp_write_error(reply, "ERR FILTER-EF must be non-negative");
+                goto done;
+            }
+        } else if (imdb_strcasecmp(opt, "FILTER") == 0 && has_val && !filter) {
+            const char *err;
+            if (!(filter = vfilter_compile(get_arg(cmd, (int)++i), &err))) {
+                char msg[96];
+                snprintf(msg, sizeof(msg), "ERR %s", err);
+                resp_write_error(reply, msg);
+                goto done;
+            }
+        } else {
+            resp_write_error(reply, "ERR syntax error");
+            goto done;
+        }
+    }
+
+    vset_t *vs;
+    if (!get_vset(db, get_arg(cmd, 1), reply, &vs)) goto done;
+    if (!vs) {
+        resp_write_array_header(reply, 0);
+        goto done;
+    }
+    long slot = -1;
+    if (ele && (slot = vset_find(vs, ele)) < 0) {
+        resp_write_error(reply, "ERR element not found in set");
+        goto done;
+    }
+    if (!ele && dim != vs->dim) {
+        char err[96];
+        snprintf(err, sizeof(err), "ERR vector dimension mismatch - got %u but set has %u", dim, vs->dim);
+        resp_write_error(reply, err);
+        goto done;
+    }
+
+    q.k = (size_t)count < vs->count ? (size_t)count : vs->count;
+    q.ef = (uint32_t)ef;
+    if (filter) {
+        q.filter = vsim_filter;
+        q.filter_ctx = filter;
+        /* 0 lets a filtered search visit the whole graph */
+        q.filter_ef = filter_ef < 0 ? (size_t)count * 100 : filter_ef == 0 ? SIZE_MAX : (size_t)filter_ef;
+    }
+    results = imdb_malloc((q.k ? q.k : 1) * sizeof(vset_result_t));
+    size_t n = ele ? vset_search_slot(vs, (uint32_t)slot, &q, results) : vset_search(vs, vec, &q, results);
+    resp_write_array_header(reply, withscores ? n * 2 : n);
+    for (size_t k = 0; k < n; k++) {
+        resp_write_bulk_string(reply, results[k].name, strlen(results[k].name));
+        if (withscores) write_score(reply, results[k].score);
+    }
+
+done:
+    imdb_free(results);
+    vfilter_free(filter);
+    imdb_free(vec);
+}
+
+/* ---- Bloom and cuckoo filter commands ---- */
+
+#define BF_DEFAULT_ERROR 0.01
+#define BF_DEFAULT_CAPACITY 100
+#define BF_DEFAULT_EXPANSION 2
+#define CF_DEFAULT_CAPACITY 1024
+#define CF_DEFAULT_BUCKET_SIZE 2
+#define CF_DEFAULT_MAX_ITERATIONS 500
+#define CF_DEFAULT_EXPANSION 1
+
+static int get_bloom(database_t *db, const char *key, resp_buf_t *reply, bloom_t **out) {
+    int wrongtype;
+    *out = db_get_bloom(db, key, &wrongtype);
+    if (wrongtype) resp_write_error(reply, WRONGTYPE_ERR);
+    return !wrongtype;
+}
+
+static int get_cuckoo(database_t *db, const char *key, resp_buf_t *reply, cuckoo_t **out) {
+    int wrongtype;
+    *out = db_get_cuckoo(db, key, &wrongtype);
+    if (wrongtype) resp_write_error(reply, WRONGTYPE_ERR);
+    return !wrongtype;
+}
+
+/* Parse a filter capacity (at least 1) */
+static int get_capacity_arg(resp_value_t *cmd, int index, resp_buf_t *reply, uint64_t *out) {
+    int64_t v;
+    if (!obj_try_parse_int(get_arg(cmd, index), &v) || v < 1) {
+        resp_write_error(reply, "ERR bad capacity");
+        return 0;
+    }
+    *out = (uint64_t)v;
+    return 1;
+}
+
+/* Bloom filter at key, created with the defaults if missing; NULL after an error reply */
+static bloom_t *bloom_for_add(database_t *db, const char *key, resp_buf_t *reply) {
+    bloom_t *bf;
+    if (!get_bloom(db, key, reply, &bf)) return NULL;
+    if (!bf) {
+        bf = bloom_create(BF_DEFAULT_CAPACITY, BF_DEFAULT_ERROR, BF_DEFAULT_EXPANSION);
+        db_store_bloom(db, key, bf);
+    }
+    return bf;
+}
+
+static void write_bloom_add(resp_buf_t *reply, int rc) {
+    if (rc < 0) resp_write_error(reply, "ERR non scaling filter is full");
+    else resp_write_integer(reply, rc);
+}
+
+/* BF.RESERVE key error_rate capacity [EXPANSION n] [NONSCALING] */
+static void cmd_bf_reserve(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 4) {
+        wrong_args(reply, "BF.RESERVE");
+        return;
+    }
+    double error;
+    uint64_t capacity;
+    uint32_t expansion = BF_DEFAULT_EXPANSION;
+    int nonscaling = 0;
+    if (!get_ratio_arg(cmd, 2, 0, "ERR (0 < error rate range < 1)", reply, &error) ||
+        !get_capacity_arg(cmd, 3, reply, &capacity)) return;
+    for (size_t i = 4; i < argc; i++) {
+        const char *opt = get_arg(cmd, (int)i);
+        if (imdb_strcasecmp(opt, "NONSCALING") == 0) {
+            nonscaling = 1;
+        } else if (imdb_strcasecmp(opt, "EXPANSION") == 0 && i + 1 < argc) {
+            if (!get_u32_arg(cmd, (int)++i, 1, 32768, "ERR expansion must be between 1 and 32768",
+                             reply, &expansion)) return;
+        } else {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+    }
+    if (!reserve_check(db, get_arg(cmd, 1), reply)) return;
+    bloom_t *bf = bloom_create(capacity, error, nonscaling ? 0 : expansion);
+    if (!bf) {
+        resp_write_error(reply, "ERR capacity too large for the error rate");
+        return;
+    }
+    db_store_bloom(db, get_arg(cmd, 1), bf);
+    resp_write_simple_string(reply, "OK");
+}
+
+/* BF.ADD key item */
+static void cmd_bf_add(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "BF.ADD");
+        return;
+    }
+    bloom_t *bf = bloom_for_add(db, get_arg(cmd, 1), reply);
+    if (bf) write_bloom_add(reply, bloom_add(bf, get_arg(cmd, 2), get_arg_len(cmd, 2)));
+}
+
+/* BF.MADD key item [item ...] */
+static void cmd_bf_madd(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3) {
+        wrong_args(reply, "BF.MADD");
+        return;
+    }
+    bloom_t *bf = bloom_for_add(db, get_arg(cmd, 1), reply);
+    if (!bf) return;
+    resp_write_array_header(reply, argc - 2);
+    for (size_t i = 2; i < argc; i++) {
+        write_bloom_add(reply, bloom_add(bf, get_arg(cmd, (int)i), get_arg_len(cmd, (int)i)));
+    }
+}
+
+/* Items from argument `first` on, for the batched lookups */
+static void collect_items(resp_value_t *cmd, size_t first, const char ***items, size_t **lens) {
+    size_t n = arg_count(cmd) - first;
+    *items = imdb_malloc(n * sizeof(char *));
+    *lens = imdb_malloc(n * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        (*items)[i] = get_arg(cmd, (int)(first + i));
+        (*lens)[i] = get_arg_len(cmd, (int)(first + i));
+    }
+}
+
+/* BF.EXISTS / BF.MEXISTS / CF.EXISTS / CF.MEXISTS: a missing key contains nothing */
+static void filter_exists_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply, int cuckoo, int multi) {
+    size_t argc = arg_count(cmd);
+    const char *name = cuckoo ? (multi ? "CF.MEXISTS" : "CF.EXISTS") : (multi ? "BF.MEXISTS" : "BF.EXISTS");
+    if (multi ? argc < 3 : argc != 3) {
+        wrong_args(reply, name);
+        return;
+    }
+    bloom_t *bf = NULL;
+    cuckoo_t *cf = NULL;
+    if (cuckoo ? !get_cuckoo(db, get_arg(cmd, 1), reply, &cf) : !get_bloom(db, get_arg(cmd, 1), reply, &bf)) return;
+    if (!multi) {
+        const char *item = get_arg(cmd, 2);
+        size_t len = get_arg_len(cmd, 2);
+        resp_write_integer(reply, cf ? cuckoo_exists(cf, item, len) : bf ? bloom_exists(bf, item, len) : 0);
+        return;
+    }
+    size_t n = argc - 2;
+    int *found = imdb_calloc(n, sizeof(int));
+    if (bf || cf) {
+        const char **items;
+        size_t *lens;
+        collect_items(cmd, 2, &items, &lens);
+        if (cf) cuckoo_exists_many(cf, items, lens, n, found);
+        else bloom_exists_many(bf, items, lens, n, found);
+        imdb_free(items);
+        imdb_free(lens);
+    }
+    resp_write_array_header(reply, n);
+    for (size_t i = 0; i < n; i++) resp_write_integer(reply, found[i]);
+    imdb_free(found);
+}
+
+static void cmd_bf_exists(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    filter_exists_generic(db, cmd, reply, 0, 0);
+}
+
+static void cmd_bf_mexists(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    filter_exists_generic(db, cmd, reply, 0, 1);
+}
+
+/* BF.CARD key */
+static void cmd_bf_card(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "BF.CARD");
+        return;
+    }
+    bloom_t *bf;
+    if (!get_bloom(db, get_arg(cmd, 1), reply, &bf)) return;
+    resp_write_integer(reply, bf ? (int64_t)bloom_count(bf) : 0);
+}
+
+/* BF.INFO key */
+static void cmd_bf_info(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "BF.INFO");
+        return;
+    }
+    bloom_t *bf;
+    if (!get_bloom(db, get_arg(cmd, 1), reply, &bf)) return;
+    if (!bf) {
+        resp_write_error(reply, "ERR not found");
+        return;
+    }
+    resp_write_array_header(reply, 10);
+    resp_write_bulk_string(reply, "Capacity", 8);
+    resp_write_integer(reply, (int64_t)bloom_capacity(bf));
+    resp_write_bulk_string(reply, "Size", 4);
+    resp_write_integer(reply, (int64_t)bloom_mem_usage(bf));
+    resp_write_bulk_string(reply, "Number of filters", 17);
+    resp_write_integer(reply, bf->nlayers);
+    resp_write_bulk_string(reply, "Number of items inserted", 24);
+    resp_write_integer(reply, (int64_t)bloom_count(bf));
+    resp_write_bulk_string(reply, "Expansion rate", 14);
+    if (bf->expansion) resp_write_integer(reply, bf->expansion);
+    else resp_write_nil(reply);
+}
+
+/* Cuckoo filter at key, created with the defaults if missing; NULL after an error reply */
+static cuckoo_t *cuckoo_for_add(database_t *db, const char *key, resp_buf_t *reply) {
+    cuckoo_t *cf;
+    if (!get_cuckoo(db, key, reply, &cf)) return NULL;
+    if (!cf) {
+        cf = cuckoo_create(CF_DEFAULT_CAPACITY, CF_DEFAULT_BUCKET_SIZE, CF_DEFAULT_MAX_ITERATIONS,
+                           CF_DEFAULT_EXPANSION);
+        db_store_cuckoo(db, key, cf);
+    }
+    return cf;
+}
+
+/* CF.RESERVE key capacity [BUCKETSIZE n] [MAXITERATIONS n] [EXPANSION n] */
+static void cmd_cf_reserve(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    size_t argc = arg_count(cmd);
+    if (argc < 3 || (argc - 3) % 2 != 0) {
+        wrong_args(reply, "CF.RESERVE");
+        return;
+    }
+    uint64_t capacity;
+    uint32_t bucket_size = CF_DEFAULT_BUCKET_SIZE, max_iterations = CF_DEFAULT_MAX_ITERATIONS;
+    uint32_t expansion = CF_DEFAULT_EXPANSION;
+    if (!get_capacity_arg(cmd, 2, reply, &capacity)) return;
+    for (size_t i = 3; i < argc; i += 2) {
+        const char *opt = get_arg(cmd, (int)i);
+        int ok;
+        if (imdb_strcasecmp(opt, "BUCKETSIZE") == 0) {
+            ok = get_u32_arg(cmd, (int)i + 1, 1, CUCKOO_MAX_BUCKET_SIZE,
+                             "ERR bucket size must be between 1 and 255", reply, &bucket_size);
+        } else if (imdb_strcasecmp(opt, "MAXITERATIONS") == 0) {
+            ok = get_u32_arg(cmd, (int)i + 1, 1, CUCKOO_MAX_ITERATIONS,
+                             "ERR max iterations must be between 1 and 65535", reply, &max_iterations);
+        } else if (imdb_strcasecmp(opt, "EXPANSION") == 0) {
+            ok = get_u32_arg(cmd, (int)i + 1, 0, 32768, "ERR expansion must be between 0 and 32768",
+                             reply, &expansion);
+        } else {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+        if (!ok) return;
+    }
+    if (!reserve_check(db, get_arg(cmd, 1), reply)) return;
+    cuckoo_t *cf = cuckoo_create(capacity, bucket_size, max_iterations, expansion);
+    if (!cf) {
+        resp_write_error(reply, "ERR capacity too large");
+        return;
+    }
+    db_store_cuckoo(db, get_arg(cmd, 1), cf);
+    resp_write_simple_string(reply, "OK");
+}
+
+/* CF.ADD key item / CF.ADDNX key item (adds only if not already present) */
+static void cf_add_generic(database_t *db, resp_value_t *cmd, resp_buf_t *reply, int nx) {
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, nx ? "CF.ADDNX" : "CF.ADD");
+        return;
+    }
+    cuckoo_t *cf = cuckoo_for_add(db, get_arg(cmd, 1), reply);
+    if (!cf) return;
+    const char *item = get_arg(cmd, 2);
+    size_t len = get_arg_len(cmd, 2);
+    if (nx && cuckoo_exists(cf, item, len)) {
+        resp_write_integer(reply, 0);
+    } else if (cuckoo_add(cf, item, len) < 0) {
+        resp_write_error(reply, "ERR filter is full");
+    } else {
+        resp_write_integer(reply, 1);
+    }
+}
+
+static void cmd_cf_add(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    cf_add_generic(db, cmd, reply, 0);
+}
+
+static void cmd_cf_addnx(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    cf_add_generic(db, cmd, reply, 1);
+}
+
+static void cmd_cf_exists(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    filter_exists_generic(db, cmd, reply, 1, 0);
+}
+
+static void cmd_cf_mexists(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    filter_exists_generic(db, cmd, reply, 1, 1);
+}
+
+/* CF.DEL key item */
+static void cmd_cf_del(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "CF.DEL");
+        return;
+    }
+    cuckoo_t *cf;
+    if (!get_cuckoo(db, get_arg(cmd, 1), reply, &cf)) return;
+    if (!cf) {
+        resp_write_error(reply, "ERR not found");
+        return;
+    }
+    int deleted = cuckoo_delete(cf, get_arg(cmd, 2), get_arg_len(cmd, 2));
+    if (!deleted) propagate_nothing();
+    resp_write_integer(reply, deleted);
+}
+
+/* CF.COUNT key item */
+static void cmd_cf_count(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "CF.COUNT");
+        return;
+    }
+    cuckoo_t *cf;
+    if (!get_cuckoo(db, get_arg(cmd, 1), reply, &cf)) return;
+    resp_write_integer(reply, cf ? (int64_t)cuckoo_count_item(cf, get_arg(cmd, 2), get_arg_len(cmd, 2)) : 0);
+}
+
+/* CF.INFO key */
+static void cmd_cf_info(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 2) {
+        wrong_args(reply, "CF.INFO");
+        return;
+    }
+    cuckoo_t *cf;
+    if (!get_cuckoo(db, get_arg(cmd, 1), reply, &cf)) return;
+    if (!cf) {
+        resp_write_error(reply, "ERR not found");
+        return;
+    }
+    resp_write_array_header(reply, 16);
+    resp_write_bulk_string(reply, "Size", 4);
+    resp_write_integer(reply, (int64_t)cuckoo_mem_usage(cf));
+    resp_write_bulk_string(reply, "Number of buckets", 17);
+    resp_write_integer(reply, (int64_t)cuckoo_buckets(cf));
+    resp_write_bulk_string(reply, "Number of filters", 17);
+    resp_write_integer(reply, cf->nlayers);
+    resp_write_bulk_string(reply, "Number of items inserted", 24);
+    resp_write_integer(reply, (int64_t)cuckoo_count(cf));
+    resp_write_bulk_string(reply, "Number of items deleted", 23);
+    resp_write_integer(reply, (int64_t)cf->deletes);
+    resp_write_bulk_string(reply, "Bucket size", 11);
+    resp_write_integer(reply, cf->bucket_size);
+    resp_write_bulk_string(reply, "Expansion rate", 14);
+    resp_write_integer(reply, cf->expansion);
+    resp_write_bulk_string(reply, "Max iterations", 14);
+    resp_write_integer(reply, cf->max_iterations);
+}
+
+/* ---- TTL commands ---- */
+
+static void cmd_expire(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) < 3) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'EXPIRE' command");
+        return;
+    }
+    int64_t secs = strtoll(get_arg(cmd, 2), NULL, 10);
+    int set = db_expire(db, get_arg(cmd, 1), secs);
+    if (set) propagate_ttl(db, get_arg(cmd, 1));
+    else propagate_nothing();
+    resp_write_integer(reply, set);
+}
+
+static void cmd_pexpireat(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) != 3) {
+        wrong_args(reply, "PEXPIREAT");
+        return;
+    }
+    int64_t ms;
+    if (!get_int_arg(cmd, 2, reply, &ms)) return;
+    int set = db_expire_at(db, get_arg(cmd, 1), ms);
+    if (!set) propagate_nothing();
+    resp_write_integer(reply, set);
+}
+
+static void cmd_ttl(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) < 2) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'TTL' command");
+        return;
+    }
+    resp_write_integer(reply, db_ttl(db, get_arg(cmd, 1)));
+}
+
+static void cmd_persist(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv;
+    if (arg_count(cmd) < 2) {
+        resp_write_error(reply, "ERR wrong number of arguments for 'PERSIST' command");
+        return;
+    }
+    int removed = db_persist(db, get_arg(cmd, 1));
+    if (!removed) propagate_nothing();
+    resp_write_integer(reply, removed);
+}
+
+/* ---- Server commands ---- */
+
+static void cmd_dbsize(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv; (void)cmd;
+    resp_write_integer(reply, (int64_t)db_size(db));
+}
+
+static void cmd_flushdb(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)srv; (void)cmd;
+    db_flush(db);
+    resp_write_simple_string(reply, "OK");
+}
+
+static void info_appendf(char *buf, size_t cap, size_t *len, const char *fmt, ...) {
+    if (*len >= cap) return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + *len, cap - *len, fmt, args);
+    va_end(args);
+    if (n > 0) *len += (size_t)n < cap - *len ? (size_t)n : cap - *len - 1;
+}
+
+static int info_section_wanted(const char *section, const char *name) {
+    return !section || imdb_strcasecmp(section, "all") == 0 ||
+           imdb_strcasecmp(section, "default") == 0 ||
+           imdb_strcasecmp(section, name) == 0;
+}
+
+static void cmd_info(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    const char *section = arg_count(cmd) > 1 ? get_arg(cmd, 1) : NULL;
+    char info[4096];
+    size_t len = 0;
+    info[0] = '\0';
+
+    if (info_section_wanted(section, "server")) {
+        info_appendf(info, sizeof(info), &len,
+            "# Server\r\n"
+            "inmemdb_version:1.0.0\r\n");
+    }
+
+    if (info_section_wanted(section, "memory")) {
+        size_t used = imdb_malloc_used();
+        size_t peak = imdb_malloc_peak();
+        size_t rss = imdb_get_rss();
+        size_t startup = srv ? srv->startup_allocated : 0;
+        char used_h[32], peak_h[32], rss_h[32];
+        imdb_bytes_to_human(used_h, sizeof(used_h), used);
+        imdb_bytes_to_human(peak_h, sizeof(peak_h), peak);
+        imdb_bytes_to_human(rss_h, sizeof(rss_h), rss);
+        info_appendf(info, sizeof(info), &len,
+            "# Memory\r\n"
+            "used_memory:%zu\r\n"
+            "used_memory_human:%s\r\n"
+            "used_memory_rss:%zu\r\n"
+            "used_memory_rss_human:%s\r\n"
+            "used_memory_peak:%zu\r\n"
+            "used_memory_peak_human:%s\r\n"
+            "used_memory_startup:%zu\r\n"
+            "used_memory_dataset:%zu\r\n"
+            "used_memory_hashtable:%zu\r\n"
+            "mem_fragmentation_ratio:%.2f\r\n",
+            used, used_h, rss, rss_h, peak, peak_h, startup,
+            used > startup ? used - startup : 0,
+            db_directory_bytes(db),
+            used ? (double)rss / (double)used : 0.0);
+    }
+
+    if (info_section_wanted(section, "persistence")) {
+        int bg = srv && srv->child_pid != -1 && srv->child_type != CHILD_AOF;
+        int rw = srv && srv->child_pid != -1 && srv->child_type == CHILD_AOF;
+        aof_stats_t aof;
+        aof_get_stats(&aof);
+        size_t delta_files = 0;
+        uint64_t delta_bytes = 0;
+        /* The loader thread owns the checkpoint state until it is done */
+        if (!srv || !srv->loading) persist_delta_stats(&delta_files, &delta_bytes);
+        info_appendf(info, sizeof(info), &len, "# Persistence\r\nloading:%d\r\n", srv ? srv->loading : 0);
+        if (srv && srv->loading) {
+            persist_progress_t p;
+            persist_load_progress(&p);
+            double elapsed = (double)(imdb_mstime() - srv->loading_start) / 1000.0;
+            /* The remaining bytes at the average rate so far */
+            long long eta = p.loaded_bytes > 0 && p.loaded_bytes <= p.total_bytes
+                ? (long long)((double)(p.total_bytes - p.loaded_bytes) * elapsed / (double)p.loaded_bytes + 0.5)
+                : -1;
+            info_appendf(info, sizeof(info), &len,
+                "loading_start_time:%lld\r\n"
+                "loading_total_bytes:%llu\r\n"
+                "loading_loaded_bytes:%llu\r\n"
+                "loading_loaded_perc:%.2f\r\n"
+                "loading_loaded_keys:%llu\r\n"
+                "loading_expected_keys:%llu\r\n"
+                "loading_eta_seconds:%lld\r\n",
+                (long long)(srv->loading_start / 1000),
+                (unsigned long long)p.total_bytes, (unsigned long long)p.loaded_bytes,
+                p.total_bytes ? 100.0 * (double)p.loaded_bytes / (double)p.total_bytes : 0.0,
+                (unsigned long long)p.loaded_keys, (unsigned long long)p.expected_keys, eta);
+        }
+        info_appendf(info, sizeof(info), &len,
+            "rdb_changes_since_last_save:%llu\r\n"
+            "rdb_bgsave_in_progress:%d\r\n"
+            "rdb_last_save_time:%lld\r\n"
+            "rdb_last_bgsave_status:%s\r\n"
+            "rdb_last_bgsave_time_sec:%lld\r\n"
+            "rdb_current_bgsave_time_sec:%lld\r\n"
+            "rdb_last_cow_size:%zu\r\n"
+            "rdb_delta_files:%zu\r\n"
+            "rdb_delta_size:%llu\r\n"
+            "aof_enabled:%d\r\n"
+            "aof_rewrite_in_progress:%d\r\n"
+            "aof_rewrite_scheduled:%d\r\n"
+            "aof_last_rewrite_time_sec:%lld\r\n"
+            "aof_current_rewrite_time_sec:%lld\r\n"
+            "aof_last_bgrewrite_status:%s\r\n"
+            "aof_last_cow_size:%zu\r\n"
+            "aof_current_size:%llu\r\n"
+            "aof_base_size:%llu\r\n"
+            "aof_files:%zu\r\n"
+            "aof_buffer_length:%zu\r\n"
+            "aof_last_write_status:%s\r\n"
+            "aof_delayed_fsync:%llu\r\n",
+            srv ? (unsigned long long)srv->dirty : 0ULL,
+            bg,
+            srv ? (long long)srv->last_save : 0LL,
+            !srv || srv->last_bgsave_ok ? "ok" : "err",
+            srv && srv->last_bgsave_ms >= 0 ? (long long)(srv->last_bgsave_ms / 1000) : -1LL,
+            bg ? (long long)((imdb_mstime() - srv->child_start) / 1000) : -1LL,
+            srv ? srv->last_cow_bytes : 0,
+            delta_files, (unsigned long long)delta_bytes,
+            aof.enabled, rw,
+            srv ? srv->aof_rewrite_scheduled : 0,
+            srv && srv->last_aof_rewrite_ms >= 0 ? (long long)(srv->last_aof_rewrite_ms / 1000) : -1LL,
+            rw ? (long long)((imdb_mstime() - srv->child_start) / 1000) : -1LL,
+            !srv || srv->last_aof_rewrite_ok ? "ok" : "err",
+            srv ? srv->aof_last_cow_bytes : 0,
+            (unsigned long long)aof.current_size, (unsigned long long)aof.base_size, aof.files,
+            aof.buffer_length,
+            aof.last_write_ok ? "ok" : "err", (unsigned long long)aof.delayed_fsync);
+    }
+
+    if (info_section_wanted(section, "keyspace")) {
+        info_appendf(info, sizeof(info), &len,
+            "# Keyspace\r\n"
+            "db0:keys=%zu\r\n",
+            db_size(db));
+    }
+    resp_write_bulk_string(reply, info, len);
+}
+
+static void memory_stat_int(resp_buf_t *reply, const char *name, int64_t value) {
+    resp_write_bulk_string(reply, name, strlen(name));
+    resp_write_integer(reply, value);
+}
+
+static void memory_stat_double(resp_buf_t *reply, const char *name, double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.4f", value);
+    resp_write_bulk_string(reply, name, strlen(name));
+    resp_write_bulk_string(reply, buf, strlen(buf));
+}
+
+static void cmd_memory(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    size_t argc = arg_count(cmd);
+    const char *sub = argc > 1 ? get_arg(cmd, 1) : NULL;
+
+    if (sub && imdb_strcasecmp(sub, "USAGE") == 0 && argc >= 3) {
+        size_t samples = MEMORY_USAGE_DEFAULT_SAMPLES;
+        if (argc == 5 && imdb_strcasecmp(get_arg(cmd, 3), "SAMPLES") == 0) {
+            int64_t n;
+            if (!obj_try_parse_int(get_arg(cmd, 4), &n) || n < 0) {
+                resp_write_error(reply, "ERR value is not an integer or out of range");
+                return;
+            }
+            samples = (size_t)n;
+        } else if (argc != 3) {
+            resp_write_error(reply, "ERR syntax error");
+            return;
+        }
+        int64_t usage = db_memory_usage(db, get_arg(cmd, 2), samples);
+        if (usage < 0) resp_write_nil(reply);
+        else resp_write_integer(reply, usage);
+        return;
+    }
+
+    if (sub && imdb_strcasecmp(sub, "STATS") == 0 && argc == 2) {
+        size_t used = imdb_malloc_used();
+        size_t rss = imdb_get_rss();
+        size_t startup = srv ? srv->startup_allocated : 0;
+        size_t keys = db_size(db);
+        size_t directory = db_directory_bytes(db);
+        size_t per_key = sizeof(db_entry_t) + sizeof(dbobj_t);
+        size_t overhead = startup + directory + keys * per_key;
+        size_t dataset = used > overhead ? used - overhead : 0;
+        size_t net = used > startup ? used - startup : 0;
+
+        resp_write_array_header(reply, 11 * 2);
+        memory_stat_int(reply, "peak.allocated", (int64_t)imdb_malloc_peak());
+        memory_stat_int(reply, "total.allocated", (int64_t)used);
+        memory_stat_int(reply, "startup.allocated", (int64_t)startup);
+        memory_stat_int(reply, "hashtable.directory", (int64_t)directory);
+        memory_stat_int(reply, "overhead.total", (int64_t)overhead);
+        memory_stat_int(reply, "keys.count", (int64_t)keys);
+        memory_stat_int(reply, "keys.overhead-per-key",
+                        keys ? (int64_t)((directory + keys * per_key) / keys) : 0);
+        memory_stat_int(reply, "keys.bytes-per-key", keys ? (int64_t)(net / keys) : 0);
+        memory_stat_int(reply, "dataset.bytes", (int64_t)dataset);
+        memory_stat_double(reply, "dataset.percentage",
+                           net ? 100.0 * (double)dataset / (double)net : 0.0);
+        memory_stat_double(reply, "fragmentation", used ? (double)rss / (double)used : 0.0);
+        return;
+    }
+
+    resp_write_error(reply, "ERR unknown subcommand or wrong number of arguments for 'MEMORY' command");
+}
+
+static void cmd_save(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     (void)cmd;
-    persist_save(db, "dump.rdb");
+    if (srv && srv->child_pid != -1 && srv->child_type != CHILD_AOF) {
+        resp_write_error(reply, "ERR Background save already in progress");
+        return;
+    }
+    db_checkpoint_begin(db);
+    int ok = persist_save(db, "dump.rdb") == 0;
+    db_checkpoint_end(db, ok);
+    if (ok) {
+        persist_checkpoint_done("dump.rdb", 1);
+        if (srv) {
+            srv->last_save = (int64_t)time(NULL);
+            srv->dirty = 0;
+        }
+        resp_write_simple_string(reply, "OK");
+    } else {
+        resp_write_error(reply, "ERR failed to save database");
+    }
+}
+
+static void cmd_bgsave(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)db; (void)cmd;
+    if (!srv) {
+        resp_write_error(reply, "ERR no server to fork");
+        return;
+    }
+    if (srv->child_pid != -1) {
+        resp_write_error(reply, srv->child_type == CHILD_AOF
+                         ? "ERR Background append only file rewriting in progress"
+                         : "ERR Background save already in progress");
+        return;
+    }
+    if (server_bgsave(srv, "dump.rdb") == 0) {
+        resp_write_simple_string(reply, "Background saving started");
+    } else {
+        resp_write_error(reply, "ERR failed to start background save");
+    }
+}
+
+static void cmd_bgrewriteaof(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)db; (void)cmd;
+    aof_stats_t aof;
+    aof_get_stats(&aof);
+    if (!srv) {
+        resp_write_error(reply, "ERR no server to fork");
+        return;
+    }
+    if (!aof.enabled) {
+        resp_write_error(reply, "ERR append only file is disabled");
+        return;
+    }
+    if (srv->child_pid != -1 && srv->child_type == CHILD_AOF) {
+        resp_write_error(reply, "ERR Background append only file rewriting already in progress");
+        return;
+    }
+    int r = server_bgrewriteaof(srv);
+    if (r == 0) {
+        resp_write_simple_string(reply, "Background append only file rewriting started");
+    } else if (r == 1) {
+        resp_write_simple_string(reply, "Background append only file rewriting scheduled");
+    } else {
+        resp_write_error(reply, "ERR failed to start background append only file rewrite");
+    }
+}
+
+static void cmd_lastsave(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)db; (void)cmd;
+    resp_write_integer(reply, srv ? srv->last_save : 0);
+}
+
+/* The final save happens in main once the event loop has stopped */
+static void cmd_shutdown(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
+    (void)db; (void)cmd;
     resp_write_simple_string(reply, "OK");
     if (srv) server_stop(srv);
 }
@@ -342,38 +4399,181 @@ static void cmd_shutdown(database_t *db, server_t *srv, resp_value_t *cmd, resp_
 
 typedef void (*cmd_handler_t)(database_t *, server_t *, resp_value_t *, resp_buf_t *);
 
+#define CMD_WRITE 1 /* modifies the dataset; logged to the AOF */
+
+/* Which arguments of a write are keys, for delta checkpoints: the first
+ * one unless one of these says otherwise */
+#define CMD_KEYS_ALL      2   /* every argument */
+#define CMD_KEYS_PAIRS    4   /* key, value, key, value, ... */
+#define CMD_KEYS_TWO      8   /* the first two */
+#define CMD_KEYS_BLOCKING 16  /* all but the last, a timeout */
+#define CMD_KEY_SECOND    32  /* the second (after an operation name) */
+
+#define CMD_LOADING 64  /* served while the dataset is still loading */
+
 typedef struct {
     const char *name;
     cmd_handler_t handler;
+    int flags;
 } cmd_entry_t;
 
 static cmd_entry_t command_table[] = {
-    {"PING",    cmd_ping},
-    {"SET",     cmd_set},
-    {"GET",     cmd_get},
-    {"DEL",     cmd_del},
-    {"EXISTS",  cmd_exists},
-    {"INCR",    cmd_incr},
-    {"DECR",    cmd_decr},
-    {"MSET",    cmd_mset},
-    {"MGET",    cmd_mget},
-    {"LPUSH",   cmd_lpush},
-    {"RPUSH",   cmd_rpush},
-    {"LPOP",    cmd_lpop},
-    {"RPOP",    cmd_rpop},
-    {"LLEN",    cmd_llen},
-    {"LRANGE",  cmd_lrange},
-    {"EXPIRE",  cmd_expire},
-    {"TTL",     cmd_ttl},
-    {"PERSIST", cmd_persist},
-    {"DBSIZE",  cmd_dbsize},
-    {"FLUSHDB", cmd_flushdb},
-    {"INFO",    cmd_info},
-    {"SAVE",    cmd_save},
-    {"SHUTDOWN",cmd_shutdown},
-    {NULL,      NULL}
+    {"PING",    cmd_ping, CMD_LOADING},
+    {"SET",     cmd_set, CMD_WRITE},
+    {"GET",     cmd_get, 0},
+    {"DEL",     cmd_del, CMD_WRITE | CMD_KEYS_ALL},
+    {"EXISTS",  cmd_exists, 0},
+    {"INCR",    cmd_incr, CMD_WRITE},
+    {"DECR",    cmd_decr, CMD_WRITE},
+    {"MSET",    cmd_mset, CMD_WRITE | CMD_KEYS_PAIRS},
+    {"MGET",    cmd_mget, 0},
+    {"INCRBY",  cmd_incrby, CMD_WRITE},
+    {"DECRBY",  cmd_decrby, CMD_WRITE},
+    {"INCRBYFLOAT", cmd_incrbyfloat, CMD_WRITE},
+    {"SETNX",   cmd_setnx, CMD_WRITE},
+    {"MSETNX",  cmd_msetnx, CMD_WRITE | CMD_KEYS_PAIRS},
+    {"GETSET",  cmd_getset, CMD_WRITE},
+    {"GETDEL",  cmd_getdel, CMD_WRITE},
+    {"GETEX",   cmd_getex, CMD_WRITE},
+    {"APPEND",  cmd_append, CMD_WRITE},
+    {"SETRANGE", cmd_setrange, CMD_WRITE},
+    {"GETRANGE", cmd_getrange, 0},
+    {"SUBSTR",  cmd_getrange, 0},
+    {"STRLEN",  cmd_strlen, 0},
+    {"LPUSH",   cmd_lpush, CMD_WRITE},
+    {"RPUSH",   cmd_rpush, CMD_WRITE},
+    {"LPOP",    cmd_lpop, CMD_WRITE},
+    {"RPOP",    cmd_rpop, CMD_WRITE},
+    {"LLEN",    cmd_llen, 0},
+    {"LRANGE",  cmd_lrange, 0},
+    {"LINDEX",  cmd_lindex, 0},
+    {"LSET",    cmd_lset, CMD_WRITE},
+    {"LTRIM",   cmd_ltrim, CMD_WRITE},
+    {"LINSERT", cmd_linsert, CMD_WRITE},
+    {"LREM",    cmd_lrem, CMD_WRITE},
+    {"LPOS",    cmd_lpos, 0},
+    {"LMOVE",   cmd_lmove, CMD_WRITE | CMD_KEYS_TWO},
+    {"BLMOVE",  cmd_blmove, CMD_WRITE | CMD_KEYS_TWO},
+    {"BLPOP",   cmd_blpop, CMD_WRITE | CMD_KEYS_BLOCKING},
+    {"BRPOP",   cmd_brpop, CMD_WRITE | CMD_KEYS_BLOCKING},
+    {"HSET",    cmd_hset, CMD_WRITE},
+    {"HMSET",   cmd_hmset, CMD_WRITE},
+    {"HSETNX",  cmd_hsetnx, CMD_WRITE},
+    {"HGET",    cmd_hget, 0},
+    {"HMGET",   cmd_hmget, 0},
+    {"HDEL",    cmd_hdel, CMD_WRITE},
+    {"HLEN",    cmd_hlen, 0},
+    {"HEXISTS", cmd_hexists, 0},
+    {"HSTRLEN", cmd_hstrlen, 0},
+    {"HGETALL", cmd_hgetall, 0},
+    {"HKEYS",   cmd_hkeys, 0},
+    {"HVALS",   cmd_hvals, 0},
+    {"HINCRBY", cmd_hincrby, CMD_WRITE},
+    {"HINCRBYFLOAT", cmd_hincrbyfloat, CMD_WRITE},
+    {"ZADD",    cmd_zadd, CMD_WRITE},
+    {"ZINCRBY", cmd_zincrby, CMD_WRITE},
+    {"ZSCORE",  cmd_zscore, 0},
+    {"ZRANK",   cmd_zrank, 0},
+    {"ZREVRANK",cmd_zrevrank, 0},
+    {"ZCARD",   cmd_zcard, 0},
+    {"ZCOUNT",  cmd_zcount, 0},
+    {"ZREM",    cmd_zrem, CMD_WRITE},
+    {"ZPOPMIN", cmd_zpopmin, CMD_WRITE},
+    {"ZPOPMAX", cmd_zpopmax, CMD_WRITE},
+    {"ZRANGE",  cmd_zrange, 0},
+    {"ZREVRANGE", cmd_zrevrange, 0},
+    {"ZRANGEBYSCORE", cmd_zrangebyscore, 0},
+    {"ZREVRANGEBYSCORE", cmd_zrevrangebyscore, 0},
+    {"SADD",    cmd_sadd, CMD_WRITE},
+    {"SREM",    cmd_srem, CMD_WRITE},
+    {"SISMEMBER", cmd_sismember, 0},
+    {"SMISMEMBER", cmd_smismember, 0},
+    {"SCARD",   cmd_scard, 0},
+    {"SMEMBERS", cmd_smembers, 0},
+    {"SINTER",  cmd_sinter, 0},
+    {"SUNION",  cmd_sunion, 0},
+    {"SDIFF",   cmd_sdiff, 0},
+    {"SINTERSTORE", cmd_sinterstore, CMD_WRITE},
+    {"SUNIONSTORE", cmd_sunionstore, CMD_WRITE},
+    {"SDIFFSTORE", cmd_sdiffstore, CMD_WRITE},
+    {"SINTERCARD", cmd_sintercard, 0},
+    {"SETBIT",  cmd_setbit, CMD_WRITE},
+    {"GETBIT",  cmd_getbit, 0},
+    {"BITCOUNT", cmd_bitcount, 0},
+    {"BITPOS",  cmd_bitpos, 0},
+    {"BITOP",   cmd_bitop, CMD_WRITE | CMD_KEY_SECOND},
+    {"BITFIELD", cmd_bitfield, CMD_WRITE},
+    {"PFADD",   cmd_pfadd, CMD_WRITE},
+    {"PFCOUNT", cmd_pfcount, 0},
+    {"PFMERGE", cmd_pfmerge, CMD_WRITE},
+    {"XADD",    cmd_xadd, CMD_WRITE},
+    {"XLEN",    cmd_xlen, 0},
+    {"XRANGE",  cmd_xrange, 0},
+    {"XREVRANGE", cmd_xrevrange, 0},
+    {"XTRIM",   cmd_xtrim, CMD_WRITE},
+    {"XREAD",   cmd_xread, 0},
+    {"CMS.INITBYDIM",  cmd_cms_initbydim, CMD_WRITE},
+    {"CMS.INITBYPROB", cmd_cms_initbyprob, CMD_WRITE},
+    {"CMS.INCRBY",     cmd_cms_incrby, CMD_WRITE},
+    {"CMS.QUERY",      cmd_cms_query, 0},
+    {"CMS.MERGE",      cmd_cms_merge, CMD_WRITE},
+    {"CMS.INFO",       cmd_cms_info, 0},
+    {"TOPK.RESERVE",   cmd_topk_reserve, CMD_WRITE},
+    {"TOPK.ADD",       cmd_topk_add, CMD_WRITE},
+    {"TOPK.INCRBY",    cmd_topk_incrby, CMD_WRITE},
+    {"TOPK.QUERY",     cmd_topk_query, 0},
+    {"TOPK.COUNT",     cmd_topk_count, 0},
+    {"TOPK.LIST",      cmd_topk_list, 0},
+    {"TOPK.INFO",      cmd_topk_info, 0},
+    {"VADD",     cmd_vadd, CMD_WRITE},
+    {"VREM",     cmd_vrem, CMD_WRITE},
+    {"VCARD",    cmd_vcard, 0},
+    {"VDIM",     cmd_vdim, 0},
+    {"VSIM",     cmd_vsim, 0},
+    {"VSETATTR", cmd_vsetattr, CMD_WRITE},
+    {"VGETATTR", cmd_vgetattr, 0},
+    {"BF.RESERVE", cmd_bf_reserve, CMD_WRITE},
+    {"BF.ADD",     cmd_bf_add, CMD_WRITE},
+    {"BF.MADD",    cmd_bf_madd, CMD_WRITE},
+    {"BF.EXISTS",  cmd_bf_exists, 0},
+    {"BF.MEXISTS", cmd_bf_mexists, 0},
+    {"BF.CARD",    cmd_bf_card, 0},
+    {"BF.INFO",    cmd_bf_info, 0},
+    {"CF.RESERVE", cmd_cf_reserve, CMD_WRITE},
+    {"CF.ADD",     cmd_cf_add, CMD_WRITE},
+    {"CF.ADDNX",   cmd_cf_addnx, CMD_WRITE},
+    {"CF.EXISTS",  cmd_cf_exists, 0},
+    {"CF.MEXISTS", cmd_cf_mexists, 0},
+    {"CF.DEL",     cmd_cf_del, CMD_WRITE},
+    {"CF.COUNT",   cmd_cf_count, 0},
+    {"CF.INFO",    cmd_cf_info, 0},
+    {"EXPIRE",  cmd_expire, CMD_WRITE},
+    {"TTL",     cmd_ttl, 0},
+    {"PEXPIREAT", cmd_pexpireat, CMD_WRITE},
+    {"PERSIST", cmd_persist, CMD_WRITE},
+    {"DBSIZE",  cmd_dbsize, 0},
+    {"FLUSHDB", cmd_flushdb, CMD_WRITE},
+    {"INFO",    cmd_info, CMD_LOADING},
+    {"MEMORY",  cmd_memory, 0},
+    {"SAVE",    cmd_save, 0},
+    {"BGSAVE",  cmd_bgsave, 0},
+    {"LASTSAVE",cmd_lastsave, 0},
+    {"BGREWRITEAOF", cmd_bgrewriteaof, 0},
+    {"SHUTDOWN",cmd_shutdown, CMD_LOADING},
+    {NULL,      NULL, 0}
 };
 
+/* Remember the keys a successful write touched */
+static void mark_changed_keys(database_t *db, const cmd_entry_t *e, resp_value_t *cmd) {
+    size_t argc = arg_count(cmd), first = 1, last = 1, step = 1;
+    if (e->flags & (CMD_KEYS_ALL | CMD_KEYS_PAIRS)) last = argc - 1;
+    if (e->flags & CMD_KEYS_PAIRS) step = 2;
+    if (e->flags & CMD_KEYS_TWO) last = 2;
+    if (e->flags & CMD_KEYS_BLOCKING) last = argc - 2;
+    if (e->flags & CMD_KEY_SECOND) first = last = 2;
+    for (size_t i = first; i <= last && i < argc; i += step) db_mark_changed(db, get_arg(cmd, (int)i));
+}
+
 void command_execute(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_t *reply) {
     if (!cmd || cmd->type != RESP_ARRAY || cmd->data.array.count == 0) {
         resp_write_error(reply, "ERR invalid command format");
@@ -388,7 +4588,22 @@ void command_execute(database_t *db, server_t *srv, resp_value_t *cmd, resp_buf_
 
     for (cmd_entry_t *e = command_table; e->name; e++) {
         if (imdb_strcasecmp(name, e->name) == 0) {
+            if (srv && srv->loading && !(e->flags & CMD_LOADING)) {
+                resp_write_error(reply, "LOADING inMemDb is loading the dataset in memory");
+                return;
+            }
+            size_t start = reply->len;
+            propagate_overridden = 0;
+            propagate_unchanged = 0;
             e->handler(db, srv, cmd, reply);
+            /* A blocked client has no reply yet and an error changed nothing */
+            int changed = (e->flags & CMD_WRITE) && !propagate_unchanged &&
+                          reply->len > start && reply->buf[start] != '-';
+            if (changed && !propagate_overridden) aof_feed_command(cmd);
+            /* One change per write towards the save rules, however it was
+             * logged; srv is NULL while the AOF is replayed */
+            if (changed && srv) srv->dirty++;
+            if (changed && db->changed) mark_changed_keys(db, e, cmd);
             return;
         }
     }
@@ -0,0 +1,134 @@
+#include "config.h"
+#include "util.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+imdb_config_t g_config = {
+    .list_max_block_bytes = 8192,
+    .list_compress_depth = 0,
+    .hash_max_listpack_entries = 128,
+    .hash_max_listpack_value = 64,
+    .zset_max_listpack_entries = 128,
+    .zset_max_listpack_value = 64,
+    .set_max_intset_entries = 512,
+    .hll_sparse_max_bytes = 3000,
+    .stream_node_max_entries = 100,
+    .stream_node_max_bytes = 4096,
+    .vset_exact_max_elements = 1024,
+    .appendonly = 0,
+    .appendfsync = AOF_FSYNC_EVERYSEC,
+    .auto_aof_rewrite_percentage = 100,
+    .auto_aof_rewrite_min_size = 64 * 1024 * 1024,
+    .rdbcompression = 1,
+    .rdb_threads = 0,
+    .save_rules = {{3600, 1}, {300, 100}, {60, 10000}},
+    .save_rule_count = 3,
+    .delta_checkpoints = 0,
+    .delta_consolidate_percentage = 50,
+};
+
+static int parse_long(const char *s, long min, long max, long *out) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (errno != 0 || *end != '\0' || end == s || v < min || v > max) return 0;
+    *out = v;
+    return 1;
+}
+
+/* "<seconds> <changes> ..." pairs; an empty string clears the rules */
+static const char *parse_save_rules(const char *value) {
+    save_rule_t rules[CONFIG_MAX_SAVE_RULES];
+    size_t n = 0;
+    const char *p = value;
+    while (1) {
+        char *end;
+        while (*p == ' ') p++;
+        if (*p == '\0') break;
+        if (n == CONFIG_MAX_SAVE_RULES) return "save takes at most 16 rules";
+        errno = 0;
+        rules[n].seconds = strtol(p, &end, 10);
+        if (errno != 0 || end == p || rules[n].seconds < 1) return "save must be <seconds> <changes> pairs";
+        p = end;
+        rules[n].changes = strtol(p, &end, 10);
+        if (errno != 0 || end == p || rules[n].changes < 1) return "save must be <seconds> <changes> pairs";
+        p = end;
+        n++;
+    }
+    for (size_t i = 0; i < n; i++) g_config.save_rules[i] = rules[i];
+    g_config.save_rule_count = n;
+    return NULL;
+}
+
+const char *config_set(const char *name, const char *value) {
+    long v;
+    if (imdb_strcasecmp(name, "list-max-block-bytes") == 0) {
+        if (!parse_long(value, 64, 1 << 30, &v)) return "list-max-block-bytes must be at least 64";
+        g_config.list_max_block_bytes = (size_t)v;
+    } else if (imdb_strcasecmp(name, "list-compress-depth") == 0) {
+        if (!parse_long(value, 0, 1 << 16, &v)) return "list-compress-depth must be non-negative";
+        g_config.list_compress_depth = (int)v;
+    } else if (imdb_strcasecmp(name, "hash-max-listpack-entries") == 0) {
+        if (!parse_long(value, 0, 1 << 20, &v)) return "hash-max-listpack-entries must be non-negative";
+        g_config.hash_max_listpack_entries = (size_t)v;
+    } else if (imdb_strcasecmp(name, "hash-max-listpack-value") == 0) {
+        if (!parse_long(value, 0, 1 << 20, &v)) return "hash-max-listpack-value must be non-negative";
+        g_config.hash_max_listpack_value = (size_t)v;
+    } else if (imdb_strcasecmp(name, "zset-max-listpack-entries") == 0) {
+        if (!parse_long(value, 0, 1 << 20, &v)) return "zset-max-listpack-entries must be non-negative";
+        g_config.zset_max_listpack_entries = (size_t)v;
+    } else if (imdb_strcasecmp(name, "zset-max-listpack-value") == 0) {
+        if (!parse_long(value, 0, 1 << 20, &v)) return "zset-max-listpack-value must be non-negative";
+        g_config.zset_max_listpack_value = (size_t)v;
+    } else if (imdb_strcasecmp(name, "set-max-intset-entries") == 0) {
+        if (!parse_long(value, 0, 1 << 30, &v)) return "set-max-intset-entries must be non-negative";
+        g_config.set_max_intset_entries = (size_t)v;
+    } else if (imdb_strcasecmp(name, "hll-sparse-max-bytes") == 0) {
+        if (!parse_long(value, 0, 1 << 20, &v)) return "hll-sparse-max-bytes must be non-negative";
+        g_config.hll_sparse_max_bytes = (size_t)v;
+    } else if (imdb_strcasecmp(name, "stream-node-max-entries") == 0) {
+        if (!parse_long(value, 1, 1 << 20, &v)) return "stream-node-max-entries must be at least 1";
+        g_config.stream_node_max_entries = (size_t)v;
+    } else if (imdb_strcasecmp(name, "stream-node-max-bytes") == 0) {
+        if (!parse_long(value, 64, 1 << 30, &v)) return "stream-node-max-bytes must be at least 64";
+        g_config.stream_node_max_bytes = (size_t)v;
+    } else if (imdb_strcasecmp(name, "vset-exact-max-elements") == 0) {
+        if (!parse_long(value, 0, 1L << 30, &v)) return "vset-exact-max-elements must be non-negative";
+        g_config.vset_exact_max_elements = (size_t)v;
+    } else if (imdb_strcasecmp(name, "appendonly") == 0) {
+        if (imdb_strcasecmp(value, "yes") == 0) g_config.appendonly = 1;
+        else if (imdb_strcasecmp(value, "no") == 0) g_config.appendonly = 0;
+        else return "appendonly must be yes or no";
+    } else if (imdb_strcasecmp(name, "appendfsync") == 0) {
+        if (imdb_strcasecmp(value, "always") == 0) g_config.appendfsync = AOF_FSYNC_ALWAYS;
+        else if (imdb_strcasecmp(value, "everysec") == 0) g_config.appendfsync = AOF_FSYNC_EVERYSEC;
+        else if (imdb_strcasecmp(value, "no") == 0) g_config.appendfsync = AOF_FSYNC_NO;
+        else return "appendfsync must be always, everysec or no";
+    } else if (imdb_strcasecmp(name, "auto-aof-rewrite-percentage") == 0) {
+        if (!parse_long(value, 0, 1L << 30, &v)) return "auto-aof-rewrite-percentage must be non-negative";
+        g_config.auto_aof_rewrite_percentage = (size_t)v;
+    } else if (imdb_strcasecmp(name, "auto-aof-rewrite-min-size") == 0) {
+        if (!parse_long(value, 0, LONG_MAX, &v)) return "auto-aof-rewrite-min-size must be non-negative";
+        g_config.auto_aof_rewrite_min_size = (size_t)v;
+    } else if (imdb_strcasecmp(name, "rdbcompression") == 0) {
+        if (imdb_strcasecmp(value, "yes") == 0) g_config.rdbcompression = 1;
+        else if (imdb_strcasecmp(value, "no") == 0) g_config.rdbcompression = 0;
+        else return "rdbcompression must be yes or no";
+    } else if (imdb_strcasecmp(name, "rdb-threads") == 0) {
+        if (!parse_long(value, 0, 64, &v)) return "rdb-threads must be between 0 and 64";
+        g_config.rdb_threads = (int)v;
+    } else if (imdb_strcasecmp(name, "save") == 0) {
+        return parse_save_rules(value);
+    } else if (imdb_strcasecmp(name, "delta-checkpoints") == 0) {
+        if (imdb_strcasecmp(value, "yes") == 0) g_config.delta_checkpoints = 1;
+        else if (imdb_strcasecmp(value, "no") == 0) g_config.delta_checkpoints = 0;
+        else return "delta-checkpoints must be yes or no";
+    } else if (imdb_strcasecmp(name, "delta-consolidate-percentage") == 0) {
+        if (!parse_long(value, 1, 1L << 30, &v)) return "delta-consolidate-percentage must be positive";
+        g_config.delta_consolidate_percentage = (size_t)v;
+    } else {
+        return "unknown option";
+    }
+    return NULL;
+}
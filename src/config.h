@@ -0,0 +1,53 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+
+/* Release version, shown in the banner and recorded in snapshots */
+#define IMDB_VERSION "1.0.0"
+
+/* appendfsync policies */
+#define AOF_FSYNC_NO       0  /* leave flushing to the operating system */
+#define AOF_FSYNC_EVERYSEC 1  /* fsync once a second on a background thread */
+#define AOF_FSYNC_ALWAYS   2  /* fsync each event-loop batch before replying */
+
+/* A `save <seconds> <changes>` rule: snapshot in the background once
+ * `changes` writes are `seconds` old */
+#define CONFIG_MAX_SAVE_RULES 16
+
+typedef struct {
+    long seconds;
+    long changes;
+} save_rule_t;
+
+/* Server tunables. Defaults live in config.c; set from the command line. */
+typedef struct {
+    size_t list_max_block_bytes; /* byte budget of one packed list block */
+    int list_compress_depth;     /* blocks kept raw at each end; 0 disables compression */
+    size_t hash_max_listpack_entries; /* fields a packed hash may hold */
+    size_t hash_max_listpack_value;   /* longest field or value a packed hash may hold */
+    size_t zset_max_listpack_entries; /* members a packed sorted set may hold */
+    size_t zset_max_listpack_value;   /* longest member a packed sorted set may hold */
+    size_t set_max_intset_entries;    /* members an all-integer set may hold as an intset */
+    size_t hll_sparse_max_bytes;      /* sparse HyperLogLog body size before it turns dense */
+    size_t stream_node_max_entries;   /* entries one stream block may hold */
+    size_t stream_node_max_bytes;     /* byte budget of one stream block */
+    size_t vset_exact_max_elements;   /* vector sets up to this size are searched by a full scan */
+    int appendonly;                   /* log writes to the append-only file */
+    int appendfsync;                  /* AOF_FSYNC_* */
+    size_t auto_aof_rewrite_percentage; /* AOF growth over its last rewritten size that triggers a rewrite; 0 = never */
+    size_t auto_aof_rewrite_min_size;   /* no automatic rewrite below this many bytes */
+    int rdbcompression;               /* LZF-compress snapshot strings that shrink */
+    int rdb_threads;                  /* threads encoding or decoding snapshot chunks; 0 = one per core */
+    save_rule_t save_rules[CONFIG_MAX_SAVE_RULES]; /* BGSAVE when any rule is met */
+    size_t save_rule_count;
+    int delta_checkpoints;            /* let save rules write only the keys changed since the last save */
+    size_t delta_consolidate_percentage; /* deltas past this share of the snapshot's size force a full one */
+} imdb_config_t;
+
+extern imdb_config_t g_config;
+
+/* Apply `--name value`. Returns NULL on success, or an error message. */
+const char *config_set(const char *name, const char *value);
+
+#endif /* CONFIG_H */
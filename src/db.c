@@ -19,12 +19,20 @@ database_t *db_create(void) {
     database_t *db = imdb_malloc(sizeof(database_t));
     db->ht = ht_create(64, entry_free);
     db->last_expire_sweep = imdb_mstime();
+    db->ready_fn = NULL;
+    db->ready_ctx = NULL;
+    db->changed = NULL;
+    db->checkpointing = NULL;
+    db->changed_all = 0;
+    db->checkpointing_all = 0;
     return db;
 }
 
 void db_destroy(database_t *db) {
     if (!db) return;
     ht_destroy(db->ht);
+    ht_destroy(db->changed);
+    ht_destroy(db->checkpointing);
     imdb_free(db);
 }
 
@@ -40,6 +48,26 @@ static int check_expired(database_t *db, const char *key) {
     return 0;
 }
 
+/* Single-probe lookup that drops the key if it has expired */
+static db_entry_t *lookup_live(database_t *db, const char *key) {
+    ht_entry_t *he = ht_get_entry(db->ht, key);
+    if (!he) return NULL;
+    db_entry_t *entry = (db_entry_t *)he->value;
+    if (entry->expire >= 0 && imdb_mstime() > entry->expire) {
+        ht_delete(db->ht, key);
+        return NULL;
+    }
+    return entry;
+}
+
+static dbobj_t *add_object(database_t *db, const char *key, dbobj_t *obj) {
+    db_entry_t *entry = imdb_malloc(sizeof(db_entry_t));
+    entry->obj = obj;
+    entry->expire = -1;
+    ht_set(db->ht, key, entry);
+    return obj;
+}
+
 db_entry_t *db_get_entry(database_t *db, const char *key) {
     if (check_expired(db, key)) return NULL;
     return (db_entry_t *)ht_get(db->ht, key);
@@ -47,19 +75,27 @@ db_entry_t *db_get_entry(database_t *db, const char *key) {
 
 /* ---- String/Int operations ---- */
 
-int db_set(database_t *db, const char *key, const char *value) {
-    db_entry_t *entry = imdb_malloc(sizeof(db_entry_t));
-    int64_t num;
-    if (obj_try_parse_int(value, &num)) {
-        entry->obj = obj_create_int(num);
-    } else {
-        entry->obj = obj_create_string(value);
+/* Overwrites in place when the key exists (even if expired), reusing its entry */
+int db_set(database_t *db, const char *key, const char *value, size_t len) {
+    ht_entry_t *he = ht_get_entry(db->ht, key);
+    if (!he) {
+        dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+        obj->type = OBJ_INT;
+        obj_set_value(obj, value, len);
+        add_object(db, key, obj);
+        return 1;
     }
+    db_entry_t *entry = (db_entry_t *)he->value;
+    obj_set_value(entry->obj, value, len);
     entry->expire = -1;
-    ht_set(db->ht, key, entry);
     return 1;
 }
 
+int db_setnx(database_t *db, const char *key, const char *value, size_t len) {
+    if (lookup_live(db, key)) return 0;
+    return db_set(db, key, value, len);
+}
+
 dbobj_t *db_get(database_t *db, const char *key) {
     db_entry_t *entry = db_get_entry(db, key);
     return entry ? entry->obj : NULL;
@@ -75,82 +111,144 @@ int db_exists(database_t *db, const char *key) {
     return ht_exists(db->ht, key);
 }
 
-/* Returns new value, or INT64_MIN on type error */
-int64_t db_incr(database_t *db, const char *key, int64_t delta) {
-    if (check_expired(db, key)) {
-        /* Key doesn't exist — treat as 0 */
-        db_entry_t *entry = imdb_malloc(sizeof(db_entry_t));
-        entry->obj = obj_create_int(delta);
-        entry->expire = -1;
-        ht_set(db->ht, key, entry);
-        return delta;
+int db_incr(database_t *db, const char *key, int64_t delta, int64_t *out) {
+    db_entry_t *entry = lookup_live(db, key);
+    if (!entry) {
+        add_object(db, key, obj_create_int(delta));
+        *out = delta;
+        return 1;
     }
 
-    db_entry_t *entry = (db_entry_t *)ht_get(db->ht, key);
-    if (!entry) {
-        entry = imdb_malloc(sizeof(db_entry_t));
-        entry->obj = obj_create_int(delta);
-        entry->expire = -1;
-        ht_set(db->ht, key, entry);
-        return delta;
+    dbobj_t *obj = entry->obj;
+    int64_t num;
+    if (obj->type == OBJ_INT) {
+        num = obj->data.num;
+    } else if (obj->type != OBJ_STRING || !obj_try_parse_int_len(obj->data.str.buf, obj->data.str.len, &num)) {
+        return 0;
+    }
+    if ((delta > 0 && num > INT64_MAX - delta) || (delta < 0 && num < INT64_MIN - delta)) return -1;
+    if (obj->type == OBJ_STRING) {
+        imdb_free(obj->data.str.buf);
+        obj->type = OBJ_INT;
+    }
+    obj->data.num = num + delta;
+    *out = obj->data.num;
+    return 1;
+}
+
+dbobj_t *db_get_or_create_string(database_t *db, const char *key, int *wrongtype) {
+    *wrongtype = 0;
+    db_entry_t *entry = lookup_live(db, key);
+    if (!entry) return add_object(db, key, obj_create_string("", 0));
+    if (entry->obj->type == OBJ_INT) obj_int_to_string(entry->obj);
+    if (entry->obj->type != OBJ_STRING) {
+        *wrongtype = 1;
+        return NULL;
     }
+    return entry->obj;
+}
 
-    if (entry->obj->type == OBJ_INT) {
-        entry->obj->data.num += delta;
-        return entry->obj->data.num;
-    } else if (entry->obj->type == OBJ_STRING) {
-        int64_t num;
-        if (obj_try_parse_int(entry->obj->data.str, &num)) {
-            obj_free(entry->obj);
-            entry->obj = obj_create_int(num + delta);
-            return num + delta;
-        }
+dbobj_t *db_take(database_t *db, const char *key) {
+    ht_entry_t *he = ht_get_entry(db->ht, key);
+    if (!he) return NULL;
+    db_entry_t *entry = (db_entry_t *)he->value;
+    dbobj_t *obj = NULL;
+    if (entry->expire < 0 || imdb_mstime() <= entry->expire) {
+        obj = entry->obj;
+        entry->obj = NULL;
     }
-    return INT64_MIN; /* type error */
+    ht_delete_entry(db->ht, he);
+    return obj;
 }
 
 /* ---- List operations ---- */
 
+void db_set_ready_hook(database_t *db, db_ready_fn fn, void *ctx) {
+    db->ready_fn = fn;
+    db->ready_ctx = ctx;
+}
+
+void db_signal_ready(database_t *db, const char *key) {
+    if (db->ready_fn) db->ready_fn(db->ready_ctx, key);
+}
+
+/* Only a freshly created list can have clients blocked on it */
 static db_entry_t *get_or_create_list(database_t *db, const char *key) {
-    check_expired(db, key);
-    db_entry_t *entry = (db_entry_t *)ht_get(db->ht, key);
+    db_entry_t *entry = lookup_live(db, key);
     if (!entry) {
         entry = imdb_malloc(sizeof(db_entry_t));
         entry->obj = obj_create_list();
         entry->expire = -1;
         ht_set(db->ht, key, entry);
+        db_signal_ready(db, key);
     }
     return entry;
 }
 
-int db_lpush(database_t *db, const char *key, const char *value) {
+int db_lpush(database_t *db, const char *key, const char *value, size_t len) {
     db_entry_t *entry = get_or_create_list(db, key);
     if (entry->obj->type != OBJ_LIST) return -1;
-    list_lpush(entry->obj->data.list, value);
+    list_lpush(entry->obj->data.list, value, len);
     return (int)list_length(entry->obj->data.list);
 }
 
-int db_rpush(database_t *db, const char *key, const char *value) {
+int db_rpush(database_t *db, const char *key, const char *value, size_t len) {
     db_entry_t *entry = get_or_create_list(db, key);
     if (entry->obj->type != OBJ_LIST) return -1;
-    list_rpush(entry->obj->data.list, value);
+    list_rpush(entry->obj->data.list, value, len);
     return (int)list_length(entry->obj->data.list);
 }
 
-char *db_lpop(database_t *db, const char *key) {
+static int64_t push_many(database_t *db, const char *key, const char **values,
+                         const size_t *lens, size_t count, int head) {
+    db_entry_t *entry = get_or_create_list(db, key);
+    if (entry->obj->type != OBJ_LIST) return -1;
+    list_push_many(entry->obj->data.list, values, lens, count, head);
+    return (int64_t)list_length(entry->obj->data.list);
+}
+
+int64_t db_lpush_many(database_t *db, const char *key, const char **values,
+                      const size_t *lens, size_t count) {
+    return push_many(db, key, values, lens, count, 1);
+}
+
+int64_t db_rpush_many(database_t *db, const char *key, const char **values,
+                      const size_t *lens, size_t count) {
+    return push_many(db, key, values, lens, count, 0);
+}
+
+static int64_t pop_count(database_t *db, const char *key, size_t count, int head,
+                         list_pop_fn fn, void *ctx) {
+    db_entry_t *entry = lookup_live(db, key);
+    if (!entry) return 0;
+    if (entry->obj->type != OBJ_LIST) return -1;
+    size_t popped = list_pop_many(entry->obj->data.list, count, head, fn, ctx);
+    if (list_length(entry->obj->data.list) == 0) ht_delete(db->ht, key);
+    return (int64_t)popped;
+}
+
+int64_t db_lpop_count(database_t *db, const char *key, size_t count, list_pop_fn fn, void *ctx) {
+    return pop_count(db, key, count, 1, fn, ctx);
+}
+
+int64_t db_rpop_count(database_t *db, const char *key, size_t count, list_pop_fn fn, void *ctx) {
+    return pop_count(db, key, count, 0, fn, ctx);
+}
+
+char *db_lpop(database_t *db, const char *key, size_t *len) {
     if (check_expired(db, key)) return NULL;
     db_entry_t *entry = (db_entry_t *)ht_get(db->ht, key);
     if (!entry || entry->obj->type != OBJ_LIST) return NULL;
-    char *val = list_lpop(entry->obj->data.list);
+    char *val = list_lpop(entry->obj->data.list, len);
     if (list_length(entry->obj->data.list) == 0) ht_delete(db->ht, key);
     return val;
 }
 
-char *db_rpop(database_t *db, const char *key) {
+char *db_rpop(database_t *db, const char *key, size_t *len) {
     if (check_expired(db, key)) return NULL;
     db_entry_t *entry = (db_entry_t *)ht_get(db->ht, key);
     if (!entry || entry->obj->type != OBJ_LIST) return NULL;
-    char *val = list_rpop(entry->obj->data.list);
+    char *val = list_rpop(entry->obj->data.list, len);
     if (list_length(entry->obj->data.list) == 0) ht_delete(db->ht, key);
     return val;
 }
@@ -163,20 +261,157 @@ int64_t db_llen(database_t *db, const char *key) {
     return (int64_t)list_length(entry->obj->data.list);
 }
 
-char **db_lrange(database_t *db, const char *key, int start, int stop, size_t *count) {
-    *count = 0;
-    if (check_expired(db, key)) return NULL;
-    db_entry_t *entry = (db_entry_t *)ht_get(db->ht, key);
-    if (!entry || entry->obj->type != OBJ_LIST) return NULL;
-    return list_range(entry->obj->data.list, start, stop, count);
+list_t *db_get_list(database_t *db, const char *key, int *wrongtype) {
+    *wrongtype = 0;
+    db_entry_t *entry = lookup_live(db, key);
+    if (!entry) return NULL;
+    if (entry->obj->type != OBJ_LIST) {
+        *wrongtype = 1;
+        return NULL;
+    }
+    return entry->obj->data.list;
+}
+
+/* ---- Hash, sorted set, set, stream and sketch operations ---- */
+
+/* Live object of the given type at key; NULL with *wrongtype set on a type mismatch */
+static dbobj_t *lookup_typed(database_t *db, const char *key, obj_type_t type, int *wrongtype) {
+    *wrongtype = 0;
+    db_entry_t *entry = lookup_live(db, key);
+    if (!entry) return NULL;
+    if (entry->obj->type != type) {
+        *wrongtype = 1;
+        return NULL;
+    }
+    return entry->obj;
+}
+
+hash_t *db_get_hash(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_HASH, wrongtype);
+    return obj ? obj->data.hash : NULL;
+}
+
+hash_t *db_get_or_create_hash(database_t *db, const char *key, int *wrongtype) {
+    hash_t *hash = db_get_hash(db, key, wrongtype);
+    if (hash || *wrongtype) return hash;
+    return add_object(db, key, obj_create_hash())->data.hash;
+}
+
+zset_t *db_get_zset(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_ZSET, wrongtype);
+    return obj ? obj->data.zset : NULL;
+}
+
+zset_t *db_get_or_create_zset(database_t *db, const char *key, int *wrongtype) {
+    zset_t *zs = db_get_zset(db, key, wrongtype);
+    if (zs || *wrongtype) return zs;
+    return add_object(db, key, obj_create_zset())->data.zset;
+}
+
+set_t *db_get_set(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_SET, wrongtype);
+    return obj ? obj->data.set : NULL;
+}
+
+set_t *db_get_or_create_set(database_t *db, const char *key, int *wrongtype) {
+    set_t *set = db_get_set(db, key, wrongtype);
+    if (set || *wrongtype) return set;
+    return add_object(db, key, obj_create_set())->data.set;
+}
+
+void db_store_set(database_t *db, const char *key, set_t *set) {
+    if (set_length(set) == 0) {
+        set_destroy(set);
+        db_del(db, key);
+        return;
+    }
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_SET;
+    obj->data.set = set;
+    add_object(db, key, obj);
+}
+
+stream_t *db_get_stream(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_STREAM, wrongtype);
+    return obj ? obj->data.stream : NULL;
+}
+
+stream_t *db_get_or_create_stream(database_t *db, const char *key, int *wrongtype) {
+    stream_t *s = db_get_stream(db, key, wrongtype);
+    if (s || *wrongtype) return s;
+    return add_object(db, key, obj_create_stream())->data.stream;
+}
+
+cms_t *db_get_cms(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_CMS, wrongtype);
+    return obj ? obj->data.cms : NULL;
+}
+
+topk_t *db_get_topk(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_TOPK, wrongtype);
+    return obj ? obj->data.topk : NULL;
+}
+
+void db_store_cms(database_t *db, const char *key, cms_t *cms) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_CMS;
+    obj->data.cms = cms;
+    add_object(db, key, obj);
+}
+
+void db_store_topk(database_t *db, const char *key, topk_t *topk) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_TOPK;
+    obj->data.topk = topk;
+    add_object(db, key, obj);
+}
+
+vset_t *db_get_vset(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_VSET, wrongtype);
+    return obj ? obj->data.vset : NULL;
+}
+
+void db_store_vset(database_t *db, const char *key, vset_t *vs) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_VSET;
+    obj->data.vset = vs;
+    add_object(db, key, obj);
+}
+
+bloom_t *db_get_bloom(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_BLOOM, wrongtype);
+    return obj ? obj->data.bloom : NULL;
+}
+
+cuckoo_t *db_get_cuckoo(database_t *db, const char *key, int *wrongtype) {
+    dbobj_t *obj = lookup_typed(db, key, OBJ_CUCKOO, wrongtype);
+    return obj ? obj->data.cuckoo : NULL;
+}
+
+void db_store_bloom(database_t *db, const char *key, bloom_t *bf) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_BLOOM;
+    obj->data.bloom = bf;
+    add_object(db, key, obj);
+}
+
+void db_store_cuckoo(database_t *db, const char *key, cuckoo_t *cf) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_CUCKOO;
+    obj->data.cuckoo = cf;
+    add_object(db, key, obj);
 }
 
 /* ---- TTL operations ---- */
 
 int db_expire(database_t *db, const char *key, int64_t seconds) {
+    return db_expire_at(db, key, imdb_mstime() + seconds * 1000);
+}
+
+int db_expire_at(database_t *db, const char *key, int64_t ms) {
     db_entry_t *entry = db_get_entry(db, key);
     if (!entry) return 0;
-    entry->expire = imdb_mstime() + seconds * 1000;
+    entry->expire = ms;
     return 1;
 }
 
@@ -206,6 +441,47 @@ size_t db_size(database_t *db) {
 void db_flush(database_t *db) {
     ht_destroy(db->ht);
     db->ht = ht_create(64, entry_free);
+    if (db->changed) db->changed_all = 1;
+}
+
+void db_adopt(database_t *db, database_t *other) {
+    ht_destroy(db->ht);
+    db->ht = other->ht;
+    other->ht = NULL;
+    db_destroy(other);
+}
+
+/* ---- Delta checkpoints ---- */
+
+void db_track_changes(database_t *db) {
+    if (!db->changed) db->changed = ht_create(64, NULL);
+}
+
+void db_mark_changed(database_t *db, const char *key) {
+    if (db->changed && !db->changed_all && !ht_exists(db->changed, key)) ht_set(db->changed, key, NULL);
+}
+
+void db_checkpoint_begin(database_t *db) {
+    if (!db->changed || db->checkpointing) return;
+    db->checkpointing = db->changed;
+    db->checkpointing_all = db->changed_all;
+    db->changed = ht_create(64, NULL);
+    db->changed_all = 0;
+}
+
+void db_checkpoint_end(database_t *db, int ok) {
+    if (!db->checkpointing) return;
+    if (!ok) {
+        /* Still unsaved: merge back whatever changed meanwhile */
+        ht_iter_t it;
+        ht_entry_t *e;
+        ht_iter_init(&it, db->checkpointing);
+        while ((e = ht_iter_next(&it)) != NULL) db_mark_changed(db, e->key);
+        db->changed_all |= db->checkpointing_all;
+    }
+    ht_destroy(db->checkpointing);
+    db->checkpointing = NULL;
+    db->checkpointing_all = 0;
 }
 
 /* Periodic expiry: sample random keys and delete expired ones */
@@ -235,6 +511,20 @@ void db_expire_sweep(database_t *db) {
     }
 }
 
+int64_t db_memory_usage(database_t *db, const char *key, size_t samples) {
+    if (check_expired(db, key)) return -1;
+    ht_entry_t *he = ht_get_entry(db->ht, key);
+    if (!he) return -1;
+    db_entry_t *entry = (db_entry_t *)he->value;
+    size_t total = sizeof(ht_entry_t) + imdb_malloc_size(he->key) + imdb_malloc_size(entry);
+    total += obj_mem_usage(entry->obj, samples);
+    return (int64_t)total;
+}
+
+size_t db_directory_bytes(database_t *db) {
+    return imdb_malloc_size(db->ht->entries);
+}
+
 hashtable_t *db_get_ht(database_t *db) {
     return db->ht;
 }
@@ -11,9 +11,18 @@ typedef struct {
     int64_t expire; /* -1 = no expiry, otherwise ms timestamp */
 } db_entry_t;
 
+/* Called when a key gains data that blocked clients may be waiting for */
+typedef void (*db_ready_fn)(void *ctx, const char *key);
+
 typedef struct {
     hashtable_t *ht;
     int64_t last_expire_sweep;
+    db_ready_fn ready_fn;
+    void *ready_ctx;
+    hashtable_t *changed;       /* keys written since the last checkpoint; NULL when not tracked */
+    hashtable_t *checkpointing; /* changed keys frozen for the checkpoint being written */
+    int changed_all;            /* flushed since the last checkpoint: only a full snapshot will do */
+    int checkpointing_all;
 } database_t;
 
 /* Create / destroy */
@@ -21,32 +30,115 @@ database_t *db_create(void);
 void db_destroy(database_t *db);
 
 /* String/Int operations */
-int db_set(database_t *db, const char *key, const char *value);
+int db_set(database_t *db, const char *key, const char *value, size_t len);
+/* Set only if the key is missing; returns 1 if it was set */
+int db_setnx(database_t *db, const char *key, const char *value, size_t len);
 dbobj_t *db_get(database_t *db, const char *key);
 int db_del(database_t *db, const char *key);
 int db_exists(database_t *db, const char *key);
-int64_t db_incr(database_t *db, const char *key, int64_t delta);
+/* Add delta to an integer value (a missing key counts as 0) and store the
+ * result in *out. Returns 1, 0 if the value is not an integer, or -1 on overflow. */
+int db_incr(database_t *db, const char *key, int64_t delta, int64_t *out);
+/* Remove a key and hand its value to the caller (who frees it with
+ * obj_free); NULL if the key is missing */
+dbobj_t *db_take(database_t *db, const char *key);
+/* String object at key for in-place edits: an integer value is converted to
+ * its string form and a missing key gets an empty string. NULL with
+ * *wrongtype set if the key holds another type. */
+dbobj_t *db_get_or_create_string(database_t *db, const char *key, int *wrongtype);
 
 /* List operations */
-int db_lpush(database_t *db, const char *key, const char *value);
-int db_rpush(database_t *db, const char *key, const char *value);
-char *db_lpop(database_t *db, const char *key);
-char *db_rpop(database_t *db, const char *key);
+int db_lpush(database_t *db, const char *key, const char *value, size_t len);
+int db_rpush(database_t *db, const char *key, const char *value, size_t len);
+/* Push all values after a single key lookup; returns the new length or -1 on type error */
+int64_t db_lpush_many(database_t *db, const char *key, const char **values,
+                      const size_t *lens, size_t count);
+int64_t db_rpush_many(database_t *db, const char *key, const char **values,
+                      const size_t *lens, size_t count);
+
+/* Pop up to count values, streaming each to fn; returns the number popped or -1 on type error */
+int64_t db_lpop_count(database_t *db, const char *key, size_t count, list_pop_fn fn, void *ctx);
+int64_t db_rpop_count(database_t *db, const char *key, size_t count, list_pop_fn fn, void *ctx);
+
+char *db_lpop(database_t *db, const char *key, size_t *len);
+char *db_rpop(database_t *db, const char *key, size_t *len);
 int64_t db_llen(database_t *db, const char *key);
-char **db_lrange(database_t *db, const char *key, int start, int stop, size_t *count);
+/* Returns the list at key, or NULL (with *wrongtype set if the key holds another type) */
+list_t *db_get_list(database_t *db, const char *key, int *wrongtype);
+
+/* Hash operations: NULL with *wrongtype set if the key holds another type.
+ * The create variant adds an empty hash when the key is missing. */
+hash_t *db_get_hash(database_t *db, const char *key, int *wrongtype);
+hash_t *db_get_or_create_hash(database_t *db, const char *key, int *wrongtype);
+
+/* Sorted set operations, same conventions as the hash ones */
+zset_t *db_get_zset(database_t *db, const char *key, int *wrongtype);
+zset_t *db_get_or_create_zset(database_t *db, const char *key, int *wrongtype);
+
+/* Set operations, same conventions as the hash ones */
+set_t *db_get_set(database_t *db, const char *key, int *wrongtype);
+set_t *db_get_or_create_set(database_t *db, const char *key, int *wrongtype);
+/* Replace whatever key holds with `set` (taking ownership, clearing any TTL); an empty set deletes the key */
+void db_store_set(database_t *db, const char *key, set_t *set);
+
+/* Stream operations, same conventions as the hash ones */
+stream_t *db_get_stream(database_t *db, const char *key, int *wrongtype);
+stream_t *db_get_or_create_stream(database_t *db, const char *key, int *wrongtype);
+
+/* Sketches: lookups follow the hash conventions; the store variants add a
+ * new sketch at key (taking ownership), replacing whatever it held */
+cms_t *db_get_cms(database_t *db, const char *key, int *wrongtype);
+topk_t *db_get_topk(database_t *db, const char *key, int *wrongtype);
+void db_store_cms(database_t *db, const char *key, cms_t *cms);
+void db_store_topk(database_t *db, const char *key, topk_t *topk);
+
+/* Vector sets, same conventions as the sketches */
+vset_t *db_get_vset(database_t *db, const char *key, int *wrongtype);
+void db_store_vset(database_t *db, const char *key, vset_t *vs);
+
+/* Bloom and cuckoo filters, same conventions */
+bloom_t *db_get_bloom(database_t *db, const char *key, int *wrongtype);
+cuckoo_t *db_get_cuckoo(database_t *db, const char *key, int *wrongtype);
+void db_store_bloom(database_t *db, const char *key, bloom_t *bf);
+void db_store_cuckoo(database_t *db, const char *key, cuckoo_t *cf);
 
 /* TTL operations */
 int db_expire(database_t *db, const char *key, int64_t seconds);
+int db_expire_at(database_t *db, const char *key, int64_t ms); /* absolute ms timestamp */
 int64_t db_ttl(database_t *db, const char *key);
 int db_persist(database_t *db, const char *key);
 
+/* Register the hook notified when a list is created by a push or a stream gains entries */
+void db_set_ready_hook(database_t *db, db_ready_fn fn, void *ctx);
+
+/* Notify the hook that key gained data */
+void db_signal_ready(database_t *db, const char *key);
+
+/* Delta checkpoints: once tracking starts, every key a write touches is
+ * remembered until a checkpoint covering it succeeds. A checkpoint freezes
+ * the set with db_checkpoint_begin (the keys a delta must hold) and calls
+ * db_checkpoint_end when done; a failed one puts the keys back. */
+void db_track_changes(database_t *db);
+void db_mark_changed(database_t *db, const char *key);
+void db_checkpoint_begin(database_t *db);
+void db_checkpoint_end(database_t *db, int ok);
+
 /* Utility */
 size_t db_size(database_t *db);
 void db_flush(database_t *db);
+/* Replace db's keys with other's and destroy other (a dataset loaded on
+ * another thread); db keeps its hooks and change tracking */
+void db_adopt(database_t *db, database_t *other);
 
 /* Periodic expiry sweep — call from event loop */
 void db_expire_sweep(database_t *db);
 
+/* Estimated bytes used by a key, its entry and value; -1 if missing */
+int64_t db_memory_usage(database_t *db, const char *key, size_t samples);
+
+/* Bytes held by the hashtable slot array */
+size_t db_directory_bytes(database_t *db);
+
 /* Get raw entry (for persistence) */
 db_entry_t *db_get_entry(database_t *db, const char *key);
 
@@ -0,0 +1,210 @@
+#include "hash.h"
+#include "listpack.h"
+#include "config.h"
+#include "util.h"
+#include <string.h>
+
+#define FIELD_STACK_LEN 128
+
+static void value_free(void *ptr) {
+    imdb_free(ptr);
+}
+
+static hash_value_t *value_create(const char *value, size_t len) {
+    hash_value_t *v = imdb_malloc(sizeof(hash_value_t) + len + 1);
+    v->len = len;
+    memcpy(v->buf, value, len);
+    v->buf[len] = '\0';
+    return v;
+}
+
+/* Hashtable keys are C strings; short fields are terminated on the stack */
+#define field_cstr(f, len, stack, heap) imdb_cstr((f), (len), (stack), FIELD_STACK_LEN, (heap))
+
+/* Find the field entry in a listpack hash; NULL if absent */
+static unsigned char *lp_find_field(unsigned char *lp, const char *field, size_t flen) {
+    unsigned char *p = lp_first(lp);
+    while (p) {
+        size_t len;
+        const char *f = lp_get(p, &len);
+        if (len == flen && memcmp(f, field, flen) == 0) return p;
+        p = lp_next(lp, lp_next(lp, p));
+    }
+    return NULL;
+}
+
+static int fits_listpack(size_t flen, size_t vlen) {
+    return flen <= g_config.hash_max_listpack_value && vlen <= g_config.hash_max_listpack_value;
+}
+
+static void convert_to_ht(hash_t *hash) {
+    unsigned char *lp = hash->data.lp;
+    hashtable_t *ht = ht_create(lp_length(lp), value_free);
+    char stack[FIELD_STACK_LEN], *heap;
+
+    for (unsigned char *p = lp_first(lp); p; p = lp_next(lp, lp_next(lp, p))) {
+        size_t flen, vlen;
+        const char *f = lp_get(p, &flen);
+        const char *v = lp_get(lp_next(lp, p), &vlen);
+        ht_set(ht, field_cstr(f, flen, stack, &heap), value_create(v, vlen));
+        imdb_free(heap);
+    }
+    lp_free(lp);
+    hash->encoding = HASH_ENC_HT;
+    hash->data.ht = ht;
+}
+
+/* ---- Public API ---- */
+
+hash_t *hash_create(void) {
+    hash_t *hash = imdb_malloc(sizeof(hash_t));
+    hash->encoding = HASH_ENC_LISTPACK;
+    hash->data.lp = lp_new();
+    return hash;
+}
+
+void hash_destroy(hash_t *hash) {
+    if (!hash) return;
+    if (hash->encoding == HASH_ENC_LISTPACK) lp_free(hash->data.lp);
+    else ht_destroy(hash->data.ht);
+    imdb_free(hash);
+}
+
+hash_t *hash_from_listpack(unsigned char *lp, size_t size) {
+    if (!lp_validate(lp, size) || lp_length(lp) % 2 != 0) return NULL;
+    hash_t *hash = imdb_malloc(sizeof(hash_t));
+    hash->encoding = HASH_ENC_LISTPACK;
+    hash->data.lp = lp;
+
+    /* Limits may have been lowered since the snapshot was written */
+    int convert = lp_length(lp) / 2 > g_config.hash_max_listpack_entries;
+    for (unsigned char *p = lp_first(lp); p && !convert; p = lp_next(lp, p)) {
+        size_t len;
+        lp_get(p, &len);
+        convert = len > g_config.hash_max_listpack_value;
+    }
+    if (convert) convert_to_ht(hash);
+    return hash;
+}
+
+size_t hash_length(const hash_t *hash) {
+    if (hash->encoding == HASH_ENC_LISTPACK) return lp_length(hash->data.lp) / 2;
+    return ht_size(hash->data.ht);
+}
+
+int hash_set(hash_t *hash, const char *field, size_t flen, const char *value, size_t vlen) {
+    if (hash->encoding == HASH_ENC_LISTPACK) {
+        unsigned char *lp = hash->data.lp;
+        unsigned char *p = lp_find_field(lp, field, flen);
+        if (p && fits_listpack(flen, vlen)) {
+            hash->data.lp = lp_replace(lp, lp_next(lp, p), value, vlen, NULL);
+            return 0;
+        }
+        if (!p && fits_listpack(flen, vlen) &&
+            lp_length(lp) / 2 < g_config.hash_max_listpack_entries) {
+            const char *pair[2] = { field, value };
+            size_t lens[2] = { flen, vlen };
+            hash->data.lp = lp_append_many(lp, pair, lens, 2);
+            return 1;
+        }
+        convert_to_ht(hash);
+    }
+
+    char stack[FIELD_STACK_LEN], *heap;
+    const char *key = field_cstr(field, flen, stack, &heap);
+    ht_entry_t *e = ht_get_entry(hash->data.ht, key);
+    int added = e == NULL;
+    if (e) {
+        value_free(e->value);
+        e->value = value_create(value, vlen);
+    } else {
+        ht_set(hash->data.ht, key, value_create(value, vlen));
+    }
+    imdb_free(heap);
+    return added;
+}
+
+int hash_get(hash_t *hash, const char *field, size_t flen, const char **value, size_t *vlen) {
+    if (hash->encoding == HASH_ENC_LISTPACK) {
+        unsigned char *lp = hash->data.lp;
+        unsigned char *p = lp_find_field(lp, field, flen);
+        if (!p) return 0;
+        *value = lp_get(lp_next(lp, p), vlen);
+        return 1;
+    }
+
+    char stack[FIELD_STACK_LEN], *heap;
+    hash_value_t *v = ht_get(hash->data.ht, field_cstr(field, flen, stack, &heap));
+    imdb_free(heap);
+    if (!v) return 0;
+    *value = v->buf;
+    *vlen = v->len;
+    return 1;
+}
+
+int hash_delete(hash_t *hash, const char *field, size_t flen) {
+    if (hash->encoding == HASH_ENC_LISTPACK) {
+        unsigned char *lp = hash->data.lp;
+        unsigned char *p = lp_find_field(lp, field, flen);
+        if (!p) return 0;
+        unsigned char *v;
+        lp = lp_delete(lp, p, &v);
+        hash->data.lp = lp_delete(lp, v, NULL);
+        return 1;
+    }
+
+    char stack[FIELD_STACK_LEN], *heap;
+    int deleted = ht_delete(hash->data.ht, field_cstr(field, flen, stack, &heap));
+    imdb_free(heap);
+    return deleted;
+}
+
+void hash_iter_init(hash_iter_t *it, hash_t *hash) {
+    it->hash = hash;
+    if (hash->encoding == HASH_ENC_LISTPACK) {
+        it->pos = lp_first(hash->data.lp);
+    } else {
+        it->pos = NULL;
+        ht_iter_init(&it->ht_it, hash->data.ht);
+    }
+}
+
+int hash_iter_next(hash_iter_t *it, const char **field, size_t *flen,
+                   const char **value, size_t *vlen) {
+    if (it->hash->encoding == HASH_ENC_LISTPACK) {
+        unsigned char *lp = it->hash->data.lp;
+        if (!it->pos) return 0;
+        unsigned char *v = lp_next(lp, it->pos);
+        *field = lp_get(it->pos, flen);
+        *value = lp_get(v, vlen);
+        it->pos = lp_next(lp, v);
+        return 1;
+    }
+
+    ht_entry_t *e = ht_iter_next(&it->ht_it);
+    if (!e) return 0;
+    hash_value_t *v = e->value;
+    *field = e->key;
+    *flen = strlen(e->key);
+    *value = v->buf;
+    *vlen = v->len;
+    return 1;
+}
+
+size_t hash_mem_usage(hash_t *hash, size_t samples) {
+    size_t total = imdb_malloc_size(hash);
+    if (hash->encoding == HASH_ENC_LISTPACK) return total + imdb_malloc_size(hash->data.lp);
+
+    hashtable_t *ht = hash->data.ht;
+    total += imdb_malloc_size(ht) + imdb_malloc_size(ht->entries);
+    size_t seen = 0, bytes = 0;
+    ht_iter_t it;
+    ht_iter_init(&it, ht);
+    ht_entry_t *e;
+    while ((samples == 0 || seen < samples) && (e = ht_iter_next(&it)) != NULL) {
+        bytes += imdb_malloc_size(e->key) + imdb_malloc_size(e->value);
+        seen++;
+    }
+    if (seen > 0) total += bytes / seen * ht_size(ht);
+    return total;
+}
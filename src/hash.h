@@ -0,0 +1,67 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "hashtable.h"
+#include <stddef.h>
+
+/*
+ * Hash: a field -> value map stored under one key. Small hashes keep
+ * fields and values as alternating entries of a single listpack and are
+ * searched linearly; a hash that grows past `hash-max-listpack-entries`
+ * fields or receives a field or value longer than `hash-max-listpack-value`
+ * bytes is converted to a hashtable. Conversion is one-way.
+ */
+typedef enum {
+    HASH_ENC_LISTPACK,
+    HASH_ENC_HT
+} hash_encoding_t;
+
+typedef struct {
+    hash_encoding_t encoding;
+    union {
+        unsigned char *lp; /* field, value, field, value, ... */
+        hashtable_t *ht;   /* field -> hash_value_t */
+    } data;
+} hash_t;
+
+/* Value stored in the hashtable encoding */
+typedef struct {
+    size_t len;
+    char buf[];
+} hash_value_t;
+
+/* Iterator; field and value pointers are valid until the hash is modified */
+typedef struct {
+    hash_t *hash;
+    unsigned char *pos;
+    ht_iter_t ht_it;
+} hash_iter_t;
+
+/* Create / destroy */
+hash_t *hash_create(void);
+void hash_destroy(hash_t *hash);
+
+/* Adopt a listpack read from a snapshot; NULL if it is not a valid field/value pack */
+hash_t *hash_from_listpack(unsigned char *lp, size_t size);
+
+/* Number of fields */
+size_t hash_length(const hash_t *hash);
+
+/* Set a field; returns 1 if it was added, 0 if an existing value was replaced */
+int hash_set(hash_t *hash, const char *field, size_t flen, const char *value, size_t vlen);
+
+/* Look up a field; *value points into the hash until it is modified. Returns 1 if found. */
+int hash_get(hash_t *hash, const char *field, size_t flen, const char **value, size_t *vlen);
+
+/* Remove a field; returns 1 if it existed */
+int hash_delete(hash_t *hash, const char *field, size_t flen);
+
+/* Walk all fields in storage order */
+void hash_iter_init(hash_iter_t *it, hash_t *hash);
+int hash_iter_next(hash_iter_t *it, const char **field, size_t *flen,
+                   const char **value, size_t *vlen);
+
+/* Estimated bytes held by the hash; the hashtable encoding samples up to `samples` fields (0 = all) */
+size_t hash_mem_usage(hash_t *hash, size_t samples);
+
+#endif /* HASH_H */
@@ -5,8 +5,15 @@
 #define HT_INITIAL_CAP  64
 #define HT_LOAD_HIGH    0.70
 #define HT_LOAD_LOW     0.20
+#define HT_LOAD_FORCE   0.90  /* grow even while resizing is disabled */
 #define HT_MIN_CAP      64
 
+static int resize_enabled = 1;
+
+void ht_set_resize_enabled(int enabled) {
+    resize_enabled = enabled;
+}
+
 /* FNV-1a hash */
 uint32_t ht_hash(const char *key) {
     uint32_t h = 2166136261u;
@@ -39,7 +46,6 @@ hashtable_t *ht_create(size_t initial_capacity, ht_free_fn free_fn) {
     ht->entries = imdb_calloc(cap, sizeof(ht_entry_t));
     ht->capacity = cap;
     ht->size = 0;
-    ht->tombstones = 0;
     ht->free_fn = free_fn;
     return ht;
 }
@@ -47,7 +53,7 @@ hashtable_t *ht_create(size_t initial_capacity, ht_free_fn free_fn) {
 void ht_destroy(hashtable_t *ht) {
     if (!ht) return;
     for (size_t i = 0; i < ht->capacity; i++) {
-        if (ht->entries[i].occupied == 1) {
+        if (ht->entries[i].occupied) {
             imdb_free(ht->entries[i].key);
             if (ht->free_fn) ht->free_fn(ht->entries[i].value);
         }
@@ -56,82 +62,114 @@ void ht_destroy(hashtable_t *ht) {
     imdb_free(ht);
 }
 
-int ht_set(hashtable_t *ht, const char *key, void *value) {
-    /* Resize if load too high */
-    if ((ht->size + ht->tombstones + 1) * 100 / ht->capacity > (size_t)(HT_LOAD_HIGH * 100)) {
-        ht_resize(ht, ht->capacity * 2);
-    }
-
-    uint32_t h = ht_hash(key);
-    char *new_key = imdb_strdup(key);
-    void *new_value = value;
-    int is_new = 1;
-
-    for (size_t i = 0; ; i++) {
-        size_t idx = probe_index(ht->capacity, h, i);
-        ht_entry_t *e = &ht->entries[idx];
-
-        if (e->occupied == 0 || e->occupied == 2) {
-            /* Empty or tombstone slot — insert here */
-            if (e->occupied == 2) ht->tombstones--;
-            e->key = new_key;
-            e->value = new_value;
+/* Robin Hood placement of an entry known not to be in the table, starting
+ * at slot idx where it is dist steps from home: it takes the first slot
+ * whose entry is closer to home, and carries that entry on from there */
+static void ht_place(ht_entry_t *entries, size_t capacity, size_t idx, size_t dist,
+                     char *key, uint32_t h, void *value) {
+    for (;; idx = (idx + 1) & (capacity - 1), dist++) {
+        ht_entry_t *e = &entries[idx];
+
+        if (!e->occupied) {
+            e->key = key;
+            e->value = value;
             e->hash = h;
             e->occupied = 1;
-            ht->size++;
-            return is_new;
+            return;
         }
 
-        if (e->occupied == 1 && e->hash == h && strcmp(e->key, key) == 0) {
-            /* Key exists — update value */
-            if (ht->free_fn) ht->free_fn(e->value);
-            e->value = new_value;
-            imdb_free(new_key);
-            return 0; /* not new */
-        }
-
-        /* Robin Hood: if current entry has shorter probe distance, swap */
-        size_t cur_dist = probe_distance(ht->capacity, e->hash, idx);
-        size_t new_dist = probe_distance(ht->capacity, h, idx);
-        if (new_dist > cur_dist) {
+        size_t cur_dist = probe_distance(capacity, e->hash, idx);
+        if (dist > cur_dist) {
             /* Swap entries */
             char *tmp_key = e->key;
             void *tmp_val = e->value;
             uint32_t tmp_hash = e->hash;
 
-            e->key = new_key;
-            e->value = new_value;
+            e->key = key;
+            e->value = value;
             e->hash = h;
 
-            new_key = tmp_key;
-            new_value = tmp_val;
+            key = tmp_key;
+            value = tmp_val;
             h = tmp_hash;
-            is_new = 1;
+            dist = cur_dist;
         }
     }
 }
 
-static ht_entry_t *ht_find(hashtable_t *ht, const char *key) {
-    uint32_t h = ht_hash(key);
+/* owned is key itself when the table adopts the caller's copy, else NULL;
+ * h is ht_hash(key) */
+static int ht_insert(hashtable_t *ht, const char *key, uint32_t h, char *owned, void *value) {
+    /* Resize if load too high */
+    double limit = resize_enabled ? HT_LOAD_HIGH : HT_LOAD_FORCE;
+    if ((ht->size + 1) * 100 / ht->capacity > (size_t)(limit * 100)) {
+        ht_resize(ht, ht->capacity * 2);
+    }
+
+    /* One probe finds the key or the slot it belongs in: past an entry
+     * closer to its home than this key would be, the key cannot occur */
+    for (size_t i = 0; ; i++) {
+        size_t idx = probe_index(ht->capacity, h, i);
+        ht_entry_t *e = &ht->entries[idx];
+
+        if (e->occupied && e->hash == h && strcmp(e->key, key) == 0) {
+            /* Key exists — update value */
+            if (ht->free_fn) ht->free_fn(e->value);
+            e->value = value;
+            imdb_free(owned);
+            return 0;
+        }
+
+        if (!e->occupied || probe_distance(ht->capacity, e->hash, idx) < i) {
+            ht_place(ht->entries, ht->capacity, idx, i, owned ? owned : imdb_strdup(key), h, value);
+            ht->size++;
+            return 1;
+        }
+    }
+}
+
+int ht_set(hashtable_t *ht, const char *key, void *value) {
+    return ht_insert(ht, key, ht_hash(key), NULL, value);
+}
+
+int ht_set_owned(hashtable_t *ht, char *key, void *value) {
+    return ht_insert(ht, key, ht_hash(key), key, value);
+}
+
+int ht_set_owned_hashed(hashtable_t *ht, char *key, uint32_t hash, void *value) {
+    return ht_insert(ht, key, hash, key, value);
+}
 
+void ht_prefetch(const hashtable_t *ht, uint32_t hash) {
+    __builtin_prefetch(&ht->entries[probe_index(ht->capacity, hash, 0)]);
+}
+
+void ht_reserve(hashtable_t *ht, size_t n) {
+    size_t cap = ht->capacity;
+    while (n * 100 / cap > (size_t)(HT_LOAD_HIGH * 100)) cap <<= 1;
+    if (cap > ht->capacity) ht_resize(ht, cap);
+}
+
+static ht_entry_t *ht_find_hashed(hashtable_t *ht, const char *key, uint32_t h) {
     for (size_t i = 0; ; i++) {
         size_t idx = probe_index(ht->capacity, h, i);
         ht_entry_t *e = &ht->entries[idx];
 
-        if (e->occupied == 0) return NULL;
+        if (!e->occupied) return NULL;
 
-        if (e->occupied == 1) {
-            size_t dist = probe_distance(ht->capacity, e->hash, idx);
-            if (i > dist) return NULL; /* Robin Hood guarantee */
+        size_t dist = probe_distance(ht->capacity, e->hash, idx);
+        if (i > dist) return NULL; /* Robin Hood guarantee */
 
-            if (e->hash == h && strcmp(e->key, key) == 0) {
-                return e;
-            }
+        if (e->hash == h && strcmp(e->key, key) == 0) {
+            return e;
         }
-        /* occupied == 2 (tombstone): keep probing */
     }
 }
 
+static ht_entry_t *ht_find(hashtable_t *ht, const char *key) {
+    return ht_find_hashed(ht, key, ht_hash(key));
+}
+
 void *ht_get(hashtable_t *ht, const char *key) {
     ht_entry_t *e = ht_find(ht, key);
     return e ? e->value : NULL;
@@ -144,22 +182,35 @@ ht_entry_t *ht_get_entry(hashtable_t *ht, const char *key) {
 int ht_delete(hashtable_t *ht, const char *key) {
     ht_entry_t *e = ht_find(ht, key);
     if (!e) return 0;
+    ht_delete_entry(ht, e);
+    return 1;
+}
 
+/* Backward-shift deletion: the entries after e that are not in their home
+ * slot move back one, so no tombstone is left and every entry stays
+ * ordered by probe distance, which the early exits above depend on */
+void ht_delete_entry(hashtable_t *ht, ht_entry_t *e) {
     imdb_free(e->key);
     if (ht->free_fn) ht->free_fn(e->value);
-    e->key = NULL;
-    e->value = NULL;
-    e->occupied = 2; /* tombstone */
+
+    size_t idx = (size_t)(e - ht->entries);
+    for (;;) {
+        size_t next = (idx + 1) & (ht->capacity - 1);
+        ht_entry_t *n = &ht->entries[next];
+        if (!n->occupied || probe_distance(ht->capacity, n->hash, next) == 0) break;
+        ht->entries[idx] = *n;
+        idx = next;
+    }
+    ht->entries[idx].key = NULL;
+    ht->entries[idx].value = NULL;
+    ht->entries[idx].occupied = 0;
     ht->size--;
-    ht->tombstones++;
 
     /* Shrink if load too low */
-    if (ht->capacity > HT_MIN_CAP &&
+    if (resize_enabled && ht->capacity > HT_MIN_CAP &&
         ht->size * 100 / ht->capacity < (size_t)(HT_LOAD_LOW * 100)) {
         ht_resize(ht, ht->capacity / 2);
     }
-
-    return 1;
 }
 
 int ht_exists(hashtable_t *ht, const char *key) {
@@ -178,36 +229,12 @@ static void ht_resize(hashtable_t *ht, size_t new_cap) {
 
     ht->entries = imdb_calloc(new_cap, sizeof(ht_entry_t));
     ht->capacity = new_cap;
-    ht->size = 0;
-    ht->tombstones = 0;
 
+    /* Re-insert without duplicating key strings */
     for (size_t i = 0; i < old_cap; i++) {
-        if (old_entries[i].occupied == 1) {
-            /* Re-insert without duplicating key strings */
-            uint32_t h = old_entries[i].hash;
-            char *k = old_entries[i].key;
-            void *v = old_entries[i].value;
-
-            for (size_t j = 0; ; j++) {
-                size_t idx = probe_index(new_cap, h, j);
-                ht_entry_t *e = &ht->entries[idx];
-                if (e->occupied == 0) {
-                    e->key = k;
-                    e->value = v;
-                    e->hash = h;
-                    e->occupied = 1;
-                    ht->size++;
-                    break;
-                }
-                /* Robin Hood during resize */
-                size_t cur_dist = probe_distance(new_cap, e->hash, idx);
-                size_t new_dist = probe_distance(new_cap, h, idx);
-                if (new_dist > cur_dist) {
-                    char *tk = e->key; void *tv = e->value; uint32_t th = e->hash;
-                    e->key = k; e->value = v; e->hash = h;
-                    k = tk; v = tv; h = th;
-                }
-            }
+        ht_entry_t *e = &old_entries[i];
+        if (e->occupied) {
+            ht_place(ht->entries, new_cap, probe_index(new_cap, e->hash, 0), 0, e->key, e->hash, e->value);
         }
     }
 
@@ -223,7 +250,7 @@ ht_entry_t *ht_iter_next(ht_iter_t *iter) {
     while (iter->index < iter->ht->capacity) {
         ht_entry_t *e = &iter->ht->entries[iter->index];
         iter->index++;
-        if (e->occupied == 1) return e;
+        if (e->occupied) return e;
     }
     return NULL;
 }
@@ -8,7 +8,7 @@ typedef struct {
     char *key;
     void *value;
     uint32_t hash;
-    int occupied; /* 0 = empty, 1 = occupied, 2 = tombstone */
+    int occupied; /* 0 = empty, 1 = occupied */
 } ht_entry_t;
 
 typedef void (*ht_free_fn)(void *value);
@@ -17,7 +17,6 @@ typedef struct {
     ht_entry_t *entries;
     size_t capacity;
     size_t size;       /* number of occupied entries */
-    size_t tombstones; /* number of tombstones */
     ht_free_fn free_fn;
 } hashtable_t;
 
@@ -33,6 +32,12 @@ void ht_destroy(hashtable_t *ht);
 
 /* Core operations */
 int ht_set(hashtable_t *ht, const char *key, void *value);
+/* ht_set adopting key (from imdb_malloc) instead of copying it */
+int ht_set_owned(hashtable_t *ht, char *key, void *value);
+/* ht_set_owned with hash = ht_hash(key) already computed, e.g. on another
+ * thread; ht_prefetch pulls in the slot such an insert probes first */
+int ht_set_owned_hashed(hashtable_t *ht, char *key, uint32_t hash, void *value);
+void ht_prefetch(const hashtable_t *ht, uint32_t hash);
 void *ht_get(hashtable_t *ht, const char *key);
 int ht_delete(hashtable_t *ht, const char *key);
 int ht_exists(hashtable_t *ht, const char *key);
@@ -40,13 +45,24 @@ int ht_exists(hashtable_t *ht, const char *key);
 /* Get entry pointer (for TTL checks etc.) */
 ht_entry_t *ht_get_entry(hashtable_t *ht, const char *key);
 
+/* Delete an entry found by ht_get_entry, saving a second probe */
+void ht_delete_entry(hashtable_t *ht, ht_entry_t *e);
+
 /* Size */
 size_t ht_size(hashtable_t *ht);
 
+/* Grow once so that n entries fit without further resizing */
+void ht_reserve(hashtable_t *ht, size_t n);
+
 /* Iterator */
 void ht_iter_init(ht_iter_t *iter, hashtable_t *ht);
 ht_entry_t *ht_iter_next(ht_iter_t *iter);
 
+/* While disabled (a forked child is writing a snapshot) tables do not
+ * shrink and grow only when nearly full, so the parent copies fewer pages
+ * shared with the child. Applies to every table in the process. */
+void ht_set_resize_enabled(int enabled);
+
 /* Hash function (FNV-1a) */
 uint32_t ht_hash(const char *key);
 
@@ -0,0 +1,284 @@
+#include "hyperloglog.h"
+#include "simd.h"
+#include "config.h"
+#include "util.h"
+#include <math.h>
+#include <string.h>
+
+#define HLL_Q (64 - HLL_P)            /* hash bits left for the run of zeros */
+#define HLL_MAX_VALUE (HLL_Q + 1)
+#define HLL_ENC_DENSE  0
+#define HLL_ENC_SPARSE 1
+#define HLL_STALE 0x80                /* in the last header byte */
+#define HLL_SPARSE_ENTRY 3
+
+/* ---- Header ---- */
+
+static int is_dense(const char *buf) {
+    return buf[4] == HLL_ENC_DENSE;
+}
+
+static void invalidate(char *buf) {
+    buf[15] = (char)((unsigned char)buf[15] | HLL_STALE);
+}
+
+static int cache_valid(const char *buf) {
+    return ((unsigned char)buf[15] & HLL_STALE) == 0;
+}
+
+static uint64_t cache_get(const char *buf) {
+    const unsigned char *p = (const unsigned char *)buf + 8;
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static void cache_set(char *buf, uint64_t card) {
+    unsigned char *p = (unsigned char *)buf + 8;
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(card >> (8 * i));
+    buf[15] = (char)(p[7] & ~HLL_STALE);
+}
+
+static char *alloc_hll(size_t len, int encoding) {
+    char *buf = imdb_calloc(len + 1, 1);
+    memcpy(buf, "HYLL", 4);
+    buf[4] = (char)encoding;
+    return buf;
+}
+
+/* ---- Hashing ---- */
+
+#define HLL_HASH_SEED 0xadc83b19ULL
+
+/* Register index and value (position of the first set bit after the index bits) */
+static uint8_t hash_register(const char *ele, size_t elen, uint32_t *index) {
+    uint64_t h = imdb_hash64(ele, elen, HLL_HASH_SEED);
+    *index = (uint32_t)(h & (HLL_REGISTERS - 1));
+    h >>= HLL_P;
+    h |= 1ULL << HLL_Q; /* bounds the run at HLL_Q zeros */
+    uint8_t count = 1;
+    while ((h & 1) == 0) {
+        count++;
+        h >>= 1;
+    }
+    return count;
+}
+
+/* ---- Dense registers (6 bits each, packed little-endian) ---- */
+
+static uint8_t dense_get(const unsigned char *regs, uint32_t i) {
+    uint32_t byte = i * 6 / 8, bit = i * 6 & 7;
+    unsigned v = regs[byte] >> bit;
+    if (bit > 2) v |= (unsigned)regs[byte + 1] << (8 - bit);
+    return (uint8_t)(v & 63);
+}
+
+static void dense_set(unsigned char *regs, uint32_t i, uint8_t val) {
+    uint32_t byte = i * 6 / 8, bit = i * 6 & 7;
+    regs[byte] = (unsigned char)((regs[byte] & ~(63u << bit)) | ((unsigned)val << bit));
+    if (bit > 2) {
+        unsigned hi = 8 - bit;
+        regs[byte + 1] = (unsigned char)((regs[byte + 1] & ~(63u >> hi)) | (val >> hi));
+    }
+}
+
+/* Unpack all registers, four at a time from each 3-byte group */
+static void dense_unpack(const unsigned char *p, uint8_t *out) {
+    for (uint32_t i = 0; i < HLL_REGISTERS; i += 4, p += 3) {
+        out[i]     = p[0] & 63;
+        out[i + 1] = (uint8_t)(((p[0] >> 6) | (p[1] << 2)) & 63);
+        out[i + 2] = (uint8_t)(((p[1] >> 4) | (p[2] << 4)) & 63);
+        out[i + 3] = p[2] >> 2;
+    }
+}
+
+static void dense_pack(const uint8_t *in, unsigned char *p) {
+    for (uint32_t i = 0; i < HLL_REGISTERS; i += 4, p += 3) {
+        p[0] = (unsigned char)(in[i] | (in[i + 1] << 6));
+        p[1] = (unsigned char)((in[i + 1] >> 2) | (in[i + 2] << 4));
+        p[2] = (unsigned char)((in[i + 2] >> 4) | (in[i + 3] << 2));
+    }
+}
+
+/* ---- Sparse entries ---- */
+
+static uint32_t sparse_entry(const unsigned char *p, uint8_t *val) {
+    uint32_t e = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    *val = (uint8_t)(e >> HLL_P);
+    return e & (HLL_REGISTERS - 1);
+}
+
+static void sparse_write(unsigned char *p, uint32_t index, uint8_t val) {
+    uint32_t e = index | (uint32_t)val << HLL_P;
+    p[0] = (unsigned char)e;
+    p[1] = (unsigned char)(e >> 8);
+    p[2] = (unsigned char)(e >> 16);
+}
+
+static char *sparse_to_dense(char *buf, size_t len, size_t *out_len) {
+    char *dense = alloc_hll(HLL_DENSE_SIZE, HLL_ENC_DENSE);
+    memcpy(dense + 5, buf + 5, HLL_HDR_SIZE - 5);
+    unsigned char *regs = (unsigned char *)dense + HLL_HDR_SIZE;
+    for (size_t off = HLL_HDR_SIZE; off < len; off += HLL_SPARSE_ENTRY) {
+        uint8_t val;
+        uint32_t index = sparse_entry((unsigned char *)buf + off, &val);
+        dense_set(regs, index, val);
+    }
+    imdb_free(buf);
+    *out_len = HLL_DENSE_SIZE;
+    return dense;
+}
+
+/* ---- Estimation ---- */
+
+static double hll_sigma(double x) {
+    if (x == 1.0) return INFINITY;
+    double y = 1.0, z = x, prev;
+    do {
+        x *= x;
+        prev = z;
+        z += x * y;
+        y += y;
+    } while (prev != z);
+    return z;
+}
+
+static double hll_tau(double x) {
+    if (x == 0.0 || x == 1.0) return 0.0;
+    double y = 1.0, z = 1 - x, prev;
+    do {
+        x = sqrt(x);
+        prev = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (prev != z);
+    return z / 3;
+}
+
+/* Ertl's improved raw estimator over a histogram of register values */
+static uint64_t estimate(const uint32_t *hist) {
+    const double m = HLL_REGISTERS;
+    double z = m * hll_tau((m - hist[HLL_MAX_VALUE]) / m);
+    for (int k = HLL_Q; k >= 1; k--) {
+        z += hist[k];
+        z *= 0.5;
+    }
+    z += m * hll_sigma(hist[0] / m);
+    return (uint64_t)llround(0.5 / log(2.0) * m * m / z);
+}
+
+static uint64_t count_uncached(const char *buf, size_t len) {
+    uint32_t hist[64] = {0};
+    if (is_dense(buf)) {
+        uint8_t regs[HLL_REGISTERS];
+        dense_unpack((const unsigned char *)buf + HLL_HDR_SIZE, regs);
+        for (uint32_t i = 0; i < HLL_REGISTERS; i++) hist[regs[i]]++;
+    } else {
+        size_t n = (len - HLL_HDR_SIZE) / HLL_SPARSE_ENTRY;
+        hist[0] = HLL_REGISTERS - (uint32_t)n;
+        for (size_t off = HLL_HDR_SIZE; off < len; off += HLL_SPARSE_ENTRY) {
+            uint8_t val;
+            sparse_entry((const unsigned char *)buf + off, &val);
+            hist[val]++;
+        }
+    }
+    return estimate(hist);
+}
+
+/* ---- Public API ---- */
+
+char *hll_create(size_t *len) {
+    *len = HLL_HDR_SIZE;
+    return alloc_hll(HLL_HDR_SIZE, HLL_ENC_SPARSE);
+}
+
+int hll_validate(const char *buf, size_t len) {
+    if (len < HLL_HDR_SIZE || memcmp(buf, "HYLL", 4) != 0) return 0;
+    if (is_dense(buf)) return len == HLL_DENSE_SIZE;
+    if (buf[4] != HLL_ENC_SPARSE || (len - HLL_HDR_SIZE) % HLL_SPARSE_ENTRY != 0) return 0;
+
+    int64_t prev = -1;
+    for (size_t off = HLL_HDR_SIZE; off < len; off += HLL_SPARSE_ENTRY) {
+        uint8_t val;
+        uint32_t index = sparse_entry((const unsigned char *)buf + off, &val);
+        if ((int64_t)index <= prev || val == 0 || val > HLL_MAX_VALUE) return 0;
+        prev = index;
+    }
+    return 1;
+}
+
+int hll_add(char **buf, size_t *len, const char *ele, size_t elen) {
+    uint32_t index;
+    uint8_t val = hash_register(ele, elen, &index);
+    char *b = *buf;
+
+    if (!is_dense(b)) {
+        /* Binary search for the register's entry or insertion point */
+        size_t lo = 0, hi = (*len - HLL_HDR_SIZE) / HLL_SPARSE_ENTRY;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            uint8_t cur;
+            uint32_t at = sparse_entry((unsigned char *)b + HLL_HDR_SIZE + mid * HLL_SPARSE_ENTRY, &cur);
+            if (at == index) {
+                if (val <= cur) return 0;
+                sparse_write((unsigned char *)b + HLL_HDR_SIZE + mid * HLL_SPARSE_ENTRY, index, val);
+                invalidate(b);
+                return 1;
+            }
+            if (at < index) lo = mid + 1;
+            else hi = mid;
+        }
+        if (*len - HLL_HDR_SIZE + HLL_SPARSE_ENTRY <= g_config.hll_sparse_max_bytes) {
+            size_t off = HLL_HDR_SIZE + lo * HLL_SPARSE_ENTRY;
+            b = imdb_realloc(b, *len + HLL_SPARSE_ENTRY + 1);
+            memmove(b + off + HLL_SPARSE_ENTRY, b + off, *len - off + 1);
+            sparse_write((unsigned char *)b + off, index, val);
+            *len += HLL_SPARSE_ENTRY;
+            invalidate(b);
+            *buf = b;
+            return 1;
+        }
+        b = *buf = sparse_to_dense(b, *len, len);
+    }
+
+    unsigned char *regs = (unsigned char *)b + HLL_HDR_SIZE;
+    if (val <= dense_get(regs, index)) return 0;
+    dense_set(regs, index, val);
+    invalidate(b);
+    return 1;
+}
+
+uint64_t hll_count(char *buf, size_t len) {
+    if (cache_valid(buf)) return cache_get(buf);
+    uint64_t card = count_uncached(buf, len);
+    cache_set(buf, card);
+    return card;
+}
+
+void hll_merge_raw(uint8_t *regs, const char *buf, size_t len) {
+    if (is_dense(buf)) {
+        uint8_t tmp[HLL_REGISTERS];
+        dense_unpack((const unsigned char *)buf + HLL_HDR_SIZE, tmp);
+        simd_max_u8(regs, tmp, HLL_REGISTERS);
+        return;
+    }
+    for (size_t off = HLL_HDR_SIZE; off < len; off += HLL_SPARSE_ENTRY) {
+        uint8_t val;
+        uint32_t index = sparse_entry((const unsigned char *)buf + off, &val);
+        if (val > regs[index]) regs[index] = val;
+    }
+}
+
+uint64_t hll_count_raw(const uint8_t *regs) {
+    uint32_t hist[256] = {0};
+    for (uint32_t i = 0; i < HLL_REGISTERS; i++) hist[regs[i]]++;
+    return estimate(hist);
+}
+
+char *hll_from_raw(const uint8_t *regs, size_t *len) {
+    char *buf = alloc_hll(HLL_DENSE_SIZE, HLL_ENC_DENSE);
+    dense_pack(regs, (unsigned char *)buf + HLL_HDR_SIZE);
+    invalidate(buf);
+    *len = HLL_DENSE_SIZE;
+    return buf;
+}
@@ -0,0 +1,45 @@
+#ifndef HYPERLOGLOG_H
+#define HYPERLOGLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * HyperLogLog cardinality estimator stored as a plain string value, so it
+ * round-trips through GET/SET and snapshots unchanged.
+ *
+ * Layout: 16-byte header ("HYLL", encoding byte, 3 reserved bytes, 8-byte
+ * little-endian cached cardinality whose top bit marks it stale) followed
+ * by the registers. 2^14 registers of 6 bits each make the dense body 12KB.
+ * The sparse body lists only non-zero registers as 3-byte entries
+ * (index | value << 14) in index order; it turns dense once it grows past
+ * `hll-sparse-max-bytes`. Buffers keep a NUL byte after `len` like every
+ * other string value.
+ */
+#define HLL_P 14
+#define HLL_REGISTERS (1 << HLL_P)
+#define HLL_HDR_SIZE 16
+#define HLL_DENSE_SIZE (HLL_HDR_SIZE + HLL_REGISTERS * 6 / 8)
+
+/* New empty estimator; *len receives its size */
+char *hll_create(size_t *len);
+
+/* Returns 1 if the bytes form a well-formed estimator */
+int hll_validate(const char *buf, size_t len);
+
+/* Add an element; *buf may be reallocated. Returns 1 if a register changed. */
+int hll_add(char **buf, size_t *len, const char *ele, size_t elen);
+
+/* Estimated cardinality, served from (and stored into) the header cache */
+uint64_t hll_count(char *buf, size_t len);
+
+/* Fold the estimator into an array of HLL_REGISTERS byte registers (max per register) */
+void hll_merge_raw(uint8_t *regs, const char *buf, size_t len);
+
+/* Estimate from byte registers */
+uint64_t hll_count_raw(const uint8_t *regs);
+
+/* Dense estimator holding the given byte registers */
+char *hll_from_raw(const uint8_t *regs, size_t *len);
+
+#endif /* HYPERLOGLOG_H */
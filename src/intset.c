@@ -0,0 +1,196 @@
+#include "intset.h"
+#include "simd.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INTSET_HDR_SIZE sizeof(intset_t)
+
+static uint32_t value_encoding(int64_t v) {
+    return (v < INT32_MIN || v > INT32_MAX) ? INTSET_ENC_INT64 : INTSET_ENC_INT32;
+}
+
+static int64_t get_encoded(const intset_t *is, size_t pos, uint32_t enc) {
+    if (enc == INTSET_ENC_INT64) {
+        int64_t v;
+        memcpy(&v, is->contents + pos * sizeof(v), sizeof(v));
+        return v;
+    }
+    int32_t v;
+    memcpy(&v, is->contents + pos * sizeof(v), sizeof(v));
+    return v;
+}
+
+static void set_value(intset_t *is, size_t pos, int64_t value) {
+    if (is->encoding == INTSET_ENC_INT64) {
+        memcpy(is->contents + pos * sizeof(int64_t), &value, sizeof(int64_t));
+    } else {
+        int32_t v = (int32_t)value;
+        memcpy(is->contents + pos * sizeof(int32_t), &v, sizeof(int32_t));
+    }
+}
+
+static intset_t *resize(intset_t *is, size_t length) {
+    return imdb_realloc(is, INTSET_HDR_SIZE + length * is->encoding);
+}
+
+/* Binary search; returns 1 if found. *pos receives the value's position or insertion point. */
+static int search(const intset_t *is, int64_t value, size_t *pos) {
+    size_t lo = 0, hi = is->length;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int64_t cur = get_encoded(is, mid, is->encoding);
+        if (cur < value) lo = mid + 1;
+        else if (cur > value) hi = mid;
+        else {
+            *pos = mid;
+            return 1;
+        }
+    }
+    *pos = lo;
+    return 0;
+}
+
+/* Widen every value to the new encoding, back to front so nothing is overwritten early */
+static intset_t *upgrade(intset_t *is, uint32_t encoding) {
+    uint32_t old = is->encoding;
+    is->encoding = encoding;
+    is = resize(is, is->length);
+    for (size_t i = is->length; i-- > 0;) set_value(is, i, get_encoded(is, i, old));
+    return is;
+}
+
+/* ---- Public API ---- */
+
+intset_t *intset_new(void) {
+    intset_t *is = imdb_malloc(INTSET_HDR_SIZE);
+    is->encoding = INTSET_ENC_INT32;
+    is->length = 0;
+    return is;
+}
+
+void intset_free(intset_t *is) {
+    imdb_free(is);
+}
+
+size_t intset_length(const intset_t *is) {
+    return is->length;
+}
+
+size_t intset_bytes(const intset_t *is) {
+    return INTSET_HDR_SIZE + (size_t)is->length * is->encoding;
+}
+
+int64_t intset_get(const intset_t *is, size_t pos) {
+    return get_encoded(is, pos, is->encoding);
+}
+
+int intset_find(const intset_t *is, int64_t value) {
+    size_t pos;
+    return value_encoding(value) <= is->encoding && search(is, value, &pos);
+}
+
+intset_t *intset_add(intset_t *is, int64_t value, int *changed) {
+    if (changed) *changed = 0;
+    if (value_encoding(value) > is->encoding) is = upgrade(is, value_encoding(value));
+
+    size_t pos;
+    if (search(is, value, &pos)) return is;
+    is = resize(is, is->length + 1);
+    memmove(is->contents + (pos + 1) * is->encoding, is->contents + pos * is->encoding,
+            (is->length - pos) * is->encoding);
+    set_value(is, pos, value);
+    is->length++;
+    if (changed) *changed = 1;
+    return is;
+}
+
+intset_t *intset_remove(intset_t *is, int64_t value, int *changed) {
+    if (changed) *changed = 0;
+    size_t pos;
+    if (value_encoding(value) > is->encoding || !search(is, value, &pos)) return is;
+    memmove(is->contents + pos * is->encoding, is->contents + (pos + 1) * is->encoding,
+            (is->length - pos - 1) * is->encoding);
+    is->length--;
+    if (changed) *changed = 1;
+    return resize(is, is->length);
+}
+
+static int cmp_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+intset_t *intset_add_many(intset_t *is, int64_t *values, size_t n, size_t *added) {
+    *added = 0;
+    if (n == 0) return is;
+    qsort(values, n, sizeof(int64_t), cmp_int64);
+
+    uint32_t enc = is->encoding;
+    if (value_encoding(values[0]) > enc || value_encoding(values[n - 1]) > enc) enc = INTSET_ENC_INT64;
+
+    /* Merge into a fresh array, dropping duplicates on either side */
+    intset_t *out = imdb_malloc(INTSET_HDR_SIZE + (is->length + n) * enc);
+    out->encoding = enc;
+    size_t i = 0, j = 0, k = 0;
+    while (i < is->length || j < n) {
+        int64_t v;
+        if (j == n || (i < is->length && intset_get(is, i) < values[j])) {
+            v = intset_get(is, i++);
+        } else {
+            v = values[j++];
+            if (i < is->length && intset_get(is, i) == v) i++;
+            else if (k > 0 && get_encoded(out, k - 1, enc) == v) continue;
+            else (*added)++;
+        }
+        set_value(out, k++, v);
+    }
+    out->length = (uint32_t)k;
+    imdb_free(is);
+    return resize(out, k);
+}
+
+intset_t *intset_intersect(const intset_t *a, const intset_t *b) {
+    if (a->length > b->length) {
+        const intset_t *t = a;
+        a = b;
+        b = t;
+    }
+    intset_t *out = imdb_malloc(INTSET_HDR_SIZE + (size_t)a->length * a->encoding);
+    out->encoding = a->encoding;
+    size_t k = 0;
+
+    if (a->encoding == b->encoding && a->encoding == INTSET_ENC_INT32) {
+        k = simd_intersect_i32((const int32_t *)a->contents, a->length,
+                               (const int32_t *)b->contents, b->length, (int32_t *)out->contents);
+    } else if (a->encoding == b->encoding) {
+        k = simd_intersect_i64((const int64_t *)a->contents, a->length,
+                               (const int64_t *)b->contents, b->length, (int64_t *)out->contents);
+    } else {
+        /* Mixed widths: plain merge */
+        size_t i = 0, j = 0;
+        while (i < a->length && j < b->length) {
+            int64_t x = intset_get(a, i), y = intset_get(b, j);
+            if (x < y) i++;
+            else if (x > y) j++;
+            else {
+                set_value(out, k++, x);
+                i++;
+                j++;
+            }
+        }
+    }
+    out->length = (uint32_t)k;
+    return resize(out, k);
+}
+
+int intset_validate(const void *data, size_t size) {
+    const intset_t *is = data;
+    if (size < INTSET_HDR_SIZE) return 0;
+    if (is->encoding != INTSET_ENC_INT32 && is->encoding != INTSET_ENC_INT64) return 0;
+    if (size != INTSET_HDR_SIZE + (size_t)is->length * is->encoding) return 0;
+    for (size_t i = 1; i < is->length; i++) {
+        if (intset_get(is, i - 1) >= intset_get(is, i)) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,49 @@
+#ifndef INTSET_H
+#define INTSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Intset: a sorted array of distinct integers in one allocation.
+ * Values are stored as int32 while they all fit and the whole array is
+ * widened to int64 the first time a larger value is added. Lookups are
+ * binary searches; functions that modify the set may reallocate it and
+ * return the new pointer.
+ */
+typedef struct {
+    uint32_t encoding;  /* bytes per value: 4 or 8 */
+    uint32_t length;
+    int8_t contents[];
+} intset_t;
+
+#define INTSET_ENC_INT32 ((uint32_t)sizeof(int32_t))
+#define INTSET_ENC_INT64 ((uint32_t)sizeof(int64_t))
+
+intset_t *intset_new(void);
+void intset_free(intset_t *is);
+
+size_t intset_length(const intset_t *is);
+size_t intset_bytes(const intset_t *is);
+
+/* Value at a position (0 <= pos < length) */
+int64_t intset_get(const intset_t *is, size_t pos);
+
+/* Returns 1 if the value is present */
+int intset_find(const intset_t *is, int64_t value);
+
+/* Add or remove one value; *changed (if given) is set to 1 when the set changed */
+intset_t *intset_add(intset_t *is, int64_t value, int *changed);
+intset_t *intset_remove(intset_t *is, int64_t value, int *changed);
+
+/* Add n values with one sort and one merge pass; `values` is reordered.
+ * *added receives the number of values that were not already present. */
+intset_t *intset_add_many(intset_t *is, int64_t *values, size_t n, size_t *added);
+
+/* New set holding the values present in both */
+intset_t *intset_intersect(const intset_t *a, const intset_t *b);
+
+/* Check that `size` bytes form a well-formed set (for untrusted input) */
+int intset_validate(const void *data, size_t size);
+
+#endif /* INTSET_H */
@@ -1,7 +1,129 @@
 #include "list.h"
+#include "listpack.h"
+#include "lzf.h"
+#include "config.h"
 #include "util.h"
 #include <string.h>
 
+#define LIST_MIN_COMPRESS_BYTES 48  /* smaller blocks are not worth compressing */
+#define LIST_MIN_COMPRESS_GAIN  8
+
+/* ---- Block helpers ---- */
+
+static list_block_t *block_create(void) {
+    list_block_t *b = imdb_calloc(1, sizeof(list_block_t));
+    b->data = lp_new();
+    b->size = (uint32_t)lp_bytes(b->data);
+    return b;
+}
+
+static void block_free(list_block_t *b) {
+    imdb_free(b->data);
+    imdb_free(b);
+}
+
+static void block_compress(list_block_t *b) {
+    b->recompress = 0;
+    if (b->compressed || b->size < LIST_MIN_COMPRESS_BYTES) return;
+
+    unsigned char *out = imdb_malloc(b->size);
+    size_t n = lzf_compress(b->data, b->size, out, b->size - LIST_MIN_COMPRESS_GAIN);
+    if (n == 0) {
+        imdb_free(out);
+        return;
+    }
+    imdb_free(b->data);
+    b->data = imdb_realloc(out, n);
+    b->raw_size = b->size;
+    b->size = (uint32_t)n;
+    b->compressed = 1;
+}
+
+static void block_decompress(list_block_t *b) {
+    if (!b->compressed) return;
+    unsigned char *raw = imdb_malloc(b->raw_size);
+    lzf_decompress(b->data, b->size, raw, b->raw_size);
+    imdb_free(b->data);
+    b->data = raw;
+    b->size = b->raw_size;
+    b->compressed = 0;
+}
+
+/* Inflate a block for reading or writing; block_release undoes it */
+static void block_access(list_block_t *b) {
+    if (b->compressed) {
+        block_decompress(b);
+        b->recompress = 1;
+    }
+}
+
+static void block_release(list_block_t *b) {
+    if (b && b->recompress) block_compress(b);
+}
+
+static void block_update_size(list_block_t *b) {
+    b->size = (uint32_t)lp_bytes(b->data);
+}
+
+/*
+ * Keep the `depth` blocks at each end raw and the one just inside them
+ * compressed. Called whenever a block is added or removed at an end, so the
+ * invariant (everything further inside is compressed) is maintained in O(depth).
+ */
+static void list_compress_edges(list_t *list) {
+    int depth = g_config.list_compress_depth;
+    if (depth <= 0) return;
+
+    if (list->block_count < (size_t)depth * 2 + 1) {
+        for (list_block_t *b = list->head; b; b = b->next) block_decompress(b);
+        return;
+    }
+
+    list_block_t *fwd = list->head;
+    list_block_t *rev = list->tail;
+    for (int i = 0; i < depth; i++) {
+        block_decompress(fwd);
+        block_decompress(rev);
+        fwd = fwd->next;
+        rev = rev->prev;
+    }
+    block_compress(fwd);
+    block_compress(rev);
+}
+
+static void list_unlink_block(list_t *list, list_block_t *b) {
+    if (b->prev) b->prev->next = b->next;
+    else list->head = b->next;
+    if (b->next) b->next->prev = b->prev;
+    else list->tail = b->prev;
+    list->block_count--;
+    block_free(b);
+}
+
+static int block_has_room(list_block_t *b, size_t len) {
+    return b->size + lp_entry_size(len) <= g_config.list_max_block_bytes;
+}
+
+/* New empty block linked at the head or tail */
+static list_block_t *list_add_block(list_t *list, int head) {
+    list_block_t *b = block_create();
+    if (head) {
+        b->next = list->head;
+        if (list->head) list->head->prev = b;
+        else list->tail = b;
+        list->head = b;
+    } else {
+        b->prev = list->tail;
+        if (list->tail) list->tail->next = b;
+        else list->head = b;
+        list->tail = b;
+    }
+    list->block_count++;
+    return b;
+}
+
+/* ---- Public API ---- */
+
 list_t *list_create(void) {
     list_t *list = imdb_calloc(1, sizeof(list_t));
     return list;
@@ -9,100 +131,441 @@ list_t *list_create(void) {
 
 void list_destroy(list_t *list) {
     if (!list) return;
-    list_node_t *n = list->head;
-    while (n) {
-        list_node_t *next = n->next;
-        imdb_free(n->value);
-        imdb_free(n);
-        n = next;
+    list_block_t *b = list->head;
+    while (b) {
+        list_block_t *next = b->next;
+        block_free(b);
+        b = next;
     }
     imdb_free(list);
 }
 
-static list_node_t *make_node(const char *value) {
-    list_node_t *n = imdb_malloc(sizeof(list_node_t));
-    n->value = imdb_strdup(value);
-    n->prev = NULL;
-    n->next = NULL;
-    return n;
+void list_lpush(list_t *list, const char *value, size_t len) {
+    list_block_t *b = list->head;
+    int created = 0;
+    if (!b || !block_has_room(b, len)) {
+        b = list_add_block(list, 1);
+        created = 1;
+    }
+    b->data = lp_prepend(b->data, value, len);
+    block_update_size(b);
+    b->count++;
+    list->length++;
+    if (created) list_compress_edges(list);
 }
 
-void list_lpush(list_t *list, const char *value) {
-    list_node_t *n = make_node(value);
-    if (list->head) {
-        n->next = list->head;
-        list->head->prev = n;
-        list->head = n;
-    } else {
-        list->head = list->tail = n;
+void list_rpush(list_t *list, const char *value, size_t len) {
+    list_block_t *b = list->tail;
+    int created = 0;
+    if (!b || !block_has_room(b, len)) {
+        b = list_add_block(list, 0);
+        created = 1;
     }
+    b->data = lp_append(b->data, value, len);
+    block_update_size(b);
+    b->count++;
     list->length++;
+    if (created) list_compress_edges(list);
 }
 
-void list_rpush(list_t *list, const char *value) {
-    list_node_t *n = make_node(value);
-    if (list->tail) {
-        n->prev = list->tail;
-        list->tail->next = n;
-        list->tail = n;
-    } else {
-        list->head = list->tail = n;
+void list_push_many(list_t *list, const char **values, const size_t *lens, size_t count, int head) {
+    size_t i = 0;
+    while (i < count) {
+        list_block_t *b = head ? list->head : list->tail;
+        int created = 0;
+        if (!b || !block_has_room(b, lens[i])) {
+            b = list_add_block(list, head);
+            created = 1;
+        }
+
+        /* Take as many values as fit (at least one, so oversized values still land) */
+        size_t bytes = b->size + lp_entry_size(lens[i]);
+        size_t j = i + 1;
+        while (j < count && bytes + lp_entry_size(lens[j]) <= g_config.list_max_block_bytes) {
+            bytes += lp_entry_size(lens[j]);
+            j++;
+        }
+
+        block_access(b);
+        if (head) b->data = lp_prepend_many(b->data, values + i, lens + i, j - i);
+        else b->data = lp_append_many(b->data, values + i, lens + i, j - i);
+        block_update_size(b);
+        block_release(b);
+        b->count += (uint32_t)(j - i);
+        list->length += j - i;
+        if (created) list_compress_edges(list);
+        i = j;
     }
-    list->length++;
 }
 
-char *list_lpop(list_t *list) {
-    if (!list->head) return NULL;
-    list_node_t *n = list->head;
-    list->head = n->next;
-    if (list->head) list->head->prev = NULL;
-    else list->tail = NULL;
-    list->length--;
+size_t list_pop_many(list_t *list, size_t count, int head, list_pop_fn fn, void *ctx) {
+    size_t popped = 0;
+    while (popped < count) {
+        list_block_t *b = head ? list->head : list->tail;
+        if (!b) break;
 
-    char *val = n->value;
-    imdb_free(n);
-    return val;
+        size_t n = b->count;
+        if (n > count - popped) n = count - popped;
+        block_access(b);
+        unsigned char *p = head ? lp_first(b->data) : lp_last(b->data);
+        for (size_t i = 0; i < n; i++) {
+            size_t len;
+            const char *v = lp_get(p, &len);
+            fn(ctx, v, len);
+            p = head ? lp_next(b->data, p) : lp_prev(b->data, p);
+        }
+        popped += n;
+        list->length -= n;
+
+        if (n == b->count) {
+            list_unlink_block(list, b);
+            list_compress_edges(list);
+        } else {
+            b->data = lp_delete_range(b->data, head ? 0 : (long)(b->count - n), n);
+            b->count -= (uint32_t)n;
+            block_update_size(b);
+            block_release(b);
+        }
+    }
+    return popped;
 }
 
-char *list_rpop(list_t *list) {
-    if (!list->tail) return NULL;
-    list_node_t *n = list->tail;
-    list->tail = n->prev;
-    if (list->tail) list->tail->next = NULL;
-    else list->head = NULL;
-    list->length--;
+static char *list_pop(list_t *list, list_block_t *b, int head, size_t *len) {
+    if (!b) return NULL;
+    unsigned char *p = head ? lp_first(b->data) : lp_last(b->data);
+    size_t vlen;
+    const char *v = lp_get(p, &vlen);
+    char *val = imdb_memdup(v, vlen);
+    if (len) *len = vlen;
 
-    char *val = n->value;
-    imdb_free(n);
+    b->data = lp_delete(b->data, p, NULL);
+    block_update_size(b);
+    b->count--;
+    list->length--;
+    if (b->count == 0) {
+        list_unlink_block(list, b);
+        list_compress_edges(list);
+    }
     return val;
 }
 
+char *list_lpop(list_t *list, size_t *len) {
+    return list_pop(list, list->head, 1, len);
+}
+
+char *list_rpop(list_t *list, size_t *len) {
+    return list_pop(list, list->tail, 0, len);
+}
+
 size_t list_length(list_t *list) {
     return list->length;
 }
 
-char **list_range(list_t *list, int start, int stop, size_t *count) {
-    int len = (int)list->length;
+/* Block holding `index` and the offset inside it, walking from the nearer end */
+static list_block_t *list_locate(list_t *list, size_t index, size_t *offset) {
+    if (index >= list->length) return NULL;
+
+    list_block_t *b;
+    if (index < list->length / 2) {
+        b = list->head;
+        while (index >= b->count) {
+            index -= b->count;
+            b = b->next;
+        }
+    } else {
+        size_t from_end = list->length - 1 - index;
+        b = list->tail;
+        while (from_end >= b->count) {
+            from_end -= b->count;
+            b = b->prev;
+        }
+        index = b->count - 1 - from_end;
+    }
+    *offset = index;
+    return b;
+}
+
+/* Split an oversized block in two; the caller releases both and fixes edges */
+static list_block_t *block_split(list_t *list, list_block_t *b) {
+    list_block_t *nb = imdb_calloc(1, sizeof(list_block_t));
+    uint32_t keep = b->count / 2;
+    nb->data = lp_split(&b->data, keep);
+    nb->count = b->count - keep;
+    nb->recompress = b->recompress;
+    b->count = keep;
+    block_update_size(b);
+    block_update_size(nb);
+
+    nb->prev = b;
+    nb->next = b->next;
+    if (b->next) b->next->prev = nb;
+    else list->tail = nb;
+    b->next = nb;
+    list->block_count++;
+    return nb;
+}
+
+char *list_index(list_t *list, long index, size_t *len) {
+    if (index < 0) index += (long)list->length;
+    if (index < 0) return NULL;
+
+    size_t offset;
+    list_block_t *b = list_locate(list, (size_t)index, &offset);
+    if (!b) return NULL;
+    block_access(b);
+    const char *v = lp_get(lp_seek(b->data, (long)offset), len);
+    char *val = imdb_memdup(v, *len);
+    block_release(b);
+    return val;
+}
+
+int list_set(list_t *list, long index, const char *value, size_t len) {
+    if (index < 0) index += (long)list->length;
+    if (index < 0) return -1;
+
+    size_t offset;
+    list_block_t *b = list_locate(list, (size_t)index, &offset);
+    if (!b) return -1;
+    block_access(b);
+    b->data = lp_replace(b->data, lp_seek(b->data, (long)offset), value, len, NULL);
+    block_update_size(b);
+
+    /* A larger value can push the block past its limit, as an insert can */
+    list_block_t *nb = NULL;
+    if (b->size > g_config.list_max_block_bytes && b->count > 1) nb = block_split(list, b);
+    block_release(b);
+    if (nb) {
+        block_release(nb);
+        list_compress_edges(list);
+    }
+    return 0;
+}
+
+long list_insert(list_t *list, const char *pivot, size_t pivot_len,
+                 const char *value, size_t len, int after) {
+    for (list_block_t *b = list->head; b; b = b->next) {
+        block_access(b);
+        for (unsigned char *p = lp_first(b->data); p; p = lp_next(b->data, p)) {
+            size_t plen;
+            const char *v = lp_get(p, &plen);
+            if (plen != pivot_len || memcmp(v, pivot, plen) != 0) continue;
+
+            if (after) p = lp_next(b->data, p);
+            b->data = lp_insert(b->data, p, value, len, NULL);
+            block_update_size(b);
+            b->count++;
+            list->length++;
+
+            list_block_t *nb = NULL;
+            if (b->size > g_config.list_max_block_bytes && b->count > 1) nb = block_split(list, b);
+            block_release(b);
+            if (nb) {
+                block_release(nb);
+                list_compress_edges(list);
+            }
+            return (long)list->length;
+        }
+        block_release(b);
+    }
+    return -1;
+}
+
+size_t list_remove(list_t *list, const char *value, size_t len, long count) {
+    int forward = count >= 0;
+    size_t limit = count == 0 ? (size_t)-1 : (size_t)(count < 0 ? -count : count);
+    size_t removed = 0;
+    int unlinked = 0;
+
+    list_block_t *b = forward ? list->head : list->tail;
+    while (b && removed < limit) {
+        list_block_t *nb = forward ? b->next : b->prev;
+        block_access(b);
+
+        unsigned char *p = forward ? lp_first(b->data) : lp_last(b->data);
+        while (p && removed < limit) {
+            size_t vlen;
+            const char *v = lp_get(p, &vlen);
+            if (vlen != len || memcmp(v, value, len) != 0) {
+                p = forward ? lp_next(b->data, p) : lp_prev(b->data, p);
+                continue;
+            }
+            if (forward) {
+                b->data = lp_delete(b->data, p, &p);
+            } else {
+                /* Entries before p keep their offsets across the delete */
+                unsigned char *prev = lp_prev(b->data, p);
+                size_t prev_off = prev ? (size_t)(prev - b->data) : 0;
+                b->data = lp_delete(b->data, p, NULL);
+                p = prev ? b->data + prev_off : NULL;
+            }
+            b->count--;
+            list->length--;
+            removed++;
+        }
+
+        block_update_size(b);
+        if (b->count == 0) {
+            list_unlink_block(list, b);
+            unlinked = 1;
+        } else {
+            block_release(b);
+        }
+        b = nb;
+    }
+    if (unlinked) list_compress_edges(list);
+    return removed;
+}
+
+void list_delete_range(list_t *list, size_t index, size_t count) {
+    size_t offset;
+    list_block_t *b = list_locate(list, index, &offset);
+    int unlinked = 0;
+
+    while (b && count > 0) {
+        list_block_t *nb = b->next;
+        if (offset == 0 && count >= b->count) {
+            /* Whole block goes without being inflated */
+            count -= b->count;
+            list->length -= b->count;
+            list_unlink_block(list, b);
+            unlinked = 1;
+        } else {
+            size_t n = b->count - offset;
+            if (n > count) n = count;
+            block_access(b);
+            b->data = lp_delete_range(b->data, (long)offset, n);
+            block_update_size(b);
+            b->count -= (uint32_t)n;
+            list->length -= n;
+            count -= n;
+            block_release(b);
+        }
+        offset = 0;
+        b = nb;
+    }
+    if (unlinked) list_compress_edges(list);
+}
+
+void list_trim(list_t *list, long start, long stop) {
+    size_t len = list->length;
+    size_t keep = list_normalize_range(list, &start, &stop);
+    if (keep == 0) {
+        list_delete_range(list, 0, len);
+        return;
+    }
+    list_delete_range(list, (size_t)stop + 1, len - (size_t)stop - 1);
+    list_delete_range(list, 0, (size_t)start);
+}
+
+size_t list_normalize_range(list_t *list, long *start, long *stop) {
+    long len = (long)list->length;
 
     /* Convert negative indices */
-    if (start < 0) start = len + start;
-    if (stop < 0) stop = len + stop;
-    if (start < 0) start = 0;
-    if (stop >= len) stop = len - 1;
+    if (*start < 0) *start = len + *start;
+    if (*stop < 0) *stop = len + *stop;
+    if (*start < 0) *start = 0;
+    if (*stop >= len) *stop = len - 1;
+
+    if (*start > *stop || *start >= len) return 0;
+    return (size_t)(*stop - *start + 1);
+}
+
+void list_iter_init(list_iter_t *it, list_t *list, size_t index, int forward) {
+    it->list = list;
+    it->forward = forward;
+    it->block = NULL;
+    it->pos = NULL;
+    it->started = 0;
+
+    size_t offset;
+    list_block_t *b = list_locate(list, index, &offset);
+    if (!b) return;
+    block_access(b);
+    it->block = b;
+    it->pos = lp_seek(b->data, (long)offset);
+}
 
-    *count = 0;
-    if (start > stop || start >= len) return NULL;
+int list_iter_next(list_iter_t *it, const char **value, size_t *len) {
+    /* Advance lazily so the previously returned value stays valid until now */
+    if (it->started && it->pos) {
+        list_block_t *b = it->block;
+        it->pos = it->forward ? lp_next(b->data, it->pos) : lp_prev(b->data, it->pos);
+        if (!it->pos) {
+            list_block_t *nb = it->forward ? b->next : b->prev;
+            block_release(b);
+            it->block = nb;
+            if (nb) {
+                block_access(nb);
+                it->pos = it->forward ? lp_first(nb->data) : lp_last(nb->data);
+            }
+        }
+    }
+    it->started = 1;
+    if (!it->pos) return 0;
+    *value = lp_get(it->pos, len);
+    return 1;
+}
 
-    size_t n = (size_t)(stop - start + 1);
-    char **result = imdb_malloc(n * sizeof(char *));
+void list_iter_release(list_iter_t *it) {
+    if (it->pos) block_release(it->block);
+    it->pos = NULL;
+}
 
-    list_node_t *node = list->head;
-    for (int i = 0; i < start; i++) node = node->next;
+int list_append_block(list_t *list, unsigned char *data, uint32_t size, uint32_t raw_size) {
+    list_block_t *b = imdb_calloc(1, sizeof(list_block_t));
+    b->data = data;
+    b->size = size;
+
+    if (raw_size != size) {
+        b->raw_size = raw_size;
+        b->compressed = 1;
+        unsigned char *raw = imdb_malloc(raw_size);
+        int ok = lzf_decompress(data, size, raw, raw_size) == raw_size &&
+                 lp_validate(raw, raw_size);
+        if (ok) b->count = (uint32_t)lp_length(raw);
+        imdb_free(raw);
+        if (!ok) {
+            block_free(b);
+            return -1;
+        }
+    } else {
+        if (!lp_validate(data, size)) {
+            block_free(b);
+            return -1;
+        }
+        b->count = (uint32_t)lp_length(data);
+    }
+
+    if (b->count == 0) {
+        block_free(b);
+        return 0;
+    }
+    b->prev = list->tail;
+    if (list->tail) list->tail->next = b;
+    else list->head = b;
+    list->tail = b;
+    list->block_count++;
+    list->length += b->count;
+    return 0;
+}
+
+void list_compress_all(list_t *list) {
+    int depth = g_config.list_compress_depth;
+    size_t i = 0;
+    for (list_block_t *b = list->head; b; b = b->next, i++) {
+        int interior = depth > 0 && i >= (size_t)depth && i + depth < list->block_count;
+        if (interior) block_compress(b);
+        else block_decompress(b);
+    }
+}
 
-    for (size_t i = 0; i < n; i++) {
-        result[i] = node->value; /* borrowed pointer, not duplicated */
-        node = node->next;
+size_t list_mem_usage(list_t *list, size_t samples) {
+    size_t total = imdb_malloc_size(list);
+    size_t seen = 0, block_bytes = 0;
+    for (list_block_t *b = list->head; b && (samples == 0 || seen < samples); b = b->next) {
+        block_bytes += imdb_malloc_size(b) + imdb_malloc_size(b->data);
+        seen++;
     }
-    *count = n;
-    return result;
+    if (seen > 0) total += block_bytes / seen * list->block_count;
+    return total;
 }
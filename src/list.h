@@ -2,35 +2,100 @@
 #define LIST_H
 
 #include <stddef.h>
+#include <stdint.h>
 
-typedef struct list_node {
-    struct list_node *prev;
-    struct list_node *next;
-    char *value;
-} list_node_t;
+/*
+ * Quicklist: a doubly linked chain of blocks, each a listpack holding many
+ * entries. Blocks more than `list-compress-depth` away from either end are
+ * kept LZF-compressed and inflated only while they are being accessed.
+ */
+typedef struct list_block {
+    struct list_block *prev;
+    struct list_block *next;
+    unsigned char *data;  /* listpack, or its compressed form */
+    uint32_t count;       /* entries in the block */
+    uint32_t size;        /* bytes at data */
+    uint32_t raw_size;    /* listpack size when compressed */
+    uint8_t compressed;
+    uint8_t recompress;   /* inflated temporarily for an access */
+} list_block_t;
 
 typedef struct {
-    list_node_t *head;
-    list_node_t *tail;
+    list_block_t *head;
+    list_block_t *tail;
     size_t length;
+    size_t block_count;
 } list_t;
 
+/* Iterator over entries; values are valid until the next call */
+typedef struct {
+    list_t *list;
+    list_block_t *block;
+    unsigned char *pos;
+    int forward;
+    int started;
+} list_iter_t;
+
 /* Create / destroy */
 list_t *list_create(void);
 void list_destroy(list_t *list);
 
 /* Push operations */
-void list_lpush(list_t *list, const char *value);
-void list_rpush(list_t *list, const char *value);
+void list_lpush(list_t *list, const char *value, size_t len);
+void list_rpush(list_t *list, const char *value, size_t len);
+
+/* Push `count` values in one pass, filling each block with a single reallocation.
+ * Equivalent to pushing values[0], values[1], ... one at a time. */
+void list_push_many(list_t *list, const char **values, const size_t *lens, size_t count, int head);
+
+/* Pop operations (caller must free returned string; *len may be NULL) */
+char *list_lpop(list_t *list, size_t *len);
+char *list_rpop(list_t *list, size_t *len);
 
-/* Pop operations (caller must free returned string) */
-char *list_lpop(list_t *list);
-char *list_rpop(list_t *list);
+/* Pop up to `count` entries from the head or tail, handing each to fn while it
+ * is still in place (the pointer is only valid during the call). Returns the number popped. */
+typedef void (*list_pop_fn)(void *ctx, const char *value, size_t len);
+size_t list_pop_many(list_t *list, size_t count, int head, list_pop_fn fn, void *ctx);
 
 /* Length */
 size_t list_length(list_t *list);
 
-/* Range — returns array of strings, sets *count. Caller must free array (not strings). */
-char **list_range(list_t *list, int start, int stop, size_t *count);
+/* Copy of the entry at index (negative = from the end), or NULL if out of range */
+char *list_index(list_t *list, long index, size_t *len);
+
+/* Replace the entry at index. Returns 0, or -1 if out of range. */
+int list_set(list_t *list, long index, const char *value, size_t len);
+
+/* Insert before/after the first entry equal to pivot. Returns the new length, or -1 if not found. */
+long list_insert(list_t *list, const char *pivot, size_t pivot_len,
+                 const char *value, size_t len, int after);
+
+/* Remove up to |count| entries equal to value, from the head (count > 0),
+ * the tail (count < 0) or everywhere (count == 0). Returns the number removed. */
+size_t list_remove(list_t *list, const char *value, size_t len, long count);
+
+/* Delete `count` entries starting at index */
+void list_delete_range(list_t *list, size_t index, size_t count);
+
+/* Keep only [start, stop] (negative = from the end) */
+void list_trim(list_t *list, long start, long stop);
+
+/* Clamp start/stop (negative = from the end) to the list; returns the number of entries */
+size_t list_normalize_range(list_t *list, long *start, long *stop);
+
+/* Iterate from `index` towards the tail (forward) or head, entering from the nearer end */
+void list_iter_init(list_iter_t *it, list_t *list, size_t index, int forward);
+int list_iter_next(list_iter_t *it, const char **value, size_t *len);
+void list_iter_release(list_iter_t *it);
+
+/* Append a serialized block (listpack or its LZF form when raw_size != size).
+ * Takes ownership of data. Returns -1 if the block is malformed. */
+int list_append_block(list_t *list, unsigned char *data, uint32_t size, uint32_t raw_size);
+
+/* Compress every block outside the configured depth (after bulk loads) */
+void list_compress_all(list_t *list);
+
+/* Estimated bytes held by the list, extrapolated from up to `samples` blocks (0 = all) */
+size_t list_mem_usage(list_t *list, size_t samples);
 
 #endif /* LIST_H */
@@ -0,0 +1,307 @@
+#include "listpack.h"
+#include "util.h"
+#include <string.h>
+
+/* ---- Header helpers (little-endian) ---- */
+
+static uint32_t read_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+#define LP_TOTAL(lp)          read_u32(lp)
+#define LP_COUNT(lp)          read_u32((lp) + 4)
+#define LP_SET_TOTAL(lp, v)   write_u32(lp, (uint32_t)(v))
+#define LP_SET_COUNT(lp, v)   write_u32((lp) + 4, (uint32_t)(v))
+
+/* ---- Entry encoding ---- */
+
+static size_t varint_size(size_t v) {
+    size_t n = 1;
+    while (v >= 0x80) { v >>= 7; n++; }
+    return n;
+}
+
+static size_t varint_encode(unsigned char *p, size_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+static size_t varint_decode(const unsigned char *p, size_t *out) {
+    size_t v = 0, n = 0;
+    int shift = 0;
+    do {
+        v |= (size_t)(p[n] & 0x7f) << shift;
+        shift += 7;
+    } while (p[n++] & 0x80);
+    *out = v;
+    return n;
+}
+
+/* backlen: the leftmost byte has bit 7 clear, every byte to its right sets it,
+ * and the rightmost byte carries the lowest 7 bits. */
+static void backlen_encode(unsigned char *p, size_t v) {
+    size_t n = varint_size(v);
+    for (size_t i = 0; i < n; i++) {
+        size_t shift = 7 * (n - 1 - i);
+        p[i] = (unsigned char)(((v >> shift) & 0x7f) | (i > 0 ? 0x80 : 0));
+    }
+}
+
+/* Decode a backlen ending just before `end`; *n receives its byte size */
+static size_t backlen_decode(const unsigned char *end, size_t *n) {
+    size_t v = 0, i = 0;
+    int shift = 0;
+    unsigned char b;
+    do {
+        b = *(end - 1 - i);
+        v |= (size_t)(b & 0x7f) << shift;
+        shift += 7;
+        i++;
+    } while (b & 0x80);
+    *n = i;
+    return v;
+}
+
+size_t lp_entry_size(size_t len) {
+    size_t head = varint_size(len) + len;
+    return head + varint_size(head);
+}
+
+static size_t entry_size_at(const unsigned char *p) {
+    size_t len;
+    varint_decode(p, &len);
+    return lp_entry_size(len);
+}
+
+static size_t entry_encode(unsigned char *p, const char *data, size_t len) {
+    size_t n = varint_encode(p, len);
+    if (len) memcpy(p + n, data, len);
+    n += len;
+    backlen_encode(p + n, n);
+    return n + varint_size(n);
+}
+
+/* ---- Public API ---- */
+
+unsigned char *lp_new(void) {
+    unsigned char *lp = imdb_malloc(LP_HDR_SIZE);
+    LP_SET_TOTAL(lp, LP_HDR_SIZE);
+    LP_SET_COUNT(lp, 0);
+    return lp;
+}
+
+void lp_free(unsigned char *lp) {
+    imdb_free(lp);
+}
+
+size_t lp_bytes(const unsigned char *lp) {
+    return LP_TOTAL(lp);
+}
+
+size_t lp_length(const unsigned char *lp) {
+    return LP_COUNT(lp);
+}
+
+unsigned char *lp_first(unsigned char *lp) {
+    return LP_COUNT(lp) ? lp + LP_HDR_SIZE : NULL;
+}
+
+unsigned char *lp_last(unsigned char *lp) {
+    if (!LP_COUNT(lp)) return NULL;
+    return lp_prev(lp, lp + LP_TOTAL(lp));
+}
+
+unsigned char *lp_next(unsigned char *lp, unsigned char *p) {
+    unsigned char *q = p + entry_size_at(p);
+    return q < lp + LP_TOTAL(lp) ? q : NULL;
+}
+
+unsigned char *lp_prev(unsigned char *lp, unsigned char *p) {
+    if (p <= lp + LP_HDR_SIZE) return NULL;
+    size_t n;
+    size_t head = backlen_decode(p, &n);
+    return p - n - head;
+}
+
+unsigned char *lp_seek(unsigned char *lp, long index) {
+    long count = (long)LP_COUNT(lp);
+    if (index < 0) index += count;
+    if (index < 0 || index >= count) return NULL;
+
+    unsigned char *p;
+    if (index < count / 2) {
+        p = lp_first(lp);
+        while (index-- > 0) p = lp_next(lp, p);
+    } else {
+        p = lp_last(lp);
+        for (long i = count - 1; i > index; i--) p = lp_prev(lp, p);
+    }
+    return p;
+}
+
+const char *lp_get(const unsigned char *p, size_t *len) {
+    size_t n = varint_decode(p, len);
+    return (const char *)p + n;
+}
+
+unsigned char *lp_insert(unsigned char *lp, unsigned char *p, const char *data, size_t len,
+                         unsigned char **newp) {
+    size_t total = LP_TOTAL(lp);
+    size_t offset = p ? (size_t)(p - lp) : total;
+    size_t esize = lp_entry_size(len);
+
+    lp = imdb_realloc(lp, total + esize);
+    memmove(lp + offset + esize, lp + offset, total - offset);
+    entry_encode(lp + offset, data, len);
+    LP_SET_TOTAL(lp, total + esize);
+    LP_SET_COUNT(lp, LP_COUNT(lp) + 1);
+    if (newp) *newp = lp + offset;
+    return lp;
+}
+
+unsigned char *lp_append(unsigned char *lp, const char *data, size_t len) {
+    return lp_insert(lp, NULL, data, len, NULL);
+}
+
+unsigned char *lp_prepend(unsigned char *lp, const char *data, size_t len) {
+    return lp_insert(lp, lp_first(lp), data, len, NULL);
+}
+
+unsigned char *lp_append_many(unsigned char *lp, const char **values, const size_t *lens, size_t n) {
+    size_t total = LP_TOTAL(lp);
+    size_t add = 0;
+    for (size_t i = 0; i < n; i++) add += lp_entry_size(lens[i]);
+
+    lp = imdb_realloc(lp, total + add);
+    unsigned char *p = lp + total;
+    for (size_t i = 0; i < n; i++) p += entry_encode(p, values[i], lens[i]);
+    LP_SET_TOTAL(lp, total + add);
+    LP_SET_COUNT(lp, LP_COUNT(lp) + n);
+    return lp;
+}
+
+unsigned char *lp_prepend_many(unsigned char *lp, const char **values, const size_t *lens, size_t n) {
+    size_t total = LP_TOTAL(lp);
+    size_t add = 0;
+    for (size_t i = 0; i < n; i++) add += lp_entry_size(lens[i]);
+
+    lp = imdb_realloc(lp, total + add);
+    memmove(lp + LP_HDR_SIZE + add, lp + LP_HDR_SIZE, total - LP_HDR_SIZE);
+    unsigned char *p = lp + LP_HDR_SIZE;
+    for (size_t i = n; i > 0; i--) p += entry_encode(p, values[i - 1], lens[i - 1]);
+    LP_SET_TOTAL(lp, total + add);
+    LP_SET_COUNT(lp, LP_COUNT(lp) + n);
+    return lp;
+}
+
+unsigned char *lp_replace(unsigned char *lp, unsigned char *p, const char *data, size_t len,
+                          unsigned char **newp) {
+    size_t total = LP_TOTAL(lp);
+    size_t offset = (size_t)(p - lp);
+    size_t old_size = entry_size_at(p);
+    size_t new_size = lp_entry_size(len);
+    size_t tail = total - offset - old_size;
+
+    if (new_size > old_size) lp = imdb_realloc(lp, total - old_size + new_size);
+    memmove(lp + offset + new_size, lp + offset + old_size, tail);
+    entry_encode(lp + offset, data, len);
+    if (new_size < old_size) lp = imdb_realloc(lp, total - old_size + new_size);
+    LP_SET_TOTAL(lp, total - old_size + new_size);
+    if (newp) *newp = lp + offset;
+    return lp;
+}
+
+unsigned char *lp_delete(unsigned char *lp, unsigned char *p, unsigned char **next) {
+    size_t total = LP_TOTAL(lp);
+    size_t offset = (size_t)(p - lp);
+    size_t esize = entry_size_at(p);
+
+    memmove(lp + offset, lp + offset + esize, total - offset - esize);
+    lp = imdb_realloc(lp, total - esize);
+    LP_SET_TOTAL(lp, total - esize);
+    LP_SET_COUNT(lp, LP_COUNT(lp) - 1);
+    if (next) *next = offset < total - esize ? lp + offset : NULL;
+    return lp;
+}
+
+unsigned char *lp_delete_range(unsigned char *lp, long index, size_t count) {
+    unsigned char *first = lp_seek(lp, index);
+    if (!first || count == 0) return lp;
+
+    size_t total = LP_TOTAL(lp);
+    unsigned char *end = first;
+    size_t removed = 0;
+    while (removed < count && end) {
+        end = lp_next(lp, end);
+        removed++;
+    }
+    size_t start_off = (size_t)(first - lp);
+    size_t end_off = end ? (size_t)(end - lp) : total;
+
+    memmove(lp + start_off, lp + end_off, total - end_off);
+    lp = imdb_realloc(lp, total - (end_off - start_off));
+    LP_SET_TOTAL(lp, total - (end_off - start_off));
+    LP_SET_COUNT(lp, LP_COUNT(lp) - removed);
+    return lp;
+}
+
+unsigned char *lp_split(unsigned char **lp, size_t index) {
+    unsigned char *head = *lp;
+    size_t total = LP_TOTAL(head);
+    size_t count = LP_COUNT(head);
+    unsigned char *p = lp_seek(head, (long)index);
+    size_t offset = p ? (size_t)(p - head) : total;
+    size_t moved = total - offset;
+
+    unsigned char *tail = imdb_malloc(LP_HDR_SIZE + moved);
+    if (moved) memcpy(tail + LP_HDR_SIZE, head + offset, moved);
+    LP_SET_TOTAL(tail, LP_HDR_SIZE + moved);
+    LP_SET_COUNT(tail, p ? count - index : 0);
+
+    head = imdb_realloc(head, offset);
+    LP_SET_TOTAL(head, offset);
+    LP_SET_COUNT(head, p ? index : count);
+    *lp = head;
+    return tail;
+}
+
+int lp_validate(const unsigned char *lp, size_t size) {
+    if (size < LP_HDR_SIZE || LP_TOTAL(lp) != size) return 0;
+
+    const unsigned char *p = lp + LP_HDR_SIZE;
+    const unsigned char *end = lp + size;
+    size_t count = 0;
+    while (p < end) {
+        /* Bounded varint decode */
+        size_t len = 0, n = 0;
+        int shift = 0;
+        do {
+            if (p + n >= end || shift > 56) return 0;
+            len |= (size_t)(p[n] & 0x7f) << shift;
+            shift += 7;
+        } while (p[n++] & 0x80);
+
+        if (len > (size_t)(end - p)) return 0;
+        size_t esize = lp_entry_size(len);
+        if (esize > (size_t)(end - p)) return 0;
+
+        unsigned char expect[10];
+        backlen_encode(expect, n + len);
+        if (memcmp(p + n + len, expect, esize - n - len) != 0) return 0;
+        p += esize;
+        count++;
+    }
+    return count == LP_COUNT(lp);
+}
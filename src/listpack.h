@@ -0,0 +1,74 @@
+#ifndef LISTPACK_H
+#define LISTPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Listpack — a compact, contiguous sequence of length-prefixed entries.
+ *
+ * Layout:   [total_bytes(4)] [count(4)] [entry]*
+ * Entry:    [len varint] [data] [backlen]
+ *
+ * Header integers are little-endian. `backlen` stores the size of the
+ * len+data part, encoded so it can be decoded right-to-left; this lets
+ * the pack be walked in both directions without per-entry pointers.
+ *
+ * Functions that modify a pack may reallocate it and return the new
+ * pointer; entry pointers into the old buffer are invalidated.
+ */
+
+#define LP_HDR_SIZE 8
+
+/* Create / destroy */
+unsigned char *lp_new(void);
+void lp_free(unsigned char *lp);
+
+/* Sizes */
+size_t lp_bytes(const unsigned char *lp);
+size_t lp_length(const unsigned char *lp);
+
+/* Bytes an entry holding `len` bytes of data occupies */
+size_t lp_entry_size(size_t len);
+
+/* Navigation — return NULL past either end */
+unsigned char *lp_first(unsigned char *lp);
+unsigned char *lp_last(unsigned char *lp);
+unsigned char *lp_next(unsigned char *lp, unsigned char *p);
+unsigned char *lp_prev(unsigned char *lp, unsigned char *p);
+
+/* Entry at index; negative indices count from the end */
+unsigned char *lp_seek(unsigned char *lp, long index);
+
+/* Data of the entry at p */
+const char *lp_get(const unsigned char *p, size_t *len);
+
+/* Insert before p (p == NULL appends). *newp, if given, receives the new entry. */
+unsigned char *lp_insert(unsigned char *lp, unsigned char *p, const char *data, size_t len,
+                         unsigned char **newp);
+unsigned char *lp_append(unsigned char *lp, const char *data, size_t len);
+unsigned char *lp_prepend(unsigned char *lp, const char *data, size_t len);
+
+/* Add n entries with one reallocation. Prepending places values[n-1] first,
+ * matching n successive lp_prepend calls. */
+unsigned char *lp_append_many(unsigned char *lp, const char **values, const size_t *lens, size_t n);
+unsigned char *lp_prepend_many(unsigned char *lp, const char **values, const size_t *lens, size_t n);
+
+/* Replace the entry at p. *newp, if given, receives the replaced entry. */
+unsigned char *lp_replace(unsigned char *lp, unsigned char *p, const char *data, size_t len,
+                          unsigned char **newp);
+
+/* Delete the entry at p. *next, if given, receives the following entry or NULL. */
+unsigned char *lp_delete(unsigned char *lp, unsigned char *p, unsigned char **next);
+
+/* Delete `count` entries starting at index (negative counts from the end) */
+unsigned char *lp_delete_range(unsigned char *lp, long index, size_t count);
+
+/* Move entries [index..] into a new pack, truncating lp to `index` entries.
+ * Returns the new pack; *lp receives the (reallocated) head part. */
+unsigned char *lp_split(unsigned char **lp, size_t index);
+
+/* Check that `size` bytes form a well-formed pack (for untrusted input) */
+int lp_validate(const unsigned char *lp, size_t size);
+
+#endif /* LISTPACK_H */
@@ -0,0 +1,115 @@
+#include "lzf.h"
+#include <stdint.h>
+#include <string.h>
+
+#define LZF_HLOG     13
+#define LZF_HSIZE    (1u << LZF_HLOG)
+#define LZF_MAX_LIT  32
+#define LZF_MAX_OFF  (1u << 13)
+#define LZF_MAX_REF  ((1u << 8) + (1u << 3))
+
+static uint32_t hash3(const uint8_t *p) {
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - LZF_HLOG);
+}
+
+size_t lzf_compress(const void *in, size_t in_len, void *out, size_t out_len) {
+    const uint8_t *base = in;
+    const uint8_t *ip = base;
+    const uint8_t *in_end = base + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = op + out_len;
+    uint32_t htab[LZF_HSIZE];
+    size_t lit = 0;
+
+    if (in_len == 0 || out_len < 2) return 0;
+    memset(htab, 0, sizeof(htab));
+
+    uint8_t *lit_ctrl = op++; /* header byte of the current literal run */
+
+    while (ip < in_end) {
+        if (ip + 2 < in_end) {
+            uint32_t h = hash3(ip);
+            uint32_t cand = htab[h];
+            htab[h] = (uint32_t)(ip - base) + 1;
+
+            if (cand) {
+                const uint8_t *ref = base + cand - 1;
+                size_t off = (size_t)(ip - ref) - 1;
+                if (off < LZF_MAX_OFF && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+                    size_t maxlen = (size_t)(in_end - ip);
+                    if (maxlen > LZF_MAX_REF) maxlen = LZF_MAX_REF;
+                    size_t len = 3;
+                    while (len < maxlen && ref[len] == ip[len]) len++;
+
+                    /* Back-reference needs up to 3 bytes plus the next run header */
+                    if (op + 4 > out_end) return 0;
+                    if (lit) *lit_ctrl = (uint8_t)(lit - 1);
+                    else op = lit_ctrl;
+
+                    size_t enc = len - 2;
+                    if (enc < 7) {
+                        *op++ = (uint8_t)((off >> 8) + (enc << 5));
+                    } else {
+                        *op++ = (uint8_t)((off >> 8) + (7 << 5));
+                        *op++ = (uint8_t)(enc - 7);
+                    }
+                    *op++ = (uint8_t)off;
+
+                    ip += len;
+                    lit = 0;
+                    lit_ctrl = op++;
+                    continue;
+                }
+            }
+        }
+
+        if (op >= out_end) return 0;
+        *op++ = *ip++;
+        lit++;
+        if (lit == LZF_MAX_LIT) {
+            *lit_ctrl = (uint8_t)(lit - 1);
+            lit = 0;
+            if (op >= out_end) return 0;
+            lit_ctrl = op++;
+        }
+    }
+
+    if (lit) *lit_ctrl = (uint8_t)(lit - 1);
+    else op = lit_ctrl;
+    return (size_t)(op - (uint8_t *)out);
+}
+
+size_t lzf_decompress(const void *in, size_t in_len, void *out, size_t out_len) {
+    const uint8_t *ip = in;
+    const uint8_t *in_end = ip + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = op + out_len;
+
+    while (ip < in_end) {
+        size_t ctrl = *ip++;
+
+        if (ctrl < (1u << 5)) {
+            ctrl++;
+            if (op + ctrl > out_end || ip + ctrl > in_end) return 0;
+            memcpy(op, ip, ctrl);
+            op += ctrl;
+            ip += ctrl;
+        } else {
+            size_t len = ctrl >> 5;
+            if (len == 7) {
+                if (ip >= in_end) return 0;
+                len += *ip++;
+            }
+            if (ip >= in_end) return 0;
+            size_t off = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+            len += 2;
+            if (off > (size_t)(op - (uint8_t *)out) || op + len > out_end) return 0;
+            const uint8_t *ref = op - off;
+            /* Overlapping copy must go byte by byte */
+            for (size_t i = 0; i < len; i++) op[i] = ref[i];
+            op += len;
+        }
+    }
+    return (size_t)(op - (uint8_t *)out);
+}
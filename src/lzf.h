@@ -0,0 +1,19 @@
+#ifndef LZF_H
+#define LZF_H
+
+#include <stddef.h>
+
+/*
+ * LZF-format compression (byte-compatible with liblzf).
+ * Fast, small-window LZ77 suited to short values and list blocks.
+ */
+
+/* Compress in[0..in_len) into out. Returns compressed size, or 0 if the
+ * result would not fit in out_len bytes. */
+size_t lzf_compress(const void *in, size_t in_len, void *out, size_t out_len);
+
+/* Decompress into out. Returns decompressed size, or 0 on corrupt input
+ * or if the output would exceed out_len. */
+size_t lzf_decompress(const void *in, size_t in_len, void *out, size_t out_len);
+
+#endif /* LZF_H */
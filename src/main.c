@@ -1,6 +1,8 @@
 #include "db.h"
 #include "server.h"
 #include "persist.h"
+#include "config.h"
+#include "aof.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,23 +15,16 @@
 static server_t *g_server = NULL;
 
 #ifdef _WIN32
+/* Only stop the event loop here; main saves once it has returned */
 static BOOL WINAPI console_handler(DWORD sig) {
     (void)sig;
-    if (g_server) {
-        printf("\nShutting down...\n");
-        persist_save(g_server->db, "dump.rdb");
-        server_stop(g_server);
-    }
+    if (g_server) server_stop(g_server);
     return TRUE;
 }
 #else
 static void signal_handler(int sig) {
     (void)sig;
-    if (g_server) {
-        printf("\nShutting down...\n");
-        persist_save(g_server->db, "dump.rdb");
-        server_stop(g_server);
-    }
+    if (g_server) server_stop(g_server);
 }
 #endif
 
@@ -41,7 +36,7 @@ static void print_banner(int port) {
     printf(" | | | | | |  | |  __/ | | | | || |_| | |_) |\n");
     printf(" |_|_| |_|_|  |_|\\___|_| |_| |_||____/|_.__/ \n");
     printf("\n");
-    printf("  Version 1.0.0 | Port %d\n", port);
+    printf("  Version " IMDB_VERSION " | Port %d\n", port);
     printf("  Type 'SHUTDOWN' from a client to stop.\n\n");
 }
 
@@ -51,6 +46,13 @@ int main(int argc, char *argv[]) {
     for (int i = 1; i < argc; i++) {
         if ((strcmp(argv[i], "--port") == 0 || strcmp(argv[i], "-p") == 0) && i + 1 < argc) {
             port = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc) {
+            const char *err = config_set(argv[i] + 2, argv[i + 1]);
+            if (err) {
+                fprintf(stderr, "Error: %s: %s\n", argv[i], err);
+                return 1;
+            }
+            i++;
         }
     }
 
@@ -67,15 +69,42 @@ int main(int argc, char *argv[]) {
 #endif
 
     database_t *db = db_create();
-
-    /* Load existing data if dump file exists */
-    persist_load(db, "dump.rdb");
-
     server_t *srv = server_create(db, port);
     g_server = srv;
 
+    /* Load existing data: the AOF when enabled and present, else the dump.
+     * Without the AOF the dump loads on a thread while the server starts
+     * answering; with it, the dump may become the AOF's first base. */
+    int loaded = g_config.appendonly ? aof_load(db) : 0;
+    if (loaded < 0) {
+        fprintf(stderr, "Error: cannot load the append-only file; fix or remove it to start\n");
+        return 1;
+    }
+    if (g_config.appendonly) {
+        if (loaded == 0 && persist_load(db, "dump.rdb") == -2) {
+            fprintf(stderr, "Error: cannot load dump.rdb; fix or remove it to start\n");
+            return 1;
+        }
+        if (aof_open(db) != 0) {
+            fprintf(stderr, "Error: cannot open the append-only file\n");
+            return 1;
+        }
+    } else if (server_load_async(srv, "dump.rdb") != 0) {
+        fprintf(stderr, "Error: cannot load dump.rdb; fix or remove it to start\n");
+        return 1;
+    }
+    if (g_config.delta_checkpoints && !g_config.appendonly) db_track_changes(db);
+
     print_banner(port);
-    server_run(srv);
+    int rc = server_run(srv);
+    server_stop_loading(srv);
+    if (rc == 0) {
+        printf("\nShutting down...\n");
+        server_kill_child(srv);
+        /* Stopped mid-load, the dump on disk is still the whole dataset */
+        if (!srv->loading && persist_save(db, "dump.rdb") == 0) persist_checkpoint_done("dump.rdb", 1);
+    }
+    aof_close();
 
     server_destroy(srv);
     db_destroy(db);
@@ -85,5 +114,5 @@ int main(int argc, char *argv[]) {
 #endif
 
     printf("Goodbye.\n");
-    return 0;
+    return rc == 0 ? 0 : 1;
 }
@@ -6,10 +6,11 @@
 #include <errno.h>
 #include <limits.h>
 
-dbobj_t *obj_create_string(const char *str) {
+dbobj_t *obj_create_string(const char *str, size_t len) {
     dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
     obj->type = OBJ_STRING;
-    obj->data.str = imdb_strdup(str);
+    obj->data.str.buf = imdb_memdup(str, len);
+    obj->data.str.len = len;
     return obj;
 }
 
@@ -27,18 +28,143 @@ dbobj_t *obj_create_list(void) {
     return obj;
 }
 
-void obj_free(dbobj_t *obj) {
-    if (!obj) return;
+dbobj_t *obj_create_hash(void) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_HASH;
+    obj->data.hash = hash_create();
+    return obj;
+}
+
+dbobj_t *obj_create_zset(void) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_ZSET;
+    obj->data.zset = zset_create();
+    return obj;
+}
+
+dbobj_t *obj_create_set(void) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_SET;
+    obj->data.set = set_create();
+    return obj;
+}
+
+dbobj_t *obj_create_stream(void) {
+    dbobj_t *obj = imdb_malloc(sizeof(dbobj_t));
+    obj->type = OBJ_STREAM;
+    obj->data.stream = stream_create();
+    return obj;
+}
+
+void obj_int_to_string(dbobj_t *obj) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%lld", (long long)obj->data.num);
+    obj->type = OBJ_STRING;
+    obj->data.str.buf = imdb_memdup(buf, (size_t)n);
+    obj->data.str.len = (size_t)n;
+}
+
+/* Past this size a growing string gets 1MB of slack rather than doubling */
+#define STRING_PREALLOC_MAX (1024 * 1024)
+
+/* Make room for len bytes plus the NUL. Growth leaves spare capacity, so a
+ * run of appends reallocates O(log n) times instead of on every call. */
+static void string_reserve(dbobj_t *obj, size_t len) {
+    if (len + 1 <= imdb_malloc_usable(obj->data.str.buf)) return;
+    size_t cap = len < STRING_PREALLOC_MAX ? len * 2 : len + STRING_PREALLOC_MAX;
+    obj->data.str.buf = imdb_realloc(obj->data.str.buf, cap + 1);
+}
+
+void obj_string_grow(dbobj_t *obj, size_t len) {
+    if (len <= obj->data.str.len) return;
+    string_reserve(obj, len);
+    memset(obj->data.str.buf + obj->data.str.len, 0, len - obj->data.str.len + 1);
+    obj->data.str.len = len;
+}
+
+void obj_string_append(dbobj_t *obj, const char *s, size_t n) {
+    string_reserve(obj, obj->data.str.len + n);
+    memcpy(obj->data.str.buf + obj->data.str.len, s, n);
+    obj->data.str.len += n;
+    obj->data.str.buf[obj->data.str.len] = '\0';
+}
+
+/* Only the canonical form of an integer is stored as OBJ_INT, so that
+ * reading it back as a string gives the same bytes ("007" stays a string) */
+static int parse_canonical_int(const char *s, size_t len, int64_t *out) {
+    char buf[32];
+    if (len == 0 || len >= sizeof(buf) || !obj_try_parse_int_len(s, len, out)) return 0;
+    return (size_t)snprintf(buf, sizeof(buf), "%lld", (long long)*out) == len && memcmp(buf, s, len) == 0;
+}
+
+/* Release whatever the object holds, leaving the dbobj_t itself */
+static void obj_clear(dbobj_t *obj) {
     switch (obj->type) {
         case OBJ_STRING:
-            imdb_free(obj->data.str);
+            imdb_free(obj->data.str.buf);
             break;
         case OBJ_INT:
             break;
         case OBJ_LIST:
             list_destroy(obj->data.list);
             break;
+        case OBJ_HASH:
+            hash_destroy(obj->data.hash);
+            break;
+        case OBJ_ZSET:
+            zset_destroy(obj->data.zset);
+            break;
+        case OBJ_SET:
+            set_destroy(obj->data.set);
+            break;
+        case OBJ_STREAM:
+            stream_destroy(obj->data.stream);
+            break;
+        case OBJ_CMS:
+            cms_destroy(obj->data.cms);
+            break;
+        case OBJ_TOPK:
+            topk_destroy(obj->data.topk);
+            break;
+        case OBJ_VSET:
+            vset_destroy(obj->data.vset);
+            break;
+        case OBJ_BLOOM:
+            bloom_destroy(obj->data.bloom);
+            break;
+        case OBJ_CUCKOO:
+            cuckoo_destroy(obj->data.cuckoo);
+            break;
+    }
+}
+
+void obj_set_value(dbobj_t *obj, const char *value, size_t len) {
+    int64_t num;
+    if (parse_canonical_int(value, len, &num)) {
+        obj_clear(obj);
+        obj->type = OBJ_INT;
+        obj->data.num = num;
+        return;
     }
+    /* Keep the old buffer if it fits without wasting more than half of it */
+    if (obj->type == OBJ_STRING) {
+        size_t usable = imdb_malloc_usable(obj->data.str.buf);
+        if (len + 1 <= usable && (len + 1) * 2 >= usable) {
+            memcpy(obj->data.str.buf, value, len);
+            obj->data.str.buf[len] = '\0';
+            obj->data.str.len = len;
+            return;
+        }
+    }
+    obj_clear(obj);
+    obj->type = OBJ_STRING;
+    obj->data.str.buf = imdb_memdup(value, len);
+    obj->data.str.len = len;
+}
+
+void obj_free(dbobj_t *obj) {
+    if (!obj) return;
+    obj_clear(obj);
     imdb_free(obj);
 }
 
@@ -52,12 +178,45 @@ int obj_try_parse_int(const char *str, int64_t *out) {
     return 1;
 }
 
+int obj_try_parse_int_len(const char *str, size_t len, int64_t *out) {
+    return str && strlen(str) == len && obj_try_parse_int(str, out);
+}
+
 const char *obj_get_string(dbobj_t *obj) {
     if (!obj) return NULL;
     switch (obj->type) {
-        case OBJ_STRING: return obj->data.str;
+        case OBJ_STRING: return obj->data.str.buf;
         case OBJ_INT:    return NULL; /* caller should use snprintf */
-        case OBJ_LIST:   return NULL;
+        case OBJ_LIST:
+        case OBJ_HASH:
+        case OBJ_ZSET:
+        case OBJ_SET:
+        case OBJ_STREAM:
+        case OBJ_CMS:
+        case OBJ_TOPK:
+        case OBJ_VSET:
+        case OBJ_BLOOM:
+        case OBJ_CUCKOO: return NULL;
     }
     return NULL;
 }
+
+size_t obj_mem_usage(dbobj_t *obj, size_t samples) {
+    if (!obj) return 0;
+    size_t total = imdb_malloc_size(obj);
+    switch (obj->type) {
+        case OBJ_STRING: total += imdb_malloc_size(obj->data.str.buf); break;
+        case OBJ_INT:    break;
+        case OBJ_LIST:   total += list_mem_usage(obj->data.list, samples); break;
+        case OBJ_HASH:   total += hash_mem_usage(obj->data.hash, samples); break;
+        case OBJ_ZSET:   total += zset_mem_usage(obj->data.zset, samples); break;
+        case OBJ_SET:    total += set_mem_usage(obj->data.set, samples); break;
+        case OBJ_STREAM: total += stream_mem_usage(obj->data.stream, samples); break;
+        case OBJ_CMS:    total += imdb_malloc_size(obj->data.cms); break;
+        case OBJ_TOPK:   total += topk_mem_usage(obj->data.topk); break;
+        case OBJ_VSET:   total += vset_mem_usage(obj->data.vset); break;
+        case OBJ_BLOOM:  total += bloom_mem_usage(obj->data.bloom); break;
+        case OBJ_CUCKOO: total += cuckoo_mem_usage(obj->data.cuckoo); break;
+    }
+    return total;
+}
@@ -2,27 +2,74 @@
 #define OBJECT_H
 
 #include "list.h"
+#include "hash.h"
+#include "zset.h"
+#include "set.h"
+#include "stream.h"
+#include "sketch.h"
+#include "vset.h"
+#include "bloom.h"
 #include <stdint.h>
 
 typedef enum {
     OBJ_STRING,
     OBJ_INT,
-    OBJ_LIST
+    OBJ_LIST,
+    OBJ_HASH,
+    OBJ_ZSET,
+    OBJ_SET,
+    OBJ_STREAM,
+    OBJ_CMS,
+    OBJ_TOPK,
+    OBJ_VSET,
+    OBJ_BLOOM,
+    OBJ_CUCKOO
 } obj_type_t;
 
 typedef struct {
     obj_type_t type;
     union {
-        char *str;
+        struct {
+            char *buf;  /* NUL-terminated; may also contain NULs */
+            size_t len;
+        } str;
         int64_t num;
         list_t *list;
+        hash_t *hash;
+        zset_t *zset;
+        set_t *set;
+        stream_t *stream;
+        cms_t *cms;
+        topk_t *topk;
+        vset_t *vset;
+        bloom_t *bloom;
+        cuckoo_t *cuckoo;
     } data;
 } dbobj_t;
 
 /* Constructors */
-dbobj_t *obj_create_string(const char *str);
+dbobj_t *obj_create_string(const char *str, size_t len);
 dbobj_t *obj_create_int(int64_t num);
 dbobj_t *obj_create_list(void);
+dbobj_t *obj_create_hash(void);
+dbobj_t *obj_create_zset(void);
+dbobj_t *obj_create_set(void);
+dbobj_t *obj_create_stream(void);
+
+/* Turn an integer object into the equivalent string object */
+void obj_int_to_string(dbobj_t *obj);
+
+/* Zero-extend a string object to at least len bytes. Strings that grow
+ * keep spare capacity, so repeated growth is amortized. */
+void obj_string_grow(dbobj_t *obj, size_t len);
+
+/* Append n bytes to a string object */
+void obj_string_append(dbobj_t *obj, const char *s, size_t n);
+
+/* Replace an object's value with a string in place, integer-encoded when
+ * it is the canonical form of one; a string buffer of about the right
+ * size is reused */
+void obj_set_value(dbobj_t *obj, const char *value, size_t len);
 
 /* Destructor */
 void obj_free(dbobj_t *obj);
@@ -30,7 +77,13 @@ void obj_free(dbobj_t *obj);
 /* Try to parse a string as an integer; returns 1 on success */
 int obj_try_parse_int(const char *str, int64_t *out);
 
+/* Same for a counted string; embedded NULs never parse */
+int obj_try_parse_int_len(const char *str, size_t len, int64_t *out);
+
 /* Get string representation (caller must free for OBJ_INT) */
 const char *obj_get_string(dbobj_t *obj);
 
+/* Estimated bytes held by the object; aggregates sample up to `samples` elements (0 = all) */
+size_t obj_mem_usage(dbobj_t *obj, size_t samples);
+
 #endif /* OBJECT_H */
@@ -1,129 +1,1059 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L /* fsync() under -std=c11 */
+#endif
 #include "persist.h"
 #include "hashtable.h"
 #include "object.h"
 #include "list.h"
+#include "hash.h"
+#include "listpack.h"
+#include "stream.h"
 #include "util.h"
+#include "config.h"
+#include "lzf.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define rdb_open _open
+#define rdb_write _write
+#define rdb_sync _commit
+#define rdb_close _close
+#define RDB_OPEN_FLAGS (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+#else
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#define rdb_open open
+#define rdb_write write
+#define rdb_sync fsync
+#define rdb_close close
+#define RDB_OPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC)
+#endif
 
 /*
- * RDB File Format:
- *   Header:  "IMDB0001" (8 bytes magic)
+ * RDB File Format (version 5):
+ *   Header:  "IMDB0005" (8 bytes magic)
+ *   Records: an opcode (0xF0 and up) or an entry
+ *     opcode 0xFA = AUX: [size(4)] [name] [value]; "ctime" (ms, which expires
+ *                  are relative to), "imdb-ver" (producer), "delta-id" and
+ *                  "delta-seq" (the checkpoint the file is, see below) and,
+ *                  after the entries, "expires" (keys with a TTL), all in
+ *                  decimal
+ *     opcode 0xFB = RESIZE: [size(4)] [keys(4)], the key count the loader
+ *                  sizes the keyspace by
+ *     opcode 0xF9 = CHUNK: [size(4)] [keys(4)] [entries] [crc(8)], a run of
+ *                  entries with the CRC-64 of their bytes (little-endian);
+ *                  the keyspace is split into chunks that are written and
+ *                  read on several threads (rdb-threads)
+ *     opcode 0xF8 = DELETE: [size(4)] [key], a key to remove (deltas only)
+ *     Every opcode carries the size of what follows it, so a loader steps
+ *     over records and AUX fields it does not know.
  *   Entries: [type(1)] [expire(8)] [key_len(4)] [key] [value_data...]
+ *     The type's high bit (RDB_EXPIRE_FLAG) marks a key with an expire,
+ *     stored as its offset in ms from ctime; otherwise it is omitted.
+ *     Fields marked (4) are unsigned LEB128 varints and fields marked (8)
+ *     zigzag varints, except doubles (decay, error, scores), which are 8
+ *     bytes of IEEE 754, little-endian.
+ *     A string is [len(4) << 1] [bytes], or [stored(4) << 1 | 1] [len(4)]
+ *     [bytes] when its bytes are LZF-compressed (rdbcompression).
+ *     Blobs (listpacks, intsets, counters, filter blocks) are written in
+ *     their in-memory layout, which is little-endian on every supported host.
  *     type 0 = string: [val_len(4)] [val]
  *     type 1 = integer: [int64(8)]
- *     type 2 = list: [count(4)] { [val_len(4)] [val] }*
- *   Footer:  0xFF (1 byte)
+ *     type 2 = list: [count(4)] { [val_len(4)] [val] }*   (read only)
+ *     type 3 = packed list: [blocks(4)] { [raw_size(4)] [size(4)] [bytes] }*
+ *              blocks are listpacks, LZF-compressed when size != raw_size
+ *     type 4 = packed hash: [size(4)] [listpack of field, value, ...]
+ *     type 5 = hash: [count(4)] { [field_len(4)] [field] [val_len(4)] [val] }*
+ *     type 6 = packed sorted set: [size(4)] [listpack of member, score(double), ...]
+ *     type 7 = sorted set: [count(4)] { [member_len(4)] [member] [score(8)] }*  (ascending)
+ *     type 8 = intset: [size(4)] [intset header and sorted values]
+ *     type 9 = set: [count(4)] { [member_len(4)] [member] }*
+ *     type 10 = stream: [last_ms(8)] [last_seq(8)] [blocks(4)]
+ *               { [master_ms(8)] [master_seq(8)] [size(4)] [listpack] }*
+ *     type 11 = count-min sketch: [width(4)] [depth(4)] [count(8)] [size(4)] [counters]
+ *     type 12 = top-k: [k(4)] [width(4)] [depth(4)] [decay(8)] [size(4)] [buckets]
+ *               [heap_len(4)] { [count(4)] [item_len(4)] [item] }*
+ *     type 13 = vector set: [dim(4)] [metric(4)] [quant(4)] [m(4)] [ef(4)] [slots(4)] [entry(4)]
+ *               { [level(4)] [name] [attr] [vector] { [n(4)] [ids(4) * n] }*(level + 1) }*
+ *               a free slot is just level 0xFFFFFFFF
+ *     type 14 = bloom filter: [expansion(4)] [layers(4)]
+ *               { [capacity(8)] [count(8)] [hashes(4)] [error(8)] [nblocks(8)] [size(4)] [blocks] }*
+ *     type 15 = cuckoo filter: [bucket_size(4)] [max_iterations(4)] [expansion(4)] [deletes(8)] [layers(4)]
+ *               { [nbuckets(8)] [count(8)] [size(4)] [fingerprints] }*
+ *   Footer:  0xFF (1 byte) [crc(8)], the CRC-64 of every byte before it except
+ *            chunk entries, little-endian
+ *
+ * Older versions are still read. Version 4 has its entries outside chunks
+ * and a checksum of the whole file. Versions 2 and 3 have a fixed header
+ * instead of opcodes ([save_time(8)], plus [keys(8)] in version 3), plain
+ * [len(4)] strings and host-order doubles. Version 1 has no header beyond
+ * the magic, every field at its fixed width in host byte order, an expire
+ * (-1 for none) on every entry and no checksum.
+ *
+ * The loader maps the file and decodes it in place, so strings are copied
+ * once, into the objects that keep them.
+ *
+ * Delta checkpoints (delta-checkpoints) are files in the same format named
+ * <snapshot>.<seq>.delta, holding a DELETE for each key written since the
+ * previous checkpoint followed by its entry if it still exists; they have
+ * no chunks and no RESIZE. A snapshot with delta-seq N is completed by the
+ * deltas N+1, N+2, ... with its delta-id in turn, up to the first one
+ * missing; the id tells apart files left over from an earlier snapshot.
  */
 
-#define RDB_MAGIC "IMDB0001"
+#define RDB_MAGIC "IMDB0005"
+#define RDB_MAGIC_PREFIX "IMDB"   /* followed by the version as 4 digits */
 #define RDB_MAGIC_LEN 8
+#define RDB_VERSION 5
 #define RDB_EOF 0xFF
 #define RDB_TYPE_STRING 0
 #define RDB_TYPE_INT    1
 #define RDB_TYPE_LIST   2
+#define RDB_TYPE_LIST_PACKED 3
+#define RDB_TYPE_HASH_PACKED 4
+#define RDB_TYPE_HASH        5
+#define RDB_TYPE_ZSET_PACKED 6
+#define RDB_TYPE_ZSET        7
+#define RDB_TYPE_SET_INTSET  8
+#define RDB_TYPE_SET         9
+#define RDB_TYPE_STREAM     10
+#define RDB_TYPE_CMS        11
+#define RDB_TYPE_TOPK       12
+#define RDB_TYPE_VSET       13
+#define RDB_TYPE_BLOOM      14
+#define RDB_TYPE_CUCKOO     15
+#define RDB_EXPIRE_FLAG   0x80
+#define RDB_OPCODE_MIN    0xF0  /* record bytes from here on are opcodes, not types */
+#define RDB_OPCODE_AUX    0xFA
+#define RDB_OPCODE_RESIZE 0xFB
+#define RDB_OPCODE_CHUNK  0xF9
+#define RDB_OPCODE_DELETE 0xF8
+
+#define RDB_COMPRESS_MIN 20     /* shorter strings are never compressed */
+#define RDB_COMPRESS_GAIN 4     /* nor kept compressed unless it saves this much */
+#define RDB_COMPRESS_MAX RDB_WRITE_BUF
+
+#define RDB_WRITE_BUF (1024 * 1024)
+#define RDB_WRITE_ALIGN 4096
+
+#define RDB_CHUNK_SLOTS 65536           /* keyspace slots a save worker claims at a time */
+#define RDB_CHUNK_BYTES (4 * 1024 * 1024) /* a chunk is closed once it holds this much */
+#define RDB_MAX_THREADS 16              /* with rdb-threads 0, at most this many */
+
+#define RDB_MAX_DELTAS 64   /* past this many a save rule writes a full snapshot */
+
+/* Which checkpoint a file is; seq is -1 when it records none */
+typedef struct {
+    int64_t id;
+    int64_t seq;
+} rdb_delta_t;
+
+/* The checkpoint on disk: a snapshot and the deltas applied over it */
+static struct {
+    int have_base;          /* the snapshot was written with this id */
+    int64_t id;             /* picked at startup unless the snapshot has one */
+    uint64_t base_seq;
+    uint64_t seq;           /* of the last checkpoint, snapshot or delta */
+    uint64_t base_bytes;
+    uint64_t delta_bytes;
+} ckpt;
+
+/* Loading progress, published by the thread running persist_load for
+ * INFO on the event loop; done_* cover the files already applied */
+static struct {
+    atomic_uint_fast64_t total_bytes, bytes, keys, expected_keys;
+    uint64_t done_bytes, done_keys;
+} progress;
+
+static void progress_note(uint64_t bytes, uint64_t keys) {
+    atomic_store_explicit(&progress.bytes, progress.done_bytes + bytes, memory_order_relaxed);
+    atomic_store_explicit(&progress.keys, progress.done_keys + keys, memory_order_relaxed);
+}
+
+/* Set by persist_cancel_load from another thread */
+static atomic_int load_cancelled;
+
+void persist_cancel_load(int cancel) {
+    atomic_store(&load_cancelled, cancel);
+}
+
+/* ---- Writer: one large page-aligned buffer, flushed with write() ---- */
+
+typedef struct {
+    int fd;               /* -1 while building a chunk in mem */
+    void *raw;            /* allocation holding buf */
+    unsigned char *buf;   /* RDB_WRITE_BUF bytes */
+    size_t len;
+    uint64_t crc;         /* of everything flushed so far */
+    int err;              /* -1 once a write has failed */
+    unsigned char *zbuf;  /* LZF output, RDB_COMPRESS_MAX bytes; NULL when not compressing */
+    unsigned char *mem;   /* flushed bytes of a chunk being built */
+    size_t mem_len, mem_cap;
+} rdb_writer_t;
+
+static void writer_init(rdb_writer_t *w, int fd) {
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->raw = imdb_malloc(RDB_WRITE_BUF + RDB_WRITE_ALIGN);
+    w->buf = (unsigned char *)(((uintptr_t)w->raw + RDB_WRITE_ALIGN - 1) & ~(uintptr_t)(RDB_WRITE_ALIGN - 1));
+    if (g_config.rdbcompression) w->zbuf = imdb_malloc(RDB_COMPRESS_MAX);
+}
+
+static void writer_free(rdb_writer_t *w) {
+    imdb_free(w->zbuf);
+    imdb_free(w->raw);
+    imdb_free(w->mem);
+}
+
+/* Write n bytes out, bypassing the buffer and the checksum */
+static void w_out(rdb_writer_t *w, const void *p, size_t n) {
+    const unsigned char *c = p;
+    if (w->fd < 0) {
+        if (n > w->mem_cap - w->mem_len) {
+            while (n > w->mem_cap - w->mem_len) w->mem_cap = w->mem_cap ? w->mem_cap * 2 : RDB_WRITE_BUF;
+            w->mem = imdb_realloc(w->mem, w->mem_cap);
+        }
+        memcpy(w->mem + w->mem_len, p, n);
+        w->mem_len += n;
+        return;
+    }
+    while (n > 0 && !w->err) {
+        unsigned chunk = n > (1u << 30) ? 1u << 30 : (unsigned)n;
+        long k = (long)rdb_write(w->fd, c, chunk);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) {
+            w->err = -1;
+            break;
+        }
+        c += k;
+        n -= (size_t)k;
+    }
+}
+
+static void w_raw(rdb_writer_t *w, const void *p, size_t n) {
+    w->crc = imdb_crc64(w->crc, p, n);
+    w_out(w, p, n);
+}
+
+static void w_flush(rdb_writer_t *w) {
+    if (w->len > 0) w_raw(w, w->buf, w->len);
+    w->len = 0;
+}
+
+static int write_bytes(rdb_writer_t *w, const void *p, size_t n) {
+    if (n > RDB_WRITE_BUF - w->len) {
+        w_flush(w);
+        /* Large values go straight from memory to the file */
+        if (n >= RDB_WRITE_BUF / 2) {
+            w_raw(w, p, n);
+            return w->err;
+        }
+    }
+    if (n > 0) memcpy(w->buf + w->len, p, n);
+    w->len += n;
+    return w->err;
+}
+
+static int write_varint(rdb_writer_t *w, uint64_t v) {
+    if (RDB_WRITE_BUF - w->len < 10) w_flush(w);
+    unsigned char *p = w->buf + w->len;
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    w->len = (size_t)(p - w->buf);
+    return w->err;
+}
+
+static int write_byte(rdb_writer_t *w, uint8_t v) {
+    return write_bytes(w, &v, 1);
+}
+
+static int write_uint32(rdb_writer_t *w, uint32_t v) {
+    return write_varint(w, v);
+}
+
+/* Zigzag, so small negative values stay short */
+static int write_int64(rdb_writer_t *w, int64_t v) {
+    return write_varint(w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+/* IEEE 754 bits, little-endian */
+static int write_double(rdb_writer_t *w, double v) {
+    uint64_t bits;
+    unsigned char le[8];
+    memcpy(&bits, &v, sizeof(bits));
+    for (int i = 0; i < 8; i++) le[i] = (unsigned char)(bits >> (8 * i));
+    return write_bytes(w, le, sizeof(le));
+}
+
+static int write_string_plain(rdb_writer_t *w, const char *s, uint32_t len) {
+    if (write_varint(w, (uint64_t)len << 1) != 0) return -1;
+    return write_bytes(w, s, len);
+}
+
+/* Compressed when LZF saves at least RDB_COMPRESS_GAIN bytes */
+static int write_string(rdb_writer_t *w, const char *s, uint32_t len) {
+    if (w->zbuf && len >= RDB_COMPRESS_MIN && len <= RDB_COMPRESS_MAX) {
+        size_t clen = lzf_compress(s, len, w->zbuf, len - RDB_COMPRESS_GAIN);
+        if (clen > 0) {
+            if (write_varint(w, (uint64_t)clen << 1 | 1) != 0 || write_uint32(w, len) != 0) return -1;
+            return write_bytes(w, w->zbuf, clen);
+        }
+    }
+    return write_string_plain(w, s, len);
+}
+
+static size_t varint_len(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
 
-static int write_uint32(FILE *f, uint32_t v) {
-    return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+/* An AUX record: [RDB_OPCODE_AUX] [size(4)] [name] [value] */
+static int write_aux(rdb_writer_t *w, const char *name, const char *value) {
+    uint32_t nlen = (uint32_t)strlen(name), vlen = (uint32_t)strlen(value);
+    size_t size = varint_len((uint64_t)nlen << 1) + nlen + varint_len((uint64_t)vlen << 1) + vlen;
+    if (write_byte(w, RDB_OPCODE_AUX) != 0 || write_uint32(w, (uint32_t)size) != 0) return -1;
+    return write_string_plain(w, name, nlen) != 0 || write_string_plain(w, value, vlen) != 0 ? -1 : 0;
 }
 
-static int write_int64(FILE *f, int64_t v) {
-    return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+static int write_aux_int(rdb_writer_t *w, const char *name, int64_t value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", (long long)value);
+    return write_aux(w, name, buf);
 }
 
-static int write_string(FILE *f, const char *s, uint32_t len) {
-    if (write_uint32(f, len) != 0) return -1;
-    if (len > 0 && fwrite(s, 1, len, f) != len) return -1;
+/* ---- Reader: walks the mapped file; fixed-width fields in version 1,
+ * varints from version 2 ---- */
+
+typedef struct {
+    const unsigned char *p, *end;
+    int version;
+    unsigned char *scratch[2];  /* decompressed strings handed out as views, */
+    size_t scratch_cap[2];      /* alternating so two can be held at once */
+    int next;
+} rdb_reader_t;
+
+/* Pointer to the next n bytes of the file, or NULL past its end */
+static const void *read_view(rdb_reader_t *r, size_t n) {
+    if ((size_t)(r->end - r->p) < n) return NULL;
+    const void *v = r->p;
+    r->p += n;
+    return v;
+}
+
+static int read_bytes(rdb_reader_t *r, void *dst, size_t n) {
+    const void *v = read_view(r, n);
+    if (!v) return -1;
+    if (n > 0) memcpy(dst, v, n);
     return 0;
 }
 
-static int read_uint32(FILE *f, uint32_t *v) {
-    return fread(v, sizeof(*v), 1, f) == 1 ? 0 : -1;
+static int read_varint(rdb_reader_t *r, uint64_t *v) {
+    uint64_t out = 0;
+    for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        unsigned char c = *r->p++;
+        out |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = out;
+            return 0;
+        }
+    }
+    return -1;
 }
 
-static int read_int64(FILE *f, int64_t *v) {
-    return fread(v, sizeof(*v), 1, f) == 1 ? 0 : -1;
+static int read_uint32(rdb_reader_t *r, uint32_t *v) {
+    if (r->version == 1) return read_bytes(r, v, sizeof(*v));
+    uint64_t x;
+    if (read_varint(r, &x) != 0 || x > UINT32_MAX) return -1;
+    *v = (uint32_t)x;
+    return 0;
 }
 
-static char *read_string(FILE *f, uint32_t *out_len) {
-    uint32_t len;
-    if (read_uint32(f, &len) != 0) return NULL;
-    char *s = imdb_malloc(len + 1);
-    if (len > 0 && fread(s, 1, len, f) != len) {
-        imdb_free(s);
-        return NULL;
+static int read_int64(rdb_reader_t *r, int64_t *v) {
+    if (r->version == 1) return read_bytes(r, v, sizeof(*v));
+    uint64_t x;
+    if (read_varint(r, &x) != 0) return -1;
+    *v = (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+    return 0;
+}
+
+static int read_uint32_array(rdb_reader_t *r, uint32_t *v, uint32_t n) {
+    if (r->version == 1) return read_bytes(r, v, (size_t)n * sizeof(*v));
+    for (uint32_t i = 0; i < n; i++) {
+        if (read_uint32(r, &v[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+static int read_double(rdb_reader_t *r, double *v) {
+    if (r->version < 4) return read_bytes(r, v, sizeof(*v));
+    const unsigned char *le = read_view(r, 8);
+    if (!le) return -1;
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) bits |= (uint64_t)le[i] << (8 * i);
+    memcpy(v, &bits, sizeof(*v));
+    return 0;
+}
+
+/* A string's stored bytes, and its original length when they are
+ * LZF-compressed (else *raw is 0) */
+static const char *read_stored(rdb_reader_t *r, uint32_t *stored, uint32_t *raw) {
+    *raw = 0;
+    if (r->version < 4) {
+        if (read_uint32(r, stored) != 0) return NULL;
+    } else {
+        uint64_t x;
+        if (read_varint(r, &x) != 0 || (x >> 1) > UINT32_MAX) return NULL;
+        *stored = (uint32_t)(x >> 1);
+        if ((x & 1) && (read_uint32(r, raw) != 0 || *raw == 0)) return NULL;
+    }
+    return read_view(r, *stored);
+}
+
+/* A [len] [bytes] string in place, for callers that copy it themselves */
+static const char *read_strview(rdb_reader_t *r, uint32_t *out_len) {
+    uint32_t len, raw;
+    const char *s = read_stored(r, &len, &raw);
+    if (!s) return NULL;
+    if (raw) {
+        int i = r->next ^= 1;
+        if (r->scratch_cap[i] < raw) {
+            r->scratch[i] = imdb_realloc(r->scratch[i], raw);
+            r->scratch_cap[i] = raw;
+        }
+        if (lzf_decompress(s, len, r->scratch[i], raw) != raw) return NULL;
+        s = (const char *)r->scratch[i];
+        len = raw;
     }
-    s[len] = '\0';
     *out_len = len;
     return s;
 }
 
-int persist_save(database_t *db, const char *filename) {
-    char tmp_name[256];
-    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename);
+/* The same as a NUL-terminated heap copy, for callers that adopt it */
+static char *read_string(rdb_reader_t *r, uint32_t *out_len) {
+    uint32_t len, raw;
+    const char *s = read_stored(r, &len, &raw);
+    if (!s) return NULL;
+    if (!raw) {
+        *out_len = len;
+        return imdb_memdup(s, len);
+    }
+    char *out = imdb_malloc((size_t)raw + 1);
+    if (lzf_decompress(s, len, out, raw) != raw) {
+        imdb_free(out);
+        return NULL;
+    }
+    out[raw] = '\0';
+    *out_len = raw;
+    return out;
+}
 
-    FILE *f = fopen(tmp_name, "wb");
-    if (!f) return -1;
+/* The graph is written slot by slot, so link IDs need no remapping */
+static int write_vset(rdb_writer_t *w, const vset_t *vs) {
+    if (write_uint32(w, vs->dim) != 0 || write_uint32(w, vs->metric) != 0 ||
+        write_uint32(w, vs->quant) != 0 || write_uint32(w, vs->m) != 0 ||
+        write_uint32(w, vs->ef_construction) != 0 || write_uint32(w, vs->slots) != 0 ||
+        write_uint32(w, vs->entry) != 0) return -1;
+    for (uint32_t s = 0; s < vs->slots; s++) {
+        const vset_node_t *n = &vs->nodes[s];
+        if (write_uint32(w, n->name ? n->level : VSET_FREE_SLOT) != 0) return -1;
+        if (!n->name) continue;
+        if (write_string(w, n->name, (uint32_t)strlen(n->name)) != 0 ||
+            write_string(w, n->attr, (uint32_t)n->attr_len) != 0 ||
+            write_string(w, vset_vector(vs, s), (uint32_t)vs->vec_bytes) != 0) return -1;
+        for (uint32_t l = 0; l <= n->level; l++) {
+            const uint32_t *links = vset_links(vs, s, l);
+            for (uint32_t i = 0; i <= links[0]; i++) {
+                if (write_uint32(w, links[i]) != 0) return -1;
+            }
+        }
+    }
+    return 0;
+}
 
-    /* Write magic header */
-    if (fwrite(RDB_MAGIC, 1, RDB_MAGIC_LEN, f) != RDB_MAGIC_LEN) goto fail;
+/* Returns -1 if the value could not be read (the file is out of step), else 0
+ * with *out NULL when the value was read but is not a consistent set */
+static int read_vset(rdb_reader_t *r, vset_t **out) {
+    uint32_t dim, metric, quant, m, ef, slots, entry;
+    *out = NULL;
+    if (read_uint32(r, &dim) != 0 || read_uint32(r, &metric) != 0 || read_uint32(r, &quant) != 0 ||
+        read_uint32(r, &m) != 0 || read_uint32(r, &ef) != 0 || read_uint32(r, &slots) != 0 ||
+        read_uint32(r, &entry) != 0) return -1;
+    if (dim == 0 || dim > VSET_MAX_DIM || metric > VSET_IP || quant > VSET_Q8 || m < 2 || m > VSET_MAX_M ||
+        ef == 0) return -1;
+    vset_t *vs = vset_create(dim, (vset_metric_t)metric, (vset_quant_t)quant, m, ef);
+    int valid = 1;
+    for (uint32_t s = 0; s < slots; s++) {
+        uint32_t level, len, alen, vlen;
+        if (read_uint32(r, &level) != 0) goto fail;
+        if (level == VSET_FREE_SLOT) {
+            vset_restore_slot(vs, NULL, NULL, 0, 0, NULL);
+            continue;
+        }
+        if (level > VSET_MAX_LEVEL) goto fail;
+        char *name = read_string(r, &len), *attr = name ? read_string(r, &alen) : NULL;
+        const char *vec = attr ? read_strview(r, &vlen) : NULL;
+        if (!vec || vlen != vs->vec_bytes) {
+            imdb_free(name);
+            imdb_free(attr);
+            goto fail;
+        }
+        if (alen == 0) {
+            imdb_free(attr);
+            attr = NULL;
+        }
+        if (vset_restore_slot(vs, name, attr, alen, level, vec) != 0) {
+            /* Duplicate name: keep reading to stay in step, into a scratch free slot */
+            valid = 0;
+            vset_restore_slot(vs, NULL, NULL, 0, 0, NULL);
+        }
+        uint32_t scratch[1 + 2 * VSET_MAX_M];
+        for (uint32_t l = 0; l <= level; l++) {
+            uint32_t *links = vs->nodes[s].name ? vset_links(vs, s, l) : scratch;
+            if (read_uint32(r, &links[0]) != 0 || links[0] > vset_layer_cap(vs, l) ||
+                read_uint32_array(r, links + 1, links[0]) != 0) goto fail;
+        }
+    }
+    if (valid && vset_restore_finish(vs, entry) == 0) {
+        *out = vs;
+    } else {
+        vset_destroy(vs);
+    }
+    return 0;
 
-    /* Iterate all entries */
-    hashtable_t *ht = db_get_ht(db);
-    ht_iter_t iter;
-    ht_iter_init(&iter, ht);
-    ht_entry_t *he;
+fail:
+    vset_destroy(vs);
+    return -1;
+}
 
-    while ((he = ht_iter_next(&iter)) != NULL) {
-        db_entry_t *entry = (db_entry_t *)he->value;
-        dbobj_t *obj = entry->obj;
-        uint8_t type;
+/* Read a [size(4)] [bytes] run straight into dst, which must hold exactly
+ * `expect` bytes; with dst NULL (a rejected value) the bytes are skipped.
+ * Returns -1 if the file is out of step, 1 on a size mismatch, else 0. */
+static int read_blob_into(rdb_reader_t *r, void *dst, uint64_t expect) {
+    uint32_t len, raw;
+    const char *s = read_stored(r, &len, &raw);
+    if (!s) return -1;
+    if (!dst || (raw ? raw : len) != expect) return 1;
+    if (raw) return lzf_decompress(s, len, dst, raw) == raw ? 0 : -1;
+    if (len > 0) memcpy(dst, s, len);
+    return 0;
+}
 
-        switch (obj->type) {
-            case OBJ_STRING: type = RDB_TYPE_STRING; break;
-            case OBJ_INT:    type = RDB_TYPE_INT;    break;
-            case OBJ_LIST:   type = RDB_TYPE_LIST;   break;
-            default: continue;
-        }
+static int write_bloom(rdb_writer_t *w, const bloom_t *bf) {
+    if (write_uint32(w, bf->expansion) != 0 || write_uint32(w, bf->nlayers) != 0) return -1;
+    for (uint32_t i = 0; i < bf->nlayers; i++) {
+        const bloom_layer_t *l = &bf->layers[i];
+        if (write_int64(w, (int64_t)l->capacity) != 0 || write_int64(w, (int64_t)l->count) != 0 ||
+            write_uint32(w, l->hashes) != 0 || write_double(w, l->error) != 0 ||
+            write_int64(w, (int64_t)l->nblocks) != 0 ||
+            write_string(w, (const char *)l->blocks, (uint32_t)bloom_layer_bytes(l)) != 0) return -1;
+    }
+    return 0;
+}
+
+/* Same contract as read_vset */
+static int read_bloom(rdb_reader_t *r, bloom_t **out) {
+    uint32_t expansion, nlayers;
+    *out = NULL;
+    if (read_uint32(r, &expansion) != 0 || read_uint32(r, &nlayers) != 0) return -1;
+    bloom_t *bf = bloom_restore(expansion);
+    int valid = nlayers > 0;
+    for (uint32_t i = 0; i < nlayers; i++) {
+        int64_t capacity, count, nblocks;
+        uint32_t hashes;
+        double error;
+        if (read_int64(r, &capacity) != 0 || read_int64(r, &count) != 0 || read_uint32(r, &hashes) != 0 ||
+            read_double(r, &error) != 0 || read_int64(r, &nblocks) != 0) goto fail;
+        bloom_layer_t *l = valid ? bloom_restore_layer(bf, (uint64_t)capacity, (uint64_t)count, hashes,
+                                                       error, (uint64_t)nblocks) : NULL;
+        int rc = read_blob_into(r, l ? l->blocks : NULL, l ? bloom_layer_bytes(l) : 0);
+        if (rc < 0) goto fail;
+        if (rc > 0) valid = 0;
+    }
+    if (valid) *out = bf;
+    else bloom_destroy(bf);
+    return 0;
+
+fail:
+    bloom_destroy(bf);
+    return -1;
+}
+
+static int write_cuckoo(rdb_writer_t *w, const cuckoo_t *cf) {
+    if (write_uint32(w, cf->bucket_size) != 0 || write_uint32(w, cf->max_iterations) != 0 ||
+        write_uint32(w, cf->expansion) != 0 || write_int64(w, (int64_t)cf->deletes) != 0 ||
+        write_uint32(w, cf->nlayers) != 0) return -1;
+    for (uint32_t i = 0; i < cf->nlayers; i++) {
+        const cuckoo_layer_t *l = &cf->layers[i];
+        if (write_int64(w, (int64_t)l->nbuckets) != 0 || write_int64(w, (int64_t)l->count) != 0 ||
+            write_string(w, (const char *)l->slots, (uint32_t)(l->nbuckets * cf->bucket_size)) != 0) return -1;
+    }
+    return 0;
+}
+
+static int read_cuckoo(rdb_reader_t *r, cuckoo_t **out) {
+    uint32_t bucket_size, max_iterations, expansion, nlayers;
+    int64_t deletes;
+    *out = NULL;
+    if (read_uint32(r, &bucket_size) != 0 || read_uint32(r, &max_iterations) != 0 ||
+        read_uint32(r, &expansion) != 0 || read_int64(r, &deletes) != 0 || read_uint32(r, &nlayers) != 0) return -1;
+    int valid = nlayers > 0 && bucket_size >= 1 && bucket_size <= CUCKOO_MAX_BUCKET_SIZE &&
+                max_iterations >= 1 && max_iterations <= CUCKOO_MAX_ITERATIONS;
+    cuckoo_t *cf = cuckoo_restore(valid ? bucket_size : 1, max_iterations, expansion);
+    cf->deletes = (uint64_t)deletes;
+    for (uint32_t i = 0; i < nlayers; i++) {
+        int64_t nbuckets, count;
+        if (read_int64(r, &nbuckets) != 0 || read_int64(r, &count) != 0) goto fail;
+        cuckoo_layer_t *l = valid ? cuckoo_restore_layer(cf, (uint64_t)nbuckets, (uint64_t)count) : NULL;
+        int rc = read_blob_into(r, l ? l->slots : NULL, l ? l->nbuckets * bucket_size : 0);
+        if (rc < 0) goto fail;
+        if (rc > 0) valid = 0;
+    }
+    if (valid) *out = cf;
+    else cuckoo_destroy(cf);
+    return 0;
+
+fail:
+    cuckoo_destroy(cf);
+    return -1;
+}
 
-        /* Write type byte */
-        if (fwrite(&type, 1, 1, f) != 1) goto fail;
+/* One keyspace entry; counts it in *expires if it has a TTL. Returns 1 if
+ * written, 0 for a type with no encoding, -1 on a write error. */
+static int write_entry(rdb_writer_t *w, const ht_entry_t *he, int64_t now, uint64_t *expires) {
+    db_entry_t *entry = (db_entry_t *)he->value;
+    dbobj_t *obj = entry->obj;
+    uint8_t type;
 
-        /* Write expire */
-        if (write_int64(f, entry->expire) != 0) goto fail;
+    switch (obj->type) {
+        case OBJ_STRING: type = RDB_TYPE_STRING; break;
+        case OBJ_INT:    type = RDB_TYPE_INT;    break;
+        case OBJ_LIST:   type = RDB_TYPE_LIST_PACKED; break;
+        case OBJ_HASH:
+            type = obj->data.hash->encoding == HASH_ENC_LISTPACK ?
+                   RDB_TYPE_HASH_PACKED : RDB_TYPE_HASH;
+            break;
+        case OBJ_ZSET:
+            type = obj->data.zset->encoding == ZSET_ENC_LISTPACK ?
+                   RDB_TYPE_ZSET_PACKED : RDB_TYPE_ZSET;
+            break;
+        case OBJ_SET:
+            type = obj->data.set->encoding == SET_ENC_INTSET ?
+                   RDB_TYPE_SET_INTSET : RDB_TYPE_SET;
+            break;
+        case OBJ_STREAM: type = RDB_TYPE_STREAM; break;
+        case OBJ_CMS:    type = RDB_TYPE_CMS;    break;
+        case OBJ_TOPK:   type = RDB_TYPE_TOPK;   break;
+        case OBJ_VSET:   type = RDB_TYPE_VSET;   break;
+        case OBJ_BLOOM:  type = RDB_TYPE_BLOOM;  break;
+        case OBJ_CUCKOO: type = RDB_TYPE_CUCKOO; break;
+        default: return 0;
+    }
 
-        /* Write key */
-        if (write_string(f, he->key, (uint32_t)strlen(he->key)) != 0) goto fail;
+    /* Write type byte, flagged when an expire follows */
+    if (entry->expire >= 0) {
+        (*expires)++;
+        if (write_byte(w, type | RDB_EXPIRE_FLAG) != 0 ||
+            write_int64(w, entry->expire - now) != 0) return -1;
+    } else if (write_byte(w, type) != 0) {
+        return -1;
+    }
+
+    /* Write key */
+    if (write_string(w, he->key, (uint32_t)strlen(he->key)) != 0) return -1;
 
-        /* Write value */
-        switch (obj->type) {
-            case OBJ_STRING:
-                if (write_string(f, obj->data.str, (uint32_t)strlen(obj->data.str)) != 0) goto fail;
+    /* Write value */
+    switch (obj->type) {
+        case OBJ_STRING:
+            if (write_string(w, obj->data.str.buf, (uint32_t)obj->data.str.len) != 0) return -1;
+            break;
+        case OBJ_INT:
+            if (write_int64(w, obj->data.num) != 0) return -1;
+            break;
+        case OBJ_LIST: {
+            /* Blocks go out as stored, compressed or not */
+            list_t *list = obj->data.list;
+            if (write_uint32(w, (uint32_t)list->block_count) != 0) return -1;
+            for (list_block_t *b = list->head; b; b = b->next) {
+                uint32_t raw_size = b->compressed ? b->raw_size : b->size;
+                if (write_uint32(w, raw_size) != 0) return -1;
+                if ((b->compressed ? write_string_plain(w, (const char *)b->data, b->size)
+                                   : write_string(w, (const char *)b->data, b->size)) != 0) return -1;
+            }
+            break;
+        }
+        case OBJ_HASH: {
+            hash_t *hash = obj->data.hash;
+            if (hash->encoding == HASH_ENC_LISTPACK) {
+                /* The packed form goes out verbatim */
+                unsigned char *lp = hash->data.lp;
+                if (write_string(w, (const char *)lp, (uint32_t)lp_bytes(lp)) != 0) return -1;
                 break;
-            case OBJ_INT:
-                if (write_int64(f, obj->data.num) != 0) goto fail;
+            }
+            if (write_uint32(w, (uint32_t)hash_length(hash)) != 0) return -1;
+            hash_iter_t it;
+            const char *field, *val;
+            size_t flen, vlen;
+            hash_iter_init(&it, hash);
+            while (hash_iter_next(&it, &field, &flen, &val, &vlen)) {
+                if (write_string(w, field, (uint32_t)flen) != 0 ||
+                    write_string(w, val, (uint32_t)vlen) != 0) return -1;
+            }
+            break;
+        }
+        case OBJ_ZSET: {
+            zset_t *zs = obj->data.zset;
+            if (zs->encoding == ZSET_ENC_LISTPACK) {
+                if (write_string(w, (const char *)zs->lp, (uint32_t)lp_bytes(zs->lp)) != 0) return -1;
                 break;
-            case OBJ_LIST: {
-                list_t *list = obj->data.list;
-                uint32_t count = (uint32_t)list_length(list);
-                if (write_uint32(f, count) != 0) goto fail;
-                list_node_t *node = list->head;
-                while (node) {
-                    if (write_string(f, node->value, (uint32_t)strlen(node->value)) != 0) goto fail;
-                    node = node->next;
-                }
+            }
+            /* Ascending order makes every insert on load land at the tail */
+            if (write_uint32(w, (uint32_t)zset_length(zs)) != 0) return -1;
+            for (zskip_node_t *n = zs->zsl->header->level[0].forward; n; n = n->level[0].forward) {
+                if (write_string(w, n->member, (uint32_t)n->mlen) != 0 ||
+                    write_double(w, n->score) != 0) return -1;
+            }
+            break;
+        }
+        case OBJ_SET: {
+            set_t *set = obj->data.set;
+            if (set->encoding == SET_ENC_INTSET) {
+                intset_t *is = set->data.is;
+                if (write_string(w, (const char *)is, (uint32_t)intset_bytes(is)) != 0) return -1;
                 break;
             }
+            if (write_uint32(w, (uint32_t)set_length(set)) != 0) return -1;
+            set_iter_t it;
+            const char *member;
+            size_t mlen;
+            set_iter_init(&it, set);
+            while (set_iter_next(&it, &member, &mlen)) {
+                if (write_string(w, member, (uint32_t)mlen) != 0) return -1;
+            }
+            break;
         }
+        case OBJ_STREAM: {
+            /* Blocks go out verbatim, oldest first */
+            stream_t *s = obj->data.stream;
+            if (write_int64(w, (int64_t)s->last_id.ms) != 0 ||
+                write_int64(w, (int64_t)s->last_id.seq) != 0 ||
+                write_uint32(w, (uint32_t)s->index->size) != 0) return -1;
+            radix_iter_t it;
+            if (!radix_seek_first(&it, s->index)) break;
+            do {
+                stream_block_t *b = it.value;
+                if (write_int64(w, (int64_t)b->master.ms) != 0 ||
+                    write_int64(w, (int64_t)b->master.seq) != 0 ||
+                    write_string(w, (const char *)b->lp, (uint32_t)lp_bytes(b->lp)) != 0) return -1;
+            } while (radix_next(&it));
+            break;
+        }
+        case OBJ_CMS: {
+            cms_t *cms = obj->data.cms;
+            if (write_uint32(w, cms->width) != 0 || write_uint32(w, cms->depth) != 0 ||
+                write_int64(w, (int64_t)cms->count) != 0 ||
+                write_string(w, (const char *)cms->counters, (uint32_t)cms_counters_bytes(cms)) != 0) return -1;
+            break;
+        }
+        case OBJ_TOPK: {
+            topk_t *tk = obj->data.topk;
+            if (write_uint32(w, tk->k) != 0 || write_uint32(w, tk->width) != 0 ||
+                write_uint32(w, tk->depth) != 0 || write_double(w, tk->decay) != 0 ||
+                write_string(w, (const char *)tk->buckets, (uint32_t)topk_buckets_bytes(tk)) != 0 ||
+                write_uint32(w, tk->heap_len) != 0) return -1;
+            for (uint32_t i = 0; i < tk->heap_len; i++) {
+                if (write_uint32(w, tk->heap[i].count) != 0 ||
+                    write_string(w, tk->heap[i].item, (uint32_t)tk->heap[i].len) != 0) return -1;
+            }
+            break;
+        }
+        case OBJ_VSET:
+            if (write_vset(w, obj->data.vset) != 0) return -1;
+            break;
+        case OBJ_BLOOM:
+            if (write_bloom(w, obj->data.bloom) != 0) return -1;
+            break;
+        case OBJ_CUCKOO:
+            if (write_cuckoo(w, obj->data.cuckoo) != 0) return -1;
+            break;
     }
+    return 1;
+}
 
-    /* Write EOF marker */
-    uint8_t eof = RDB_EOF;
-    if (fwrite(&eof, 1, 1, f) != 1) goto fail;
+/* ---- Chunks: the keyspace is written as independently checksummed
+ * chunks, encoded by several threads and decoded by several on load ---- */
 
-    fclose(f);
+#ifdef _WIN32
+/* No threads: chunks are encoded and decoded one after another */
+typedef int rdb_mutex_t;
+typedef int rdb_cond_t;
+#define rdb_mutex_init(m) (*(m) = 0)
+#define rdb_mutex_destroy(m) ((void)(m))
+#define rdb_mutex_lock(m) ((void)(m))
+#define rdb_mutex_unlock(m) ((void)(m))
+#define rdb_cond_init(c) (*(c) = 0)
+#define rdb_cond_destroy(c) ((void)(c))
+#define rdb_cond_wait(c, m) ((void)(c), (void)(m))
+#define rdb_cond_broadcast(c) ((void)(c))
+#else
+typedef pthread_mutex_t rdb_mutex_t;
+typedef pthread_cond_t rdb_cond_t;
+#define rdb_mutex_init(m) pthread_mutex_init(m, NULL)
+#define rdb_mutex_destroy(m) pthread_mutex_destroy(m)
+#define rdb_mutex_lock(m) pthread_mutex_lock(m)
+#define rdb_mutex_unlock(m) pthread_mutex_unlock(m)
+#define rdb_cond_init(c) pthread_cond_init(c, NULL)
+#define rdb_cond_destroy(c) pthread_cond_destroy(c)
+#define rdb_cond_wait(c, m) pthread_cond_wait(c, m)
+#define rdb_cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+/* Threads for `work` units: rdb-threads, or one per online core */
+static int rdb_thread_count(size_t work) {
+#ifdef _WIN32
+    (void)work;
+    return 1;
+#else
+    long n = g_config.rdb_threads;
+    if (n == 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n > RDB_MAX_THREADS) n = RDB_MAX_THREADS;
+    }
+    if ((size_t)n > work) n = (long)work;
+    return n < 1 ? 1 : (int)n;
+#endif
+}
+
+typedef struct {
+    int n;
+#ifndef _WIN32
+    pthread_t tids[64];
+#endif
+} rdb_threads_t;
+
+/* Start up to n threads running fn(arg); t->n is how many did */
+static void threads_start(rdb_threads_t *t, int n, void *(*fn)(void *), void *arg) {
+    t->n = 0;
+#ifndef _WIN32
+    while (t->n < n && t->n < 64 && pthread_create(&t->tids[t->n], NULL, fn, arg) == 0) t->n++;
+#else
+    (void)n;
+    (void)fn;
+    (void)arg;
+#endif
+}
+
+static void threads_join(rdb_threads_t *t) {
+#ifndef _WIN32
+    for (int i = 0; i < t->n; i++) pthread_join(t->tids[i], NULL);
+#endif
+    t->n = 0;
+}
+
+typedef struct {
+    hashtable_t *ht;
+    int64_t now;
+    rdb_writer_t *out;      /* the file; whole chunks are appended to it */
+    rdb_mutex_t lock;       /* guards out and the fields below */
+    size_t next_slot;       /* first slot no worker has claimed */
+    uint64_t expires;
+    int err;
+} rdb_save_job_t;
+
+/* Append the chunk built in w as [RDB_OPCODE_CHUNK] [size] [keys] [body]
+ * [crc(8)]. The body is left out of the file's checksum, being covered by
+ * its own. */
+static void save_chunk(rdb_save_job_t *job, rdb_writer_t *w, uint64_t keys) {
+    unsigned char crc[8];
+    w_flush(w);
+    for (int i = 0; i < 8; i++) crc[i] = (unsigned char)(w->crc >> (8 * i));
+
+    rdb_mutex_lock(&job->lock);
+    rdb_writer_t *out = job->out;
+    if (!job->err) {
+        uint64_t size = varint_len(keys) + w->mem_len + sizeof(crc);
+        if (write_byte(out, RDB_OPCODE_CHUNK) != 0 || write_varint(out, size) != 0 ||
+            write_varint(out, keys) != 0) {
+            job->err = -1;
+        } else {
+            w_flush(out);
+            w_out(out, w->mem, w->mem_len);
+            if (write_bytes(out, crc, sizeof(crc)) != 0) job->err = -1;
+        }
+    }
+    rdb_mutex_unlock(&job->lock);
+
+    w->mem_len = 0;
+    w->crc = 0;
+}
+
+/* Claim slot ranges and write their entries as chunks of up to about
+ * RDB_CHUNK_BYTES each */
+static void *save_worker(void *arg) {
+    rdb_save_job_t *job = arg;
+    hashtable_t *ht = job->ht;
+    rdb_writer_t w;
+    uint64_t expires = 0;
+    int err = 0;
+    writer_init(&w, -1);
+
+    while (!err) {
+        rdb_mutex_lock(&job->lock);
+        size_t start = job->next_slot;
+        job->next_slot += RDB_CHUNK_SLOTS;
+        err = job->err;
+        rdb_mutex_unlock(&job->lock);
+        if (start >= ht->capacity || err) break;
+
+        size_t end = ht->capacity - start < RDB_CHUNK_SLOTS ? ht->capacity : start + RDB_CHUNK_SLOTS;
+        uint64_t keys = 0;
+        for (size_t i = start; i < end; i++) {
+            const ht_entry_t *he = &ht->entries[i];
+            if (he->occupied != 1) continue;
+            int rc = write_entry(&w, he, job->now, &expires);
+            if (rc < 0) {
+                err = -1;
+                break;
+            }
+            keys += (uint64_t)rc;
+            if (w.mem_len + w.len >= RDB_CHUNK_BYTES) {
+                save_chunk(job, &w, keys);
+                keys = 0;
+            }
+        }
+        if (!err && keys > 0) save_chunk(job, &w, keys);
+    }
+
+    rdb_mutex_lock(&job->lock);
+    job->expires += expires;
+    if (err) job->err = err;
+    rdb_mutex_unlock(&job->lock);
+    writer_free(&w);
+    return NULL;
+}
+
+/* Write EOF marker, then the checksum of everything before it */
+static int write_footer(rdb_writer_t *w) {
+    if (write_byte(w, RDB_EOF) != 0) return -1;
+    w_flush(w);
+    unsigned char crc[8];
+    for (int i = 0; i < 8; i++) crc[i] = (unsigned char)(w->crc >> (8 * i));
+    w_raw(w, crc, sizeof(crc));
+    return w->err;
+}
+
+static int write_entries(rdb_writer_t *w, database_t *db) {
+    /* Magic header, then the creation time expires are stored relative to,
+     * the producer, the checkpoint deltas will follow, and the key count
+     * the loader sizes the keyspace by */
+    int64_t now = imdb_mstime();
+    uint64_t keys = db_size(db), expires = 0;
+    if (write_bytes(w, RDB_MAGIC, RDB_MAGIC_LEN) != 0 || write_aux_int(w, "ctime", now) != 0 ||
+        write_aux(w, "imdb-ver", IMDB_VERSION) != 0 ||
+        write_aux_int(w, "delta-id", ckpt.id) != 0 || write_aux_int(w, "delta-seq", (int64_t)ckpt.seq) != 0 ||
+        write_byte(w, RDB_OPCODE_RESIZE) != 0 || write_uint32(w, (uint32_t)varint_len(keys)) != 0 ||
+        write_varint(w, keys) != 0) return -1;
+
+    /* Flushing the header also builds the CRC tables before the workers
+     * checksum their chunks */
+    w_flush(w);
+    if (w->err) return -1;
+
+    hashtable_t *ht = db_get_ht(db);
+    rdb_save_job_t job = {0};
+    job.ht = ht;
+    job.now = now;
+    job.out = w;
+    rdb_mutex_init(&job.lock);
+    rdb_threads_t threads;
+    threads_start(&threads, rdb_thread_count((ht->capacity + RDB_CHUNK_SLOTS - 1) / RDB_CHUNK_SLOTS) - 1,
+                  save_worker, &job);
+    save_worker(&job);
+    threads_join(&threads);
+    rdb_mutex_destroy(&job.lock);
+    if (job.err) return -1;
+    expires = job.expires;
+
+    /* Counted on the way, so it trails the keyspace */
+    if (write_aux_int(w, "expires", (int64_t)expires) != 0) return -1;
+    return write_footer(w);
+}
+
+/* A DELETE record: [RDB_OPCODE_DELETE] [size(4)] [key] */
+static int write_delete(rdb_writer_t *w, const char *key) {
+    uint32_t len = (uint32_t)strlen(key);
+    if (write_byte(w, RDB_OPCODE_DELETE) != 0 ||
+        write_uint32(w, (uint32_t)(varint_len((uint64_t)len << 1) + len)) != 0) return -1;
+    return write_string_plain(w, key, len);
+}
+
+/* The keys frozen by db_checkpoint_begin, as the next delta */
+static int write_delta(rdb_writer_t *w, database_t *db) {
+    int64_t now = imdb_mstime();
+    uint64_t expires = 0;
+    if (write_bytes(w, RDB_MAGIC, RDB_MAGIC_LEN) != 0 || write_aux_int(w, "ctime", now) != 0 ||
+        write_aux(w, "imdb-ver", IMDB_VERSION) != 0 ||
+        write_aux_int(w, "delta-id", ckpt.id) != 0 || write_aux_int(w, "delta-seq", (int64_t)ckpt.seq + 1) != 0)
+        return -1;
+
+    hashtable_t *ht = db_get_ht(db);
+    ht_iter_t it;
+    ht_entry_t *k;
+    ht_iter_init(&it, db->checkpointing);
+    while ((k = ht_iter_next(&it)) != NULL) {
+        /* Deleted first even when rewritten, so a value that expires
+         * before the load does not bring back the older one */
+        if (write_delete(w, k->key) != 0) return -1;
+        ht_entry_t *he = ht_get_entry(ht, k->key);
+        if (he && write_entry(w, he, now, &expires) < 0) return -1;
+    }
+    if (write_aux_int(w, "expires", (int64_t)expires) != 0) return -1;
+    return write_footer(w);
+}
+
+int persist_write(database_t *db, int fd) {
+    rdb_writer_t w;
+    writer_init(&w, fd);
+    int rc = write_entries(&w, db);
+    writer_free(&w);
+    return rc;
+}
+
+static int save_file(database_t *db, const char *filename, int (*fill)(rdb_writer_t *, database_t *)) {
+    char tmp_name[256];
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename);
+
+    int fd = rdb_open(tmp_name, RDB_OPEN_FLAGS, 0644);
+    if (fd < 0) return -1;
+    rdb_writer_t w;
+    writer_init(&w, fd);
+    int rc = fill(&w, db);
+    writer_free(&w);
+    /* Synced before the rename, so the name never points at a partial file */
+    if (rc != 0 || rdb_sync(fd) != 0) {
+        rdb_close(fd);
+        remove(tmp_name);
+        return -1;
+    }
+    if (rdb_close(fd) != 0) {
+        remove(tmp_name);
+        return -1;
+    }
 
     /* Atomic rename */
     remove(filename);
@@ -131,99 +1061,853 @@ int persist_save(database_t *db, const char *filename) {
         remove(tmp_name);
         return -1;
     }
+    return 0;
+}
 
+int persist_save(database_t *db, const char *filename) {
+    if (save_file(db, filename, write_entries) != 0) return -1;
     printf("Database saved to %s\n", filename);
     return 0;
+}
 
-fail:
-    fclose(f);
-    remove(tmp_name);
+int persist_save_delta(database_t *db, const char *filename) {
+    if (!db->checkpointing || save_file(db, filename, write_delta) != 0) return -1;
+    printf("Delta checkpoint saved to %s (%zu keys)\n", filename, ht_size(db->checkpointing));
+    return 0;
+}
+
+/* Step over a value without building it (an expired key's) */
+static int skip_value(rdb_reader_t *r, uint8_t type) {
+    uint32_t n, len, dims;
+    int64_t num;
+    double d;
+    switch (type) {
+        case RDB_TYPE_STRING:
+        case RDB_TYPE_HASH_PACKED:
+        case RDB_TYPE_ZSET_PACKED:
+        case RDB_TYPE_SET_INTSET:
+            return read_strview(r, &len) ? 0 : -1;
+        case RDB_TYPE_INT:
+            return read_int64(r, &num);
+        case RDB_TYPE_LIST:
+        case RDB_TYPE_LIST_PACKED:
+        case RDB_TYPE_HASH:
+        case RDB_TYPE_ZSET:
+        case RDB_TYPE_SET:
+            if (read_uint32(r, &n) != 0) return -1;
+            for (uint32_t i = 0; i < n; i++) {
+                if (type == RDB_TYPE_LIST_PACKED && read_uint32(r, &len) != 0) return -1;
+                if (!read_strview(r, &len)) return -1;
+                if (type == RDB_TYPE_HASH && !read_strview(r, &len)) return -1;
+                if (type == RDB_TYPE_ZSET && read_double(r, &d) != 0) return -1;
+            }
+            return 0;
+        case RDB_TYPE_STREAM:
+            if (read_int64(r, &num) != 0 || read_int64(r, &num) != 0 || read_uint32(r, &n) != 0) return -1;
+            for (uint32_t i = 0; i < n; i++) {
+                if (read_int64(r, &num) != 0 || read_int64(r, &num) != 0 || !read_strview(r, &len)) return -1;
+            }
+            return 0;
+        case RDB_TYPE_CMS:
+            return read_uint32(r, &dims) != 0 || read_uint32(r, &dims) != 0 || read_int64(r, &num) != 0 ||
+                   !read_strview(r, &len) ? -1 : 0;
+        case RDB_TYPE_TOPK:
+            if (read_uint32(r, &dims) != 0 || read_uint32(r, &dims) != 0 || read_uint32(r, &dims) != 0 ||
+                read_double(r, &d) != 0 || !read_strview(r, &len) || read_uint32(r, &n) != 0) return -1;
+            for (uint32_t i = 0; i < n; i++) {
+                if (read_uint32(r, &dims) != 0 || !read_strview(r, &len)) return -1;
+            }
+            return 0;
+        case RDB_TYPE_VSET: {
+            vset_t *vs;
+            if (read_vset(r, &vs) != 0) return -1;
+            vset_destroy(vs);
+            return 0;
+        }
+        case RDB_TYPE_BLOOM: {
+            bloom_t *bf;
+            if (read_bloom(r, &bf) != 0) return -1;
+            bloom_destroy(bf);
+            return 0;
+        }
+        case RDB_TYPE_CUCKOO: {
+            cuckoo_t *cf;
+            if (read_cuckoo(r, &cf) != 0) return -1;
+            cuckoo_destroy(cf);
+            return 0;
+        }
+    }
     return -1;
 }
 
-int persist_load(database_t *db, const char *filename) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) return -1;
+/* Apply an opcode record. Its payload is length-prefixed, so records and
+ * AUX fields this version does not know are stepped over. */
+static int read_opcode(database_t *db, rdb_reader_t *r, uint8_t op, int64_t *save_time,
+                       rdb_delta_t *delta) {
+    uint32_t size;
+    if (read_uint32(r, &size) != 0) return -1;
+    const unsigned char *payload = read_view(r, size);
+    if (!payload) return -1;
+    rdb_reader_t sub = {payload, payload + size, r->version, {NULL, NULL}, {0, 0}, 0};
 
-    /* Verify magic */
-    char magic[RDB_MAGIC_LEN];
-    if (fread(magic, 1, RDB_MAGIC_LEN, f) != RDB_MAGIC_LEN ||
-        memcmp(magic, RDB_MAGIC, RDB_MAGIC_LEN) != 0) {
-        fclose(f);
-        return -1;
+    if (op == RDB_OPCODE_AUX) {
+        uint32_t nlen, vlen;
+        const char *name = read_strview(&sub, &nlen);
+        const char *value = name ? read_strview(&sub, &vlen) : NULL;
+        char buf[32];
+        if (!value) return -1;
+        /* The creation time is also the base of every expire that follows */
+        if (nlen == 5 && memcmp(name, "ctime", 5) == 0 && vlen < sizeof(buf)) {
+            memcpy(buf, value, vlen);
+            buf[vlen] = '\0';
+            *save_time = strtoll(buf, NULL, 10);
+        } else if (nlen == 8 && memcmp(name, "delta-id", 8) == 0 && vlen < sizeof(buf)) {
+            memcpy(buf, value, vlen);
+            buf[vlen] = '\0';
+            delta->id = strtoll(buf, NULL, 10);
+        } else if (nlen == 9 && memcmp(name, "delta-seq", 9) == 0 && vlen < sizeof(buf)) {
+            memcpy(buf, value, vlen);
+            buf[vlen] = '\0';
+            delta->seq = strtoll(buf, NULL, 10);
+        }
+    } else if (op == RDB_OPCODE_DELETE) {
+        uint32_t len;
+        char *key = read_string(&sub, &len);
+        if (!key) return -1;
+        ht_delete(db_get_ht(db), key);
+        imdb_free(key);
+    } else if (op == RDB_OPCODE_RESIZE) {
+        uint64_t keys;
+        /* Size the keyspace once instead of doubling it all the way up */
+        if (read_varint(&sub, &keys) == 0 && keys <= (uint64_t)(r->end - r->p)) {
+            ht_reserve(db_get_ht(db), ht_size(db_get_ht(db)) + (size_t)keys);
+            atomic_store_explicit(&progress.expected_keys, progress.done_keys + keys, memory_order_relaxed);
+        }
     }
+    return 0;
+}
 
-    int loaded = 0;
-    while (1) {
-        uint8_t type;
-        if (fread(&type, 1, 1, f) != 1) break;
-        if (type == RDB_EOF) break;
+/* Decode one entry after its type byte. Returns 1 with the key and entry
+ * built, 0 for a key that is skipped (expired or damaged beyond use), -1
+ * if the data runs out or makes no sense. */
+static int read_entry(rdb_reader_t *r, uint8_t type, int64_t save_time, char **out_key,
+                      db_entry_t **out_entry) {
+    /* Read expire */
+    int64_t expire = -1;
+    if (r->version == 1) {
+        if (read_int64(r, &expire) != 0) return -1;
+    } else if (type & RDB_EXPIRE_FLAG) {
+        if (read_int64(r, &expire) != 0) return -1;
+        expire += save_time;
+        type &= (uint8_t)~RDB_EXPIRE_FLAG;
+    }
+
+    /* Read key */
+    uint32_t key_len;
+    char *key = read_string(r, &key_len);
+    if (!key) return -1;
 
-        /* Read expire */
-        int64_t expire;
-        if (read_int64(f, &expire) != 0) break;
+    /* Skip expired keys */
+    if (expire >= 0 && imdb_mstime() > expire) {
+        imdb_free(key);
+        return skip_value(r, type);
+    }
 
-        /* Read key */
-        uint32_t key_len;
-        char *key = read_string(f, &key_len);
-        if (!key) break;
+    /* Read and create entry */
+    db_entry_t *entry = imdb_malloc(sizeof(db_entry_t));
+    entry->expire = expire;
 
-        /* Skip expired keys */
-        if (expire >= 0 && imdb_mstime() > expire) {
-            imdb_free(key);
-            /* Skip value data */
-            if (type == RDB_TYPE_STRING) {
-                uint32_t vlen; char *v = read_string(f, &vlen);
-                imdb_free(v);
-            } else if (type == RDB_TYPE_INT) {
-                int64_t tmp; read_int64(f, &tmp);
-            } else if (type == RDB_TYPE_LIST) {
-                uint32_t count; read_uint32(f, &count);
-                for (uint32_t i = 0; i < count; i++) {
-                    uint32_t vlen; char *v = read_string(f, &vlen);
-                    imdb_free(v);
-                }
+    if (type == RDB_TYPE_STRING) {
+        uint32_t val_len;
+        const char *val = read_strview(r, &val_len);
+        if (!val) { imdb_free(key); imdb_free(entry); return -1; }
+        entry->obj = obj_create_string(val, val_len);
+    } else if (type == RDB_TYPE_INT) {
+        int64_t num;
+        if (read_int64(r, &num) != 0) { imdb_free(key); imdb_free(entry); return -1; }
+        entry->obj = obj_create_int(num);
+    } else if (type == RDB_TYPE_LIST) {
+        uint32_t count;
+        if (read_uint32(r, &count) != 0) { imdb_free(key); imdb_free(entry); return -1; }
+        entry->obj = obj_create_list();
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t vlen;
+            const char *val = read_strview(r, &vlen);
+            if (!val) break;
+            list_rpush(entry->obj->data.list, val, vlen);
+        }
+    } else if (type == RDB_TYPE_LIST_PACKED) {
+        uint32_t blocks;
+        if (read_uint32(r, &blocks) != 0) { imdb_free(key); imdb_free(entry); return -1; }
+        entry->obj = obj_create_list();
+        list_t *list = entry->obj->data.list;
+        for (uint32_t i = 0; i < blocks; i++) {
+            uint32_t raw_size, size;
+            char *data;
+            if (read_uint32(r, &raw_size) != 0 || !(data = read_string(r, &size))) break;
+            if (list_append_block(list, (unsigned char *)data, size, raw_size) != 0) {
+                fprintf(stderr, "Warning: skipping corrupt list block in key '%s'\n", key);
             }
-            continue;
         }
-
-        /* Read and create entry */
-        db_entry_t *entry = imdb_malloc(sizeof(db_entry_t));
-        entry->expire = expire;
-
-        if (type == RDB_TYPE_STRING) {
-            uint32_t val_len;
-            char *val = read_string(f, &val_len);
-            if (!val) { imdb_free(key); imdb_free(entry); break; }
-            entry->obj = obj_create_string(val);
-            imdb_free(val);
-        } else if (type == RDB_TYPE_INT) {
-            int64_t num;
-            if (read_int64(f, &num) != 0) { imdb_free(key); imdb_free(entry); break; }
-            entry->obj = obj_create_int(num);
-        } else if (type == RDB_TYPE_LIST) {
-            uint32_t count;
-            if (read_uint32(f, &count) != 0) { imdb_free(key); imdb_free(entry); break; }
-            entry->obj = obj_create_list();
-            for (uint32_t i = 0; i < count; i++) {
-                uint32_t vlen;
-                char *val = read_string(f, &vlen);
-                if (!val) break;
-                list_rpush(entry->obj->data.list, val);
-                imdb_free(val);
+        list_compress_all(list);
+    } else if (type == RDB_TYPE_HASH_PACKED) {
+        uint32_t size;
+        char *data = read_string(r, &size);
+        if (!data) { imdb_free(key); imdb_free(entry); return -1; }
+        hash_t *hash = hash_from_listpack((unsigned char *)data, size);
+        if (!hash) {
+            fprintf(stderr, "Warning: skipping corrupt hash in key '%s'\n", key);
+            imdb_free(data);
+            imdb_free(key);
+            imdb_free(entry);
+            return 0;
+        }
+        entry->obj = imdb_malloc(sizeof(dbobj_t));
+        entry->obj->type = OBJ_HASH;
+        entry->obj->data.hash = hash;
+    } else if (type == RDB_TYPE_HASH) {
+        uint32_t count;
+        if (read_uint32(r, &count) != 0) { imdb_free(key); imdb_free(entry); return -1; }
+        entry->obj = obj_create_hash();
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t flen, vlen;
+            const char *field = read_strview(r, &flen);
+            const char *val = field ? read_strview(r, &vlen) : NULL;
+            if (!val) break;
+            hash_set(entry->obj->data.hash, field, flen, val, vlen);
+        }
+    } else if (type == RDB_TYPE_ZSET_PACKED) {
+        uint32_t size;
+        char *data = read_string(r, &size);
+        if (!data) { imdb_free(key); imdb_free(entry); return -1; }
+        zset_t *zs = zset_from_listpack((unsigned char *)data, size);
+        if (!zs) {
+            fprintf(stderr, "Warning: skipping corrupt sorted set in key '%s'\n", key);
+            imdb_free(data);
+            imdb_free(key);
+            imdb_free(entry);
+            return 0;
+        }
+        entry->obj = imdb_malloc(sizeof(dbobj_t));
+        entry->obj->type = OBJ_ZSET;
+        entry->obj->data.zset = zs;
+    } else if (type == RDB_TYPE_ZSET) {
+        uint32_t count;
+        if (read_uint32(r, &count) != 0) { imdb_free(key); imdb_free(entry); return -1; }
+        entry->obj = obj_create_zset();
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t mlen;
+            double score;
+            int out;
+            const char *member = read_strview(r, &mlen);
+            if (!member || read_double(r, &score) != 0) break;
+            zset_add(entry->obj->data.zset, score, member, mlen, 0, &out, &score);
+        }
+    } else if (type == RDB_TYPE_SET_INTSET) {
+        uint32_t size;
+        char *data = read_string(r, &size);
+        if (!data) { imdb_free(key); imdb_free(entry); return -1; }
+        set_t *set = set_from_intset(data, size);
+        if (!set) {
+            fprintf(stderr, "Warning: skipping corrupt set in key '%s'\n", key);
+            imdb_free(data);
+            imdb_free(key);
+            imdb_free(entry);
+            return 0;
+        }
+        entry->obj = imdb_malloc(sizeof(dbobj_t));
+        entry->obj->type = OBJ_SET;
+        entry->obj->data.set = set;
+    } else if (type == RDB_TYPE_SET) {
+        uint32_t count;
+        if (read_uint32(r, &count) != 0) { imdb_free(key); imdb_free(entry); return -1; }
+        entry->obj = obj_create_set();
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t mlen;
+            const char *member = read_strview(r, &mlen);
+            if (!member) break;
+            set_add(entry->obj->data.set, member, mlen);
+        }
+    } else if (type == RDB_TYPE_CMS) {
+        uint32_t width, depth, size;
+        int64_t count;
+        const char *data;
+        if (read_uint32(r, &width) != 0 || read_uint32(r, &depth) != 0 ||
+            read_int64(r, &count) != 0 || !(data = read_strview(r, &size))) {
+            imdb_free(key);
+            imdb_free(entry);
+            return -1;
+        }
+        if (width == 0 || depth == 0 || depth > SKETCH_MAX_DEPTH ||
+            (uint64_t)width * depth > SKETCH_MAX_CELLS || size != (uint64_t)width * depth * 4) {
+            fprintf(stderr, "Warning: skipping corrupt count-min sketch in key '%s'\n", key);
+            imdb_free(key);
+            imdb_free(entry);
+            return 0;
+        }
+        cms_t *cms = cms_create(width, depth);
+        memcpy(cms->counters, data, size);
+        cms->count = (uint64_t)count;
+        entry->obj = imdb_malloc(sizeof(dbobj_t));
+        entry->obj->type = OBJ_CMS;
+        entry->obj->data.cms = cms;
+    } else if (type == RDB_TYPE_TOPK) {
+        uint32_t k, width, depth, size, heap_len;
+        double decay;
+        const char *data;
+        if (read_uint32(r, &k) != 0 || read_uint32(r, &width) != 0 || read_uint32(r, &depth) != 0 ||
+            read_double(r, &decay) != 0 || !(data = read_strview(r, &size))) {
+            imdb_free(key);
+            imdb_free(entry);
+            return -1;
+        }
+        int ok = read_uint32(r, &heap_len) == 0;
+        int valid = k > 0 && k <= TOPK_MAX_K && width > 0 && depth > 0 && depth <= SKETCH_MAX_DEPTH &&
+                    (uint64_t)width * depth <= SKETCH_MAX_CELLS && decay > 0 && decay <= 1 &&
+                    size == (uint64_t)width * depth * sizeof(topk_bucket_t);
+        topk_t *tk = valid ? topk_create(k, width, depth, decay) : NULL;
+        if (tk) memcpy(tk->buckets, data, size);
+        /* Heap entries are read even for a rejected sketch to stay in step */
+        for (uint32_t i = 0; ok && i < heap_len; i++) {
+            uint32_t count, len;
+            const char *item;
+            if (read_uint32(r, &count) != 0 || !(item = read_strview(r, &len))) {
+                ok = 0;
+                break;
             }
-        } else {
+            if (tk && topk_restore(tk, item, len, count) != 0) valid = 0;
+        }
+        if (!ok || !valid) {
+            if (ok) fprintf(stderr, "Warning: skipping corrupt top-k in key '%s'\n", key);
+            topk_destroy(tk);
+            imdb_free(key);
+            imdb_free(entry);
+            if (!ok) return -1;
+            return 0;
+        }
+        entry->obj = imdb_malloc(sizeof(dbobj_t));
+        entry->obj->type = OBJ_TOPK;
+        entry->obj->data.topk = tk;
+    } else if (type == RDB_TYPE_VSET) {
+        vset_t *vs;
+        if (read_vset(r, &vs) != 0) {
+            imdb_free(key);
+            imdb_free(entry);
+            return -1;
+        }
+        if (!vs) {
+            fprintf(stderr, "Warning: skipping corrupt vector set in key '%s'\n", key);
+            imdb_free(key);
+            imdb_free(entry);
+            return 0;
+        }
+        entry->obj = imdb_malloc(sizeof(dbobj_t));
+        entry->obj->type = OBJ_VSET;
+        entry->obj->data.vset = vs;
+    } else if (type == RDB_TYPE_BLOOM) {
+        bloom_t *bf;
+        if (read_bloom(r, &bf) != 0) {
+            imdb_free(key);
+            imdb_free(entry);
+            return -1;
+        }
+        if (!bf) {
+            fprintf(stderr, "Warning: skipping corrupt bloom filter in key '%s'\n", key);
+            imdb_free(key);
+            imdb_free(entry);
+            return 0;
+        }
+        entry->obj = imdb_malloc(sizeof(dbobj_t));
+        entry->obj->type = OBJ_BLOOM;
+        entry->obj->data.bloom = bf;
+    } else if (type == RDB_TYPE_CUCKOO) {
+        cuckoo_t *cf;
+        if (read_cuckoo(r, &cf) != 0) {
+            imdb_free(key);
+            imdb_free(entry);
+            return -1;
+        }
+        if (!cf) {
+            fprintf(stderr, "Warning: skipping corrupt cuckoo filter in key '%s'\n", key);
+            imdb_free(key);
+            imdb_free(entry);
+            return 0;
+        }
+        entry->obj = imdb_malloc(sizeof(dbobj_t));
+        entry->obj->type = OBJ_CUCKOO;
+        entry->obj->data.cuckoo = cf;
+    } else if (type == RDB_TYPE_STREAM) {
+        int64_t ms, seq;
+        uint32_t blocks;
+        if (read_int64(r, &ms) != 0 || read_int64(r, &seq) != 0 || read_uint32(r, &blocks) != 0) {
             imdb_free(key);
             imdb_free(entry);
+            return -1;
+        }
+        entry->obj = obj_create_stream();
+        stream_t *s = entry->obj->data.stream;
+        s->last_id.ms = (uint64_t)ms;
+        s->last_id.seq = (uint64_t)seq;
+        for (uint32_t i = 0; i < blocks; i++) {
+            stream_id_t master;
+            uint32_t size;
+            char *data;
+            if (read_int64(r, &ms) != 0 || read_int64(r, &seq) != 0 ||
+                !(data = read_string(r, &size))) break;
+            master.ms = (uint64_t)ms;
+            master.seq = (uint64_t)seq;
+            if (stream_load_block(s, master, (unsigned char *)data, size) != 0) {
+                fprintf(stderr, "Warning: skipping corrupt stream block in key '%s'\n", key);
+            }
+        }
+    } else {
+        imdb_free(key);
+        imdb_free(entry);
+        return -1;
+    }
+
+    *out_key = key;
+    *out_entry = entry;
+    return 1;
+}
+
+/* A decoded entry waiting to be merged into the keyspace */
+typedef struct {
+    char *key;
+    uint32_t hash;
+    db_entry_t *entry;
+} rdb_staged_t;
+
+typedef struct {
+    const unsigned char *body;
+    size_t len;
+    uint64_t keys;
+    uint64_t crc;
+    rdb_staged_t *staged;
+    size_t nstaged;
+    int damaged;
+    int done;
+} rdb_chunk_t;
+
+typedef struct {
+    rdb_chunk_t *chunks;
+    size_t nchunks;
+    int version;
+    int64_t save_time;
+    rdb_mutex_t lock;       /* guards the fields below and every chunk's done */
+    rdb_cond_t cond;
+    size_t next;            /* first chunk no worker has claimed */
+    size_t merged;          /* chunks merged so far */
+    size_t window;          /* decoded chunks allowed to wait for the merge */
+    int stop;               /* the load was cancelled: claim no more chunks */
+    uint64_t bytes, keys;   /* loaded outside chunks, then with each merge */
+} rdb_load_job_t;
+
+/* Verify a chunk and build its entries, hashing each key for the merge */
+static void decode_chunk(rdb_load_job_t *job, rdb_chunk_t *c) {
+    if (imdb_crc64(0, c->body, c->len) != c->crc || c->keys > c->len) {
+        c->damaged = 1;
+        return;
+    }
+    rdb_reader_t r = {c->body, c->body + c->len, job->version, {NULL, NULL}, {0, 0}, 0};
+    c->staged = imdb_malloc((size_t)c->keys * sizeof(rdb_staged_t));
+    for (uint64_t i = 0; i < c->keys; i++) {
+        uint8_t type;
+        char *key = NULL;
+        db_entry_t *entry = NULL;
+        int rc = read_bytes(&r, &type, 1) == 0 && type < RDB_OPCODE_MIN ?
+                 read_entry(&r, type, job->save_time, &key, &entry) : -1;
+        if (rc < 0) break;
+        if (rc == 0) continue;
+        c->staged[c->nstaged].key = key;
+        c->staged[c->nstaged].hash = ht_hash(key);
+        c->staged[c->nstaged].entry = entry;
+        c->nstaged++;
+    }
+    if (r.p != r.end) c->damaged = 1;
+    imdb_free(r.scratch[0]);
+    imdb_free(r.scratch[1]);
+}
+
+/* Decode chunks in file order, staying at most `window` ahead of the merge */
+static void *load_worker(void *arg) {
+    rdb_load_job_t *job = arg;
+    rdb_mutex_lock(&job->lock);
+    while (1) {
+        while (!job->stop && job->next < job->nchunks && job->next >= job->merged + job->window)
+            rdb_cond_wait(&job->cond, &job->lock);
+        if (job->stop || job->next >= job->nchunks) break;
+        rdb_chunk_t *c = &job->chunks[job->next++];
+        rdb_mutex_unlock(&job->lock);
+        decode_chunk(job, c);
+        rdb_mutex_lock(&job->lock);
+        c->done = 1;
+        rdb_cond_broadcast(&job->cond);
+    }
+    rdb_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* Decode the chunks on worker threads while this thread inserts what they
+ * built, in file order. Returns the keys loaded, -2 if a chunk is damaged
+ * (the others are still loaded), or -3 if the load was cancelled. */
+static int load_chunks(database_t *db, rdb_load_job_t *job) {
+    hashtable_t *ht = db_get_ht(db);
+    int count = rdb_thread_count(job->nchunks);
+    int loaded = 0, damaged = 0;
+    size_t claimed = job->nchunks;
+    job->window = (size_t)count * 2;
+    rdb_mutex_init(&job->lock);
+    rdb_cond_init(&job->cond);
+    /* With one thread there is nothing to overlap; decode inline */
+    rdb_threads_t threads;
+    threads_start(&threads, count > 1 ? count : 0, load_worker, job);
+    int pooled = threads.n > 0;
+
+    for (size_t i = 0; i < job->nchunks; i++) {
+        rdb_chunk_t *c = &job->chunks[i];
+        /* Once cancelled, merge only what the workers already took on so
+         * that no decoded entries are left behind */
+        if (claimed == job->nchunks && atomic_load(&load_cancelled)) {
+            rdb_mutex_lock(&job->lock);
+            job->stop = 1;
+            claimed = pooled ? job->next : i;
+            rdb_cond_broadcast(&job->cond);
+            rdb_mutex_unlock(&job->lock);
+        }
+        if (i >= claimed) break;
+        if (pooled) {
+            rdb_mutex_lock(&job->lock);
+            while (!c->done) rdb_cond_wait(&job->cond, &job->lock);
+            rdb_mutex_unlock(&job->lock);
+        } else {
+            decode_chunk(job, c);
+        }
+        if (c->damaged) {
+            fprintf(stderr, "Error: snapshot chunk %zu of %zu is damaged\n", i + 1, job->nchunks);
+            damaged = 1;
+        }
+
+        /* Each insert's first probe is fetched a few entries ahead */
+        for (size_t k = 0; k < c->nstaged; k++) {
+            if (k + 8 < c->nstaged) ht_prefetch(ht, c->staged[k + 8].hash);
+            ht_set_owned_hashed(ht, c->staged[k].key, c->staged[k].hash, c->staged[k].entry);
+        }
+        loaded += (int)c->nstaged;
+        imdb_free(c->staged);
+        c->staged = NULL;
+        job->bytes += c->len;
+        progress_note(job->bytes, job->keys + (uint64_t)loaded);
+
+        rdb_mutex_lock(&job->lock);
+        job->merged = i + 1;
+        rdb_cond_broadcast(&job->cond);
+        rdb_mutex_unlock(&job->lock);
+    }
+
+    threads_join(&threads);
+    rdb_cond_destroy(&job->cond);
+    rdb_mutex_destroy(&job->lock);
+    if (claimed < job->nchunks) return -3;
+    return damaged ? -2 : loaded;
+}
+
+/* Decode the snapshot at the start of data; *used is set to its length.
+ * With want set, a file that is not that checkpoint is left unapplied and
+ * read as missing (-1). */
+static int read_snapshot(database_t *db, rdb_reader_t *r, const unsigned char *data, size_t *used,
+                         rdb_delta_t *delta, const rdb_delta_t *want) {
+    /* Verify magic */
+    const char *magic = read_view(r, RDB_MAGIC_LEN);
+    if (!magic || memcmp(magic, RDB_MAGIC_PREFIX, 4) != 0) return -1;
+    for (int i = 4; i < RDB_MAGIC_LEN; i++) {
+        if (magic[i] < '0' || magic[i] > '9') return -1;
+        r->version = r->version * 10 + (magic[i] - '0');
+    }
+    if (r->version < 1) return -1;
+    if (r->version > RDB_VERSION) {
+        fprintf(stderr, "Error: snapshot format version %d is newer than this server reads (%d)\n",
+                r->version, RDB_VERSION);
+        return -2;
+    }
+
+    /* Versions 2 and 3 have a fixed header; 4 has opcode records instead */
+    int64_t save_time = 0, keys = 0;
+    if (r->version >= 2 && r->version < 4 && read_int64(r, &save_time) != 0) return -2;
+    if (r->version == 3 && read_int64(r, &keys) != 0) return -2;
+    if (keys > 0 && (uint64_t)keys <= (uint64_t)(r->end - r->p))
+        ht_reserve(db_get_ht(db), ht_size(db_get_ht(db)) + (size_t)keys);
+
+    /* Chunks are collected here and decoded once the file has been walked.
+     * The file checksum skips their bodies, which carry their own. */
+    rdb_load_job_t job = {0};
+    size_t chunk_cap = 0;
+    const unsigned char *crc_from = data;
+    uint64_t file_crc = 0, chunk_bytes = 0, records = 0;
+
+    int loaded = 0, complete = 0;
+    while (1) {
+        uint8_t type;
+        if ((++records & 1023) == 0) {
+            progress_note((uint64_t)(r->p - data) - chunk_bytes, (uint64_t)loaded);
+            if (atomic_load(&load_cancelled)) break;
+        }
+        if (read_bytes(r, &type, 1) != 0) break;
+        if (type == RDB_EOF) {
+            complete = 1;
             break;
         }
+        if (r->version >= 5 && type == RDB_OPCODE_CHUNK) {
+            uint64_t size, keys;
+            const unsigned char *payload, *body;
+            if (read_varint(r, &size) != 0 || !(payload = read_view(r, size))) break;
+            rdb_reader_t sub = {payload, payload + size, r->version, {NULL, NULL}, {0, 0}, 0};
+            if (read_varint(&sub, &keys) != 0 || (size_t)(sub.end - sub.p) < 8) break;
+            body = sub.p;
+            if (job.nchunks == chunk_cap) {
+                chunk_cap = chunk_cap ? chunk_cap * 2 : 64;
+                job.chunks = imdb_realloc(job.chunks, chunk_cap * sizeof(rdb_chunk_t));
+            }
+            rdb_chunk_t *c = &job.chunks[job.nchunks++];
+            memset(c, 0, sizeof(*c));
+            c->body = body;
+            c->len = (size_t)(sub.end - 8 - body);
+            c->keys = keys;
+            for (int i = 0; i < 8; i++) c->crc |= (uint64_t)sub.end[i - 8] << (8 * i);
+            file_crc = imdb_crc64(file_crc, crc_from, (size_t)(body - crc_from));
+            crc_from = body + c->len;
+            chunk_bytes += c->len;
+            continue;
+        }
+        /* The AUX fields lead, so the checkpoint is known before any
+         * record touches the keyspace */
+        if (want && type != RDB_OPCODE_AUX) {
+            if (delta->id != want->id || delta->seq != want->seq) return -1;
+            want = NULL;
+        }
+        if (r->version >= 4 && type >= RDB_OPCODE_MIN) {
+            if (read_opcode(db, r, type, &save_time, delta) != 0) break;
+            continue;
+        }
 
-        ht_set(db_get_ht(db), key, entry);
-        imdb_free(key);
+        char *key = NULL;
+        db_entry_t *entry = NULL;
+        int rc = read_entry(r, type, save_time, &key, &entry);
+        if (rc < 0) break;
+        if (rc == 0) continue;
+        ht_set_owned(db_get_ht(db), key, entry);
         loaded++;
     }
 
+    /* Intact chunks are loaded even when the file is damaged elsewhere */
+    int damaged = 0;
+    if (job.nchunks > 0) {
+        job.version = r->version;
+        job.save_time = save_time;
+        job.bytes = (uint64_t)(r->p - data) - chunk_bytes;
+        job.keys = (uint64_t)loaded;
+        int n = load_chunks(db, &job);
+        if (n < 0) damaged = 1;
+        else loaded += n;
+        imdb_free(job.chunks);
+    }
+    if (atomic_load(&load_cancelled)) return -3;
+
+    if (r->version > 1) {
+        const unsigned char *crc = complete ? read_view(r, 8) : NULL;
+        uint64_t stored = 0;
+        if (!crc) {
+            fprintf(stderr, "Error: snapshot is truncated after %d keys\n", loaded);
+            return -2;
+        }
+        for (int i = 0; i < 8; i++) stored |= (uint64_t)crc[i] << (8 * i);
+        if (stored != imdb_crc64(file_crc, crc_from, (size_t)(r->p - 8 - crc_from))) {
+            fprintf(stderr, "Error: snapshot checksum mismatch\n");
+            return -2;
+        }
+    }
+    if (damaged) return -2;
+    *used = (size_t)(r->p - data);
+    return loaded;
+}
+
+/* ---- Mapping the file ---- */
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    void *heap;           /* set when the file was read instead of mapped */
+} rdb_map_t;
+
+static int map_file(const char *filename, rdb_map_t *m) {
+    memset(m, 0, sizeof(*m));
+#ifdef _WIN32
+    FILE *f = fopen(filename, "rb");
+    if (!f) return -1;
+    size_t cap = 1 << 20, n;
+    m->heap = imdb_malloc(cap);
+    while ((n = fread((char *)m->heap + m->len, 1, cap - m->len, f)) > 0) {
+        m->len += n;
+        if (m->len == cap) m->heap = imdb_realloc(m->heap, cap *= 2);
+    }
     fclose(f);
+    m->data = m->heap;
+    return 0;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    m->len = (size_t)st.st_size;
+    if (m->len > 0) {
+        void *p = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        /* Read ahead aggressively and drop pages once passed */
+        posix_madvise(p, m->len, POSIX_MADV_SEQUENTIAL);
+        m->data = p;
+    }
+    close(fd);
+    return 0;
+#endif
+}
+
+static void unmap_file(rdb_map_t *m) {
+#ifdef _WIN32
+    imdb_free(m->heap);
+#else
+    if (m->len > 0) munmap((void *)m->data, m->len);
+#endif
+}
+
+static int read_file(database_t *db, const char *filename, uint64_t *end, rdb_delta_t *delta,
+                     const rdb_delta_t *want) {
+    rdb_map_t m;
+    delta->id = 0;
+    delta->seq = -1;
+    if (map_file(filename, &m) != 0) return -1;
+    rdb_reader_t r = {m.data, m.data + m.len, 0, {NULL, NULL}, {0, 0}, 0};
+    size_t used = 0;
+    int loaded = read_snapshot(db, &r, m.data, &used, delta, want);
+    imdb_free(r.scratch[0]);
+    imdb_free(r.scratch[1]);
+    unmap_file(&m);
+    *end = used;
+    return loaded;
+}
+
+int persist_read(database_t *db, const char *filename, uint64_t *end) {
+    rdb_delta_t delta;
+    return read_file(db, filename, end, &delta, NULL);
+}
+
+static uint64_t file_size(const char *filename) {
+    struct stat st;
+    return stat(filename, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+static void delta_name(char *buf, size_t size, const char *filename, uint64_t seq) {
+    snprintf(buf, size, "%s.%llu.delta", filename, (unsigned long long)seq);
+}
+
+int persist_load(database_t *db, const char *filename) {
+    uint64_t end;
+    rdb_delta_t delta;
+    /* A new id unless the snapshot carries one, so deltas left by some
+     * other snapshot are never taken for this one's */
+    memset(&ckpt, 0, sizeof(ckpt));
+    ckpt.id = imdb_mstime();
+    progress.done_bytes = progress.done_keys = 0;
+    atomic_store(&progress.total_bytes, file_size(filename));
+    atomic_store(&progress.expected_keys, 0);
+    progress_note(0, 0);
+    int loaded = read_file(db, filename, &end, &delta, NULL);
+    if (loaded < 0) return loaded;
     printf("Loaded %d keys from %s\n", loaded, filename);
+    progress.done_bytes = file_size(filename);
+    progress.done_keys = (uint64_t)loaded;
+    progress_note(0, 0);
+    if (delta.seq < 0) return 0;
+
+    ckpt.have_base = 1;
+    ckpt.id = delta.id;
+    ckpt.base_seq = ckpt.seq = (uint64_t)delta.seq;
+    ckpt.base_bytes = progress.done_bytes;
+    char name[256];
+    while (1) {
+        delta_name(name, sizeof(name), filename, ckpt.seq + 1);
+        uint64_t size = file_size(name);
+        atomic_fetch_add(&progress.total_bytes, size);
+        rdb_delta_t want = {ckpt.id, (int64_t)ckpt.seq + 1};
+        int n = read_file(db, name, &end, &delta, &want);
+        if (n == -3) return n;
+        if (n == -1) break;
+        if (n < 0) {
+            fprintf(stderr, "Error: cannot apply delta checkpoint %s\n", name);
+            return -2;
+        }
+        ckpt.seq++;
+        ckpt.delta_bytes += size;
+        progress.done_bytes += size;
+        progress.done_keys += (uint64_t)n;
+        progress_note(0, 0);
+        printf("Applied %d keys from %s\n", n, name);
+    }
     return 0;
 }
+
+void persist_load_progress(persist_progress_t *out) {
+    out->total_bytes = atomic_load_explicit(&progress.total_bytes, memory_order_relaxed);
+    out->loaded_bytes = atomic_load_explicit(&progress.bytes, memory_order_relaxed);
+    out->loaded_keys = atomic_load_explicit(&progress.keys, memory_order_relaxed);
+    out->expected_keys = atomic_load_explicit(&progress.expected_keys, memory_order_relaxed);
+}
+
+void persist_delta_name(char *buf, size_t size, const char *filename) {
+    delta_name(buf, size, filename, ckpt.seq + 1);
+}
+
+int persist_delta_due(database_t *db, const char *filename) {
+    if (!g_config.delta_checkpoints || g_config.appendonly || !db->changed || db->changed_all ||
+        !ckpt.have_base || ckpt.seq - ckpt.base_seq >= RDB_MAX_DELTAS) return 0;
+    /* The snapshot must still be the one the deltas were counted against */
+    if (file_size(filename) != ckpt.base_bytes) return 0;
+    /* Past half the keyspace, a delta saves little over a full snapshot */
+    if (ht_size(db->changed) * 2 > db_size(db)) return 0;
+    return ckpt.delta_bytes * 100 < ckpt.base_bytes * g_config.delta_consolidate_percentage;
+}
+
+void persist_checkpoint_done(const char *filename, int full) {
+    char name[256];
+    if (!full) {
+        ckpt.seq++;
+        delta_name(name, sizeof(name), filename, ckpt.seq);
+        ckpt.delta_bytes += file_size(name);
+        return;
+    }
+
+    /* The snapshot holds everything its deltas did */
+    ckpt.have_base = 1;
+    ckpt.base_seq = ckpt.seq;
+    ckpt.base_bytes = file_size(filename);
+    ckpt.delta_bytes = 0;
+    for (uint64_t seq = ckpt.seq; seq > 0; seq--) {
+        delta_name(name, sizeof(name), filename, seq);
+        if (remove(name) != 0) break;
+    }
+    for (uint64_t seq = ckpt.seq + 1;; seq++) {
+        delta_name(name, sizeof(name), filename, seq);
+        if (remove(name) != 0) break;
+    }
+}
+
+void persist_delta_stats(size_t *files, uint64_t *bytes) {
+    *files = (size_t)(ckpt.seq - ckpt.base_seq);
+    *bytes = ckpt.delta_bytes;
+}
+
@@ -2,11 +2,63 @@
 #define PERSIST_H
 
 #include "db.h"
+#include <stddef.h>
+#include <stdint.h>
 
 /* Save database to an RDB-style binary file. Returns 0 on success. */
 int persist_save(database_t *db, const char *filename);
 
-/* Load database from an RDB-style binary file. Returns 0 on success. */
+/* Load database from an RDB-style binary file. Returns 0 on success, -1 if
+ * there is no snapshot to read, -2 if it is truncated or fails its checksum
+ * (the keys read before the damage stay loaded), -3 if it was cancelled. */
 int persist_load(database_t *db, const char *filename);
 
+/* Make a persist_load running on another thread stop early with -3 (1), or
+ * let the next one run to the end (0) */
+void persist_cancel_load(int cancel);
+
+typedef struct {
+    uint64_t total_bytes;    /* of the snapshot and the deltas found so far */
+    uint64_t loaded_bytes;
+    uint64_t loaded_keys;
+    uint64_t expected_keys;  /* as recorded by the snapshot; 0 if unknown */
+} persist_progress_t;
+
+/* Progress of the persist_load running now, or of the last one; safe to
+ * call from another thread */
+void persist_load_progress(persist_progress_t *out);
+
+/* Write the snapshot (magic through checksum) to fd through one large
+ * buffer. Returns 0 on success. */
+int persist_write(database_t *db, int fd);
+
+/* Load the snapshot at the start of filename, which may be followed by
+ * other data; *end is set to the offset just past it. Returns the number
+ * of keys loaded, -1 if the file holds no snapshot, or -2 if it is
+ * truncated or fails its checksum. */
+int persist_read(database_t *db, const char *filename, uint64_t *end);
+
+/* Delta checkpoints (delta-checkpoints): a save rule may write just the
+ * keys changed since the last checkpoint, frozen by db_checkpoint_begin,
+ * to <filename>.<seq>.delta instead of a full snapshot. persist_load
+ * applies the deltas after the snapshot they follow. */
+
+/* The file the next delta of filename goes to */
+void persist_delta_name(char *buf, size_t size, const char *filename);
+
+/* Write the frozen keys to the delta file named by persist_delta_name.
+ * Returns 0 on success. */
+int persist_save_delta(database_t *db, const char *filename);
+
+/* Whether the next checkpoint of filename may be a delta: changes are
+ * tracked, the keyspace was not flushed, the AOF is off, and the deltas so
+ * far are under delta-consolidate-percentage of the snapshot's size */
+int persist_delta_due(database_t *db, const char *filename);
+
+/* Record a successful checkpoint of filename; a full one removes the
+ * deltas it supersedes */
+void persist_checkpoint_done(const char *filename, int full);
+
+void persist_delta_stats(size_t *files, uint64_t *bytes);
+
 #endif /* PERSIST_H */
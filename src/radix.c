@@ -0,0 +1,246 @@
+#include "radix.h"
+#include "util.h"
+#include <string.h>
+
+#define NODE_KEYS(n) ((uint8_t *)((n)->child + (n)->cap))
+
+static radix_node_t *node_new(radix_t *tree, uint16_t cap) {
+    radix_node_t *n = imdb_malloc(sizeof(radix_node_t) + cap * (sizeof(void *) + 1));
+    n->count = 0;
+    n->cap = cap;
+    tree->bytes += imdb_malloc_size(n);
+    return n;
+}
+
+static void node_free(radix_t *tree, radix_node_t *n) {
+    tree->bytes -= imdb_malloc_size(n);
+    imdb_free(n);
+}
+
+/* Index of the first child byte >= b (count if none) */
+static int node_lower_bound(radix_node_t *n, uint8_t b) {
+    const uint8_t *keys = NODE_KEYS(n);
+    int lo = 0, hi = n->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (keys[mid] < b) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Insert child `b` at index i, growing the node; returns the (moved) node */
+static radix_node_t *node_add(radix_t *tree, radix_node_t *n, int i, uint8_t b, void *child) {
+    if (n->count == n->cap) {
+        uint16_t cap = n->cap < 4 ? (uint16_t)(n->cap + 1) : (uint16_t)(n->cap * 2 > 256 ? 256 : n->cap * 2);
+        radix_node_t *grown = node_new(tree, cap);
+        grown->count = n->count;
+        memcpy(grown->child, n->child, n->count * sizeof(void *));
+        memcpy(NODE_KEYS(grown), NODE_KEYS(n), n->count);
+        node_free(tree, n);
+        n = grown;
+    }
+    uint8_t *keys = NODE_KEYS(n);
+    memmove(n->child + i + 1, n->child + i, (size_t)(n->count - i) * sizeof(void *));
+    memmove(keys + i + 1, keys + i, (size_t)(n->count - i));
+    n->child[i] = child;
+    keys[i] = b;
+    n->count++;
+    return n;
+}
+
+static void node_del(radix_node_t *n, int i) {
+    uint8_t *keys = NODE_KEYS(n);
+    memmove(n->child + i, n->child + i + 1, (size_t)(n->count - i - 1) * sizeof(void *));
+    memmove(keys + i, keys + i + 1, (size_t)(n->count - i - 1));
+    n->count--;
+}
+
+radix_t *radix_create(size_t keylen) {
+    radix_t *tree = imdb_malloc(sizeof(radix_t));
+    tree->keylen = keylen;
+    tree->size = 0;
+    tree->bytes = 0;
+    tree->root = node_new(tree, 4);
+    return tree;
+}
+
+static void free_subtree(radix_t *tree, radix_node_t *n, size_t depth, void (*free_fn)(void *)) {
+    for (int i = 0; i < n->count; i++) {
+        if (depth + 1 == tree->keylen) {
+            if (free_fn) free_fn(n->child[i]);
+        } else {
+            free_subtree(tree, n->child[i], depth + 1, free_fn);
+        }
+    }
+    node_free(tree, n);
+}
+
+void radix_destroy(radix_t *tree, void (*free_fn)(void *)) {
+    if (!tree) return;
+    free_subtree(tree, tree->root, 0, free_fn);
+    imdb_free(tree);
+}
+
+int radix_insert(radix_t *tree, const uint8_t *key, void *value) {
+    radix_node_t **slot = &tree->root;
+    for (size_t d = 0; d < tree->keylen; d++) {
+        radix_node_t *n = *slot;
+        int i = node_lower_bound(n, key[d]);
+        int last = d + 1 == tree->keylen;
+        if (i < n->count && NODE_KEYS(n)[i] == key[d]) {
+            if (last) {
+                n->child[i] = value;
+                return 0;
+            }
+        } else {
+            n = *slot = node_add(tree, n, i, key[d], last ? value : node_new(tree, 1));
+            if (last) {
+                tree->size++;
+                return 1;
+            }
+        }
+        slot = (radix_node_t **)&n->child[i];
+    }
+    return 0;
+}
+
+void *radix_find(radix_t *tree, const uint8_t *key) {
+    radix_node_t *n = tree->root;
+    for (size_t d = 0; d < tree->keylen; d++) {
+        int i = node_lower_bound(n, key[d]);
+        if (i == n->count || NODE_KEYS(n)[i] != key[d]) return NULL;
+        if (d + 1 == tree->keylen) return n->child[i];
+        n = n->child[i];
+    }
+    return NULL;
+}
+
+int radix_remove(radix_t *tree, const uint8_t *key) {
+    radix_node_t *path[RADIX_MAX_KEY];
+    int idx[RADIX_MAX_KEY];
+    radix_node_t *n = tree->root;
+    for (size_t d = 0; d < tree->keylen; d++) {
+        int i = node_lower_bound(n, key[d]);
+        if (i == n->count || NODE_KEYS(n)[i] != key[d]) return 0;
+        path[d] = n;
+        idx[d] = i;
+        if (d + 1 < tree->keylen) n = n->child[i];
+    }
+    /* Unlink upwards while nodes become empty; the root always stays */
+    for (size_t d = tree->keylen; d-- > 0;) {
+        node_del(path[d], idx[d]);
+        if (path[d]->count > 0 || d == 0) break;
+        node_free(tree, path[d]);
+    }
+    tree->size--;
+    return 1;
+}
+
+/* ---- Iteration ---- */
+
+static void iter_fill(radix_iter_t *it) {
+    size_t keylen = it->tree->keylen;
+    for (size_t d = 0; d < keylen; d++) it->key[d] = NODE_KEYS(it->stack[d])[it->pos[d]];
+    it->value = it->stack[keylen - 1]->child[it->pos[keylen - 1]];
+    it->valid = 1;
+}
+
+/* Follow the first (or last) child from it->stack[depth] down to a leaf */
+static int descend(radix_iter_t *it, size_t depth, int last) {
+    size_t keylen = it->tree->keylen;
+    for (size_t d = depth; d < keylen; d++) {
+        radix_node_t *n = it->stack[d];
+        if (n->count == 0) return it->valid = 0;
+        it->pos[d] = last ? n->count - 1 : 0;
+        if (d + 1 < keylen) it->stack[d + 1] = n->child[it->pos[d]];
+    }
+    iter_fill(it);
+    return 1;
+}
+
+/* Move to the neighbouring subtree at `depth` or above, then to its nearest leaf */
+static int step(radix_iter_t *it, int depth, int dir) {
+    for (int d = depth; d >= 0; d--) {
+        int p = it->pos[d] + dir;
+        if (p >= 0 && p < it->stack[d]->count) {
+            it->pos[d] = p;
+            if ((size_t)d + 1 < it->tree->keylen) it->stack[d + 1] = it->stack[d]->child[p];
+            return descend(it, (size_t)d + 1, dir < 0);
+        }
+    }
+    return it->valid = 0;
+}
+
+static void iter_start(radix_iter_t *it, radix_t *tree) {
+    it->tree = tree;
+    it->stack[0] = tree->root;
+    it->valid = 0;
+}
+
+int radix_seek_first(radix_iter_t *it, radix_t *tree) {
+    iter_start(it, tree);
+    return descend(it, 0, 0);
+}
+
+int radix_seek_last(radix_iter_t *it, radix_t *tree) {
+    iter_start(it, tree);
+    return descend(it, 0, 1);
+}
+
+int radix_seek_le(radix_iter_t *it, radix_t *tree, const uint8_t *key) {
+    iter_start(it, tree);
+    for (size_t d = 0; d < tree->keylen; d++) {
+        radix_node_t *n = it->stack[d];
+        int i = node_lower_bound(n, key[d]);
+        if (i < n->count && NODE_KEYS(n)[i] == key[d]) {
+            it->pos[d] = i;
+            if (d + 1 < tree->keylen) it->stack[d + 1] = n->child[i];
+            continue;
+        }
+        if (i > 0) {
+            /* A smaller byte here: take the largest key below it */
+            it->pos[d] = i - 1;
+            if (d + 1 < tree->keylen) it->stack[d + 1] = n->child[i - 1];
+            return descend(it, d + 1, 1);
+        }
+        return step(it, (int)d - 1, -1);
+    }
+    iter_fill(it);
+    return 1;
+}
+
+int radix_seek_ge(radix_iter_t *it, radix_t *tree, const uint8_t *key) {
+    iter_start(it, tree);
+    for (size_t d = 0; d < tree->keylen; d++) {
+        radix_node_t *n = it->stack[d];
+        int i = node_lower_bound(n, key[d]);
+        if (i < n->count && NODE_KEYS(n)[i] == key[d]) {
+            it->pos[d] = i;
+            if (d + 1 < tree->keylen) it->stack[d + 1] = n->child[i];
+            continue;
+        }
+        if (i < n->count) {
+            it->pos[d] = i;
+            if (d + 1 < tree->keylen) it->stack[d + 1] = n->child[i];
+            return descend(it, d + 1, 0);
+        }
+        return step(it, (int)d - 1, 1);
+    }
+    iter_fill(it);
+    return 1;
+}
+
+int radix_next(radix_iter_t *it) {
+    if (!it->valid) return 0;
+    return step(it, (int)it->tree->keylen - 1, 1);
+}
+
+int radix_prev(radix_iter_t *it) {
+    if (!it->valid) return 0;
+    return step(it, (int)it->tree->keylen - 1, -1);
+}
+
+size_t radix_mem_usage(radix_t *tree) {
+    return imdb_malloc_size(tree) + tree->bytes;
+}
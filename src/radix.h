@@ -0,0 +1,68 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Radix tree over fixed-length binary keys (at most RADIX_MAX_KEY bytes),
+ * one level per key byte. Each node keeps its child bytes sorted, so an
+ * in-order walk visits keys in memcmp order; keys stored big-endian
+ * therefore iterate numerically. Values are opaque non-NULL pointers.
+ */
+#define RADIX_MAX_KEY 16
+
+typedef struct radix_node {
+    uint16_t count;
+    uint16_t cap;
+    void *child[];      /* `cap` pointers, then `cap` sorted key bytes */
+} radix_node_t;
+
+typedef struct {
+    radix_node_t *root;
+    size_t keylen;
+    size_t size;        /* keys stored */
+    size_t bytes;       /* held by nodes */
+} radix_t;
+
+/* Iterator; positions are invalidated by any insert or remove */
+typedef struct {
+    radix_t *tree;
+    radix_node_t *stack[RADIX_MAX_KEY];
+    int pos[RADIX_MAX_KEY];
+    int valid;
+    uint8_t key[RADIX_MAX_KEY];
+    void *value;
+} radix_iter_t;
+
+/* Create / destroy; free_fn, if given, receives every value */
+radix_t *radix_create(size_t keylen);
+void radix_destroy(radix_t *tree, void (*free_fn)(void *));
+
+/* Insert or replace; returns 1 if the key is new */
+int radix_insert(radix_t *tree, const uint8_t *key, void *value);
+
+/* Value stored at key, or NULL */
+void *radix_find(radix_t *tree, const uint8_t *key);
+
+/* Remove a key, pruning emptied nodes; returns 1 if it existed */
+int radix_remove(radix_t *tree, const uint8_t *key);
+
+/*
+ * Position an iterator. radix_seek_le finds the greatest key <= key,
+ * radix_seek_ge the smallest key >= key. Each returns 1 and fills
+ * it->key / it->value on success, 0 if there is no such key.
+ */
+int radix_seek_first(radix_iter_t *it, radix_t *tree);
+int radix_seek_last(radix_iter_t *it, radix_t *tree);
+int radix_seek_le(radix_iter_t *it, radix_t *tree, const uint8_t *key);
+int radix_seek_ge(radix_iter_t *it, radix_t *tree, const uint8_t *key);
+
+/* Step to the following / preceding key; 0 once past either end */
+int radix_next(radix_iter_t *it);
+int radix_prev(radix_iter_t *it);
+
+/* Bytes held by the tree's nodes (not the values) */
+size_t radix_mem_usage(radix_t *tree);
+
+#endif /* RADIX_H */
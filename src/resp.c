@@ -69,6 +69,14 @@ void resp_write_nil(resp_buf_t *rb) {
     resp_buf_append(rb, "$-1\r\n", 5);
 }
 
+void resp_write_raw(resp_buf_t *rb, const char *data, size_t len) {
+    resp_buf_append(rb, data, len);
+}
+
+void resp_write_null_array(resp_buf_t *rb) {
+    resp_buf_append(rb, "*-1\r\n", 5);
+}
+
 void resp_write_array_header(resp_buf_t *rb, size_t count) {
     char header[32];
     snprintf(header, sizeof(header), "*%zu\r\n", count);
@@ -100,20 +108,23 @@ static int resp_parse_value(const char *buf, size_t len, resp_value_t **out) {
     case '+': { /* Simple String */
         resp_value_t *v = imdb_malloc(sizeof(resp_value_t));
         v->type = RESP_SIMPLE_STRING;
-        v->data.str = imdb_strndup(buf + 1, line_len - 1);
+        v->len = line_len - 1;
+        v->data.str = imdb_memdup(buf + 1, line_len - 1);
         *out = v;
         return (int)consumed;
     }
     case '-': { /* Error */
         resp_value_t *v = imdb_malloc(sizeof(resp_value_t));
         v->type = RESP_ERROR;
-        v->data.str = imdb_strndup(buf + 1, line_len - 1);
+        v->len = line_len - 1;
+        v->data.str = imdb_memdup(buf + 1, line_len - 1);
         *out = v;
         return (int)consumed;
     }
     case ':': { /* Integer */
         resp_value_t *v = imdb_malloc(sizeof(resp_value_t));
         v->type = RESP_INTEGER;
+        v->len = 0;
         v->data.num = strtoll(buf + 1, NULL, 10);
         *out = v;
         return (int)consumed;
@@ -123,6 +134,7 @@ static int resp_parse_value(const char *buf, size_t len, resp_value_t **out) {
         if (bulk_len == -1) {
             resp_value_t *v = imdb_malloc(sizeof(resp_value_t));
             v->type = RESP_NIL;
+            v->len = 0;
             v->data.str = NULL;
             *out = v;
             return (int)consumed;
@@ -134,7 +146,8 @@ static int resp_parse_value(const char *buf, size_t len, resp_value_t **out) {
 
         resp_value_t *v = imdb_malloc(sizeof(resp_value_t));
         v->type = RESP_BULK_STRING;
-        v->data.str = imdb_strndup(buf + consumed, (size_t)bulk_len);
+        v->len = (size_t)bulk_len;
+        v->data.str = imdb_memdup(buf + consumed, (size_t)bulk_len);
         *out = v;
         return (int)(consumed + (size_t)bulk_len + 2);
     }
@@ -143,6 +156,7 @@ static int resp_parse_value(const char *buf, size_t len, resp_value_t **out) {
         if (arr_count == -1) {
             resp_value_t *v = imdb_malloc(sizeof(resp_value_t));
             v->type = RESP_NIL;
+            v->len = 0;
             v->data.str = NULL;
             *out = v;
             return (int)consumed;
@@ -151,6 +165,7 @@ static int resp_parse_value(const char *buf, size_t len, resp_value_t **out) {
 
         resp_value_t *v = imdb_malloc(sizeof(resp_value_t));
         v->type = RESP_ARRAY;
+        v->len = 0;
         v->data.array.count = (size_t)arr_count;
         v->data.array.items = imdb_calloc((size_t)arr_count, sizeof(resp_value_t *));
 
@@ -16,6 +16,7 @@ typedef enum {
 
 typedef struct resp_value {
     resp_type_t type;
+    size_t len;             /* bytes in str, which may contain NULs */
     union {
         char *str;          /* simple string, error, bulk string */
         int64_t num;        /* integer */
@@ -47,6 +48,10 @@ void resp_write_error(resp_buf_t *rb, const char *str);
 void resp_write_integer(resp_buf_t *rb, int64_t num);
 void resp_write_bulk_string(resp_buf_t *rb, const char *str, size_t len);
 void resp_write_nil(resp_buf_t *rb);
+void resp_write_null_array(resp_buf_t *rb);
 void resp_write_array_header(resp_buf_t *rb, size_t count);
 
+/* Append already-serialized RESP */
+void resp_write_raw(resp_buf_t *rb, const char *data, size_t len);
+
 #endif /* RESP_H */
@@ -1,21 +1,47 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L /* kill() under -std=c11 */
+#endif
+
 #include "server.h"
 #include "command.h"
 #include "resp.h"
 #include "util.h"
+#include "persist.h"
+#include "aof.h"
+#include "config.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 
 #ifdef _WIN32
 #pragma comment(lib, "ws2_32.lib")
 #define close_socket closesocket
 #define sock_errno WSAGetLastError()
 #else
+#include <signal.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #define close_socket close
 #define sock_errno errno
 #endif
 
+#define SELECT_TIMEOUT_MS 50 /* upper bound between expiry sweeps */
+#define SAVE_RETRY_DELAY 5   /* seconds before a failed automatic BGSAVE is retried */
+#define LOADING_POLL_MS 5    /* how soon a finished background load is noticed */
+
+typedef struct {
+    client_t **clients;
+    size_t count;
+    size_t cap;
+} block_queue_t;
+
+static void process_client_input(server_t *srv, client_t *c);
+static void unblock_client(server_t *srv, client_t *c);
+
 static void set_nonblocking(socket_t fd) {
 #ifdef _WIN32
     u_long mode = 1;
@@ -33,17 +59,21 @@ static client_t *client_create(socket_t fd) {
     c->write_buf = imdb_malloc(c->write_cap);
     c->write_len = 0;
     c->write_pos = 0;
+    c->read_cap = CLIENT_BUF_SIZE;
+    c->read_buf = imdb_malloc(c->read_cap);
     return c;
 }
 
 static void client_destroy(client_t *c) {
     if (!c) return;
     close_socket(c->fd);
+    imdb_free(c->read_buf);
     imdb_free(c->write_buf);
     imdb_free(c);
 }
 
 static void client_queue_write(client_t *c, const char *data, size_t len) {
+    if (len == 0) return;
     while (c->write_len + len > c->write_cap) {
         c->write_cap *= 2;
         c->write_buf = imdb_realloc(c->write_buf, c->write_cap);
@@ -52,12 +82,426 @@ static void client_queue_write(client_t *c, const char *data, size_t len) {
     c->write_len += len;
 }
 
+/* ---- Blocking operations ---- */
+
+static void block_queue_free(void *ptr) {
+    block_queue_t *q = ptr;
+    imdb_free(q->clients);
+    imdb_free(q);
+}
+
+static void key_ready(void *ctx, const char *key) {
+    server_t *srv = ctx;
+    if (ht_exists(srv->blocking_keys, key) && !ht_exists(srv->ready_keys, key))
+        ht_set(srv->ready_keys, key, NULL);
+}
+
+static void timeout_swap(server_t *srv, size_t a, size_t b) {
+    client_t *tmp = srv->timeouts[a];
+    srv->timeouts[a] = srv->timeouts[b];
+    srv->timeouts[b] = tmp;
+    srv->timeouts[a]->timeout_index = a;
+    srv->timeouts[b]->timeout_index = b;
+}
+
+static void timeout_sift_up(server_t *srv, size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (srv->timeouts[parent]->block_deadline <= srv->timeouts[i]->block_deadline) break;
+        timeout_swap(srv, i, parent);
+        i = parent;
+    }
+}
+
+static void timeout_sift_down(server_t *srv, size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < srv->timeout_count &&
+            srv->timeouts[l]->block_deadline < srv->timeouts[min]->block_deadline) min = l;
+        if (r < srv->timeout_count &&
+            srv->timeouts[r]->block_deadline < srv->timeouts[min]->block_deadline) min = r;
+        if (min == i) break;
+        timeout_swap(srv, i, min);
+        i = min;
+    }
+}
+
+static void timeout_add(server_t *srv, client_t *c) {
+    if (srv->timeout_count == srv->timeout_cap) {
+        srv->timeout_cap = srv->timeout_cap ? srv->timeout_cap * 2 : 16;
+        srv->timeouts = imdb_realloc(srv->timeouts, srv->timeout_cap * sizeof(client_t *));
+    }
+    c->timeout_index = srv->timeout_count;
+    srv->timeouts[srv->timeout_count++] = c;
+    timeout_sift_up(srv, c->timeout_index);
+}
+
+static void timeout_remove(server_t *srv, client_t *c) {
+    size_t i = c->timeout_index;
+    size_t last = --srv->timeout_count;
+    if (i != last) {
+        timeout_swap(srv, i, last);
+        timeout_sift_down(srv, i);
+        timeout_sift_up(srv, i);
+    }
+}
+
+void server_block_client(server_t *srv, const char **keys, size_t nkeys,
+                         int64_t deadline, int timeout_reply) {
+    client_t *c = srv ? srv->current_client : NULL;
+    if (!c || c->blocked) return;
+
+    c->blocked = 1;
+    c->block_deadline = deadline;
+    c->block_timeout_reply = timeout_reply;
+    c->blocked_keys = imdb_malloc(nkeys * sizeof(char *));
+    c->blocked_nkeys = nkeys;
+    for (size_t i = 0; i < nkeys; i++) {
+        c->blocked_keys[i] = imdb_strdup(keys[i]);
+        block_queue_t *q = ht_get(srv->blocking_keys, keys[i]);
+        if (!q) {
+            q = imdb_calloc(1, sizeof(block_queue_t));
+            ht_set(srv->blocking_keys, keys[i], q);
+        }
+        if (q->count == q->cap) {
+            q->cap = q->cap ? q->cap * 2 : 4;
+            q->clients = imdb_realloc(q->clients, q->cap * sizeof(client_t *));
+        }
+        q->clients[q->count++] = c;
+    }
+    if (deadline > 0) timeout_add(srv, c);
+    srv->blocked_clients++;
+}
+
+static void unblock_client(server_t *srv, client_t *c) {
+    if (!c->blocked) return;
+    for (size_t i = 0; i < c->blocked_nkeys; i++) {
+        block_queue_t *q = ht_get(srv->blocking_keys, c->blocked_keys[i]);
+        if (q) {
+            for (size_t j = 0; j < q->count; j++) {
+                if (q->clients[j] == c) {
+                    memmove(q->clients + j, q->clients + j + 1, (q->count - j - 1) * sizeof(client_t *));
+                    q->count--;
+                    break;
+                }
+            }
+            if (q->count == 0) ht_delete(srv->blocking_keys, c->blocked_keys[i]);
+        }
+        imdb_free(c->blocked_keys[i]);
+    }
+    imdb_free(c->blocked_keys);
+    c->blocked_keys = NULL;
+    c->blocked_nkeys = 0;
+    if (c->block_deadline > 0) timeout_remove(srv, c);
+    resp_free(c->blocked_cmd);
+    c->blocked_cmd = NULL;
+    c->blocked = 0;
+    srv->blocked_clients--;
+}
+
+/* Re-run a blocked client's command; a reply means it was served */
+static void retry_blocked_client(server_t *srv, client_t *c) {
+    resp_buf_t reply;
+    resp_buf_init(&reply);
+    srv->current_client = c;
+    command_execute(srv->db, srv, c->blocked_cmd, &reply);
+    srv->current_client = NULL;
+
+    if (reply.len > 0) {
+        client_queue_write(c, reply.buf, reply.len);
+        unblock_client(srv, c);
+        process_client_input(srv, c); /* resume pipelined commands */
+    }
+    resp_buf_free(&reply);
+}
+
+/* Serve clients blocked on keys that received data, in FIFO order per key */
+static void handle_ready_keys(server_t *srv) {
+    while (ht_size(srv->ready_keys) > 0) {
+        /* Serving can make further keys ready; those go into a fresh set */
+        hashtable_t *ready = srv->ready_keys;
+        srv->ready_keys = ht_create(16, NULL);
+
+        ht_iter_t iter;
+        ht_iter_init(&iter, ready);
+        ht_entry_t *he;
+        while ((he = ht_iter_next(&iter)) != NULL) {
+            block_queue_t *q = ht_get(srv->blocking_keys, he->key);
+            if (!q) continue;
+
+            /* Work on a snapshot: served clients leave the queue as we go */
+            size_t n = q->count;
+            client_t **waiting = imdb_malloc(n * sizeof(client_t *));
+            memcpy(waiting, q->clients, n * sizeof(client_t *));
+            for (size_t i = 0; i < n; i++) {
+                if (waiting[i]->blocked) retry_blocked_client(srv, waiting[i]);
+            }
+            imdb_free(waiting);
+        }
+        ht_destroy(ready);
+    }
+}
+
+static void handle_block_timeouts(server_t *srv) {
+    int64_t now = imdb_mstime();
+    while (srv->timeout_count > 0 && srv->timeouts[0]->block_deadline <= now) {
+        client_t *c = srv->timeouts[0];
+        resp_buf_t reply;
+        resp_buf_init(&reply);
+        if (c->block_timeout_reply == BLOCK_REPLY_NIL) resp_write_nil(&reply);
+        else resp_write_null_array(&reply);
+        client_queue_write(c, reply.buf, reply.len);
+        resp_buf_free(&reply);
+        unblock_client(srv, c);
+        process_client_input(srv, c);
+    }
+}
+
+/* ---- Background save and AOF rewrite ---- */
+
+/* Fork a child that saves the dataset to filename. Returns 0 if started. */
+static int start_child(server_t *srv, int type, const char *filename) {
+#ifdef _WIN32
+    (void)srv; (void)type; (void)filename;
+    return -1;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+
+    /* Buffered output would otherwise be printed by both processes */
+    fflush(stdout);
+    fflush(stderr);
+    int64_t start = imdb_mstime();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        /* Child: the dataset is a copy-on-write image frozen at the fork */
+        close(fds[0]);
+        close_socket(srv->listen_fd);
+        int rc = type == CHILD_DELTA ? persist_save_delta(srv->db, filename) : persist_save(srv->db, filename);
+        size_t cow = imdb_get_private_dirty();
+        ssize_t n = write(fds[1], &cow, sizeof(cow));
+        (void)n;
+        fflush(stdout);
+        _exit(rc == 0 ? 0 : 1);
+    }
+
+    close(fds[1]);
+    srv->child_pid = pid;
+    srv->child_type = type;
+    srv->child_pipe = fds[0];
+    srv->child_start = start;
+    snprintf(srv->child_tmp, sizeof(srv->child_tmp), "%s.tmp", filename);
+    /* Rehashing would rewrite whole tables the child still shares */
+    ht_set_resize_enabled(0);
+    return 0;
+#endif
+}
+
+/* A full snapshot or a delta of filename. The keys changed so far are
+ * frozen for the child; those changed after it forks wait for the next. */
+static int start_checkpoint(server_t *srv, int type, const char *filename) {
+    char delta[256];
+    if (srv->child_pid != -1) return -1;
+    srv->last_bgsave_try = (int64_t)time(NULL);
+    if (type == CHILD_DELTA) persist_delta_name(delta, sizeof(delta), filename);
+    db_checkpoint_begin(srv->db);
+    if (start_child(srv, type, type == CHILD_DELTA ? delta : filename) != 0) {
+        db_checkpoint_end(srv->db, 0);
+        return -1;
+    }
+    snprintf(srv->child_snapshot, sizeof(srv->child_snapshot), "%s", filename);
+    srv->dirty_before_bgsave = srv->dirty;
+    printf("Background %s started by pid %ld\n", type == CHILD_DELTA ? "delta checkpoint" : "saving",
+           srv->child_pid);
+    return 0;
+}
+
+int server_bgsave(server_t *srv, const char *filename) {
+    return start_checkpoint(srv, CHILD_RDB, filename);
+}
+
+int server_bgrewriteaof(server_t *srv) {
+    if (srv->child_pid != -1) {
+        srv->aof_rewrite_scheduled = 1;
+        return 1;
+    }
+    srv->aof_rewrite_scheduled = 0;
+    const char *base = aof_rewrite_start();
+    if (!base) return -1;
+    if (start_child(srv, CHILD_AOF, base) != 0) {
+        aof_rewrite_done(0);
+        return -1;
+    }
+    printf("Background append only file rewriting started by pid %ld\n", srv->child_pid);
+    return 0;
+}
+
+#ifndef _WIN32
+static void child_done(server_t *srv, int ok) {
+    size_t cow = 0;
+    if (read(srv->child_pipe, &cow, sizeof(cow)) != (ssize_t)sizeof(cow)) cow = 0;
+    close(srv->child_pipe);
+    srv->child_pipe = -1;
+    srv->child_pid = -1;
+    if (!ok) remove(srv->child_tmp);
+    int64_t elapsed = imdb_mstime() - srv->child_start;
+
+    if (srv->child_type != CHILD_AOF) {
+        srv->last_bgsave_ok = ok;
+        srv->last_bgsave_ms = elapsed;
+        srv->last_cow_bytes = cow;
+        db_checkpoint_end(srv->db, ok);
+        if (ok) {
+            /* Writes made while the child ran are not in its snapshot */
+            srv->dirty -= srv->dirty_before_bgsave;
+            srv->last_save = (int64_t)time(NULL);
+            persist_checkpoint_done(srv->child_snapshot, srv->child_type == CHILD_RDB);
+        }
+        printf(ok ? "Background saving terminated with success\n" : "Background saving error\n");
+    } else {
+        aof_rewrite_done(ok);
+        srv->last_aof_rewrite_ok = ok;
+        srv->last_aof_rewrite_ms = elapsed;
+        srv->aof_last_cow_bytes = cow;
+        printf(ok ? "Background AOF rewrite terminated with success\n" : "Background AOF rewrite error\n");
+    }
+    ht_set_resize_enabled(1);
+}
+
+/* Reap the child once it exits, without blocking */
+static void check_child(server_t *srv) {
+    if (srv->child_pid == -1) return;
+    int status;
+    pid_t r = waitpid((pid_t)srv->child_pid, &status, WNOHANG);
+    if (r == 0) return;
+    child_done(srv, r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/* Start a BGSAVE when a save rule is met. After a failed one, wait
+ * SAVE_RETRY_DELAY seconds before trying again. */
+static void check_save_rules(server_t *srv) {
+    if (srv->child_pid != -1 || srv->dirty == 0) return;
+    int64_t now = (int64_t)time(NULL);
+    if (!srv->last_bgsave_ok && now - srv->last_bgsave_try < SAVE_RETRY_DELAY) return;
+    for (size_t i = 0; i < g_config.save_rule_count; i++) {
+        const save_rule_t *rule = &g_config.save_rules[i];
+        if (srv->dirty >= (uint64_t)rule->changes && now - srv->last_save >= rule->seconds) {
+            printf("%ld changes in %ld seconds. Saving...\n", rule->changes, rule->seconds);
+            int type = persist_delta_due(srv->db, "dump.rdb") ? CHILD_DELTA : CHILD_RDB;
+            if (start_checkpoint(srv, type, "dump.rdb") != 0) srv->last_bgsave_ok = 0;
+            return;
+        }
+    }
+}
+#endif
+
+/* ---- Loading the dataset in the background ---- */
+
+#ifndef _WIN32
+static struct {
+    pthread_t thread;
+    database_t *db;          /* filled by the thread, adopted once done */
+    const char *filename;
+    int rc;
+    atomic_int done;
+} loader;
+
+static void *loader_main(void *arg) {
+    (void)arg;
+    loader.rc = persist_load(loader.db, loader.filename);
+    atomic_store(&loader.done, 1);
+    return NULL;
+}
+#endif
+
+int server_load_async(server_t *srv, const char *filename) {
+#ifndef _WIN32
+    /* The keyspace is not shared with the thread: it loads into its own
+     * and the event loop swaps that in */
+    loader.db = db_create();
+    loader.filename = filename;
+    atomic_store(&loader.done, 0);
+    persist_cancel_load(0);
+    if (pthread_create(&loader.thread, NULL, loader_main, NULL) == 0) {
+        srv->loading = 1;
+        srv->loading_start = imdb_mstime();
+        return 0;
+    }
+    db_destroy(loader.db);
+    loader.db = NULL;
+#endif
+    return persist_load(srv->db, filename) == -2 ? -2 : 0;
+}
+
+/* Install the loaded dataset once the thread finishes. Returns -1 if the
+ * load failed. */
+static int check_loading(server_t *srv) {
+#ifdef _WIN32
+    (void)srv;
+#else
+    if (!srv->loading || !atomic_load(&loader.done)) return 0;
+    pthread_join(loader.thread, NULL);
+    srv->loading = 0;
+    if (loader.rc == -2) {
+        fprintf(stderr, "Error: cannot load %s; fix or remove it to start\n", loader.filename);
+        db_destroy(loader.db);
+        loader.db = NULL;
+        return -1;
+    }
+    db_adopt(srv->db, loader.db);
+    loader.db = NULL;
+    printf("DB loaded from disk: %.3f seconds\n", (double)(imdb_mstime() - srv->loading_start) / 1000.0);
+#endif
+    return 0;
+}
+
+void server_stop_loading(server_t *srv) {
+#ifdef _WIN32
+    (void)srv;
+#else
+    if (!srv->loading) return;
+    persist_cancel_load(1);
+    pthread_join(loader.thread, NULL);
+    db_destroy(loader.db);
+    loader.db = NULL;
+#endif
+}
+
+void server_kill_child(server_t *srv) {
+#ifdef _WIN32
+    (void)srv;
+#else
+    if (srv->child_pid == -1) return;
+    int status;
+    kill((pid_t)srv->child_pid, SIGKILL);
+    waitpid((pid_t)srv->child_pid, &status, 0);
+    printf("Background %s aborted\n", srv->child_type == CHILD_AOF ? "AOF rewrite" : "saving");
+    child_done(srv, 0);
+#endif
+}
+
 server_t *server_create(database_t *db, int port) {
     server_t *srv = imdb_calloc(1, sizeof(server_t));
     srv->db = db;
     srv->port = port;
     srv->running = 0;
     srv->listen_fd = INVALID_SOCK;
+    srv->blocking_keys = ht_create(16, block_queue_free);
+    srv->ready_keys = ht_create(16, NULL);
+    db_set_ready_hook(db, key_ready, srv);
+    srv->startup_allocated = imdb_malloc_used();
+    srv->child_pid = -1;
+    srv->child_pipe = -1;
+    srv->last_save = (int64_t)time(NULL);
+    srv->last_bgsave_ok = 1;
+    srv->last_bgsave_ms = -1;
+    srv->last_aof_rewrite_ok = 1;
+    srv->last_aof_rewrite_ms = -1;
     return srv;
 }
 
@@ -131,36 +575,67 @@ static void server_accept(server_t *srv) {
 }
 
 static void server_remove_client(server_t *srv, int index) {
+    unblock_client(srv, srv->clients[index]);
     client_destroy(srv->clients[index]);
     srv->clients[index] = NULL;
     srv->client_count--;
 }
 
 static void process_client_input(server_t *srv, client_t *c) {
-    while (c->read_len > 0) {
+    size_t pos = 0;
+
+    while (pos < c->read_len && !c->blocked) {
         resp_value_t *cmd = NULL;
-        int consumed = resp_parse(c->read_buf, c->read_len, &cmd);
+        int consumed = resp_parse(c->read_buf + pos, c->read_len - pos, &cmd);
 
         if (consumed <= 0) break; /* incomplete or error */
 
         /* Execute command */
         resp_buf_t reply;
         resp_buf_init(&reply);
+        srv->current_client = c;
         command_execute(srv->db, srv, cmd, &reply);
-        resp_free(cmd);
+        srv->current_client = NULL;
+
+        /* A blocked client keeps its command for re-execution */
+        if (c->blocked) c->blocked_cmd = cmd;
+        else resp_free(cmd);
 
         /* Queue reply */
         client_queue_write(c, reply.buf, reply.len);
         resp_buf_free(&reply);
 
-        /* Consume from read buffer */
-        memmove(c->read_buf, c->read_buf + consumed, c->read_len - consumed);
-        c->read_len -= consumed;
+        pos += (size_t)consumed;
+    }
+
+    /* Drop everything parsed in this pass with a single move */
+    if (pos > 0) {
+        memmove(c->read_buf, c->read_buf + pos, c->read_len - pos);
+        c->read_len -= pos;
     }
+
+    /* Give back a buffer that grew for one oversized command */
+    if (c->read_len == 0 && c->read_cap > CLIENT_BUF_SIZE) {
+        c->read_buf = imdb_realloc(c->read_buf, CLIENT_BUF_SIZE);
+        c->read_cap = CLIENT_BUF_SIZE;
+    }
+}
+
+/* Make room for more input, doubling the query buffer when it is full.
+ * Returns 0 when the pending command is already at the size limit. */
+static int client_reserve_read(client_t *c) {
+    if (c->read_len < c->read_cap) return 1;
+    if (c->read_cap >= CLIENT_MAX_QUERY_BUF) return 0;
+    size_t cap = c->read_cap * 2;
+    if (cap > CLIENT_MAX_QUERY_BUF) cap = CLIENT_MAX_QUERY_BUF;
+    c->read_buf = imdb_realloc(c->read_buf, cap);
+    c->read_cap = cap;
+    return 1;
 }
 
-void server_run(server_t *srv) {
-    if (server_listen(srv) < 0) return;
+int server_run(server_t *srv) {
+    if (server_listen(srv) < 0) return -1;
+    int rc = 0;
 
     srv->running = 1;
     printf("inMemDb server listening on port %d\n", srv->port);
@@ -183,9 +658,16 @@ void server_run(server_t *srv) {
             if (c->fd > max_fd) max_fd = c->fd;
         }
 
+        /* Wake up for the expiry sweep, the end of the load or the nearest
+         * blocking deadline */
+        int64_t wait_ms = srv->loading ? LOADING_POLL_MS : SELECT_TIMEOUT_MS;
+        if (srv->timeout_count > 0) {
+            int64_t until = srv->timeouts[0]->block_deadline - imdb_mstime();
+            if (until < wait_ms) wait_ms = until > 0 ? until : 0;
+        }
         struct timeval tv;
         tv.tv_sec = 0;
-        tv.tv_usec = 50000; /* 50ms timeout for expiry sweeps */
+        tv.tv_usec = (long)(wait_ms * 1000);
 
         int ready = select((int)(max_fd + 1), &read_fds, &write_fds, NULL, &tv);
         if (ready < 0) {
@@ -198,15 +680,18 @@ void server_run(server_t *srv) {
             server_accept(srv);
         }
 
-        /* Process client I/O */
+        /* Read and execute client input */
         for (int i = 0; i < MAX_CLIENTS; i++) {
             client_t *c = srv->clients[i];
             if (!c) continue;
 
-            /* Read */
             if (FD_ISSET(c->fd, &read_fds)) {
-                int n = recv(c->fd, c->read_buf + c->read_len,
-                           (int)(CLIENT_BUF_SIZE - c->read_len), 0);
+                int n = -1;
+                if (client_reserve_read(c)) {
+                    size_t room = c->read_cap - c->read_len;
+                    if (room > INT_MAX) room = INT_MAX;
+                    n = recv(c->fd, c->read_buf + c->read_len, (int)room, 0);
+                }
                 if (n <= 0) {
                     server_remove_client(srv, i);
                     continue;
@@ -214,8 +699,18 @@ void server_run(server_t *srv) {
                 c->read_len += n;
                 process_client_input(srv, c);
             }
+        }
+
+        /* Serve blocked clients whose keys got data during this batch */
+        handle_ready_keys(srv);
+        handle_block_timeouts(srv);
 
-            /* Write */
+        /* Log the batch's writes before any of its replies go out */
+        aof_flush();
+
+        /* Send replies */
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            client_t *c = srv->clients[i];
             if (c && FD_ISSET(c->fd, &write_fds)) {
                 size_t to_write = c->write_len - c->write_pos;
                 int n = send(c->fd, c->write_buf + c->write_pos, (int)to_write, 0);
@@ -233,6 +728,18 @@ void server_run(server_t *srv) {
 
         /* Periodic expiry sweep */
         db_expire_sweep(srv->db);
+
+        if (check_loading(srv) != 0) {
+            rc = -1;
+            break;
+        }
+
+#ifndef _WIN32
+        check_child(srv);
+        check_save_rules(srv);
+        if (srv->child_pid == -1 && (srv->aof_rewrite_scheduled || aof_rewrite_needed()))
+            server_bgrewriteaof(srv);
+#endif
     }
 
     /* Cleanup */
@@ -240,6 +747,7 @@ void server_run(server_t *srv) {
     for (int i = 0; i < MAX_CLIENTS; i++) {
         if (srv->clients[i]) server_remove_client(srv, i);
     }
+    return rc;
 }
 
 void server_stop(server_t *srv) {
@@ -248,5 +756,8 @@ void server_stop(server_t *srv) {
 
 void server_destroy(server_t *srv) {
     if (!srv) return;
+    ht_destroy(srv->blocking_keys);
+    ht_destroy(srv->ready_keys);
+    imdb_free(srv->timeouts);
     imdb_free(srv);
 }
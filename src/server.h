@@ -2,6 +2,7 @@
 #define SERVER_H
 
 #include "db.h"
+#include "resp.h"
 #include <stdint.h>
 
 #ifdef _WIN32
@@ -22,19 +23,33 @@ typedef int socket_t;
 #endif
 
 #define MAX_CLIENTS    1024
-#define CLIENT_BUF_SIZE 65536
+#define CLIENT_BUF_SIZE 65536                 /* initial query buffer */
+#define CLIENT_MAX_QUERY_BUF (512u * 1024 * 1024) /* a single command may not exceed this */
 #define DEFAULT_PORT   6399
 
 typedef struct {
     socket_t fd;
-    char read_buf[CLIENT_BUF_SIZE];
+    char *read_buf;
     size_t read_len;
+    size_t read_cap;
     char *write_buf;
     size_t write_len;
     size_t write_cap;
     size_t write_pos;
+
+    /* Blocking state (BLPOP and friends) */
+    int blocked;
+    int64_t block_deadline;     /* ms timestamp, 0 = wait forever */
+    int block_timeout_reply;    /* BLOCK_REPLY_* sent when the deadline passes */
+    size_t timeout_index;       /* position in the server's timeout heap */
+    char **blocked_keys;
+    size_t blocked_nkeys;
+    resp_value_t *blocked_cmd;  /* re-executed when one of the keys is ready */
 } client_t;
 
+#define BLOCK_REPLY_NULL_ARRAY 0
+#define BLOCK_REPLY_NIL        1
+
 typedef struct server {
     database_t *db;
     socket_t listen_fd;
@@ -42,12 +57,79 @@ typedef struct server {
     int running;
     client_t *clients[MAX_CLIENTS];
     int client_count;
+    size_t startup_allocated; /* bytes in use before the dataset was loaded */
+
+    client_t *current_client;    /* client whose command is executing, if any */
+    hashtable_t *blocking_keys;  /* key -> FIFO of clients blocked on it */
+    hashtable_t *ready_keys;     /* blocked-on keys that received data this batch */
+    client_t **timeouts;         /* min-heap of blocked clients by deadline */
+    size_t timeout_count;
+    size_t timeout_cap;
+    int blocked_clients;
+
+    /* Background save (BGSAVE) and AOF rewrite (BGREWRITEAOF) */
+    long child_pid;              /* forked snapshot writer, -1 if none */
+    int child_type;              /* CHILD_RDB, CHILD_DELTA or CHILD_AOF */
+    int child_pipe;              /* read end; the child reports its COW bytes */
+    int64_t child_start;         /* ms timestamp the child was forked */
+    int64_t last_save;           /* unix time of the last successful save */
+    uint64_t dirty;              /* writes since the last successful save */
+    uint64_t dirty_before_bgsave; /* dirty when the running BGSAVE forked */
+    int64_t last_bgsave_try;     /* unix time of the last BGSAVE attempt */
+    int last_bgsave_ok;
+    int64_t last_bgsave_ms;      /* duration of the last background save */
+    size_t last_cow_bytes;       /* memory the last child copied on write */
+    char child_tmp[272];         /* snapshot file the child is writing */
+    char child_snapshot[256];    /* snapshot a CHILD_RDB or CHILD_DELTA checkpoints */
+    int aof_rewrite_scheduled;   /* run a rewrite once the current child exits */
+    int last_aof_rewrite_ok;
+    int64_t last_aof_rewrite_ms;
+    size_t aof_last_cow_bytes;
+
+    /* Startup load on a thread (server_load_async) */
+    int loading;                 /* commands without CMD_LOADING get -LOADING */
+    int64_t loading_start;       /* ms timestamp the load began */
 } server_t;
 
+#define CHILD_RDB 1  /* BGSAVE */
+#define CHILD_AOF 2  /* AOF rewrite */
+#define CHILD_DELTA 3 /* delta checkpoint, started by a save rule */
+
 /* Create, run, and stop the server */
 server_t *server_create(database_t *db, int port);
-void server_run(server_t *srv);
+/* Returns -1 if the server could not listen or the background load
+ * failed, 0 once it was stopped */
+int server_run(server_t *srv);
 void server_stop(server_t *srv);
 void server_destroy(server_t *srv);
 
+/* Fork a child that writes the snapshot to filename while the parent keeps
+ * serving. Returns 0 if started, -1 if a save is already running or the
+ * fork failed (always on Windows, which has no fork). */
+int server_bgsave(server_t *srv, const char *filename);
+
+/* Start an AOF rewrite in a forked child. Returns 0 if started, 1 if it
+ * was scheduled to run once the current child exits, -1 on failure. */
+int server_bgrewriteaof(server_t *srv);
+
+/* Load the snapshot filename and its deltas on a thread, so the port
+ * opens at once; until the dataset is installed, commands other than
+ * PING, INFO and SHUTDOWN are refused with -LOADING. Where threads are
+ * unavailable it loads before returning. Returns -2 if that load failed. */
+int server_load_async(server_t *srv, const char *filename);
+
+/* Cancel a load still running and wait for its threads. The server stays
+ * marked as loading, so nothing saves the partial dataset. */
+void server_stop_loading(server_t *srv);
+
+/* Stop a running background save and remove its temporary file */
+void server_kill_child(server_t *srv);
+
+/* Park the current client on keys until one is signalled ready or the
+ * deadline (ms timestamp, 0 = never) passes. The command is re-executed
+ * when a key becomes ready; a re-execution that writes no reply keeps the
+ * client blocked. No-op when there is no client or it is already blocked. */
+void server_block_client(server_t *srv, const char **keys, size_t nkeys,
+                         int64_t deadline, int timeout_reply);
+
 #endif /* SERVER_H */
@@ -0,0 +1,337 @@
+#include "set.h"
+#include "config.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMBER_STACK_LEN 128
+
+#define member_cstr(m, len, stack, heap) imdb_cstr((m), (len), (stack), MEMBER_STACK_LEN, (heap))
+
+/* Parse a member that is the canonical decimal form of an int64 (no sign
+ * other than '-', no leading zeros, no "-0"), so that formatting the value
+ * back gives the same bytes. */
+static int member_to_int(const char *s, size_t len, int64_t *out) {
+    if (len == 0 || len > 20) return 0;
+    size_t i = 0;
+    int neg = s[0] == '-';
+    if (neg && len == 1) return 0;
+    i = neg;
+    if (s[i] == '0') {
+        if (len != 1) return 0;
+        *out = 0;
+        return 1;
+    }
+    uint64_t v = 0;
+    for (; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return 0;
+        uint64_t d = (uint64_t)(s[i] - '0');
+        if (v > (UINT64_MAX - d) / 10) return 0;
+        v = v * 10 + d;
+    }
+    if (neg) {
+        if (v > (uint64_t)INT64_MAX + 1) return 0;
+        *out = v == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)v;
+    } else {
+        if (v > (uint64_t)INT64_MAX) return 0;
+        *out = (int64_t)v;
+    }
+    return 1;
+}
+
+static size_t format_int(char *buf, size_t cap, int64_t v) {
+    return (size_t)snprintf(buf, cap, "%lld", (long long)v);
+}
+
+static set_t *set_wrap_intset(intset_t *is) {
+    set_t *set = imdb_malloc(sizeof(set_t));
+    set->encoding = SET_ENC_INTSET;
+    set->data.is = is;
+    return set;
+}
+
+static void convert_to_ht(set_t *set) {
+    intset_t *is = set->data.is;
+    hashtable_t *ht = ht_create(intset_length(is), NULL);
+    char buf[24];
+    for (size_t i = 0; i < intset_length(is); i++) {
+        format_int(buf, sizeof(buf), intset_get(is, i));
+        ht_set(ht, buf, NULL);
+    }
+    intset_free(is);
+    set->encoding = SET_ENC_HT;
+    set->data.ht = ht;
+}
+
+/* ---- Public API ---- */
+
+set_t *set_create(void) {
+    return set_wrap_intset(intset_new());
+}
+
+void set_destroy(set_t *set) {
+    if (!set) return;
+    if (set->encoding == SET_ENC_INTSET) intset_free(set->data.is);
+    else ht_destroy(set->data.ht);
+    imdb_free(set);
+}
+
+set_t *set_from_intset(void *data, size_t size) {
+    if (!intset_validate(data, size)) return NULL;
+    set_t *set = set_wrap_intset(data);
+    /* The limit may have been lowered since the snapshot was written */
+    if (intset_length(set->data.is) > g_config.set_max_intset_entries) convert_to_ht(set);
+    return set;
+}
+
+size_t set_length(const set_t *set) {
+    if (set->encoding == SET_ENC_INTSET) return intset_length(set->data.is);
+    return ht_size(set->data.ht);
+}
+
+int set_add(set_t *set, const char *member, size_t len) {
+    if (set->encoding == SET_ENC_INTSET) {
+        int64_t v;
+        if (member_to_int(member, len, &v)) {
+            if (intset_find(set->data.is, v)) return 0;
+            if (intset_length(set->data.is) < g_config.set_max_intset_entries) {
+                set->data.is = intset_add(set->data.is, v, NULL);
+                return 1;
+            }
+        }
+        convert_to_ht(set);
+    }
+
+    char stack[MEMBER_STACK_LEN], *heap;
+    const char *key = member_cstr(member, len, stack, &heap);
+    int added = !ht_exists(set->data.ht, key);
+    if (added) ht_set(set->data.ht, key, NULL);
+    imdb_free(heap);
+    return added;
+}
+
+size_t set_add_many(set_t *set, const char **members, const size_t *lens, size_t count) {
+    if (set->encoding == SET_ENC_INTSET && count > 1) {
+        int64_t *values = imdb_malloc(count * sizeof(int64_t));
+        size_t n = 0;
+        while (n < count && member_to_int(members[n], lens[n], &values[n])) n++;
+        if (n == count) {
+            size_t added;
+            set->data.is = intset_add_many(set->data.is, values, count, &added);
+            imdb_free(values);
+            if (intset_length(set->data.is) > g_config.set_max_intset_entries) convert_to_ht(set);
+            return added;
+        }
+        imdb_free(values);
+    }
+
+    size_t added = 0;
+    for (size_t i = 0; i < count; i++) added += (size_t)set_add(set, members[i], lens[i]);
+    return added;
+}
+
+int set_remove(set_t *set, const char *member, size_t len) {
+    if (set->encoding == SET_ENC_INTSET) {
+        int64_t v;
+        int removed = 0;
+        if (member_to_int(member, len, &v)) set->data.is = intset_remove(set->data.is, v, &removed);
+        return removed;
+    }
+    char stack[MEMBER_STACK_LEN], *heap;
+    int removed = ht_delete(set->data.ht, member_cstr(member, len, stack, &heap));
+    imdb_free(heap);
+    return removed;
+}
+
+int set_contains(set_t *set, const char *member, size_t len) {
+    if (set->encoding == SET_ENC_INTSET) {
+        int64_t v;
+        return member_to_int(member, len, &v) && intset_find(set->data.is, v);
+    }
+    char stack[MEMBER_STACK_LEN], *heap;
+    int found = ht_exists(set->data.ht, member_cstr(member, len, stack, &heap));
+    imdb_free(heap);
+    return found;
+}
+
+void set_iter_init(set_iter_t *it, set_t *set) {
+    it->set = set;
+    it->pos = 0;
+    if (set->encoding == SET_ENC_HT) ht_iter_init(&it->ht_it, set->data.ht);
+}
+
+int set_iter_next(set_iter_t *it, const char **member, size_t *len) {
+    if (it->set->encoding == SET_ENC_INTSET) {
+        if (it->pos >= intset_length(it->set->data.is)) return 0;
+        *len = format_int(it->buf, sizeof(it->buf), intset_get(it->set->data.is, it->pos++));
+        *member = it->buf;
+        return 1;
+    }
+    ht_entry_t *e = ht_iter_next(&it->ht_it);
+    if (!e) return 0;
+    *member = e->key;
+    *len = strlen(e->key);
+    return 1;
+}
+
+/* ---- Multi-set operations ---- */
+
+static int cmp_length(const void *a, const void *b) {
+    size_t x = set_length(*(set_t *const *)a), y = set_length(*(set_t *const *)b);
+    return (x > y) - (x < y);
+}
+
+/* Copy of the sources ordered smallest first; NULL if any source is missing or empty */
+static set_t **sorted_sources(set_t **sets, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!sets[i] || set_length(sets[i]) == 0) return NULL;
+    }
+    set_t **sorted = imdb_malloc(n * sizeof(set_t *));
+    memcpy(sorted, sets, n * sizeof(set_t *));
+    qsort(sorted, n, sizeof(set_t *), cmp_length);
+    return sorted;
+}
+
+static int all_intsets(set_t **sets, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (sets[i]->encoding != SET_ENC_INTSET) return 0;
+    }
+    return 1;
+}
+
+/* Intersect intsets pairwise, smallest first, on the vectorized kernels */
+static intset_t *inter_intsets(set_t **sorted, size_t n) {
+    intset_t *acc = NULL;
+    for (size_t i = 1; i < n; i++) {
+        intset_t *next = intset_intersect(acc ? acc : sorted[0]->data.is, sorted[i]->data.is);
+        intset_free(acc);
+        acc = next;
+        if (intset_length(acc) == 0) break;
+    }
+    if (!acc) {
+        acc = imdb_malloc(intset_bytes(sorted[0]->data.is));
+        memcpy(acc, sorted[0]->data.is, intset_bytes(sorted[0]->data.is));
+    }
+    return acc;
+}
+
+/* Walk the smallest source and probe the rest; stops after `limit` matches (0 = all) */
+static size_t inter_probe(set_t **sorted, size_t n, set_t *out, size_t limit) {
+    size_t found = 0;
+    set_iter_t it;
+    const char *m;
+    size_t len;
+    set_iter_init(&it, sorted[0]);
+    while (set_iter_next(&it, &m, &len)) {
+        size_t i = 1;
+        while (i < n && set_contains(sorted[i], m, len)) i++;
+        if (i < n) continue;
+        if (out) set_add(out, m, len);
+        if (++found == limit) break;
+    }
+    return found;
+}
+
+set_t *set_inter(set_t **sets, size_t n) {
+    set_t **sorted = sorted_sources(sets, n);
+    if (!sorted) return set_create();
+
+    set_t *out;
+    if (all_intsets(sorted, n)) {
+        out = set_wrap_intset(inter_intsets(sorted, n));
+    } else {
+        out = set_create();
+        inter_probe(sorted, n, out, 0);
+    }
+    imdb_free(sorted);
+    return out;
+}
+
+size_t set_inter_card(set_t **sets, size_t n, size_t limit) {
+    set_t **sorted = sorted_sources(sets, n);
+    if (!sorted) return 0;
+
+    size_t card;
+    if (all_intsets(sorted, n)) {
+        intset_t *is = inter_intsets(sorted, n);
+        card = intset_length(is);
+        intset_free(is);
+        if (limit && card > limit) card = limit;
+    } else {
+        card = inter_probe(sorted, n, NULL, limit);
+    }
+    imdb_free(sorted);
+    return card;
+}
+
+set_t *set_union(set_t **sets, size_t n) {
+    set_t *out = set_create();
+    int intsets = 1;
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!sets[i]) continue;
+        if (sets[i]->encoding != SET_ENC_INTSET) intsets = 0;
+        total += set_length(sets[i]);
+    }
+
+    if (intsets && total > 0) {
+        /* Gather every value and merge once */
+        int64_t *values = imdb_malloc(total * sizeof(int64_t));
+        size_t k = 0, added;
+        for (size_t i = 0; i < n; i++) {
+            if (!sets[i]) continue;
+            for (size_t j = 0; j < intset_length(sets[i]->data.is); j++) {
+                values[k++] = intset_get(sets[i]->data.is, j);
+            }
+        }
+        out->data.is = intset_add_many(out->data.is, values, total, &added);
+        imdb_free(values);
+        if (intset_length(out->data.is) > g_config.set_max_intset_entries) convert_to_ht(out);
+        return out;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!sets[i]) continue;
+        set_iter_t it;
+        const char *m;
+        size_t len;
+        set_iter_init(&it, sets[i]);
+        while (set_iter_next(&it, &m, &len)) set_add(out, m, len);
+    }
+    return out;
+}
+
+set_t *set_diff(set_t **sets, size_t n) {
+    set_t *out = set_create();
+    if (!sets[0]) return out;
+
+    set_iter_t it;
+    const char *m;
+    size_t len;
+    set_iter_init(&it, sets[0]);
+    while (set_iter_next(&it, &m, &len)) {
+        size_t i = 1;
+        while (i < n && !(sets[i] && set_contains(sets[i], m, len))) i++;
+        if (i == n) set_add(out, m, len);
+    }
+    return out;
+}
+
+size_t set_mem_usage(set_t *set, size_t samples) {
+    size_t total = imdb_malloc_size(set);
+    if (set->encoding == SET_ENC_INTSET) return total + imdb_malloc_size(set->data.is);
+
+    hashtable_t *ht = set->data.ht;
+    total += imdb_malloc_size(ht) + imdb_malloc_size(ht->entries);
+    size_t seen = 0, bytes = 0;
+    ht_iter_t it;
+    ht_iter_init(&it, ht);
+    ht_entry_t *e;
+    while ((samples == 0 || seen < samples) && (e = ht_iter_next(&it)) != NULL) {
+        bytes += imdb_malloc_size(e->key);
+        seen++;
+    }
+    if (seen > 0) total += bytes / seen * ht_size(ht);
+    return total;
+}
@@ -0,0 +1,80 @@
+#ifndef SET_H
+#define SET_H
+
+#include "hashtable.h"
+#include "intset.h"
+#include <stddef.h>
+
+/*
+ * Set: an unordered collection of distinct members. While every member is
+ * a canonical integer and there are at most `set-max-intset-entries` of
+ * them the set is a sorted intset, and intersections between intsets run
+ * on the vectorized kernels in simd.c. Any other member, or growth past
+ * the limit, converts the set to a hashtable of members (values unused).
+ * Conversion is one-way.
+ */
+typedef enum {
+    SET_ENC_INTSET,
+    SET_ENC_HT
+} set_encoding_t;
+
+typedef struct {
+    set_encoding_t encoding;
+    union {
+        intset_t *is;
+        hashtable_t *ht;
+    } data;
+} set_t;
+
+/* Iterator; member pointers are valid until the next call or a modification */
+typedef struct {
+    set_t *set;
+    size_t pos;
+    ht_iter_t ht_it;
+    char buf[24];
+} set_iter_t;
+
+/* Create / destroy */
+set_t *set_create(void);
+void set_destroy(set_t *set);
+
+/* Adopt an intset read from a snapshot; NULL if it is not well formed */
+set_t *set_from_intset(void *data, size_t size);
+
+/* Number of members */
+size_t set_length(const set_t *set);
+
+/* Add a member; returns 1 if it was not already present */
+int set_add(set_t *set, const char *member, size_t len);
+
+/* Add many members; returns how many were new. Integer batches going
+ * into an intset are sorted and merged in one pass. */
+size_t set_add_many(set_t *set, const char **members, const size_t *lens, size_t count);
+
+/* Remove a member; returns 1 if it existed */
+int set_remove(set_t *set, const char *member, size_t len);
+
+/* Returns 1 if the member is present */
+int set_contains(set_t *set, const char *member, size_t len);
+
+/* Walk all members (intsets in ascending order) */
+void set_iter_init(set_iter_t *it, set_t *set);
+int set_iter_next(set_iter_t *it, const char **member, size_t *len);
+
+/*
+ * Multi-set algebra. Each takes `n` >= 1 sources, where a NULL source
+ * stands for a missing key (an empty set), and returns a new set.
+ * Intersections visit the sources smallest first and stop as soon as the
+ * running result is empty.
+ */
+set_t *set_inter(set_t **sets, size_t n);
+set_t *set_union(set_t **sets, size_t n);
+set_t *set_diff(set_t **sets, size_t n);
+
+/* Size of the intersection, counting no further than `limit` (0 = no limit) */
+size_t set_inter_card(set_t **sets, size_t n, size_t limit);
+
+/* Estimated bytes held by the set; the hashtable encoding samples up to `samples` members (0 = all) */
+size_t set_mem_usage(set_t *set, size_t samples);
+
+#endif /* SET_H */
@@ -0,0 +1,561 @@
+#include "simd.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/* ---- Block galloping ----
+ *
+ * Both variants keep `j` at the start of a block of `b` that may contain
+ * the current value x of `a`: every value before b[j] is < x. Blocks that
+ * end below x are skipped by doubling the stride, then a binary search
+ * over block ends finds the first block whose last value is >= x.
+ */
+
+#define GALLOP(T, W)                                                        \
+    static size_t gallop_##T(const T *b, size_t nb, size_t j, T x) {         \
+        if (j + W > nb || b[j + W - 1] >= x) return j;                      \
+        size_t lo = j, step = W;                                            \
+        while (lo + step + W <= nb && b[lo + step + W - 1] < x) {           \
+            lo += step;                                                     \
+            step *= 2;                                                      \
+        }                                                                   \
+        /* Block at lo ends below x; find the first block end >= x */       \
+        size_t hi = lo + step;                                              \
+        if (hi + W > nb) hi = nb >= W ? nb - W + 1 : lo + 1;                \
+        lo++;                                                               \
+        while (lo < hi) {                                                   \
+            size_t mid = lo + (hi - lo) / 2;                                \
+            if (b[mid + W - 1] < x) lo = mid + 1;                           \
+            else hi = mid;                                                  \
+        }                                                                   \
+        return lo;                                                          \
+    }
+
+GALLOP(int32_t, 8)
+GALLOP(int64_t, 4)
+
+/* Plain merge; also finishes the blocked kernels once fewer than a block remains */
+#define TAIL(T)                                                             \
+    static size_t tail_##T(const T *a, size_t i, size_t na, const T *b,      \
+                           size_t j, size_t nb, T *out, size_t k) {          \
+        while (i < na && j < nb) {                                          \
+            if (a[i] < b[j]) i++;                                           \
+            else if (a[i] > b[j]) j++;                                      \
+            else { out[k++] = a[i]; i++; j++; }                             \
+        }                                                                   \
+        return k;                                                           \
+    }
+
+TAIL(int32_t)
+TAIL(int64_t)
+
+/* Galloping pays off once `b` is this many times longer than `a`; below
+ * that both arrays are walked in step */
+#define GALLOP_RATIO 32
+
+/* ---- Scalar kernels ---- */
+
+static size_t intersect_i32_scalar(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                                   int32_t *out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j + 8 <= nb) {
+        int32_t x = a[i];
+        j = gallop_int32_t(b, nb, j, x);
+        if (j + 8 > nb) break;
+        for (size_t t = 0; t < 8; t++) {
+            if (b[j + t] == x) {
+                out[k++] = x;
+                break;
+            }
+        }
+        i++;
+    }
+    return tail_int32_t(a, i, na, b, j, nb, out, k);
+}
+
+static size_t intersect_i64_scalar(const int64_t *a, size_t na, const int64_t *b, size_t nb,
+                                   int64_t *out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j + 4 <= nb) {
+        int64_t x = a[i];
+        j = gallop_int64_t(b, nb, j, x);
+        if (j + 4 > nb) break;
+        for (size_t t = 0; t < 4; t++) {
+            if (b[j + t] == x) {
+                out[k++] = x;
+                break;
+            }
+        }
+        i++;
+    }
+    return tail_int64_t(a, i, na, b, j, nb, out, k);
+}
+
+/* ---- AVX2 kernels ----
+ *
+ * The merge variants compare a block of `a` against a block of `b` in all
+ * lane pairings (by rotating the `b` register), emit the lanes of `a` that
+ * matched, then advance whichever block has the smaller last value (both
+ * when equal). Values are distinct, so nothing is emitted twice.
+ */
+
+#ifdef SIMD_X86
+__attribute__((target("avx2")))
+static size_t merge_i32_avx2(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                             int32_t *out) {
+    const __m256i rot = _mm256_set_epi32(0, 7, 6, 5, 4, 3, 2, 1);
+    size_t i = 0, j = 0, k = 0;
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+        __m256i eq = _mm256_cmpeq_epi32(va, vb);
+        for (int r = 1; r < 8; r++) {
+            vb = _mm256_permutevar8x32_epi32(vb, rot);
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(va, vb));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        while (mask) {
+            out[k++] = a[i + (size_t)__builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+        int32_t amax = a[i + 7], bmax = b[j + 7];
+        if (amax <= bmax) i += 8;
+        if (bmax <= amax) j += 8;
+    }
+    return tail_int32_t(a, i, na, b, j, nb, out, k);
+}
+
+__attribute__((target("avx2")))
+static size_t merge_i64_avx2(const int64_t *a, size_t na, const int64_t *b, size_t nb,
+                             int64_t *out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+        __m256i eq = _mm256_cmpeq_epi64(va, vb);
+        for (int r = 1; r < 4; r++) {
+            vb = _mm256_permute4x64_epi64(vb, _MM_SHUFFLE(0, 3, 2, 1));
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, vb));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        while (mask) {
+            out[k++] = a[i + (size_t)__builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+        int64_t amax = a[i + 3], bmax = b[j + 3];
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+    return tail_int64_t(a, i, na, b, j, nb, out, k);
+}
+
+__attribute__((target("avx2")))
+static size_t intersect_i32_avx2(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                                 int32_t *out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j + 8 <= nb) {
+        int32_t x = a[i];
+        j = gallop_int32_t(b, nb, j, x);
+        if (j + 8 > nb) break;
+        __m256i block = _mm256_loadu_si256((const __m256i *)(b + j));
+        __m256i eq = _mm256_cmpeq_epi32(block, _mm256_set1_epi32(x));
+        if (_mm256_movemask_epi8(eq)) out[k++] = x;
+        i++;
+    }
+    return tail_int32_t(a, i, na, b, j, nb, out, k);
+}
+
+__attribute__((target("avx2")))
+static size_t intersect_i64_avx2(const int64_t *a, size_t na, const int64_t *b, size_t nb,
+                                 int64_t *out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j + 4 <= nb) {
+        int64_t x = a[i];
+        j = gallop_int64_t(b, nb, j, x);
+        if (j + 4 > nb) break;
+        __m256i block = _mm256_loadu_si256((const __m256i *)(b + j));
+        __m256i eq = _mm256_cmpeq_epi64(block, _mm256_set1_epi64x(x));
+        if (_mm256_movemask_epi8(eq)) out[k++] = x;
+        i++;
+    }
+    return tail_int64_t(a, i, na, b, j, nb, out, k);
+}
+
+__attribute__((target("avx2")))
+static void max_u8_avx2(uint8_t *dst, const uint8_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_max_epu8(d, s));
+    }
+    for (; i < n; i++) {
+        if (src[i] > dst[i]) dst[i] = src[i];
+    }
+}
+
+/* Per-nibble popcounts summed bytewise; flushed to 64-bit lanes before a byte can overflow */
+__attribute__((target("avx2")))
+static uint64_t popcount_avx2(const uint8_t *p, size_t n) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m256i local = _mm256_setzero_si256();
+        for (int k = 0; k < 31 && i + 32 <= n; k++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+            __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low));
+            __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+            local = _mm256_add_epi8(local, _mm256_add_epi8(lo, hi));
+        }
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(local, _mm256_setzero_si256()));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    uint64_t total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; i++) total += (uint64_t)__builtin_popcount(p[i]);
+    return total;
+}
+
+__attribute__((target("popcnt")))
+static uint64_t popcount_hw(const uint8_t *p, size_t n) {
+    uint64_t total = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        total += (uint64_t)__builtin_popcountll(w);
+    }
+    for (; i < n; i++) total += (uint64_t)__builtin_popcount(p[i]);
+    return total;
+}
+
+__attribute__((target("avx2")))
+static void bitop_avx2(int op, uint8_t *dst, const uint8_t *src, size_t n) {
+    size_t i = 0;
+    const __m256i ones = _mm256_set1_epi8(-1);
+    for (; i + 32 <= n; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        switch (op) {
+            case SIMD_BITOP_AND: d = _mm256_and_si256(d, s); break;
+            case SIMD_BITOP_OR:  d = _mm256_or_si256(d, s); break;
+            case SIMD_BITOP_XOR: d = _mm256_xor_si256(d, s); break;
+            default:             d = _mm256_xor_si256(s, ones); break;
+        }
+        _mm256_storeu_si256((__m256i *)(dst + i), d);
+    }
+    for (; i < n; i++) {
+        switch (op) {
+            case SIMD_BITOP_AND: dst[i] &= src[i]; break;
+            case SIMD_BITOP_OR:  dst[i] |= src[i]; break;
+            case SIMD_BITOP_XOR: dst[i] ^= src[i]; break;
+            default:             dst[i] = (uint8_t)~src[i]; break;
+        }
+    }
+}
+/* Gather up to 8 counters at idx[0..m); lanes past m read as UINT32_MAX */
+__attribute__((target("avx2")))
+static __m256i gather_counters(const uint32_t *counters, const uint32_t *idx, size_t m, __m256i *mask) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    *mask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)m), lanes);
+    __m256i vi = _mm256_maskload_epi32((const int *)idx, *mask);
+    return _mm256_mask_i32gather_epi32(_mm256_set1_epi32(-1), (const int *)counters, vi, *mask, 4);
+}
+
+__attribute__((target("avx2")))
+static uint32_t hmin_u32_avx2(__m256i v) {
+    __m128i m = _mm_min_epu32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    m = _mm_min_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(m);
+}
+
+__attribute__((target("avx2")))
+static uint32_t counters_add_avx2(uint32_t *counters, const uint32_t *idx, size_t n, uint32_t incr) {
+    const __m256i cap = _mm256_set1_epi32((int)(UINT32_MAX - incr));
+    const __m256i inc = _mm256_set1_epi32((int)incr);
+    __m256i lo = _mm256_set1_epi32(-1);
+    for (size_t i = 0; i < n; i += 8) {
+        size_t m = n - i < 8 ? n - i : 8;
+        __m256i mask;
+        __m256i v = gather_counters(counters, idx + i, m, &mask);
+        v = _mm256_add_epi32(_mm256_min_epu32(v, cap), inc); /* saturating add */
+        uint32_t out[8];
+        _mm256_storeu_si256((__m256i *)out, v);
+        for (size_t k = 0; k < m; k++) counters[idx[i + k]] = out[k];
+        lo = _mm256_min_epu32(lo, _mm256_or_si256(v, _mm256_xor_si256(mask, _mm256_set1_epi32(-1))));
+    }
+    return hmin_u32_avx2(lo);
+}
+
+__attribute__((target("avx2")))
+static uint32_t counters_min_avx2(const uint32_t *counters, const uint32_t *idx, size_t n) {
+    __m256i lo = _mm256_set1_epi32(-1);
+    for (size_t i = 0; i < n; i += 8) {
+        __m256i mask;
+        lo = _mm256_min_epu32(lo, gather_counters(counters, idx + i, n - i < 8 ? n - i : 8, &mask));
+    }
+    return hmin_u32_avx2(lo);
+}
+
+/* ---- Vector distance kernels ----
+ *
+ * Float kernels keep four 8-lane accumulators in flight to hide the FMA
+ * latency. The int8 dot product widens 16 bytes to 16-bit lanes and uses
+ * madd to sum adjacent products into 32-bit lanes (no overflow for any
+ * realistic dimension: each madd lane is at most 2 * 127 * 128).
+ */
+
+__attribute__((target("avx2")))
+static float hsum_f32_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_f32_avx2(const float *a, const float *b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    float sum = hsum_f32_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float l2sq_f32_avx2(const float *a, const float *b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsum_f32_avx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; i++) sum += (a[i] - b[i]) * (a[i] - b[i]);
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_i8_avx2(const int8_t *a, const int8_t *b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t sum = _mm_cvtsi128_si32(s);
+    for (; i < n; i++) sum += (int32_t)a[i] * b[i];
+    return sum;
+}
+#endif
+
+/* ---- Portable bit kernels ---- */
+
+static uint64_t popcount_scalar(const uint8_t *p, size_t n) {
+    uint64_t total = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        total += (uint64_t)__builtin_popcountll(w);
+    }
+    for (; i < n; i++) total += (uint64_t)__builtin_popcount(p[i]);
+    return total;
+}
+
+/* Eight bytes per step through 64-bit words */
+static void bitop_scalar(int op, uint8_t *dst, const uint8_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t d, s;
+        memcpy(&d, dst + i, 8);
+        memcpy(&s, src + i, 8);
+        switch (op) {
+            case SIMD_BITOP_AND: d &= s; break;
+            case SIMD_BITOP_OR:  d |= s; break;
+            case SIMD_BITOP_XOR: d ^= s; break;
+            default:             d = ~s; break;
+        }
+        memcpy(dst + i, &d, 8);
+    }
+    for (; i < n; i++) {
+        switch (op) {
+            case SIMD_BITOP_AND: dst[i] &= src[i]; break;
+            case SIMD_BITOP_OR:  dst[i] |= src[i]; break;
+            case SIMD_BITOP_XOR: dst[i] ^= src[i]; break;
+            default:             dst[i] = (uint8_t)~src[i]; break;
+        }
+    }
+}
+
+/* ---- Dispatch ---- */
+
+static int simd_has_avx2(void) {
+#ifdef SIMD_X86
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return cached;
+#else
+    return 0;
+#endif
+}
+
+/* The float distance kernels also need FMA */
+static int simd_has_fma(void) {
+#ifdef SIMD_X86
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = simd_has_avx2() && __builtin_cpu_supports("fma") ? 1 : 0;
+    }
+    return cached;
+#else
+    return 0;
+#endif
+}
+
+static int simd_has_popcnt(void) {
+#ifdef SIMD_X86
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("popcnt") ? 1 : 0;
+    }
+    return cached;
+#else
+    return 0;
+#endif
+}
+
+const char *simd_backend(void) {
+    return simd_has_avx2() ? "avx2" : "scalar";
+}
+
+size_t simd_intersect_i32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out) {
+    int gallop = nb / GALLOP_RATIO >= na;
+#ifdef SIMD_X86
+    if (simd_has_avx2()) {
+        return gallop ? intersect_i32_avx2(a, na, b, nb, out) : merge_i32_avx2(a, na, b, nb, out);
+    }
+#endif
+    return gallop ? intersect_i32_scalar(a, na, b, nb, out) : tail_int32_t(a, 0, na, b, 0, nb, out, 0);
+}
+
+size_t simd_intersect_i64(const int64_t *a, size_t na, const int64_t *b, size_t nb, int64_t *out) {
+    int gallop = nb / GALLOP_RATIO >= na;
+#ifdef SIMD_X86
+    if (simd_has_avx2()) {
+        return gallop ? intersect_i64_avx2(a, na, b, nb, out) : merge_i64_avx2(a, na, b, nb, out);
+    }
+#endif
+    return gallop ? intersect_i64_scalar(a, na, b, nb, out) : tail_int64_t(a, 0, na, b, 0, nb, out, 0);
+}
+
+void simd_max_u8(uint8_t *dst, const uint8_t *src, size_t n) {
+#ifdef SIMD_X86
+    if (simd_has_avx2()) {
+        max_u8_avx2(dst, src, n);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; i++) {
+        if (src[i] > dst[i]) dst[i] = src[i];
+    }
+}
+
+uint64_t simd_popcount(const uint8_t *p, size_t n) {
+#ifdef SIMD_X86
+    if (simd_has_avx2()) return popcount_avx2(p, n);
+    if (simd_has_popcnt()) return popcount_hw(p, n);
+#endif
+    return popcount_scalar(p, n);
+}
+
+uint32_t simd_counters_add(uint32_t *counters, const uint32_t *idx, size_t n, uint32_t incr) {
+#ifdef SIMD_X86
+    if (simd_has_avx2()) return counters_add_avx2(counters, idx, n, incr);
+#endif
+    uint32_t lo = UINT32_MAX;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t *c = &counters[idx[i]];
+        *c = *c > UINT32_MAX - incr ? UINT32_MAX : *c + incr;
+        if (*c < lo) lo = *c;
+    }
+    return lo;
+}
+
+uint32_t simd_counters_min(const uint32_t *counters, const uint32_t *idx, size_t n) {
+#ifdef SIMD_X86
+    if (simd_has_avx2()) return counters_min_avx2(counters, idx, n);
+#endif
+    uint32_t lo = UINT32_MAX;
+    for (size_t i = 0; i < n; i++) {
+        if (counters[idx[i]] < lo) lo = counters[idx[i]];
+    }
+    return lo;
+}
+
+void simd_bitop(int op, uint8_t *dst, const uint8_t *src, size_t n) {
+#ifdef SIMD_X86
+    if (simd_has_avx2()) {
+        bitop_avx2(op, dst, src, n);
+        return;
+    }
+#endif
+    bitop_scalar(op, dst, src, n);
+}
+
+float simd_dot_f32(const float *a, const float *b, size_t n) {
+#ifdef SIMD_X86
+    if (simd_has_fma()) return dot_f32_avx2(a, b, n);
+#endif
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+float simd_l2sq_f32(const float *a, const float *b, size_t n) {
+#ifdef SIMD_X86
+    if (simd_has_fma()) return l2sq_f32_avx2(a, b, n);
+#endif
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) sum += (a[i] - b[i]) * (a[i] - b[i]);
+    return sum;
+}
+
+int32_t simd_dot_i8(const int8_t *a, const int8_t *b, size_t n) {
+#ifdef SIMD_X86
+    if (simd_has_avx2()) return dot_i8_avx2(a, b, n);
+#endif
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += (int32_t)a[i] * b[i];
+    return sum;
+}
@@ -0,0 +1,57 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Vectorized kernels with runtime dispatch. On x86 builds with GCC or
+ * Clang the AVX2 variants are used when the CPU supports them; every
+ * kernel has a portable scalar fallback with identical results.
+ */
+
+/* Name of the instruction set the kernels dispatch to ("avx2" or "scalar") */
+const char *simd_backend(void);
+
+/*
+ * Intersect two strictly increasing arrays into `out` (room for `na`
+ * values, not overlapping the inputs), returning the number of common
+ * values. Pass the shorter array as `a`. Arrays of similar length are
+ * merged block against block; when `b` is much longer it is walked in
+ * 8-value blocks (4 for 64-bit), galloping over blocks that end below the
+ * current value of `a`.
+ */
+size_t simd_intersect_i32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+size_t simd_intersect_i64(const int64_t *a, size_t na, const int64_t *b, size_t nb, int64_t *out);
+
+/* dst[i] = max(dst[i], src[i]) for n bytes */
+void simd_max_u8(uint8_t *dst, const uint8_t *src, size_t n);
+
+/* Number of set bits in n bytes (AVX2 nibble lookup, else hardware popcnt) */
+uint64_t simd_popcount(const uint8_t *p, size_t n);
+
+/* dst = dst op src over n bytes; for SIMD_BITOP_NOT, dst = ~src */
+#define SIMD_BITOP_AND 0
+#define SIMD_BITOP_OR  1
+#define SIMD_BITOP_XOR 2
+#define SIMD_BITOP_NOT 3
+void simd_bitop(int op, uint8_t *dst, const uint8_t *src, size_t n);
+
+/*
+ * Counter rows of a sketch: idx[] holds n distinct positions in `counters`
+ * (below 2^31). The add variant raises each by incr, saturating at
+ * UINT32_MAX; both return the smallest of the (updated) counters.
+ */
+uint32_t simd_counters_add(uint32_t *counters, const uint32_t *idx, size_t n, uint32_t incr);
+uint32_t simd_counters_min(const uint32_t *counters, const uint32_t *idx, size_t n);
+
+/* Dot product and squared Euclidean distance of two n-float vectors (AVX2
+ * with FMA; the summation order differs from the scalar loop, so results
+ * may differ in the last bits) */
+float simd_dot_f32(const float *a, const float *b, size_t n);
+float simd_l2sq_f32(const float *a, const float *b, size_t n);
+
+/* Dot product of two n-byte signed vectors */
+int32_t simd_dot_i8(const int8_t *a, const int8_t *b, size_t n);
+
+#endif /* SIMD_H */
@@ -0,0 +1,230 @@
+#include "sketch.h"
+#include "simd.h"
+#include "util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SKETCH_HASH_SEED 0x9747b28cULL
+
+/* Row positions of an item (row i at h1 + i*h2 scaled onto [0, width)) and
+ * a fingerprint independent of them */
+static void row_positions(const char *item, size_t len, uint32_t width, uint32_t depth,
+                          uint32_t *idx, uint32_t *fp) {
+    uint64_t h = imdb_hash64(item, len, SKETCH_HASH_SEED);
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    for (uint32_t i = 0; i < depth; i++) {
+        uint32_t x = h1 + i * h2;
+        idx[i] = i * width + (uint32_t)(((uint64_t)x * width) >> 32);
+    }
+    if (fp) *fp = (uint32_t)((h * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+static uint32_t sat_add(uint32_t a, uint64_t b) {
+    return b > UINT32_MAX - a ? UINT32_MAX : a + (uint32_t)b;
+}
+
+/* ---- Count-min sketch ---- */
+
+cms_t *cms_create(uint32_t width, uint32_t depth) {
+    cms_t *cms = imdb_calloc(1, sizeof(cms_t) + (size_t)width * depth * sizeof(uint32_t));
+    cms->width = width;
+    cms->depth = depth;
+    return cms;
+}
+
+void cms_destroy(cms_t *cms) {
+    imdb_free(cms);
+}
+
+uint32_t cms_incrby(cms_t *cms, const char *item, size_t len, uint32_t incr) {
+    uint32_t idx[SKETCH_MAX_DEPTH];
+    row_positions(item, len, cms->width, cms->depth, idx, NULL);
+    cms->count += incr;
+    return simd_counters_add(cms->counters, idx, cms->depth, incr);
+}
+
+uint32_t cms_query(const cms_t *cms, const char *item, size_t len) {
+    uint32_t idx[SKETCH_MAX_DEPTH];
+    row_positions(item, len, cms->width, cms->depth, idx, NULL);
+    return simd_counters_min(cms->counters, idx, cms->depth);
+}
+
+void cms_merge(cms_t *dst, const cms_t *src, uint32_t weight) {
+    size_t cells = (size_t)dst->width * dst->depth;
+    for (size_t i = 0; i < cells; i++) {
+        dst->counters[i] = sat_add(dst->counters[i], (uint64_t)src->counters[i] * weight);
+    }
+    dst->count += src->count * weight;
+}
+
+void cms_clear(cms_t *cms) {
+    memset(cms->counters, 0, cms_counters_bytes(cms));
+    cms->count = 0;
+}
+
+size_t cms_counters_bytes(const cms_t *cms) {
+    return (size_t)cms->width * cms->depth * sizeof(uint32_t);
+}
+
+/* ---- Top-K ---- */
+
+topk_t *topk_create(uint32_t k, uint32_t width, uint32_t depth, double decay) {
+    topk_t *tk = imdb_calloc(1, sizeof(topk_t) + (size_t)width * depth * sizeof(topk_bucket_t));
+    tk->k = k;
+    tk->width = width;
+    tk->depth = depth;
+    tk->decay = decay;
+    tk->rng = 0x2545f4914f6cdd1dULL;
+    tk->heap = imdb_calloc(k, sizeof(topk_entry_t));
+    return tk;
+}
+
+void topk_destroy(topk_t *tk) {
+    if (!tk) return;
+    for (uint32_t i = 0; i < tk->heap_len; i++) imdb_free(tk->heap[i].item);
+    imdb_free(tk->heap);
+    imdb_free(tk);
+}
+
+/* Uniform in [0, 1) (xorshift64*) */
+static double topk_random(topk_t *tk) {
+    tk->rng ^= tk->rng >> 12;
+    tk->rng ^= tk->rng << 25;
+    tk->rng ^= tk->rng >> 27;
+    return (double)((tk->rng * 0x2545f4914f6cdd1dULL) >> 11) / 9007199254740992.0;
+}
+
+static void heap_swap(topk_t *tk, uint32_t a, uint32_t b) {
+    topk_entry_t tmp = tk->heap[a];
+    tk->heap[a] = tk->heap[b];
+    tk->heap[b] = tmp;
+}
+
+static void heap_sift_up(topk_t *tk, uint32_t i) {
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (tk->heap[parent].count <= tk->heap[i].count) break;
+        heap_swap(tk, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(topk_t *tk, uint32_t i) {
+    for (;;) {
+        uint32_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < tk->heap_len && tk->heap[l].count < tk->heap[min].count) min = l;
+        if (r < tk->heap_len && tk->heap[r].count < tk->heap[min].count) min = r;
+        if (min == i) break;
+        heap_swap(tk, i, min);
+        i = min;
+    }
+}
+
+/* Heap slot holding the item, or -1 */
+static long heap_find(const topk_t *tk, uint32_t fp, const char *item, size_t len) {
+    for (uint32_t i = 0; i < tk->heap_len; i++) {
+        const topk_entry_t *e = &tk->heap[i];
+        if (e->fp == fp && e->len == len && memcmp(e->item, item, len) == 0) return (long)i;
+    }
+    return -1;
+}
+
+char *topk_add(topk_t *tk, const char *item, size_t len, uint32_t incr, size_t *elen) {
+    uint32_t idx[SKETCH_MAX_DEPTH], fp, max = 0;
+    row_positions(item, len, tk->width, tk->depth, idx, &fp);
+
+    for (uint32_t i = 0; i < tk->depth; i++) {
+        topk_bucket_t *b = &tk->buckets[idx[i]];
+        if (b->count == 0) {
+            b->fp = fp;
+            b->count = incr;
+        } else if (b->fp == fp) {
+            b->count = sat_add(b->count, incr);
+        } else {
+            /* Each unit of a colliding item decays the owner with probability decay^count */
+            for (uint32_t left = incr; left > 0; left--) {
+                if (topk_random(tk) >= pow(tk->decay, b->count)) continue;
+                if (--b->count == 0) {
+                    b->fp = fp;
+                    b->count = left;
+                    break;
+                }
+            }
+        }
+        if (b->fp == fp && b->count > max) max = b->count;
+    }
+    if (max == 0) return NULL;
+
+    long slot = heap_find(tk, fp, item, len);
+    if (slot >= 0) {
+        if (max > tk->heap[slot].count) {
+            tk->heap[slot].count = max;
+            heap_sift_down(tk, (uint32_t)slot);
+        }
+        return NULL;
+    }
+    topk_entry_t entry = { max, fp, imdb_memdup(item, len), len };
+    if (tk->heap_len < tk->k) {
+        tk->heap[tk->heap_len++] = entry;
+        heap_sift_up(tk, tk->heap_len - 1);
+        return NULL;
+    }
+    if (max <= tk->heap[0].count) {
+        imdb_free(entry.item);
+        return NULL;
+    }
+    char *expelled = tk->heap[0].item;
+    *elen = tk->heap[0].len;
+    tk->heap[0] = entry;
+    heap_sift_down(tk, 0);
+    return expelled;
+}
+
+int topk_query(const topk_t *tk, const char *item, size_t len) {
+    uint32_t idx[SKETCH_MAX_DEPTH], fp;
+    row_positions(item, len, tk->width, tk->depth, idx, &fp);
+    return heap_find(tk, fp, item, len) >= 0;
+}
+
+uint32_t topk_count(const topk_t *tk, const char *item, size_t len) {
+    uint32_t idx[SKETCH_MAX_DEPTH], fp, max = 0;
+    row_positions(item, len, tk->width, tk->depth, idx, &fp);
+    for (uint32_t i = 0; i < tk->depth; i++) {
+        const topk_bucket_t *b = &tk->buckets[idx[i]];
+        if (b->fp == fp && b->count > max) max = b->count;
+    }
+    return max;
+}
+
+static int entry_cmp_desc(const void *a, const void *b) {
+    uint32_t ca = (*(const topk_entry_t *const *)a)->count;
+    uint32_t cb = (*(const topk_entry_t *const *)b)->count;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+size_t topk_list(const topk_t *tk, const topk_entry_t **out) {
+    for (uint32_t i = 0; i < tk->heap_len; i++) out[i] = &tk->heap[i];
+    qsort(out, tk->heap_len, sizeof(*out), entry_cmp_desc);
+    return tk->heap_len;
+}
+
+int topk_restore(topk_t *tk, const char *item, size_t len, uint32_t count) {
+    uint32_t idx[SKETCH_MAX_DEPTH], fp;
+    if (tk->heap_len == tk->k) return -1;
+    row_positions(item, len, tk->width, tk->depth, idx, &fp);
+    topk_entry_t entry = { count, fp, imdb_memdup(item, len), len };
+    tk->heap[tk->heap_len++] = entry;
+    heap_sift_up(tk, tk->heap_len - 1);
+    return 0;
+}
+
+size_t topk_buckets_bytes(const topk_t *tk) {
+    return (size_t)tk->width * tk->depth * sizeof(topk_bucket_t);
+}
+
+size_t topk_mem_usage(const topk_t *tk) {
+    size_t total = imdb_malloc_size((void *)tk) + imdb_malloc_size(tk->heap);
+    for (uint32_t i = 0; i < tk->heap_len; i++) total += imdb_malloc_size(tk->heap[i].item);
+    return total;
+}
@@ -0,0 +1,106 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-size frequency sketches. Both hash an item once and derive one
+ * position per row by double hashing, so the rows of an update are
+ * gathered and updated together by the counter kernels in simd.c.
+ */
+
+/* Bounds on a sketch's dimensions (counter positions must fit in 31 bits) */
+#define SKETCH_MAX_CELLS (1u << 28)
+#define SKETCH_MAX_DEPTH 64
+#define TOPK_MAX_K 100000
+
+/* ---- Count-min sketch ----
+ *
+ * `depth` rows of `width` saturating 32-bit counters. An item's estimate
+ * is the smallest of its counters: never below the true count, and above
+ * it by at most total/width * e with probability 1 - 0.5^depth.
+ */
+typedef struct {
+    uint32_t width;
+    uint32_t depth;
+    uint64_t count;       /* sum of all increments */
+    uint32_t counters[];  /* row-major */
+} cms_t;
+
+cms_t *cms_create(uint32_t width, uint32_t depth);
+void cms_destroy(cms_t *cms);
+
+/* Add incr to an item; returns its new estimate */
+uint32_t cms_incrby(cms_t *cms, const char *item, size_t len, uint32_t incr);
+
+/* Current estimate for an item */
+uint32_t cms_query(const cms_t *cms, const char *item, size_t len);
+
+/* dst += weight * src (saturating); the sketches must have equal dimensions */
+void cms_merge(cms_t *dst, const cms_t *src, uint32_t weight);
+
+/* Zero every counter */
+void cms_clear(cms_t *cms);
+
+/* Bytes of counters (width * depth * 4) */
+size_t cms_counters_bytes(const cms_t *cms);
+
+/* ---- Top-K ----
+ *
+ * HeavyKeeper: `depth` rows of `width` buckets, each holding a 32-bit
+ * fingerprint and a count. A colliding item decays a bucket's count with
+ * probability decay^count and takes the bucket over once it reaches zero,
+ * so small flows cannot hold on to buckets. The k items with the largest
+ * counts are kept in a min-heap.
+ */
+typedef struct {
+    uint32_t fp;
+    uint32_t count;
+} topk_bucket_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t fp;
+    char *item;
+    size_t len;
+} topk_entry_t;
+
+typedef struct {
+    uint32_t k;
+    uint32_t width;
+    uint32_t depth;
+    double decay;
+    uint64_t rng;
+    uint32_t heap_len;
+    topk_entry_t *heap;     /* min-heap on count, k slots */
+    topk_bucket_t buckets[];
+} topk_t;
+
+topk_t *topk_create(uint32_t k, uint32_t width, uint32_t depth, double decay);
+void topk_destroy(topk_t *tk);
+
+/* Add incr to an item. If that pushes another item out of the top k, the
+ * expelled item is returned (caller frees) with its length in *elen;
+ * otherwise NULL. */
+char *topk_add(topk_t *tk, const char *item, size_t len, uint32_t incr, size_t *elen);
+
+/* Returns 1 if the item is currently in the top k */
+int topk_query(const topk_t *tk, const char *item, size_t len);
+
+/* Estimated count of an item */
+uint32_t topk_count(const topk_t *tk, const char *item, size_t len);
+
+/* Heap entries sorted by descending count into out (room for tk->heap_len) */
+size_t topk_list(const topk_t *tk, const topk_entry_t **out);
+
+/* Put a heap entry back while loading a snapshot; returns -1 if the heap is full */
+int topk_restore(topk_t *tk, const char *item, size_t len, uint32_t count);
+
+/* Bytes of buckets (width * depth * 8) */
+size_t topk_buckets_bytes(const topk_t *tk);
+
+/* Estimated bytes held by the sketch */
+size_t topk_mem_usage(const topk_t *tk);
+
+#endif /* SKETCH_H */
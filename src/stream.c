@@ -0,0 +1,472 @@
+#include "stream.h"
+#include "listpack.h"
+#include "config.h"
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define STREAM_KEY_LEN 16
+#define STREAM_HDR_MAX 30   /* three 64-bit varints */
+
+/* ---- IDs ---- */
+
+int stream_id_cmp(stream_id_t a, stream_id_t b) {
+    if (a.ms != b.ms) return a.ms < b.ms ? -1 : 1;
+    if (a.seq != b.seq) return a.seq < b.seq ? -1 : 1;
+    return 0;
+}
+
+/* Big-endian, so the radix tree orders keys numerically */
+static void id_to_key(stream_id_t id, uint8_t *key) {
+    for (int i = 0; i < 8; i++) {
+        key[i] = (uint8_t)(id.ms >> (56 - 8 * i));
+        key[8 + i] = (uint8_t)(id.seq >> (56 - 8 * i));
+    }
+}
+
+static int parse_u64(const char *s, size_t len, uint64_t *out) {
+    uint64_t v = 0;
+    if (len == 0 || len > 20) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return 0;
+        uint64_t d = (uint64_t)(s[i] - '0');
+        if (v > (UINT64_MAX - d) / 10) return 0;
+        v = v * 10 + d;
+    }
+    *out = v;
+    return 1;
+}
+
+int stream_parse_id(const char *s, uint64_t default_seq, stream_id_t *out) {
+    const char *dash = strchr(s, '-');
+    if (!dash) {
+        out->seq = default_seq;
+        return parse_u64(s, strlen(s), &out->ms);
+    }
+    return parse_u64(s, (size_t)(dash - s), &out->ms) &&
+           parse_u64(dash + 1, strlen(dash + 1), &out->seq);
+}
+
+int stream_format_id(stream_id_t id, char *buf) {
+    return snprintf(buf, 42, "%" PRIu64 "-%" PRIu64, id.ms, id.seq);
+}
+
+/* ---- Block encoding ---- */
+
+static size_t put_varint(unsigned char *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/* Decode a varint that must end before `end`; returns 0 if truncated or too long */
+static int get_varint(const unsigned char **p, const unsigned char *end, uint64_t *out) {
+    uint64_t v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char b = *(*p)++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Master field count of a block; *fields receives the first master field */
+static uint64_t block_master(const stream_block_t *b, unsigned char **fields) {
+    size_t len;
+    unsigned char *p = lp_first(b->lp);
+    const unsigned char *data = (const unsigned char *)lp_get(p, &len);
+    uint64_t n = 0;
+    get_varint(&data, data + len, &n);
+    *fields = lp_next(b->lp, p);
+    return n;
+}
+
+/* Header of the entry at p; 0 if it is malformed */
+static int decode_header(const stream_block_t *b, const unsigned char *p, stream_id_t *id,
+                         uint64_t *nfields, int *same) {
+    size_t len;
+    const unsigned char *data = (const unsigned char *)lp_get(p, &len);
+    const unsigned char *end = data + len;
+    uint64_t delta, flags;
+    if (!get_varint(&data, end, &delta) || !get_varint(&data, end, &id->seq) ||
+        !get_varint(&data, end, &flags) || data != end) return 0;
+    if (delta > UINT64_MAX - b->master.ms) return 0;
+    id->ms = b->master.ms + delta;
+    *nfields = flags >> 1;
+    *same = (int)(flags & 1);
+    return 1;
+}
+
+static uint64_t entry_elements(uint64_t nfields, int same) {
+    return same ? nfields : nfields * 2;
+}
+
+/* Step over n elements; NULL if the block ends first */
+static unsigned char *skip_elements(unsigned char *lp, unsigned char *p, uint64_t n) {
+    while (p && n-- > 0) p = lp_next(lp, p);
+    return p;
+}
+
+/* First entry header of a block */
+static unsigned char *first_entry(const stream_block_t *b) {
+    unsigned char *fields;
+    uint64_t n = block_master(b, &fields);
+    return skip_elements(b->lp, fields, n);
+}
+
+/* Header of the entry after the one at p, given its decoded field count */
+static unsigned char *next_entry(const stream_block_t *b, unsigned char *p, uint64_t nfields, int same) {
+    return skip_elements(b->lp, lp_next(b->lp, p), entry_elements(nfields, same));
+}
+
+static int fields_match(const stream_block_t *b, const char **argv, const size_t *lens, size_t nfields) {
+    unsigned char *p;
+    if (block_master(b, &p) != nfields) return 0;
+    for (size_t i = 0; i < nfields; i++, p = lp_next(b->lp, p)) {
+        size_t len;
+        const char *f = lp_get(p, &len);
+        if (len != lens[2 * i] || memcmp(f, argv[2 * i], len) != 0) return 0;
+    }
+    return 1;
+}
+
+static void block_free(void *ptr) {
+    stream_block_t *b = ptr;
+    lp_free(b->lp);
+    imdb_free(b);
+}
+
+/* ---- Stream ---- */
+
+stream_t *stream_create(void) {
+    stream_t *s = imdb_malloc(sizeof(stream_t));
+    s->index = radix_create(STREAM_KEY_LEN);
+    s->tail = NULL;
+    s->length = 0;
+    s->last_id.ms = 0;
+    s->last_id.seq = 0;
+    return s;
+}
+
+void stream_destroy(stream_t *s) {
+    if (!s) return;
+    radix_destroy(s->index, block_free);
+    imdb_free(s);
+}
+
+size_t stream_length(const stream_t *s) {
+    return s->length;
+}
+
+static stream_block_t *block_new(stream_t *s, stream_id_t master, const char **argv,
+                                 const size_t *lens, size_t nfields) {
+    stream_block_t *b = imdb_malloc(sizeof(stream_block_t));
+    unsigned char hdr[10];
+    const char **vals = imdb_malloc((nfields + 1) * sizeof(char *));
+    size_t *vlens = imdb_malloc((nfields + 1) * sizeof(size_t));
+    vals[0] = (const char *)hdr;
+    vlens[0] = put_varint(hdr, nfields);
+    for (size_t i = 0; i < nfields; i++) {
+        vals[i + 1] = argv[2 * i];
+        vlens[i + 1] = lens[2 * i];
+    }
+    b->lp = lp_append_many(lp_new(), vals, vlens, nfields + 1);
+    imdb_free(vals);
+    imdb_free(vlens);
+    b->master = master;
+    b->last = master;
+    b->count = 0;
+
+    uint8_t key[STREAM_KEY_LEN];
+    id_to_key(master, key);
+    radix_insert(s->index, key, b);
+    s->tail = b;
+    return b;
+}
+
+void stream_append(stream_t *s, stream_id_t id, const char **argv, const size_t *lens, size_t nfields) {
+    stream_block_t *b = s->tail;
+    if (!b || b->count >= g_config.stream_node_max_entries ||
+        lp_bytes(b->lp) >= g_config.stream_node_max_bytes) {
+        b = block_new(s, id, argv, lens, nfields);
+    }
+    int same = fields_match(b, argv, lens, nfields);
+
+    unsigned char hdr[STREAM_HDR_MAX];
+    size_t hlen = put_varint(hdr, id.ms - b->master.ms);
+    hlen += put_varint(hdr + hlen, id.seq);
+    hlen += put_varint(hdr + hlen, ((uint64_t)nfields << 1) | (uint64_t)same);
+
+    /* Header and values (plus fields unless shared) go in with one reallocation */
+    size_t n = 1 + (size_t)entry_elements(nfields, same);
+    const char **vals = imdb_malloc(n * sizeof(char *));
+    size_t *vlens = imdb_malloc(n * sizeof(size_t));
+    vals[0] = (const char *)hdr;
+    vlens[0] = hlen;
+    for (size_t i = 0, j = 1; i < nfields; i++) {
+        if (!same) {
+            vals[j] = argv[2 * i];
+            vlens[j++] = lens[2 * i];
+        }
+        vals[j] = argv[2 * i + 1];
+        vlens[j++] = lens[2 * i + 1];
+    }
+    b->lp = lp_append_many(b->lp, vals, vlens, n);
+    imdb_free(vals);
+    imdb_free(vlens);
+
+    b->count++;
+    b->last = id;
+    s->length++;
+    s->last_id = id;
+}
+
+/* ---- Reading ---- */
+
+static void entry_init(stream_entry_t *e, const stream_block_t *b, unsigned char *p,
+                       stream_id_t id, uint64_t nfields, int same) {
+    e->id = id;
+    e->nfields = (size_t)nfields;
+    e->remaining = (size_t)nfields;
+    e->lp = b->lp;
+    e->p = lp_next(b->lp, p);
+    e->master = NULL;
+    if (same) block_master(b, &e->master);
+}
+
+int stream_entry_field(stream_entry_t *e, const char **field, size_t *flen,
+                       const char **value, size_t *vlen) {
+    if (e->remaining == 0) return 0;
+    if (e->master) {
+        *field = lp_get(e->master, flen);
+        e->master = lp_next(e->lp, e->master);
+    } else {
+        *field = lp_get(e->p, flen);
+        e->p = lp_next(e->lp, e->p);
+    }
+    *value = lp_get(e->p, vlen);
+    e->p = lp_next(e->lp, e->p);
+    e->remaining--;
+    return 1;
+}
+
+size_t stream_range(stream_t *s, stream_id_t start, stream_id_t end, size_t count, int rev,
+                    stream_entry_fn fn, void *ctx) {
+    if (stream_id_cmp(start, end) > 0 || s->length == 0) return 0;
+    radix_iter_t it;
+    uint8_t key[STREAM_KEY_LEN];
+    size_t visited = 0;
+
+    if (!rev) {
+        /* The block holding `start` is the last one whose master is not above it */
+        id_to_key(start, key);
+        if (!radix_seek_le(&it, s->index, key) && !radix_seek_first(&it, s->index)) return 0;
+        do {
+            stream_block_t *b = it.value;
+            if (stream_id_cmp(b->master, end) > 0) break;
+            if (stream_id_cmp(b->last, start) < 0) continue;
+            for (unsigned char *p = first_entry(b); p;) {
+                stream_id_t id;
+                uint64_t nfields;
+                int same;
+                decode_header(b, p, &id, &nfields, &same);
+                if (stream_id_cmp(id, end) > 0) return visited;
+                if (stream_id_cmp(id, start) >= 0) {
+                    stream_entry_t e;
+                    entry_init(&e, b, p, id, nfields, same);
+                    visited++;
+                    if (!fn(ctx, &e) || visited == count) return visited;
+                }
+                p = next_entry(b, p, nfields, same);
+            }
+        } while (radix_next(&it));
+        return visited;
+    }
+
+    /* Backwards: entries only chain forwards, so note each block's entry offsets first */
+    unsigned char **entries = NULL;
+    size_t cap = 0;
+    id_to_key(end, key);
+    if (!radix_seek_le(&it, s->index, key)) return 0;
+    do {
+        stream_block_t *b = it.value;
+        if (stream_id_cmp(b->last, start) < 0) break;
+        if (b->count > cap) {
+            cap = b->count;
+            entries = imdb_realloc(entries, cap * sizeof(unsigned char *));
+        }
+        size_t n = 0;
+        for (unsigned char *p = first_entry(b); p; n++) {
+            stream_id_t id;
+            uint64_t nfields;
+            int same;
+            entries[n] = p;
+            decode_header(b, p, &id, &nfields, &same);
+            p = next_entry(b, p, nfields, same);
+        }
+        while (n-- > 0) {
+            stream_id_t id;
+            uint64_t nfields;
+            int same;
+            decode_header(b, entries[n], &id, &nfields, &same);
+            if (stream_id_cmp(id, end) > 0) continue;
+            if (stream_id_cmp(id, start) < 0) goto done;
+            stream_entry_t e;
+            entry_init(&e, b, entries[n], id, nfields, same);
+            visited++;
+            if (!fn(ctx, &e) || visited == count) goto done;
+        }
+    } while (radix_prev(&it));
+done:
+    imdb_free(entries);
+    return visited;
+}
+
+/* ---- Trimming ---- */
+
+static stream_block_t *head_block(stream_t *s) {
+    radix_iter_t it;
+    return radix_seek_first(&it, s->index) ? it.value : NULL;
+}
+
+static void drop_block(stream_t *s, stream_block_t *b) {
+    uint8_t key[STREAM_KEY_LEN];
+    id_to_key(b->master, key);
+    radix_remove(s->index, key);
+    s->length -= b->count;
+    if (s->tail == b) s->tail = NULL;
+    block_free(b);
+}
+
+/* Delete the first n entries of a block that keeps at least one */
+static void block_delete_head(stream_t *s, stream_block_t *b, size_t n) {
+    unsigned char *fields;
+    uint64_t nmaster = block_master(b, &fields);
+    unsigned char *p = skip_elements(b->lp, fields, nmaster);
+    size_t elements = 0;
+    for (size_t i = 0; i < n; i++) {
+        stream_id_t id;
+        uint64_t nfields;
+        int same;
+        decode_header(b, p, &id, &nfields, &same);
+        elements += 1 + (size_t)entry_elements(nfields, same);
+        p = next_entry(b, p, nfields, same);
+    }
+    b->lp = lp_delete_range(b->lp, (long)(nmaster + 1), elements);
+    b->count -= (uint32_t)n;
+    s->length -= n;
+}
+
+size_t stream_trim_maxlen(stream_t *s, size_t maxlen, int approx) {
+    size_t before = s->length;
+    while (s->length > maxlen) {
+        stream_block_t *b = head_block(s);
+        if (s->length - b->count >= maxlen) {
+            drop_block(s, b);
+            continue;
+        }
+        if (!approx) block_delete_head(s, b, s->length - maxlen);
+        break;
+    }
+    return before - s->length;
+}
+
+size_t stream_trim_minid(stream_t *s, stream_id_t minid, int approx) {
+    size_t before = s->length;
+    while (s->length > 0) {
+        stream_block_t *b = head_block(s);
+        if (stream_id_cmp(b->last, minid) < 0) {
+            drop_block(s, b);
+            continue;
+        }
+        if (!approx) {
+            size_t n = 0;
+            for (unsigned char *p = first_entry(b); p; n++) {
+                stream_id_t id;
+                uint64_t nfields;
+                int same;
+                decode_header(b, p, &id, &nfields, &same);
+                if (stream_id_cmp(id, minid) >= 0) break;
+                p = next_entry(b, p, nfields, same);
+            }
+            if (n > 0) block_delete_head(s, b, n);
+        }
+        break;
+    }
+    return before - s->length;
+}
+
+/* ---- Snapshots and accounting ---- */
+
+int stream_load_block(stream_t *s, stream_id_t master, unsigned char *lp, size_t size) {
+    stream_block_t *b = imdb_malloc(sizeof(stream_block_t));
+    b->lp = lp;
+    b->master = master;
+    b->count = 0;
+    if (!lp_validate(lp, size) || lp_length(lp) == 0) goto corrupt;
+    if (s->tail && stream_id_cmp(master, s->tail->last) <= 0) goto corrupt;
+
+    /* The master field count must fill its element exactly */
+    size_t len;
+    unsigned char *p = lp_first(lp);
+    const unsigned char *data = (const unsigned char *)lp_get(p, &len);
+    const unsigned char *end = data + len;
+    uint64_t nmaster;
+    if (!get_varint(&data, end, &nmaster) || data != end || nmaster >= lp_length(lp)) goto corrupt;
+    p = skip_elements(lp, lp_next(lp, p), nmaster);
+
+    stream_id_t prev = master;
+    while (p) {
+        stream_id_t id;
+        uint64_t nfields;
+        int same;
+        if (!decode_header(b, p, &id, &nfields, &same)) goto corrupt;
+        if (stream_id_cmp(id, prev) < (b->count == 0 ? 0 : 1) || stream_id_cmp(id, s->last_id) > 0) goto corrupt;
+        if ((same && nfields != nmaster) || nfields > lp_length(lp)) goto corrupt;
+        /* Every element of the entry must be present */
+        unsigned char *q = lp_next(lp, p);
+        for (uint64_t i = 0; i < entry_elements(nfields, same); i++) {
+            if (!q) goto corrupt;
+            q = lp_next(lp, q);
+        }
+        p = q;
+        prev = id;
+        b->count++;
+    }
+    if (b->count == 0) goto corrupt;
+    b->last = prev;
+
+    uint8_t key[STREAM_KEY_LEN];
+    id_to_key(master, key);
+    radix_insert(s->index, key, b);
+    s->tail = b;
+    s->length += b->count;
+    return 0;
+
+corrupt:
+    block_free(b);
+    return -1;
+}
+
+size_t stream_mem_usage(stream_t *s, size_t samples) {
+    size_t total = imdb_malloc_size(s) + radix_mem_usage(s->index);
+    size_t seen = 0, block_bytes = 0;
+    radix_iter_t it;
+    if (radix_seek_first(&it, s->index)) {
+        do {
+            stream_block_t *b = it.value;
+            block_bytes += imdb_malloc_size(b) + imdb_malloc_size(b->lp);
+            seen++;
+        } while ((samples == 0 || seen < samples) && radix_next(&it));
+    }
+    if (seen > 0) total += block_bytes / seen * s->index->size;
+    return total;
+}
@@ -0,0 +1,96 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "radix.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Stream: an append-only log of field/value entries keyed by strictly
+ * increasing <ms>-<seq> IDs. Entries live in blocks, each one listpack
+ * that starts with the block's master fields (those of its first entry)
+ * followed by the entries:
+ *
+ *   [header] [value]*        fields equal to the master fields
+ *   [header] [field value]*  anything else
+ *
+ * The header packs varint(ms - master.ms), varint(seq) and
+ * varint(nfields << 1 | same_fields). Blocks are indexed by their master
+ * ID (16 bytes, big-endian) in a radix tree and hold up to
+ * `stream-node-max-entries` entries or `stream-node-max-bytes` bytes.
+ */
+typedef struct {
+    uint64_t ms;
+    uint64_t seq;
+} stream_id_t;
+
+typedef struct {
+    stream_id_t master;   /* index key; entry IDs are stored relative to it */
+    stream_id_t last;     /* ID of the last entry */
+    unsigned char *lp;
+    uint32_t count;       /* entries in the block */
+} stream_block_t;
+
+typedef struct {
+    radix_t *index;       /* master ID -> stream_block_t */
+    stream_block_t *tail; /* block receiving appends, NULL when empty */
+    size_t length;
+    stream_id_t last_id;  /* highest ID ever added, kept across trims */
+} stream_t;
+
+/* One entry handed out by stream_range; valid only during the callback */
+typedef struct {
+    stream_id_t id;
+    size_t nfields;
+    unsigned char *lp;
+    unsigned char *master;  /* next master field, when the fields are shared */
+    unsigned char *p;       /* next element of the entry */
+    size_t remaining;       /* pairs not yet read */
+} stream_entry_t;
+
+/* Called for each entry in range; return 0 to stop early */
+typedef int (*stream_entry_fn)(void *ctx, stream_entry_t *entry);
+
+/* Create / destroy */
+stream_t *stream_create(void);
+void stream_destroy(stream_t *s);
+
+size_t stream_length(const stream_t *s);
+
+/* Compare two IDs (-1, 0, 1) */
+int stream_id_cmp(stream_id_t a, stream_id_t b);
+
+/* Parse "<ms>[-<seq>]"; a missing seq becomes `default_seq`. Returns 0 if malformed. */
+int stream_parse_id(const char *s, uint64_t default_seq, stream_id_t *out);
+
+/* Format an ID into buf (at least 42 bytes); returns the length */
+int stream_format_id(stream_id_t id, char *buf);
+
+/* Append an entry of `nfields` field/value pairs (argv alternates field,
+ * value). The ID must be greater than s->last_id. */
+void stream_append(stream_t *s, stream_id_t id, const char **argv, const size_t *lens, size_t nfields);
+
+/* Visit entries with start <= ID <= end in ascending (or, with rev,
+ * descending) order, stopping after `count` (0 = no limit). Returns the
+ * number visited. */
+size_t stream_range(stream_t *s, stream_id_t start, stream_id_t end, size_t count, int rev,
+                    stream_entry_fn fn, void *ctx);
+
+/* Next field/value pair of an entry; 0 when all have been read */
+int stream_entry_field(stream_entry_t *e, const char **field, size_t *flen,
+                       const char **value, size_t *vlen);
+
+/* Drop the oldest entries until at most `maxlen` remain, or until the
+ * first entry's ID is >= minid. With `approx` only whole blocks are
+ * removed, so slightly more entries may be kept. Return the number removed. */
+size_t stream_trim_maxlen(stream_t *s, size_t maxlen, int approx);
+size_t stream_trim_minid(stream_t *s, stream_id_t minid, int approx);
+
+/* Adopt a block read from a snapshot (takes ownership of lp). Blocks must
+ * arrive in order; returns -1 if the block is malformed or out of order. */
+int stream_load_block(stream_t *s, stream_id_t master, unsigned char *lp, size_t size);
+
+/* Estimated bytes held by the stream, extrapolated from up to `samples` blocks (0 = all) */
+size_t stream_mem_usage(stream_t *s, size_t samples);
+
+#endif /* STREAM_H */
@@ -3,44 +3,197 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdatomic.h>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
+#include <malloc.h>
 #else
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 
+/*
+ * Allocation sizes come from the allocator when it can report them;
+ * otherwise each block carries a size_t prefix holding the requested size.
+ */
+#if defined(_WIN32)
+#define HAVE_MALLOC_SIZE 1
+#define malloc_size_of(p) _msize(p)
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#define HAVE_MALLOC_SIZE 1
+#define malloc_size_of(p) malloc_usable_size(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define HAVE_MALLOC_SIZE 1
+#define malloc_size_of(p) malloc_size(p)
+#else
+#define PREFIX_SIZE sizeof(size_t)
+#endif
+
+static atomic_size_t used_memory = 0;
+static atomic_size_t peak_memory = 0;
+
+static void account_alloc(size_t n) {
+    size_t used = atomic_fetch_add_explicit(&used_memory, n, memory_order_relaxed) + n;
+    if (used > atomic_load_explicit(&peak_memory, memory_order_relaxed))
+        atomic_store_explicit(&peak_memory, used, memory_order_relaxed);
+}
+
+static void account_free(size_t n) {
+    atomic_fetch_sub_explicit(&used_memory, n, memory_order_relaxed);
+}
+
+static void oom(size_t size) {
+    fprintf(stderr, "Fatal: out of memory allocating %zu bytes\n", size);
+    abort();
+}
+
+#ifdef HAVE_MALLOC_SIZE
+
 void *imdb_malloc(size_t size) {
     void *p = malloc(size);
-    if (!p && size) {
-        fprintf(stderr, "Fatal: out of memory allocating %zu bytes\n", size);
-        abort();
-    }
+    if (!p && size) oom(size);
+    if (p) account_alloc(malloc_size_of(p));
     return p;
 }
 
 void *imdb_calloc(size_t count, size_t size) {
     void *p = calloc(count, size);
-    if (!p && count && size) {
-        fprintf(stderr, "Fatal: out of memory allocating %zu bytes\n", count * size);
-        abort();
-    }
+    if (!p && count && size) oom(count * size);
+    if (p) account_alloc(malloc_size_of(p));
     return p;
 }
 
 void *imdb_realloc(void *ptr, size_t size) {
+    size_t old = ptr ? malloc_size_of(ptr) : 0;
     void *p = realloc(ptr, size);
-    if (!p && size) {
-        fprintf(stderr, "Fatal: out of memory reallocating %zu bytes\n", size);
-        abort();
-    }
+    if (!p && size) oom(size);
+    account_free(old);
+    if (p) account_alloc(malloc_size_of(p));
     return p;
 }
 
 void imdb_free(void *ptr) {
+    if (!ptr) return;
+    account_free(malloc_size_of(ptr));
     free(ptr);
 }
 
+size_t imdb_malloc_size(void *ptr) {
+    return ptr ? malloc_size_of(ptr) : 0;
+}
+
+size_t imdb_malloc_usable(void *ptr) {
+    return ptr ? malloc_size_of(ptr) : 0;
+}
+
+#else
+
+void *imdb_malloc(size_t size) {
+    size_t *p = malloc(size + PREFIX_SIZE);
+    if (!p) oom(size);
+    *p = size;
+    account_alloc(size + PREFIX_SIZE);
+    return (char *)p + PREFIX_SIZE;
+}
+
+void *imdb_calloc(size_t count, size_t size) {
+    size_t total = count * size;
+    size_t *p = calloc(1, total + PREFIX_SIZE);
+    if (!p) oom(total);
+    *p = total;
+    account_alloc(total + PREFIX_SIZE);
+    return (char *)p + PREFIX_SIZE;
+}
+
+void *imdb_realloc(void *ptr, size_t size) {
+    if (!ptr) return imdb_malloc(size);
+    size_t *real = (size_t *)((char *)ptr - PREFIX_SIZE);
+    size_t old = *real;
+    size_t *p = realloc(real, size + PREFIX_SIZE);
+    if (!p) oom(size);
+    *p = size;
+    account_free(old);
+    account_alloc(size);
+    return (char *)p + PREFIX_SIZE;
+}
+
+void imdb_free(void *ptr) {
+    if (!ptr) return;
+    size_t *real = (size_t *)((char *)ptr - PREFIX_SIZE);
+    account_free(*real + PREFIX_SIZE);
+    free(real);
+}
+
+size_t imdb_malloc_size(void *ptr) {
+    return ptr ? *(size_t *)((char *)ptr - PREFIX_SIZE) + PREFIX_SIZE : 0;
+}
+
+size_t imdb_malloc_usable(void *ptr) {
+    return ptr ? *(size_t *)((char *)ptr - PREFIX_SIZE) : 0;
+}
+
+#endif
+
+size_t imdb_malloc_used(void) {
+    return atomic_load_explicit(&used_memory, memory_order_relaxed);
+}
+
+size_t imdb_malloc_peak(void) {
+    return atomic_load_explicit(&peak_memory, memory_order_relaxed);
+}
+
+size_t imdb_get_rss(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return (size_t)pmc.WorkingSetSize;
+    return 0;
+#else
+    /* Second field of /proc/self/statm is resident pages */
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size, resident;
+    int n = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    if (n != 2) return 0;
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+size_t imdb_get_private_dirty(void) {
+#ifdef __linux__
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return 0;
+    char line[256];
+    size_t total = 0;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long kb;
+        if (sscanf(line, "Private_Dirty: %lu kB", &kb) == 1) total += (size_t)kb * 1024;
+    }
+    fclose(f);
+    return total;
+#else
+    return 0;
+#endif
+}
+
+void imdb_bytes_to_human(char *buf, size_t len, size_t bytes) {
+    double d = (double)bytes;
+    if (bytes < 1024) {
+        snprintf(buf, len, "%zuB", bytes);
+    } else if (bytes < 1024 * 1024) {
+        snprintf(buf, len, "%.2fK", d / 1024);
+    } else if (bytes < 1024ULL * 1024 * 1024) {
+        snprintf(buf, len, "%.2fM", d / (1024 * 1024));
+    } else {
+        snprintf(buf, len, "%.2fG", d / (1024.0 * 1024 * 1024));
+    }
+}
+
 char *imdb_strdup(const char *s) {
     if (!s) return NULL;
     size_t len = strlen(s);
@@ -51,14 +204,32 @@ char *imdb_strdup(const char *s) {
 
 char *imdb_strndup(const char *s, size_t n) {
     if (!s) return NULL;
-    size_t len = strlen(s);
-    if (n < len) len = n;
+    const char *nul = memchr(s, '\0', n);
+    size_t len = nul ? (size_t)(nul - s) : n;
     char *d = imdb_malloc(len + 1);
     memcpy(d, s, len);
     d[len] = '\0';
     return d;
 }
 
+char *imdb_memdup(const void *s, size_t n) {
+    char *d = imdb_malloc(n + 1);
+    if (n) memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+const char *imdb_cstr(const char *s, size_t n, char *stack, size_t cap, char **heap) {
+    *heap = NULL;
+    if (n < cap) {
+        if (n) memcpy(stack, s, n);
+        stack[n] = '\0';
+        return stack;
+    }
+    *heap = imdb_memdup(s, n);
+    return *heap;
+}
+
 int64_t imdb_mstime(void) {
 #ifdef _WIN32
     FILETIME ft;
@@ -73,6 +244,79 @@ int64_t imdb_mstime(void) {
 #endif
 }
 
+/* MurmurHash64A */
+uint64_t imdb_hash64(const void *key, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    const unsigned char *data = key;
+    uint64_t h = seed ^ (len * m);
+
+    size_t blocks = len / 8;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t k;
+        memcpy(&k, data + i * 8, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    const unsigned char *tail = data + blocks * 8;
+    switch (len & 7) {
+        case 7: h ^= (uint64_t)tail[6] << 48; /* fall through */
+        case 6: h ^= (uint64_t)tail[5] << 40; /* fall through */
+        case 5: h ^= (uint64_t)tail[4] << 32; /* fall through */
+        case 4: h ^= (uint64_t)tail[3] << 24; /* fall through */
+        case 3: h ^= (uint64_t)tail[2] << 16; /* fall through */
+        case 2: h ^= (uint64_t)tail[1] << 8;  /* fall through */
+        case 1: h ^= (uint64_t)tail[0];
+                h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+/* CRC-64/Jones (reflected 0xad93d23594c935a9), eight bytes per step
+ * through eight derived tables (slice-by-8) */
+#define CRC64_POLY 0x95ac9329ac4bc9b5ULL
+
+static uint64_t crc64_table[8][256];
+static int crc64_ready = 0;
+
+static void crc64_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint64_t c = (uint64_t)i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ CRC64_POLY : c >> 1;
+        crc64_table[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint64_t c = crc64_table[t - 1][i];
+            crc64_table[t][i] = (c >> 8) ^ crc64_table[0][c & 0xff];
+        }
+    }
+    crc64_ready = 1;
+}
+
+uint64_t imdb_crc64(uint64_t crc, const void *data, size_t len) {
+    const unsigned char *p = data;
+    if (!crc64_ready) crc64_init();
+    while (len >= 8) {
+        crc ^= (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+               (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+        crc = crc64_table[7][crc & 0xff] ^ crc64_table[6][(crc >> 8) & 0xff] ^
+              crc64_table[5][(crc >> 16) & 0xff] ^ crc64_table[4][(crc >> 24) & 0xff] ^
+              crc64_table[3][(crc >> 32) & 0xff] ^ crc64_table[2][(crc >> 40) & 0xff] ^
+              crc64_table[1][(crc >> 48) & 0xff] ^ crc64_table[0][crc >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = crc64_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
 int imdb_strcasecmp(const char *a, const char *b) {
     while (*a && *b) {
         int ca = tolower((unsigned char)*a);
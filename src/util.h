@@ -10,13 +10,45 @@ void *imdb_calloc(size_t count, size_t size);
 void *imdb_realloc(void *ptr, size_t size);
 void imdb_free(void *ptr);
 
+/* Memory accounting — bytes currently held through the wrappers above */
+size_t imdb_malloc_used(void);
+size_t imdb_malloc_peak(void);
+size_t imdb_malloc_size(void *ptr);
+
+/* Bytes of a block the caller may use, at least the size requested */
+size_t imdb_malloc_usable(void *ptr);
+
+/* Resident set size of the process in bytes (0 if unavailable) */
+size_t imdb_get_rss(void);
+
+/* Bytes of memory this process has written to and does not share (Linux
+ * Private_Dirty; 0 if unavailable). In a forked child this is the memory
+ * copied on write since the fork. */
+size_t imdb_get_private_dirty(void);
+
+/* Format a byte count as "1.50M" etc. */
+void imdb_bytes_to_human(char *buf, size_t len, size_t bytes);
+
 /* String duplication */
 char *imdb_strdup(const char *s);
 char *imdb_strndup(const char *s, size_t n);
 
+/* Copy exactly n bytes into a new NUL-terminated buffer */
+char *imdb_memdup(const void *s, size_t n);
+
+/* NUL-terminated view of n bytes for C-string APIs: copied into `stack` (cap bytes)
+ * when it fits, else into a heap copy returned in *heap, which the caller frees */
+const char *imdb_cstr(const char *s, size_t n, char *stack, size_t cap, char **heap);
+
 /* Time utilities (milliseconds since epoch) */
 int64_t imdb_mstime(void);
 
+/* 64-bit hash of n bytes (MurmurHash64A) */
+uint64_t imdb_hash64(const void *key, size_t len, uint64_t seed);
+
+/* CRC-64 (Jones polynomial) of n bytes, continuing from crc (0 to start) */
+uint64_t imdb_crc64(uint64_t crc, const void *data, size_t len);
+
 /* Case-insensitive string compare */
 int imdb_strcasecmp(const char *a, const char *b);
 
@@ -0,0 +1,412 @@
+#include "vfilter.h"
+#include "util.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VF_MAX_DEPTH 64
+#define VF_MAX_OPERANDS 1024   /* bounds the tree, and so the evaluation recursion */
+
+typedef enum {
+    VF_NUM,
+    VF_STR,
+    VF_FIELD,
+    VF_NOT,
+    VF_AND,
+    VF_OR,
+    VF_CMP
+} vf_kind_t;
+
+typedef enum {
+    VF_EQ,
+    VF_NE,
+    VF_LT,
+    VF_LE,
+    VF_GT,
+    VF_GE
+} vf_op_t;
+
+typedef struct vf_node {
+    vf_kind_t kind;
+    vf_op_t op;
+    double num;
+    char *str;             /* string literal or field name */
+    size_t len;
+    struct vf_node *l, *r;
+} vf_node_t;
+
+struct vfilter {
+    vf_node_t *root;
+};
+
+/* ---- JSON scanning ---- */
+
+static const char *json_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return p;
+}
+
+/* p at the opening quote; returns the position after the closing one, or NULL */
+static const char *json_string(const char *p, const char *end) {
+    for (p++; p < end; p++) {
+        if (*p == '"') return p + 1;
+        if (*p == '\\' && ++p == end) return NULL;
+        if ((unsigned char)*p < 0x20) return NULL;
+    }
+    return NULL;
+}
+
+static const char *json_number(const char *p, const char *end) {
+    if (p < end && *p == '-') p++;
+    const char *digits = p;
+    while (p < end && isdigit((unsigned char)*p)) p++;
+    if (p == digits) return NULL;
+    if (p < end && *p == '.') {
+        digits = ++p;
+        while (p < end && isdigit((unsigned char)*p)) p++;
+        if (p == digits) return NULL;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        digits = p;
+        while (p < end && isdigit((unsigned char)*p)) p++;
+        if (p == digits) return NULL;
+    }
+    return p;
+}
+
+static const char *json_literal(const char *p, const char *end, const char *word) {
+    size_t n = strlen(word);
+    return (size_t)(end - p) >= n && memcmp(p, word, n) == 0 ? p + n : NULL;
+}
+
+/* Skip one value; returns the position after it, or NULL if malformed */
+static const char *json_value(const char *p, const char *end, int depth) {
+    if (p == end || depth > VF_MAX_DEPTH) return NULL;
+    switch (*p) {
+        case '"': return json_string(p, end);
+        case 't': return json_literal(p, end, "true");
+        case 'f': return json_literal(p, end, "false");
+        case 'n': return json_literal(p, end, "null");
+        case '{':
+        case '[': {
+            char close = *p == '{' ? '}' : ']';
+            p = json_ws(p + 1, end);
+            if (p < end && *p == close) return p + 1;
+            for (;;) {
+                if (close == '}') {
+                    if (p == end || *p != '"' || !(p = json_string(p, end))) return NULL;
+                    p = json_ws(p, end);
+                    if (p == end || *p != ':') return NULL;
+                    p = json_ws(p + 1, end);
+                }
+                if (!(p = json_value(p, end, depth + 1))) return NULL;
+                p = json_ws(p, end);
+                if (p == end) return NULL;
+                if (*p == close) return p + 1;
+                if (*p != ',') return NULL;
+                p = json_ws(p + 1, end);
+            }
+        }
+        default: return json_number(p, end);
+    }
+}
+
+int vfilter_json_valid(const char *s, size_t len) {
+    const char *end = s + len, *p = json_ws(s, end);
+    if (p == end || *p != '{' || !(p = json_value(p, end, 0))) return 0;
+    return json_ws(p, end) == end;
+}
+
+/* ---- Evaluation ---- */
+
+typedef enum {
+    VAL_MISSING,
+    VAL_NUM,
+    VAL_STR
+} vf_val_kind_t;
+
+typedef struct {
+    vf_val_kind_t kind;
+    double num;
+    const char *s;
+    size_t len;
+} vf_val_t;
+
+/* Value of a top-level field of a (valid) attribute object */
+static vf_val_t json_field(const char *attr, size_t len, const char *name, size_t nlen) {
+    vf_val_t v = { VAL_MISSING, 0, NULL, 0 };
+    if (!attr) return v;
+    const char *end = attr + len, *p = json_ws(attr, end);
+    if (p == end || *p != '{') return v;
+    p = json_ws(p + 1, end);
+    while (p < end && *p == '"') {
+        const char *key = p + 1, *q = json_string(p, end);
+        if (!q) return v;
+        int match = (size_t)(q - 1 - key) == nlen && memcmp(key, name, nlen) == 0;
+        p = json_ws(q, end);
+        if (p == end || *p != ':') return v;
+        p = json_ws(p + 1, end);
+        if (match) {
+            if (*p == '"') {
+                if (!(q = json_string(p, end))) return v;
+                v.kind = VAL_STR;
+                v.s = p + 1;
+                v.len = (size_t)(q - 1 - v.s);
+            } else if (*p == 't' || *p == 'f') {
+                v.kind = VAL_NUM;
+                v.num = *p == 't';
+            } else if (*p == '-' || isdigit((unsigned char)*p)) {
+                v.kind = VAL_NUM;
+                v.num = strtod(p, NULL);
+            }
+            return v;
+        }
+        if (!(p = json_value(p, end, 0))) return v;
+        p = json_ws(p, end);
+        if (p == end || *p != ',') return v;
+        p = json_ws(p + 1, end);
+    }
+    return v;
+}
+
+static int eval_bool(const vf_node_t *n, const char *attr, size_t len);
+
+static vf_val_t eval_value(const vf_node_t *n, const char *attr, size_t len) {
+    vf_val_t v = { VAL_NUM, 0, NULL, 0 };
+    switch (n->kind) {
+        case VF_NUM:
+            v.num = n->num;
+            return v;
+        case VF_STR:
+            v.kind = VAL_STR;
+            v.s = n->str;
+            v.len = n->len;
+            return v;
+        case VF_FIELD:
+            return json_field(attr, len, n->str, n->len);
+        default:
+            v.num = eval_bool(n, attr, len);
+            return v;
+    }
+}
+
+static int compare(vf_op_t op, vf_val_t a, vf_val_t b) {
+    if (a.kind == VAL_MISSING || b.kind == VAL_MISSING) return 0;
+    if (a.kind != b.kind) return op == VF_NE;
+    int c;
+    if (a.kind == VAL_NUM) {
+        c = a.num < b.num ? -1 : a.num > b.num ? 1 : 0;
+    } else {
+        size_t n = a.len < b.len ? a.len : b.len;
+        c = memcmp(a.s, b.s, n);
+        if (c == 0) c = a.len < b.len ? -1 : a.len > b.len ? 1 : 0;
+    }
+    switch (op) {
+        case VF_EQ: return c == 0;
+        case VF_NE: return c != 0;
+        case VF_LT: return c < 0;
+        case VF_LE: return c <= 0;
+        case VF_GT: return c > 0;
+        case VF_GE: return c >= 0;
+    }
+    return 0;
+}
+
+static int eval_bool(const vf_node_t *n, const char *attr, size_t len) {
+    switch (n->kind) {
+        case VF_NOT: return !eval_bool(n->l, attr, len);
+        case VF_AND: return eval_bool(n->l, attr, len) && eval_bool(n->r, attr, len);
+        case VF_OR:  return eval_bool(n->l, attr, len) || eval_bool(n->r, attr, len);
+        case VF_CMP: return compare(n->op, eval_value(n->l, attr, len), eval_value(n->r, attr, len));
+        default: {
+            vf_val_t v = eval_value(n, attr, len);
+            return v.kind == VAL_NUM ? v.num != 0 : v.kind == VAL_STR && v.len > 0;
+        }
+    }
+}
+
+int vfilter_match(const vfilter_t *f, const char *attr, size_t len) {
+    return eval_bool(f->root, attr, len);
+}
+
+/* ---- Parser ---- */
+
+typedef struct {
+    const char *p;
+    const char *err;
+    int depth;
+    int operands;
+} vf_parser_t;
+
+static void node_free(vf_node_t *n) {
+    if (!n) return;
+    node_free(n->l);
+    node_free(n->r);
+    imdb_free(n->str);
+    imdb_free(n);
+}
+
+static vf_node_t *node_new(vf_kind_t kind, vf_node_t *l, vf_node_t *r) {
+    vf_node_t *n = imdb_calloc(1, sizeof(vf_node_t));
+    n->kind = kind;
+    n->l = l;
+    n->r = r;
+    return n;
+}
+
+static void skip_ws(vf_parser_t *ps) {
+    while (isspace((unsigned char)*ps->p)) ps->p++;
+}
+
+static int is_ident(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/* Consume a symbol or a keyword (which must not run into an identifier) */
+static int accept(vf_parser_t *ps, const char *tok) {
+    skip_ws(ps);
+    size_t n = strlen(tok);
+    if (strncmp(ps->p, tok, n) != 0) return 0;
+    if (is_ident(tok[0]) && is_ident(ps->p[n])) return 0;
+    ps->p += n;
+    return 1;
+}
+
+static vf_node_t *fail(vf_parser_t *ps, const char *err, vf_node_t *partial) {
+    if (!ps->err) ps->err = err;
+    node_free(partial);
+    return NULL;
+}
+
+static vf_node_t *parse_or(vf_parser_t *ps);
+
+static vf_node_t *parse_operand(vf_parser_t *ps) {
+    if (++ps->operands > VF_MAX_OPERANDS) return fail(ps, "filter too long", NULL);
+    skip_ws(ps);
+    const char *p = ps->p;
+    if (*p == '(') {
+        if (++ps->depth > VF_MAX_DEPTH) return fail(ps, "filter nested too deeply", NULL);
+        ps->p++;
+        vf_node_t *n = parse_or(ps);
+        if (!n) return NULL;
+        if (!accept(ps, ")")) return fail(ps, "missing ')' in filter", n);
+        ps->depth--;
+        return n;
+    }
+    if (*p == '.') {
+        const char *start = ++p;
+        while (is_ident(*p)) p++;
+        if (p == start) return fail(ps, "expected a field name after '.' in filter", NULL);
+        vf_node_t *n = node_new(VF_FIELD, NULL, NULL);
+        n->str = imdb_memdup(start, (size_t)(p - start));
+        n->len = (size_t)(p - start);
+        ps->p = p;
+        return n;
+    }
+    if (*p == '"' || *p == '\'') {
+        char quote = *p++;
+        char *buf = imdb_malloc(strlen(p) + 1);
+        size_t len = 0;
+        while (*p && *p != quote) {
+            if (*p == '\\' && p[1]) p++;
+            buf[len++] = *p++;
+        }
+        if (*p != quote) {
+            imdb_free(buf);
+            return fail(ps, "unterminated string in filter", NULL);
+        }
+        vf_node_t *n = node_new(VF_STR, NULL, NULL);
+        buf[len] = '\0';
+        n->str = buf;
+        n->len = len;
+        ps->p = p + 1;
+        return n;
+    }
+    int truth = accept(ps, "true");
+    if (truth || accept(ps, "false")) {
+        vf_node_t *n = node_new(VF_NUM, NULL, NULL);
+        n->num = truth;
+        return n;
+    }
+    char *end;
+    double num = strtod(p, &end);
+    if (end == p || !(isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.')) {
+        return fail(ps, "syntax error in filter", NULL);
+    }
+    vf_node_t *n = node_new(VF_NUM, NULL, NULL);
+    n->num = num;
+    ps->p = end;
+    return n;
+}
+
+static vf_node_t *parse_cmp(vf_parser_t *ps) {
+    static const struct { const char *tok; vf_op_t op; } ops[] = {
+        {"==", VF_EQ}, {"!=", VF_NE}, {"<=", VF_LE}, {">=", VF_GE}, {"<", VF_LT}, {">", VF_GT}
+    };
+    vf_node_t *l = parse_operand(ps);
+    if (!l) return NULL;
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (!accept(ps, ops[i].tok)) continue;
+        vf_node_t *r = parse_operand(ps);
+        if (!r) return fail(ps, "syntax error in filter", l);
+        vf_node_t *n = node_new(VF_CMP, l, r);
+        n->op = ops[i].op;
+        return n;
+    }
+    return l;
+}
+
+static vf_node_t *parse_not(vf_parser_t *ps) {
+    skip_ws(ps);
+    if ((ps->p[0] == '!' && ps->p[1] != '=' && accept(ps, "!")) || accept(ps, "not")) {
+        if (++ps->depth > VF_MAX_DEPTH) return fail(ps, "filter nested too deeply", NULL);
+        vf_node_t *inner = parse_not(ps);
+        ps->depth--;
+        return inner ? node_new(VF_NOT, inner, NULL) : NULL;
+    }
+    return parse_cmp(ps);
+}
+
+static vf_node_t *parse_and(vf_parser_t *ps) {
+    vf_node_t *l = parse_not(ps);
+    while (l && (accept(ps, "and") || accept(ps, "&&"))) {
+        vf_node_t *r = parse_not(ps);
+        if (!r) return fail(ps, "syntax error in filter", l);
+        l = node_new(VF_AND, l, r);
+    }
+    return l;
+}
+
+static vf_node_t *parse_or(vf_parser_t *ps) {
+    vf_node_t *l = parse_and(ps);
+    while (l && (accept(ps, "or") || accept(ps, "||"))) {
+        vf_node_t *r = parse_and(ps);
+        if (!r) return fail(ps, "syntax error in filter", l);
+        l = node_new(VF_OR, l, r);
+    }
+    return l;
+}
+
+vfilter_t *vfilter_compile(const char *expr, const char **err) {
+    vf_parser_t ps = { expr, NULL, 0, 0 };
+    vf_node_t *root = parse_or(&ps);
+    if (root) {
+        skip_ws(&ps);
+        if (*ps.p != '\0') root = fail(&ps, "syntax error in filter", root);
+    }
+    if (!root) {
+        *err = ps.err ? ps.err : "syntax error in filter";
+        return NULL;
+    }
+    vfilter_t *f = imdb_malloc(sizeof(vfilter_t));
+    f->root = root;
+    return f;
+}
+
+void vfilter_free(vfilter_t *f) {
+    if (!f) return;
+    node_free(f->root);
+    imdb_free(f);
+}
@@ -0,0 +1,32 @@
+#ifndef VFILTER_H
+#define VFILTER_H
+
+#include <stddef.h>
+
+/*
+ * Filter expressions over vector set attributes, which are JSON objects.
+ * An expression is compiled once per query and then tested against each
+ * candidate's attributes:
+ *
+ *   .year >= 1980 and (.genre == "scifi" or not .archived)
+ *
+ * Operands are `.field` (a top-level attribute), numbers, quoted strings
+ * and true/false (1/0). Operators, loosest first: `or`/`||`, `and`/`&&`,
+ * `not`/`!`, and the comparisons == != < <= > >=. Strings compare
+ * bytewise, numbers numerically. Any comparison with a missing field is
+ * false; values of different kinds are unequal and unordered. A bare
+ * operand is true if it is a non-zero number or a non-empty string.
+ */
+typedef struct vfilter vfilter_t;
+
+/* Compile an expression; returns NULL with a message in *err on a syntax error */
+vfilter_t *vfilter_compile(const char *expr, const char **err);
+void vfilter_free(vfilter_t *f);
+
+/* Returns 1 if attributes (attr may be NULL) satisfy the filter */
+int vfilter_match(const vfilter_t *f, const char *attr, size_t len);
+
+/* Returns 1 if s is a well-formed JSON object */
+int vfilter_json_valid(const char *s, size_t len);
+
+#endif /* VFILTER_H */
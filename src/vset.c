@@ -0,0 +1,626 @@
+#include "vset.h"
+#include "config.h"
+#include "simd.h"
+#include "util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define Q8_HDR 8   /* [scale float][squared norm float] before the int8 values */
+
+/* ---- Vectors ---- */
+
+static unsigned char *vec_at(const vset_t *vs, uint32_t slot) {
+    return vs->vecs + (size_t)slot * vs->vec_bytes;
+}
+
+/* Store a float vector in the set's encoding (normalized first for cosine) */
+static void vec_encode(const vset_t *vs, const float *in, unsigned char *out) {
+    uint32_t dim = vs->dim;
+    float norm = 1;
+    if (vs->metric == VSET_COSINE) {
+        double sq = 0;
+        for (uint32_t i = 0; i < dim; i++) sq += (double)in[i] * in[i];
+        if (sq > 0) norm = (float)sqrt(sq);
+    }
+    if (vs->quant == VSET_FP32) {
+        float *v = (float *)out;
+        for (uint32_t i = 0; i < dim; i++) v[i] = in[i] / norm;
+        return;
+    }
+    float maxabs = 0;
+    for (uint32_t i = 0; i < dim; i++) {
+        float a = fabsf(in[i] / norm);
+        if (a > maxabs) maxabs = a;
+    }
+    float scale = maxabs / 127.0f, inv = maxabs > 0 ? 127.0f / maxabs : 0;
+    int8_t *q = (int8_t *)(out + Q8_HDR);
+    int64_t sq = 0;
+    for (uint32_t i = 0; i < dim; i++) {
+        long x = lrintf(in[i] / norm * inv);
+        q[i] = (int8_t)(x > 127 ? 127 : x < -127 ? -127 : x);
+        sq += (int64_t)q[i] * q[i];
+    }
+    float norm2 = scale * scale * (float)sq;
+    memcpy(out, &scale, sizeof(float));
+    memcpy(out + 4, &norm2, sizeof(float));
+}
+
+static float vec_dot(const vset_t *vs, const unsigned char *a, const unsigned char *b) {
+    if (vs->quant == VSET_FP32) return simd_dot_f32((const float *)a, (const float *)b, vs->dim);
+    float sa, sb;
+    memcpy(&sa, a, sizeof(float));
+    memcpy(&sb, b, sizeof(float));
+    return sa * sb * (float)simd_dot_i8((const int8_t *)(a + Q8_HDR), (const int8_t *)(b + Q8_HDR), vs->dim);
+}
+
+/* Distance where lower is closer: 1 - cos, -dot, or squared Euclidean */
+static float vec_dist(const vset_t *vs, const unsigned char *a, const unsigned char *b) {
+    switch (vs->metric) {
+        case VSET_COSINE: return 1.0f - vec_dot(vs, a, b);
+        case VSET_IP:     return -vec_dot(vs, a, b);
+        case VSET_L2:     break;
+    }
+    if (vs->quant == VSET_FP32) return simd_l2sq_f32((const float *)a, (const float *)b, vs->dim);
+    float na, nb;
+    memcpy(&na, a + 4, sizeof(float));
+    memcpy(&nb, b + 4, sizeof(float));
+    float d = na + nb - 2.0f * vec_dot(vs, a, b);
+    return d > 0 ? d : 0;
+}
+
+static float slot_dist(const vset_t *vs, uint32_t a, uint32_t b) {
+    return vec_dist(vs, vec_at(vs, a), vec_at(vs, b));
+}
+
+/* The score reported to clients for a distance */
+static float dist_score(const vset_t *vs, float d) {
+    switch (vs->metric) {
+        case VSET_COSINE: return 1.0f - d;
+        case VSET_IP:     return -d;
+        case VSET_L2:     break;
+    }
+    return sqrtf(d);
+}
+
+/* ---- Candidate heaps ---- */
+
+/* Min-heap on d; a max-heap stores negated distances */
+typedef struct {
+    float d;
+    uint32_t id;
+} vcand_t;
+
+typedef struct {
+    vcand_t *v;
+    size_t len;
+    size_t cap;
+} vheap_t;
+
+static void heap_init(vheap_t *h, size_t cap) {
+    h->cap = cap ? cap : 1;
+    h->v = imdb_malloc(h->cap * sizeof(vcand_t));
+    h->len = 0;
+}
+
+static void heap_push(vheap_t *h, float d, uint32_t id) {
+    if (h->len == h->cap) {
+        h->cap *= 2;
+        h->v = imdb_realloc(h->v, h->cap * sizeof(vcand_t));
+    }
+    size_t i = h->len++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (h->v[parent].d <= d) break;
+        h->v[i] = h->v[parent];
+        i = parent;
+    }
+    h->v[i].d = d;
+    h->v[i].id = id;
+}
+
+static vcand_t heap_pop(vheap_t *h) {
+    vcand_t top = h->v[0], last = h->v[--h->len];
+    size_t i = 0;
+    for (;;) {
+        size_t l = 2 * i + 1, min = l;
+        if (l >= h->len) break;
+        if (l + 1 < h->len && h->v[l + 1].d < h->v[l].d) min = l + 1;
+        if (h->v[min].d >= last.d) break;
+        h->v[i] = h->v[min];
+        i = min;
+    }
+    if (h->len > 0) h->v[i] = last;
+    return top;
+}
+
+/* Push into a max-heap (negated) bounded to `limit` entries */
+static void heap_push_bounded(vheap_t *h, float d, uint32_t id, size_t limit) {
+    heap_push(h, -d, id);
+    if (h->len > limit) heap_pop(h);
+}
+
+static float heap_worst(const vheap_t *h) {
+    return -h->v[0].d;
+}
+
+/* ---- Graph helpers ---- */
+
+static size_t links_words(const vset_t *vs, uint32_t level) {
+    return 1 + 2 * (size_t)vs->m + (size_t)level * (1 + vs->m);
+}
+
+uint32_t vset_layer_cap(const vset_t *vs, uint32_t level) {
+    return level == 0 ? 2 * vs->m : vs->m;
+}
+
+uint32_t *vset_links(const vset_t *vs, uint32_t slot, uint32_t level) {
+    uint32_t *base = vs->nodes[slot].links;
+    return level == 0 ? base : base + 1 + 2 * (size_t)vs->m + (size_t)(level - 1) * (1 + vs->m);
+}
+
+const void *vset_vector(const vset_t *vs, uint32_t slot) {
+    return vec_at(vs, slot);
+}
+
+/* Whether a link target is a live element present on the layer (links left
+ * dangling by a removal never reach past this check) */
+static int on_layer(const vset_t *vs, uint32_t slot, uint32_t level) {
+    return vs->nodes[slot].name && vs->nodes[slot].level >= level;
+}
+
+static void remove_link(vset_t *vs, uint32_t from, uint32_t to, uint32_t level) {
+    uint32_t *l = vset_links(vs, from, level);
+    for (uint32_t i = 1; i <= l[0]; i++) {
+        if (l[i] == to) {
+            l[i] = l[l[0]--];
+            return;
+        }
+    }
+}
+
+static int has_link(const vset_t *vs, uint32_t from, uint32_t to, uint32_t level) {
+    const uint32_t *l = vset_links(vs, from, level);
+    for (uint32_t i = 1; i <= l[0]; i++) {
+        if (l[i] == to) return 1;
+    }
+    return 0;
+}
+
+static void add_pair(vset_t *vs, uint32_t a, uint32_t b, uint32_t level) {
+    uint32_t *la = vset_links(vs, a, level), *lb = vset_links(vs, b, level);
+    la[++la[0]] = b;
+    lb[++lb[0]] = a;
+}
+
+/* Link new node a with b. A full b gives up its farthest neighbour (one
+ * that keeps another link) if a is closer; otherwise nothing is linked. */
+static void link_pair(vset_t *vs, uint32_t a, uint32_t b, uint32_t level, float d_ab) {
+    uint32_t *lb = vset_links(vs, b, level);
+    if (lb[0] < vset_layer_cap(vs, level)) {
+        add_pair(vs, a, b, level);
+        return;
+    }
+    long worst = -1;
+    float worst_d = d_ab;
+    for (uint32_t i = 1; i <= lb[0]; i++) {
+        uint32_t w = lb[i];
+        if (!on_layer(vs, w, level)) {
+            worst = w;
+            break;
+        }
+        if (vset_links(vs, w, level)[0] < 2) continue;
+        float d = slot_dist(vs, b, w);
+        if (d > worst_d) {
+            worst = w;
+            worst_d = d;
+        }
+    }
+    if (worst < 0) return;
+    remove_link(vs, b, (uint32_t)worst, level);
+    if (on_layer(vs, (uint32_t)worst, level)) remove_link(vs, (uint32_t)worst, b, level);
+    add_pair(vs, a, b, level);
+}
+
+static uint32_t visit_begin(vset_t *vs) {
+    if (++vs->visit_tag == 0) {
+        memset(vs->visited, 0, (size_t)vs->cap * sizeof(uint32_t));
+        vs->visit_tag = 1;
+    }
+    return vs->visit_tag;
+}
+
+/* Walk to the nearest node on a layer by repeatedly moving to a closer neighbour */
+static uint32_t greedy(const vset_t *vs, const unsigned char *q, uint32_t cur, float *cur_d, uint32_t level) {
+    for (int changed = 1; changed;) {
+        changed = 0;
+        const uint32_t *l = vset_links(vs, cur, level);
+        for (uint32_t i = 1; i <= l[0]; i++) {
+            if (!on_layer(vs, l[i], level)) continue;
+            float d = vec_dist(vs, q, vec_at(vs, l[i]));
+            if (d < *cur_d) {
+                *cur_d = d;
+                cur = l[i];
+                changed = 1;
+            }
+        }
+    }
+    return cur;
+}
+
+static int filter_match(const vset_t *vs, const vset_query_t *fq, uint32_t slot) {
+    const vset_node_t *n = &vs->nodes[slot];
+    return fq->filter(fq->filter_ctx, n->attr, n->attr_len);
+}
+
+/*
+ * Beam search of width ef on one layer, leaving the nearest nodes in `res`
+ * (a max-heap). With a filter only matching nodes enter `res` (up to k);
+ * the beam itself still spans every node, and keeps widening while fewer
+ * than k matches were found, until filter_ef nodes have been visited.
+ */
+static void search_layer(vset_t *vs, const unsigned char *q, uint32_t ep, float ep_d, uint32_t ef,
+                         uint32_t level, const vset_query_t *fq, vheap_t *res) {
+    int filtered = fq && fq->filter;
+    size_t k = filtered ? fq->k : ef;
+    uint32_t tag = visit_begin(vs);
+    size_t visits = 1;
+    vheap_t cand, beam_store;
+    vheap_t *beam = filtered ? &beam_store : res;
+    heap_init(&cand, ef);
+    if (filtered) heap_init(&beam_store, ef + 1);
+
+    vs->visited[ep] = tag;
+    heap_push(&cand, ep_d, ep);
+    heap_push(beam, -ep_d, ep);
+    if (filtered && filter_match(vs, fq, ep)) heap_push(res, -ep_d, ep);
+
+    while (cand.len > 0) {
+        vcand_t c = heap_pop(&cand);
+        if (beam->len >= ef && c.d > heap_worst(beam) && (!filtered || res->len >= k)) break;
+        if (filtered && visits >= fq->filter_ef) break;
+        const uint32_t *l = vset_links(vs, c.id, level);
+        for (uint32_t i = 1; i <= l[0]; i++) {
+            uint32_t e = l[i];
+            if (vs->visited[e] == tag || !on_layer(vs, e, level)) continue;
+            vs->visited[e] = tag;
+            visits++;
+            float d = vec_dist(vs, q, vec_at(vs, e));
+            if (beam->len < ef || d < heap_worst(beam) || (filtered && res->len < k)) {
+                heap_push(&cand, d, e);
+                heap_push_bounded(beam, d, e, ef);
+                if (filtered && filter_match(vs, fq, e)) heap_push_bounded(res, d, e, k);
+            }
+        }
+    }
+    imdb_free(cand.v);
+    if (filtered) imdb_free(beam_store.v);
+}
+
+/* Drain a max-heap into an array sorted nearest first */
+static size_t heap_drain_sorted(vheap_t *h, vcand_t *out) {
+    size_t n = h->len;
+    for (size_t i = n; i > 0; i--) {
+        vcand_t c = heap_pop(h);
+        out[i - 1].d = -c.d;
+        out[i - 1].id = c.id;
+    }
+    return n;
+}
+
+/* HNSW neighbour heuristic: keep a candidate only if it is closer to the
+ * new node than to every neighbour kept so far, which spreads the links
+ * across directions instead of bunching them in one cluster */
+static size_t select_neighbors(const vset_t *vs, vcand_t *cands, size_t n, size_t max) {
+    size_t kept = 0;
+    for (size_t i = 0; i < n && kept < max; i++) {
+        int good = 1;
+        for (size_t j = 0; j < kept && good; j++) {
+            if (slot_dist(vs, cands[i].id, cands[j].id) < cands[i].d) good = 0;
+        }
+        if (good) cands[kept++] = cands[i];
+    }
+    return kept;
+}
+
+static uint32_t random_level(vset_t *vs) {
+    vs->rng ^= vs->rng >> 12;
+    vs->rng ^= vs->rng << 25;
+    vs->rng ^= vs->rng >> 27;
+    double u = (double)(((vs->rng * 0x2545f4914f6cdd1dULL) >> 11) + 1) / 9007199254740993.0;
+    double level = -log(u) / log((double)vs->m);
+    return level >= VSET_MAX_LEVEL ? VSET_MAX_LEVEL : (uint32_t)level;
+}
+
+static void insert_graph(vset_t *vs, uint32_t s, uint32_t ef) {
+    uint32_t level = vs->nodes[s].level;
+    if (vs->max_level < 0) {
+        vs->entry = s;
+        vs->max_level = (int)level;
+        return;
+    }
+    const unsigned char *q = vec_at(vs, s);
+    uint32_t cur = vs->entry;
+    float cur_d = vec_dist(vs, q, vec_at(vs, cur));
+    for (int l = vs->max_level; l > (int)level; l--) cur = greedy(vs, q, cur, &cur_d, (uint32_t)l);
+
+    vheap_t res;
+    heap_init(&res, ef + 1);
+    vcand_t *sorted = imdb_malloc(((size_t)ef + 1) * sizeof(vcand_t));
+    for (int l = (int)level < vs->max_level ? (int)level : vs->max_level; l >= 0; l--) {
+        search_layer(vs, q, cur, cur_d, ef, (uint32_t)l, NULL, &res);
+        size_t n = heap_drain_sorted(&res, sorted);
+        cur = sorted[0].id;
+        cur_d = sorted[0].d;
+        n = select_neighbors(vs, sorted, n, vs->m);
+        for (size_t i = 0; i < n; i++) link_pair(vs, s, sorted[i].id, (uint32_t)l, sorted[i].d);
+    }
+    imdb_free(sorted);
+    imdb_free(res.v);
+    if ((int)level > vs->max_level) {
+        vs->entry = s;
+        vs->max_level = (int)level;
+    }
+}
+
+/* ---- Slots ---- */
+
+static void grow(vset_t *vs) {
+    uint32_t cap = vs->cap ? vs->cap * 2 : 16;
+    vs->nodes = imdb_realloc(vs->nodes, (size_t)cap * sizeof(vset_node_t));
+    vs->vecs = imdb_realloc(vs->vecs, (size_t)cap * vs->vec_bytes);
+    vs->free_slots = imdb_realloc(vs->free_slots, (size_t)cap * sizeof(uint32_t));
+    vs->visited = imdb_realloc(vs->visited, (size_t)cap * sizeof(uint32_t));
+    memset(vs->visited + vs->cap, 0, (size_t)(cap - vs->cap) * sizeof(uint32_t));
+    vs->cap = cap;
+}
+
+static uint32_t alloc_slot(vset_t *vs) {
+    if (vs->nfree > 0) return vs->free_slots[--vs->nfree];
+    if (vs->slots == vs->cap) grow(vs);
+    return vs->slots++;
+}
+
+/* Register a live node in a fresh slot; the name is stored once, as the index key */
+static void fill_slot(vset_t *vs, uint32_t s, const char *name, char *attr, size_t attr_len, uint32_t level) {
+    ht_set(vs->index, name, (void *)(uintptr_t)(s + 1));
+    vset_node_t *n = &vs->nodes[s];
+    n->name = ht_get_entry(vs->index, name)->key;
+    n->attr = attr;
+    n->attr_len = attr_len;
+    n->level = level;
+    n->links = imdb_calloc(links_words(vs, level), sizeof(uint32_t));
+    vs->count++;
+}
+
+static void remove_slot(vset_t *vs, uint32_t s) {
+    vset_node_t *node = &vs->nodes[s];
+    uint32_t nb[2 * VSET_MAX_M];
+    for (uint32_t l = 0; l <= node->level; l++) {
+        uint32_t *links = vset_links(vs, s, l), n = 0;
+        for (uint32_t i = 1; i <= links[0]; i++) {
+            if (!on_layer(vs, links[i], l) || links[i] == s) continue;
+            remove_link(vs, links[i], s, l);
+            nb[n++] = links[i];
+        }
+        /* Each former neighbour lost a link; give it the nearest other one with room */
+        uint32_t cap = vset_layer_cap(vs, l);
+        for (uint32_t i = 0; i < n; i++) {
+            if (vset_links(vs, nb[i], l)[0] >= cap) continue;
+            long best = -1;
+            float best_d = 0;
+            for (uint32_t j = 0; j < n; j++) {
+                if (j == i || vset_links(vs, nb[j], l)[0] >= cap || has_link(vs, nb[i], nb[j], l)) continue;
+                float d = slot_dist(vs, nb[i], nb[j]);
+                if (best < 0 || d < best_d) {
+                    best = nb[j];
+                    best_d = d;
+                }
+            }
+            if (best >= 0) add_pair(vs, nb[i], (uint32_t)best, l);
+        }
+    }
+
+    ht_delete(vs->index, node->name);
+    imdb_free(node->attr);
+    imdb_free(node->links);
+    node->name = NULL;
+    node->attr = NULL;
+    node->links = NULL;
+    node->level = VSET_FREE_SLOT;
+    vs->free_slots[vs->nfree++] = s;
+    vs->count--;
+
+    if (s != vs->entry) return;
+    /* Rare: the entry point went away, so take any node on the highest layer left */
+    vs->max_level = -1;
+    for (uint32_t i = 0; i < vs->slots; i++) {
+        if (vs->nodes[i].name && (int)vs->nodes[i].level > vs->max_level) {
+            vs->max_level = (int)vs->nodes[i].level;
+            vs->entry = i;
+        }
+    }
+}
+
+/* ---- Public API ---- */
+
+vset_t *vset_create(uint32_t dim, vset_metric_t metric, vset_quant_t quant, uint32_t m, uint32_t ef_construction) {
+    vset_t *vs = imdb_calloc(1, sizeof(vset_t));
+    vs->dim = dim;
+    vs->metric = metric;
+    vs->quant = quant;
+    vs->m = m;
+    vs->ef_construction = ef_construction;
+    vs->vec_bytes = quant == VSET_FP32 ? (size_t)dim * sizeof(float) : Q8_HDR + (((size_t)dim + 3) & ~(size_t)3);
+    vs->index = ht_create(16, NULL);
+    vs->max_level = -1;
+    vs->rng = 0x9e3779b97f4a7c15ULL;
+    return vs;
+}
+
+void vset_destroy(vset_t *vs) {
+    if (!vs) return;
+    for (uint32_t i = 0; i < vs->slots; i++) {
+        imdb_free(vs->nodes[i].attr);
+        imdb_free(vs->nodes[i].links);
+    }
+    ht_destroy(vs->index);
+    imdb_free(vs->nodes);
+    imdb_free(vs->vecs);
+    imdb_free(vs->free_slots);
+    imdb_free(vs->visited);
+    imdb_free(vs);
+}
+
+long vset_find(const vset_t *vs, const char *name) {
+    void *v = ht_get(vs->index, name);
+    return v ? (long)((uintptr_t)v - 1) : -1;
+}
+
+int vset_add(vset_t *vs, const char *name, const float *vec, uint32_t ef) {
+    long old = vset_find(vs, name);
+    char *attr = NULL;
+    size_t attr_len = 0;
+    if (old >= 0) {
+        /* A new vector means new links: reinsert, keeping the attributes */
+        attr = vs->nodes[old].attr;
+        attr_len = vs->nodes[old].attr_len;
+        vs->nodes[old].attr = NULL;
+        remove_slot(vs, (uint32_t)old);
+    }
+    uint32_t s = alloc_slot(vs);
+    vec_encode(vs, vec, vec_at(vs, s));
+    fill_slot(vs, s, name, attr, attr_len, random_level(vs));
+    insert_graph(vs, s, ef > 0 ? ef : vs->ef_construction);
+    return old < 0;
+}
+
+int vset_remove(vset_t *vs, const char *name) {
+    long s = vset_find(vs, name);
+    if (s < 0) return 0;
+    remove_slot(vs, (uint32_t)s);
+    return 1;
+}
+
+int vset_set_attr(vset_t *vs, const char *name, const char *attr, size_t len) {
+    long s = vset_find(vs, name);
+    if (s < 0) return 0;
+    vset_node_t *n = &vs->nodes[s];
+    imdb_free(n->attr);
+    n->attr = len > 0 ? imdb_memdup(attr, len) : NULL;
+    n->attr_len = len;
+    return 1;
+}
+
+void vset_get_vector(const vset_t *vs, uint32_t slot, float *out) {
+    const unsigned char *v = vec_at(vs, slot);
+    if (vs->quant == VSET_FP32) {
+        memcpy(out, v, (size_t)vs->dim * sizeof(float));
+        return;
+    }
+    float scale;
+    memcpy(&scale, v, sizeof(float));
+    const int8_t *q = (const int8_t *)(v + Q8_HDR);
+    for (uint32_t i = 0; i < vs->dim; i++) out[i] = scale * q[i];
+}
+
+/* Exact k nearest by scanning every slot */
+static void search_exact(const vset_t *vs, const unsigned char *q, const vset_query_t *fq, vheap_t *res) {
+    for (uint32_t s = 0; s < vs->slots; s++) {
+        if (!vs->nodes[s].name || (fq->filter && !filter_match(vs, fq, s))) continue;
+        float d = vec_dist(vs, q, vec_at(vs, s));
+        if (res->len < fq->k || d < heap_worst(res)) heap_push_bounded(res, d, s, fq->k);
+    }
+}
+
+static size_t search_encoded(vset_t *vs, const unsigned char *q, const vset_query_t *fq, vset_result_t *out) {
+    if (vs->count == 0 || fq->k == 0) return 0;
+    vheap_t res;
+    uint32_t ef = fq->ef > fq->k ? fq->ef : (uint32_t)fq->k;
+    heap_init(&res, ef + 1);
+    if (fq->exact || vs->count <= g_config.vset_exact_max_elements) {
+        search_exact(vs, q, fq, &res);
+    } else {
+        uint32_t cur = vs->entry;
+        float cur_d = vec_dist(vs, q, vec_at(vs, cur));
+        for (int l = vs->max_level; l > 0; l--) cur = greedy(vs, q, cur, &cur_d, (uint32_t)l);
+        search_layer(vs, q, cur, cur_d, ef, 0, fq, &res);
+        while (res.len > fq->k) heap_pop(&res);
+    }
+    size_t n = res.len;
+    for (size_t i = n; i > 0; i--) {
+        vcand_t c = heap_pop(&res);
+        out[i - 1].name = vs->nodes[c.id].name;
+        out[i - 1].score = dist_score(vs, -c.d);
+    }
+    imdb_free(res.v);
+    return n;
+}
+
+size_t vset_search(vset_t *vs, const float *vec, const vset_query_t *q, vset_result_t *out) {
+    unsigned char *enc = imdb_malloc(vs->vec_bytes);
+    vec_encode(vs, vec, enc);
+    size_t n = search_encoded(vs, enc, q, out);
+    imdb_free(enc);
+    return n;
+}
+
+size_t vset_search_slot(vset_t *vs, uint32_t slot, const vset_query_t *q, vset_result_t *out) {
+    return search_encoded(vs, vec_at(vs, slot), q, out);
+}
+
+/* ---- Snapshot support ---- */
+
+int vset_restore_slot(vset_t *vs, char *name, char *attr, size_t attr_len, uint32_t level, const void *vec) {
+    if (name && (level > VSET_MAX_LEVEL || ht_exists(vs->index, name))) {
+        imdb_free(name);
+        imdb_free(attr);
+        return -1;
+    }
+    if (vs->slots == vs->cap) grow(vs);
+    uint32_t s = vs->slots++;
+    if (!name) {
+        memset(&vs->nodes[s], 0, sizeof(vset_node_t));
+        vs->nodes[s].level = VSET_FREE_SLOT;
+        memset(vec_at(vs, s), 0, vs->vec_bytes);
+        vs->free_slots[vs->nfree++] = s;
+        return 0;
+    }
+    memcpy(vec_at(vs, s), vec, vs->vec_bytes);
+    fill_slot(vs, s, name, attr, attr_len, level);
+    imdb_free(name);
+    return 0;
+}
+
+int vset_restore_finish(vset_t *vs, uint32_t entry) {
+    int top = -1;
+    for (uint32_t s = 0; s < vs->slots; s++) {
+        const vset_node_t *n = &vs->nodes[s];
+        if (!n->name) continue;
+        for (uint32_t l = 0; l <= n->level; l++) {
+            const uint32_t *links = vset_links(vs, s, l);
+            if (links[0] > vset_layer_cap(vs, l)) return -1;
+            for (uint32_t i = 1; i <= links[0]; i++) {
+                if (links[i] >= vs->slots || links[i] == s || !on_layer(vs, links[i], l)) return -1;
+            }
+        }
+        if ((int)n->level > top) top = (int)n->level;
+    }
+    if (vs->count == 0) return 0;
+    if (entry >= vs->slots || !vs->nodes[entry].name || (int)vs->nodes[entry].level != top) return -1;
+    vs->entry = entry;
+    vs->max_level = top;
+    return 0;
+}
+
+size_t vset_mem_usage(const vset_t *vs) {
+    size_t total = imdb_malloc_size((void *)vs) + imdb_malloc_size(vs->nodes) + imdb_malloc_size(vs->vecs) +
+                   imdb_malloc_size(vs->free_slots) + imdb_malloc_size(vs->visited) +
+                   imdb_malloc_size(vs->index) + imdb_malloc_size(vs->index->entries);
+    for (uint32_t s = 0; s < vs->slots; s++) {
+        const vset_node_t *n = &vs->nodes[s];
+        if (!n->name) continue;
+        total += imdb_malloc_size(n->name) + imdb_malloc_size(n->attr) + imdb_malloc_size(n->links);
+    }
+    return total;
+}
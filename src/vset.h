@@ -0,0 +1,133 @@
+#ifndef VSET_H
+#define VSET_H
+
+#include "hashtable.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Vector set: fixed-dimension vectors under string element names, searched
+ * for nearest neighbours through an HNSW graph (hierarchical navigable
+ * small world). Every element sits on layer 0 and, with geometrically
+ * falling probability, on higher layers; a search descends greedily from
+ * the top layer's entry point, then runs a beam search of width `ef` on
+ * layer 0. Links are kept symmetric, so removing an element only has to
+ * visit its own neighbours.
+ *
+ * Elements live in numbered slots; freed slots are reused. Vectors are
+ * stored in one array indexed by slot, either as float32 or quantized to
+ * int8 with a per-vector scale. Cosine sets store unit vectors so every
+ * metric reduces to a dot product or a squared distance.
+ */
+typedef enum {
+    VSET_COSINE,
+    VSET_L2,
+    VSET_IP
+} vset_metric_t;
+
+typedef enum {
+    VSET_FP32,
+    VSET_Q8
+} vset_quant_t;
+
+#define VSET_MAX_DIM 32768
+#define VSET_MAX_LEVEL 16
+#define VSET_MAX_M 128
+#define VSET_DEFAULT_M 16
+#define VSET_DEFAULT_EF_CONSTRUCTION 200
+#define VSET_FREE_SLOT UINT32_MAX   /* level of an unused slot */
+
+typedef struct {
+    char *name;          /* NULL for a free slot */
+    char *attr;          /* JSON attributes, NULL if none */
+    size_t attr_len;
+    uint32_t level;
+    uint32_t *links;     /* per layer [count][ids]: 2m ids on layer 0, m above */
+} vset_node_t;
+
+typedef struct {
+    uint32_t dim;
+    vset_metric_t metric;
+    vset_quant_t quant;
+    uint32_t m;
+    uint32_t ef_construction;
+    size_t vec_bytes;    /* bytes of one stored vector */
+    uint32_t count;      /* live elements */
+    uint32_t slots;      /* slots handed out, live or free */
+    uint32_t cap;
+    vset_node_t *nodes;
+    unsigned char *vecs; /* cap * vec_bytes */
+    uint32_t *free_slots;
+    uint32_t nfree;
+    hashtable_t *index;  /* name -> slot + 1 */
+    uint32_t entry;
+    int max_level;       /* -1 while empty */
+    uint32_t *visited;   /* per-slot search tags */
+    uint32_t visit_tag;
+    uint64_t rng;
+} vset_t;
+
+/* One search hit; name points into the set */
+typedef struct {
+    const char *name;
+    float score;
+} vset_result_t;
+
+/* Attribute predicate for filtered searches; attr is NULL when the element has none */
+typedef int (*vset_filter_fn)(void *ctx, const char *attr, size_t len);
+
+typedef struct {
+    size_t k;
+    uint32_t ef;             /* layer-0 beam width (raised to k) */
+    int exact;               /* scan every element instead of walking the graph */
+    vset_filter_fn filter;   /* optional */
+    void *filter_ctx;
+    size_t filter_ef;        /* elements a filtered graph search may visit */
+} vset_query_t;
+
+vset_t *vset_create(uint32_t dim, vset_metric_t metric, vset_quant_t quant, uint32_t m, uint32_t ef_construction);
+void vset_destroy(vset_t *vs);
+
+/* Insert or replace an element's vector (dim floats); returns 1 if the
+ * element is new. ef overrides the set's construction beam width if > 0. */
+int vset_add(vset_t *vs, const char *name, const float *vec, uint32_t ef);
+
+/* Remove an element; returns 1 if it existed */
+int vset_remove(vset_t *vs, const char *name);
+
+/* Slot of an element, or -1 */
+long vset_find(const vset_t *vs, const char *name);
+
+/* Replace an element's attributes (len 0 clears them); returns 0 if absent */
+int vset_set_attr(vset_t *vs, const char *name, const char *attr, size_t len);
+
+/* Copy an element's vector as floats into out (dequantized for Q8) */
+void vset_get_vector(const vset_t *vs, uint32_t slot, float *out);
+
+/* Nearest elements to a vector, or to a stored element's vector, best
+ * first into out (room for q->k); returns the number found. Scores are
+ * cosine similarity, dot product or Euclidean distance by metric. */
+size_t vset_search(vset_t *vs, const float *vec, const vset_query_t *q, vset_result_t *out);
+size_t vset_search_slot(vset_t *vs, uint32_t slot, const vset_query_t *q, vset_result_t *out);
+
+/* ---- Snapshot support ---- */
+
+/* Stored vector of a slot (vec_bytes) and its link list on a layer */
+const void *vset_vector(const vset_t *vs, uint32_t slot);
+uint32_t *vset_links(const vset_t *vs, uint32_t slot, uint32_t level);
+
+/* Link capacity of a layer */
+uint32_t vset_layer_cap(const vset_t *vs, uint32_t level);
+
+/* Append the next slot while loading: a free one (name NULL) or an element
+ * taking ownership of name and attr, with empty link lists to be filled
+ * through vset_links. Returns -1 on a duplicate name or bad level. */
+int vset_restore_slot(vset_t *vs, char *name, char *attr, size_t attr_len, uint32_t level, const void *vec);
+
+/* Check the loaded links and set the entry point; returns -1 if the graph is inconsistent */
+int vset_restore_finish(vset_t *vs, uint32_t entry);
+
+/* Estimated bytes held by the set */
+size_t vset_mem_usage(const vset_t *vs);
+
+#endif /* VSET_H */
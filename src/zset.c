@@ -0,0 +1,532 @@
+#include "zset.h"
+#include "listpack.h"
+#include "config.h"
+#include "util.h"
+#include <string.h>
+#include <math.h>
+
+#define MEMBER_STACK_LEN 128
+
+/* Dict keys are C strings; short members are terminated on the stack */
+#define member_cstr(m, len, stack, heap) imdb_cstr((m), (len), (stack), MEMBER_STACK_LEN, (heap))
+
+/* ---- Ordering ---- */
+
+static int member_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    size_t n = alen < blen ? alen : blen;
+    int c = n ? memcmp(a, b, n) : 0;
+    if (c) return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+/* Compare (s1, m1) with (s2, m2): by score, then by member */
+static int entry_cmp(double s1, const char *m1, size_t l1, double s2, const char *m2, size_t l2) {
+    if (s1 < s2) return -1;
+    if (s1 > s2) return 1;
+    return member_cmp(m1, l1, m2, l2);
+}
+
+/* ---- Skiplist ---- */
+
+/* Per thread: snapshot loader threads build skiplists concurrently */
+static _Thread_local uint64_t zsl_rng = 0x9E3779B97F4A7C15ULL;
+
+/* Level with P(level > k) = 1/4^k, from a xorshift generator */
+static int zsl_random_level(void) {
+    zsl_rng ^= zsl_rng << 13;
+    zsl_rng ^= zsl_rng >> 7;
+    zsl_rng ^= zsl_rng << 17;
+    uint64_t r = zsl_rng;
+    int level = 1;
+    while ((r & 3) == 0 && level < ZSKIPLIST_MAXLEVEL) {
+        level++;
+        r >>= 2;
+    }
+    return level;
+}
+
+static zskip_node_t *zsl_create_node(int level, double score, char *member, size_t mlen) {
+    zskip_node_t *n = imdb_calloc(1, sizeof(zskip_node_t) + (size_t)level * sizeof(struct zskip_level));
+    n->score = score;
+    n->member = member;
+    n->mlen = mlen;
+    return n;
+}
+
+static zskiplist_t *zsl_create(void) {
+    zskiplist_t *zsl = imdb_malloc(sizeof(zskiplist_t));
+    zsl->header = zsl_create_node(ZSKIPLIST_MAXLEVEL, 0, NULL, 0);
+    zsl->tail = NULL;
+    zsl->length = 0;
+    zsl->level = 1;
+    return zsl;
+}
+
+static void zsl_free_node(zskip_node_t *n) {
+    imdb_free(n->member);
+    imdb_free(n);
+}
+
+static void zsl_free(zskiplist_t *zsl) {
+    zskip_node_t *n = zsl->header->level[0].forward;
+    while (n) {
+        zskip_node_t *next = n->level[0].forward;
+        zsl_free_node(n);
+        n = next;
+    }
+    imdb_free(zsl->header);
+    imdb_free(zsl);
+}
+
+static int node_cmp(const zskip_node_t *n, double score, const char *member, size_t mlen) {
+    return entry_cmp(n->score, n->member, n->mlen, score, member, mlen);
+}
+
+/* Insert a member the caller has checked is absent; takes ownership of `member` */
+static zskip_node_t *zsl_insert(zskiplist_t *zsl, double score, char *member, size_t mlen) {
+    zskip_node_t *update[ZSKIPLIST_MAXLEVEL], *x = zsl->header;
+    size_t rank[ZSKIPLIST_MAXLEVEL];
+
+    for (int i = zsl->level - 1; i >= 0; i--) {
+        rank[i] = i == zsl->level - 1 ? 0 : rank[i + 1];
+        while (x->level[i].forward && node_cmp(x->level[i].forward, score, member, mlen) < 0) {
+            rank[i] += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+
+    int level = zsl_random_level();
+    if (level > zsl->level) {
+        for (int i = zsl->level; i < level; i++) {
+            rank[i] = 0;
+            update[i] = zsl->header;
+            update[i]->level[i].span = zsl->length;
+        }
+        zsl->level = level;
+    }
+
+    x = zsl_create_node(level, score, member, mlen);
+    for (int i = 0; i < level; i++) {
+        x->level[i].forward = update[i]->level[i].forward;
+        update[i]->level[i].forward = x;
+        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+        update[i]->level[i].span = rank[0] - rank[i] + 1;
+    }
+    for (int i = level; i < zsl->level; i++) update[i]->level[i].span++;
+
+    x->backward = update[0] == zsl->header ? NULL : update[0];
+    if (x->level[0].forward) x->level[0].forward->backward = x;
+    else zsl->tail = x;
+    zsl->length++;
+    return x;
+}
+
+/* Unlink x given the rightmost node before it on every level */
+static void zsl_unlink(zskiplist_t *zsl, zskip_node_t *x, zskip_node_t **update) {
+    for (int i = 0; i < zsl->level; i++) {
+        if (update[i]->level[i].forward == x) {
+            update[i]->level[i].span += x->level[i].span - 1;
+            update[i]->level[i].forward = x->level[i].forward;
+        } else {
+            update[i]->level[i].span--;
+        }
+    }
+    if (x->level[0].forward) x->level[0].forward->backward = x->backward;
+    else zsl->tail = x->backward;
+    while (zsl->level > 1 && !zsl->header->level[zsl->level - 1].forward) zsl->level--;
+    zsl->length--;
+}
+
+/* Collect the predecessors of (score, member) on every level; returns the node itself */
+static zskip_node_t *zsl_find(zskiplist_t *zsl, double score, const char *member, size_t mlen,
+                              zskip_node_t **update) {
+    zskip_node_t *x = zsl->header;
+    for (int i = zsl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward && node_cmp(x->level[i].forward, score, member, mlen) < 0)
+            x = x->level[i].forward;
+        update[i] = x;
+    }
+    x = x->level[0].forward;
+    return x && node_cmp(x, score, member, mlen) == 0 ? x : NULL;
+}
+
+/* Move node n to a new score; returns the node now holding the member */
+static zskip_node_t *zsl_update_score(zskiplist_t *zsl, zskip_node_t *n, double newscore) {
+    zskip_node_t *prev = n->backward, *next = n->level[0].forward;
+    if ((!prev || entry_cmp(prev->score, prev->member, prev->mlen, newscore, n->member, n->mlen) < 0) &&
+        (!next || entry_cmp(next->score, next->member, next->mlen, newscore, n->member, n->mlen) > 0)) {
+        n->score = newscore; /* position unchanged */
+        return n;
+    }
+    zskip_node_t *update[ZSKIPLIST_MAXLEVEL];
+    zsl_find(zsl, n->score, n->member, n->mlen, update);
+    zsl_unlink(zsl, n, update);
+    zskip_node_t *moved = zsl_insert(zsl, newscore, n->member, n->mlen);
+    imdb_free(n);
+    return moved;
+}
+
+/* Node at a 1-based rank */
+static zskip_node_t *zsl_node_by_rank(zskiplist_t *zsl, size_t rank) {
+    zskip_node_t *x = zsl->header;
+    size_t traversed = 0;
+    for (int i = zsl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward && traversed + x->level[i].span <= rank) {
+            traversed += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        if (traversed == rank) return x;
+    }
+    return NULL;
+}
+
+/* ---- Listpack encoding ---- */
+
+static double lp_score(const unsigned char *p) {
+    size_t len;
+    const char *d = lp_get(p, &len);
+    double score;
+    memcpy(&score, d, sizeof(score));
+    return score;
+}
+
+static unsigned char *lp_find_member(unsigned char *lp, const char *member, size_t mlen) {
+    for (unsigned char *p = lp_first(lp); p; p = lp_next(lp, lp_next(lp, p))) {
+        size_t len;
+        const char *m = lp_get(p, &len);
+        if (len == mlen && memcmp(m, member, mlen) == 0) return p;
+    }
+    return NULL;
+}
+
+static unsigned char *lp_insert_sorted(unsigned char *lp, double score, const char *member, size_t mlen) {
+    unsigned char *p = lp_first(lp);
+    while (p) {
+        size_t len;
+        const char *m = lp_get(p, &len);
+        unsigned char *s = lp_next(lp, p);
+        if (entry_cmp(lp_score(s), m, len, score, member, mlen) > 0) break;
+        p = lp_next(lp, s);
+    }
+    unsigned char *newp;
+    lp = lp_insert(lp, p, member, mlen, &newp);
+    return lp_insert(lp, lp_next(lp, newp), (const char *)&score, sizeof(score), NULL);
+}
+
+static unsigned char *lp_delete_pair(unsigned char *lp, unsigned char *p) {
+    unsigned char *s;
+    lp = lp_delete(lp, p, &s);
+    return lp_delete(lp, s, NULL);
+}
+
+static void convert_to_skiplist(zset_t *zs) {
+    unsigned char *lp = zs->lp;
+    zs->zsl = zsl_create();
+    zs->dict = ht_create(lp_length(lp), NULL);
+    char stack[MEMBER_STACK_LEN], *heap;
+
+    for (unsigned char *p = lp_first(lp); p; p = lp_next(lp, lp_next(lp, p))) {
+        size_t mlen;
+        const char *m = lp_get(p, &mlen);
+        zskip_node_t *n = zsl_insert(zs->zsl, lp_score(lp_next(lp, p)), imdb_memdup(m, mlen), mlen);
+        ht_set(zs->dict, member_cstr(m, mlen, stack, &heap), n);
+        imdb_free(heap);
+    }
+    lp_free(lp);
+    zs->lp = NULL;
+    zs->encoding = ZSET_ENC_SKIPLIST;
+}
+
+/* ---- Public API ---- */
+
+zset_t *zset_create(void) {
+    zset_t *zs = imdb_calloc(1, sizeof(zset_t));
+    zs->encoding = ZSET_ENC_LISTPACK;
+    zs->lp = lp_new();
+    return zs;
+}
+
+void zset_destroy(zset_t *zs) {
+    if (!zs) return;
+    if (zs->encoding == ZSET_ENC_LISTPACK) {
+        lp_free(zs->lp);
+    } else {
+        ht_destroy(zs->dict);
+        zsl_free(zs->zsl);
+    }
+    imdb_free(zs);
+}
+
+zset_t *zset_from_listpack(unsigned char *lp, size_t size) {
+    if (!lp_validate(lp, size) || lp_length(lp) % 2 != 0) return NULL;
+
+    /* Scores must be 8-byte doubles and pairs strictly ordered */
+    const char *prev = NULL;
+    size_t prev_len = 0, longest = 0;
+    double prev_score = 0;
+    for (unsigned char *p = lp_first(lp); p; p = lp_next(lp, lp_next(lp, p))) {
+        size_t mlen, slen;
+        const char *m = lp_get(p, &mlen);
+        unsigned char *s = lp_next(lp, p);
+        lp_get(s, &slen);
+        if (slen != sizeof(double)) return NULL;
+        double score = lp_score(s);
+        if (isnan(score)) return NULL;
+        if (prev && entry_cmp(prev_score, prev, prev_len, score, m, mlen) >= 0) return NULL;
+        prev = m;
+        prev_len = mlen;
+        prev_score = score;
+        if (mlen > longest) longest = mlen;
+    }
+
+    zset_t *zs = imdb_calloc(1, sizeof(zset_t));
+    zs->encoding = ZSET_ENC_LISTPACK;
+    zs->lp = lp;
+    /* Limits may have been lowered since the snapshot was written */
+    if (lp_length(lp) / 2 > g_config.zset_max_listpack_entries ||
+        longest > g_config.zset_max_listpack_value) {
+        convert_to_skiplist(zs);
+    }
+    return zs;
+}
+
+size_t zset_length(const zset_t *zs) {
+    if (zs->encoding == ZSET_ENC_LISTPACK) return lp_length(zs->lp) / 2;
+    return zs->zsl->length;
+}
+
+int zset_score(zset_t *zs, const char *member, size_t mlen, double *score) {
+    if (zs->encoding == ZSET_ENC_LISTPACK) {
+        unsigned char *p = lp_find_member(zs->lp, member, mlen);
+        if (!p) return 0;
+        *score = lp_score(lp_next(zs->lp, p));
+        return 1;
+    }
+    char stack[MEMBER_STACK_LEN], *heap;
+    zskip_node_t *n = ht_get(zs->dict, member_cstr(member, mlen, stack, &heap));
+    imdb_free(heap);
+    if (!n) return 0;
+    *score = n->score;
+    return 1;
+}
+
+int zset_add(zset_t *zs, double score, const char *member, size_t mlen,
+             int flags, int *out, double *newscore) {
+    *out = 0;
+    if (isnan(score)) {
+        *out = ZADD_OUT_NAN;
+        return 0;
+    }
+
+    double cur;
+    if (zset_score(zs, member, mlen, &cur)) {
+        if (flags & ZADD_NX) {
+            *out |= ZADD_OUT_NOP;
+            return 1;
+        }
+        if (flags & ZADD_INCR) {
+            score += cur;
+            if (isnan(score)) {
+                *out |= ZADD_OUT_NAN;
+                return 0;
+            }
+        }
+        if (((flags & ZADD_LT) && score >= cur) || ((flags & ZADD_GT) && score <= cur)) {
+            *out |= ZADD_OUT_NOP;
+            return 1;
+        }
+        *newscore = score;
+        if (score == cur) return 1;
+
+        if (zs->encoding == ZSET_ENC_LISTPACK) {
+            zs->lp = lp_delete_pair(zs->lp, lp_find_member(zs->lp, member, mlen));
+            zs->lp = lp_insert_sorted(zs->lp, score, member, mlen);
+        } else {
+            char stack[MEMBER_STACK_LEN], *heap;
+            ht_entry_t *e = ht_get_entry(zs->dict, member_cstr(member, mlen, stack, &heap));
+            imdb_free(heap);
+            e->value = zsl_update_score(zs->zsl, e->value, score);
+        }
+        *out |= ZADD_OUT_UPDATED;
+        return 1;
+    }
+
+    if (flags & ZADD_XX) {
+        *out |= ZADD_OUT_NOP;
+        return 1;
+    }
+
+    if (zs->encoding == ZSET_ENC_LISTPACK &&
+        (zset_length(zs) + 1 > g_config.zset_max_listpack_entries ||
+         mlen > g_config.zset_max_listpack_value)) {
+        convert_to_skiplist(zs);
+    }
+    if (zs->encoding == ZSET_ENC_LISTPACK) {
+        zs->lp = lp_insert_sorted(zs->lp, score, member, mlen);
+    } else {
+        zskip_node_t *n = zsl_insert(zs->zsl, score, imdb_memdup(member, mlen), mlen);
+        char stack[MEMBER_STACK_LEN], *heap;
+        ht_set(zs->dict, member_cstr(member, mlen, stack, &heap), n);
+        imdb_free(heap);
+    }
+    *newscore = score;
+    *out |= ZADD_OUT_ADDED;
+    return 1;
+}
+
+long zset_rank(zset_t *zs, const char *member, size_t mlen, int reverse) {
+    size_t len = zset_length(zs);
+    long rank = -1;
+    if (zs->encoding == ZSET_ENC_LISTPACK) {
+        long i = 0;
+        for (unsigned char *p = lp_first(zs->lp); p; p = lp_next(zs->lp, lp_next(zs->lp, p)), i++) {
+            size_t l;
+            const char *m = lp_get(p, &l);
+            if (l == mlen && memcmp(m, member, mlen) == 0) {
+                rank = i;
+                break;
+            }
+        }
+    } else {
+        char stack[MEMBER_STACK_LEN], *heap;
+        zskip_node_t *n = ht_get(zs->dict, member_cstr(member, mlen, stack, &heap));
+        imdb_free(heap);
+        if (n) {
+            /* Sum spans down to the node: its 1-based rank */
+            zskip_node_t *x = zs->zsl->header;
+            size_t traversed = 0;
+            for (int i = zs->zsl->level - 1; i >= 0; i--) {
+                while (x->level[i].forward &&
+                       node_cmp(x->level[i].forward, n->score, n->member, n->mlen) <= 0) {
+                    traversed += x->level[i].span;
+                    x = x->level[i].forward;
+                }
+                if (x == n) break;
+            }
+            rank = (long)traversed - 1;
+        }
+    }
+    if (rank < 0) return -1;
+    return reverse ? (long)len - 1 - rank : rank;
+}
+
+int zset_delete(zset_t *zs, const char *member, size_t mlen) {
+    if (zs->encoding == ZSET_ENC_LISTPACK) {
+        unsigned char *p = lp_find_member(zs->lp, member, mlen);
+        if (!p) return 0;
+        zs->lp = lp_delete_pair(zs->lp, p);
+        return 1;
+    }
+
+    char stack[MEMBER_STACK_LEN], *heap;
+    const char *key = member_cstr(member, mlen, stack, &heap);
+    zskip_node_t *n = ht_get(zs->dict, key);
+    if (n) {
+        zskip_node_t *update[ZSKIPLIST_MAXLEVEL];
+        zsl_find(zs->zsl, n->score, n->member, n->mlen, update);
+        zsl_unlink(zs->zsl, n, update);
+        zsl_free_node(n);
+        ht_delete(zs->dict, key);
+    }
+    imdb_free(heap);
+    return n != NULL;
+}
+
+size_t zset_count_below(zset_t *zs, double score, int inclusive) {
+    size_t count = 0;
+    if (zs->encoding == ZSET_ENC_LISTPACK) {
+        for (unsigned char *p = lp_first(zs->lp); p; p = lp_next(zs->lp, lp_next(zs->lp, p))) {
+            double s = lp_score(lp_next(zs->lp, p));
+            if (inclusive ? s > score : s >= score) break;
+            count++;
+        }
+        return count;
+    }
+    zskip_node_t *x = zs->zsl->header;
+    for (int i = zs->zsl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward &&
+               (inclusive ? x->level[i].forward->score <= score : x->level[i].forward->score < score)) {
+            count += x->level[i].span;
+            x = x->level[i].forward;
+        }
+    }
+    return count;
+}
+
+size_t zset_count_below_lex(zset_t *zs, const char *member, size_t mlen, int inclusive) {
+    size_t count = 0;
+    if (zs->encoding == ZSET_ENC_LISTPACK) {
+        for (unsigned char *p = lp_first(zs->lp); p; p = lp_next(zs->lp, lp_next(zs->lp, p))) {
+            size_t len;
+            const char *m = lp_get(p, &len);
+            int c = member_cmp(m, len, member, mlen);
+            if (c > 0 || (c == 0 && !inclusive)) break;
+            count++;
+        }
+        return count;
+    }
+    zskip_node_t *x = zs->zsl->header;
+    for (int i = zs->zsl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward) {
+            zskip_node_t *f = x->level[i].forward;
+            int c = member_cmp(f->member, f->mlen, member, mlen);
+            if (c > 0 || (c == 0 && !inclusive)) break;
+            count += x->level[i].span;
+            x = f;
+        }
+    }
+    return count;
+}
+
+void zset_iter_init(zset_iter_t *it, zset_t *zs, size_t rank, int reverse) {
+    it->zs = zs;
+    it->reverse = reverse;
+    it->pos = NULL;
+    it->node = NULL;
+    if (rank >= zset_length(zs)) return;
+    if (zs->encoding == ZSET_ENC_LISTPACK) it->pos = lp_seek(zs->lp, (long)rank * 2);
+    else it->node = zsl_node_by_rank(zs->zsl, rank + 1);
+}
+
+int zset_iter_next(zset_iter_t *it, const char **member, size_t *mlen, double *score) {
+    if (it->zs->encoding == ZSET_ENC_LISTPACK) {
+        unsigned char *lp = it->zs->lp, *p = it->pos;
+        if (!p) return 0;
+        unsigned char *s = lp_next(lp, p);
+        *member = lp_get(p, mlen);
+        *score = lp_score(s);
+        if (it->reverse) {
+            unsigned char *prev = lp_prev(lp, p);
+            it->pos = prev ? lp_prev(lp, prev) : NULL;
+        } else {
+            it->pos = lp_next(lp, s);
+        }
+        return 1;
+    }
+
+    zskip_node_t *n = it->node;
+    if (!n) return 0;
+    *member = n->member;
+    *mlen = n->mlen;
+    *score = n->score;
+    it->node = it->reverse ? n->backward : n->level[0].forward;
+    return 1;
+}
+
+size_t zset_mem_usage(zset_t *zs, size_t samples) {
+    size_t total = imdb_malloc_size(zs);
+    if (zs->encoding == ZSET_ENC_LISTPACK) return total + imdb_malloc_size(zs->lp);
+
+    total += imdb_malloc_size(zs->zsl) + imdb_malloc_size(zs->zsl->header);
+    total += imdb_malloc_size(zs->dict) + imdb_malloc_size(zs->dict->entries);
+    size_t seen = 0, bytes = 0;
+    for (zskip_node_t *n = zs->zsl->header->level[0].forward;
+         n && (samples == 0 || seen < samples); n = n->level[0].forward) {
+        /* Node, its member, and the dict's copy of the member */
+        bytes += imdb_malloc_size(n) + 2 * imdb_malloc_size(n->member);
+        seen++;
+    }
+    if (seen > 0) total += bytes / seen * zs->zsl->length;
+    return total;
+}
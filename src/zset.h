@@ -0,0 +1,106 @@
+#ifndef ZSET_H
+#define ZSET_H
+
+#include "hashtable.h"
+#include <stddef.h>
+
+/*
+ * Sorted set: members ordered by (score, member). Small sets are a single
+ * listpack of member, score pairs kept in order, with the score stored as
+ * a raw 8-byte double. A set that grows past `zset-max-listpack-entries`
+ * members or receives a member longer than `zset-max-listpack-value` bytes
+ * is converted to a skiplist (ordered, with spans for O(log n) rank) plus
+ * a hashtable from member to skiplist node. Conversion is one-way.
+ */
+#define ZSKIPLIST_MAXLEVEL 32
+
+typedef struct zskip_node {
+    char *member;
+    size_t mlen;
+    double score;
+    struct zskip_node *backward;
+    struct zskip_level {
+        struct zskip_node *forward;
+        size_t span;             /* nodes skipped by this link */
+    } level[];
+} zskip_node_t;
+
+typedef struct {
+    zskip_node_t *header;
+    zskip_node_t *tail;
+    size_t length;
+    int level;
+} zskiplist_t;
+
+typedef enum {
+    ZSET_ENC_LISTPACK,
+    ZSET_ENC_SKIPLIST
+} zset_encoding_t;
+
+typedef struct {
+    zset_encoding_t encoding;
+    unsigned char *lp;   /* listpack encoding */
+    zskiplist_t *zsl;    /* skiplist encoding ... */
+    hashtable_t *dict;   /* ... with member -> zskip_node_t */
+} zset_t;
+
+/* ZADD input flags */
+#define ZADD_NX   (1 << 0)  /* only add new members */
+#define ZADD_XX   (1 << 1)  /* only update existing members */
+#define ZADD_GT   (1 << 2)  /* only update when the new score is greater */
+#define ZADD_LT   (1 << 3)  /* only update when the new score is lower */
+#define ZADD_INCR (1 << 4)  /* add the score to the current one */
+
+/* ZADD outcomes */
+#define ZADD_OUT_NOP     (1 << 0)
+#define ZADD_OUT_NAN     (1 << 1)
+#define ZADD_OUT_ADDED   (1 << 2)
+#define ZADD_OUT_UPDATED (1 << 3)
+
+/* Iterator by rank; pointers are valid until the set is modified */
+typedef struct {
+    zset_t *zs;
+    int reverse;
+    unsigned char *pos;
+    zskip_node_t *node;
+} zset_iter_t;
+
+/* Create / destroy */
+zset_t *zset_create(void);
+void zset_destroy(zset_t *zs);
+
+/* Adopt a listpack read from a snapshot; NULL if it is not a valid ordered pack */
+zset_t *zset_from_listpack(unsigned char *lp, size_t size);
+
+/* Number of members */
+size_t zset_length(const zset_t *zs);
+
+/* Add or update a member according to ZADD_* flags. *out receives ZADD_OUT_* and,
+ * unless the call was a no-op, *newscore the member's score. Returns 0 on NaN. */
+int zset_add(zset_t *zs, double score, const char *member, size_t mlen,
+             int flags, int *out, double *newscore);
+
+/* Score of a member; returns 1 if found */
+int zset_score(zset_t *zs, const char *member, size_t mlen, double *score);
+
+/* 0-based rank of a member (from the highest score if reverse), -1 if missing */
+long zset_rank(zset_t *zs, const char *member, size_t mlen, int reverse);
+
+/* Remove a member; returns 1 if it existed */
+int zset_delete(zset_t *zs, const char *member, size_t mlen);
+
+/* Members with a score below `score`, or at most `score` when `inclusive` */
+size_t zset_count_below(zset_t *zs, double score, int inclusive);
+
+/* Members ordering before `member` (or not after it, when `inclusive`),
+ * comparing members only; meaningful when all scores are equal */
+size_t zset_count_below_lex(zset_t *zs, const char *member, size_t mlen, int inclusive);
+
+/* Walk from a 0-based rank towards higher (or, if reverse, lower) ranks */
+void zset_iter_init(zset_iter_t *it, zset_t *zs, size_t rank, int reverse);
+int zset_iter_next(zset_iter_t *it, const char **member, size_t *mlen, double *score);
+
+/* Estimated bytes held by the set; the skiplist encoding samples up to `samples` members (0 = all) */
+size_t zset_mem_usage(zset_t *zs, size_t samples);
+
+#endif /* ZSET_H */
@@ -0,0 +1,323 @@
+#!/bin/sh
+#
+# Snapshot and delta checkpoint round trips: each case writes through the
+# CLI, stops the server with kill -9 (so only what is on disk survives),
+# starts it again over the same directory and compares what it reads back.
+#
+# Usage: tests/roundtrip.sh   (run by `make test`; PORT overrides 16399)
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SERVER=$ROOT/build/inmemdb-server
+CLI=$ROOT/build/inmemdb-cli
+PORT=${PORT:-16399}
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/inmemdb-test.XXXXXX")
+PID=
+FAILED=0
+
+cleanup() {
+    [ -n "$PID" ] && kill -9 "$PID" 2>/dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+fail() {
+    echo "FAIL: $*"
+    echo "  server log: $(tail -n 5 "$WORK/server.log" | tr '\n' ' ')"
+    FAILED=1
+}
+
+# Send one command per line on stdin; print the replies without prompts
+run() {
+    "$CLI" -p "$PORT" | sed -e '1,3d' -e 's/^inmemdb> //' -e '/^$/d'
+}
+
+info() {
+    echo "INFO persistence" | run | tr -d '\r'
+}
+
+# start [server options]: wait for PING, then for the load to finish
+start() {
+    (cd "$WORK" && exec "$SERVER" --port "$PORT" "$@" >> server.log 2>&1) &
+    PID=$!
+    i=0
+    until [ "$(echo PING | run 2>/dev/null)" = PONG ]; do
+        i=$((i + 1))
+        [ $i -gt 100 ] && { fail "server did not start"; return 1; }
+        sleep 0.1
+    done
+    wait_info '^loading:0'
+}
+
+crash() {
+    kill -9 "$PID" 2>/dev/null
+    wait "$PID" 2>/dev/null
+    PID=
+}
+
+# wait_info pattern: poll INFO persistence until a line matches (10s)
+wait_info() {
+    i=0
+    until info | grep -q "$1"; do
+        i=$((i + 1))
+        [ $i -gt 100 ] && { fail "timed out waiting for $1"; return 1; }
+        sleep 0.1
+    done
+}
+
+delta_files() {
+    info | sed -n 's/^rdb_delta_files://p'
+}
+
+# expect name file1 file2: the reads before and after a restart match
+expect_same() {
+    if cmp -s "$2" "$3"; then
+        echo "ok   $1"
+    else
+        fail "$1"
+        diff "$2" "$3" | head -n 10
+    fi
+}
+
+# ---- Snapshot formats ----
+
+write_all_types() {
+    cat <<'EOF'
+SET str hello
+SET num 12345
+SET ttl live EX 100000
+SETBIT bits 7 1
+SETBIT bits 1000 1
+RPUSH list a b c 1 2 3
+HSET hsmall f1 v1 f2 v2
+SADD sint 1 2 3 100
+SADD sstr a b c
+ZADD zsmall 1 a 2 b 2.5 c
+XADD stream 1-1 f v
+XADD stream 2-1 a b c d
+PFADD hll a b c d e
+CMS.INITBYDIM cms 100 5
+CMS.INCRBY cms a 3 b 5
+TOPK.RESERVE tk 3
+TOPK.ADD tk a b a c a
+VADD vs VALUES 3 1 0 0 e1
+VADD vs VALUES 3 0 1 0 e2
+BF.ADD bf a
+CF.ADD cf a
+EOF
+    # Large encodings: a quicklist, a hashtable hash, a set past the
+    # intset limit, a skiplist zset and a string LZF compresses
+    awk 'BEGIN {
+        for (i = 0; i < 600; i += 50) {
+            l = "RPUSH biglist"; s = "SADD sbig"
+            for (j = i; j < i + 50; j++) { l = l " item" j; s = s " " j * 7 }
+            print l; print s
+        }
+        for (i = 0; i < 200; i += 50) {
+            h = "HSET hbig"; z = "ZADD zbig"
+            for (j = i; j < i + 50; j++) { h = h " f" j " v" j; z = z " " j / 4 " m" j }
+            print h; print z
+        }
+        for (i = 0; i < 20; i++) {
+            a = "APPEND lzf "
+            for (j = 0; j < 50; j++) a = a "abcdefghij" j % 10
+            print a
+        }
+    }'
+}
+
+read_all_types() {
+    run <<'EOF'
+GET str
+GET num
+GETBIT bits 7
+GETBIT bits 1000
+BITCOUNT bits
+LRANGE list 0 -1
+HMGET hsmall f1 f2
+SMISMEMBER sint 1 2 3 100 5
+SMISMEMBER sstr a b c d
+ZRANGE zsmall 0 -1 WITHSCORES
+XRANGE stream - +
+PFCOUNT hll
+CMS.QUERY cms a b c
+TOPK.QUERY tk a b c z
+VCARD vs
+VDIM vs
+BF.EXISTS bf a
+BF.EXISTS bf z
+CF.EXISTS cf a
+LLEN biglist
+LRANGE biglist 295 305
+LINDEX biglist -1
+SCARD sbig
+SMISMEMBER sbig 0 7 4193 4200
+HLEN hbig
+HMGET hbig f0 f99 f199
+ZCARD zbig
+ZRANGE zbig 0 3 WITHSCORES
+ZRANGE zbig -3 -1 WITHSCORES
+STRLEN lzf
+GETRANGE lzf 0 30
+GETRANGE lzf -30 -1
+DBSIZE
+MGET bulk:0 bulk:29999 bulk:59999
+EOF
+    # A TTL only has to survive, not keep its exact value
+    printf 'TTL ttl\nTTL str\n' | run | sed 's/^(integer) [1-9][0-9]*$/(integer) positive/'
+}
+
+# Enough keys for several 4MB chunks, with values LZF cannot shrink much
+write_bulk() {
+    awk 'BEGIN {
+        srand(1)
+        for (i = 0; i < 60000; i += 25) {
+            m = "MSET"
+            for (j = i; j < i + 25; j++) {
+                v = ""
+                for (k = 0; k < 16; k++) v = v sprintf("%06d", int(rand() * 1000000))
+                m = m " bulk:" j " " v
+            }
+            print m
+        }
+    }'
+}
+
+snapshot_case() {
+    name=$1
+    shift
+    rm -rf "$WORK"/dump.rdb*
+    start "$@" || return
+    { write_all_types; write_bulk; } | run > /dev/null
+    read_all_types > "$WORK/before"
+    echo SAVE | run > /dev/null
+    crash
+    start "$@" || return
+    read_all_types > "$WORK/after"
+    crash
+    expect_same "$name" "$WORK/before" "$WORK/after"
+}
+
+# ---- Delta checkpoints ----
+
+start_delta() {
+    start --delta-checkpoints yes --save "1 1" "$@"
+}
+
+read_delta_keys() {
+    echo "MGET a b c d e f g t" | run
+    echo "LRANGE l 0 -1" | run
+    echo DBSIZE | run
+}
+
+# SAVE, retried while a checkpoint the save rule started is still running
+save() {
+    i=0
+    until [ "$(echo SAVE | run | tr -d '\r')" = OK ]; do
+        i=$((i + 1))
+        [ $i -gt 100 ] && { fail "SAVE kept failing"; return 1; }
+        sleep 0.1
+    done
+}
+
+# wait_delta n: the nth delta since the snapshot is on disk
+wait_delta() {
+    wait_info "^rdb_delta_files:$1\$"
+}
+
+delta_case() {
+    rm -rf "$WORK"/dump.rdb*
+    start_delta || return
+    # A snapshot big enough that a few small deltas stay under the
+    # consolidation threshold
+    { write_bulk | sed -n '1,10p'; echo "MSET a 1 b 1 c 1 d 1 e 1 t old"; echo "RPUSH l x y"; } | run > /dev/null
+    save || return
+
+    # Each step goes through one connection so its writes share a checkpoint.
+    # Plain changes and a DELETE record:
+    printf 'MSET a 2 c 2\nDEL b\n' | run > /dev/null
+    wait_delta 1 || return
+
+    # A key deleted in one delta and written again in the next
+    echo "DEL d" | run > /dev/null
+    wait_delta 2 || return
+    printf 'SET d back\nRPUSH l z\n' | run > /dev/null
+    wait_delta 3 || return
+
+    # Deleted and written again between two checkpoints; the snapshot's
+    # older t must not return once the new one expires
+    printf 'DEL e\nSET e again\nSET t new EX 1\n' | run > /dev/null
+    wait_delta 4 || return
+
+    # A checkpoint that cannot be written puts its keys back for the next
+    # (a directory in the way of its temporary file, not empty so that
+    # remove() cannot clear it)
+    mkdir -p "$WORK/dump.rdb.5.delta.tmp/x"
+    echo "SET f kept" | run > /dev/null
+    wait_info '^rdb_last_bgsave_status:err' || return
+    rm -rf "$WORK/dump.rdb.5.delta.tmp"
+    echo "SET g 1" | run > /dev/null
+    wait_delta 5 || return
+    sleep 1.2
+    read_delta_keys > "$WORK/before"
+    crash
+
+    start_delta || return
+    read_delta_keys > "$WORK/after"
+    [ "$(delta_files)" = 5 ] || fail "delta: $(delta_files) of 5 deltas applied"
+    grep -q kept "$WORK/after" || fail "delta: the failed checkpoint's key is missing"
+    expect_same "delta replay" "$WORK/before" "$WORK/after"
+    echo "SET h 1" | run > /dev/null
+    wait_delta 6 || return
+    crash
+}
+
+# Deltas left over from an earlier snapshot's id are not applied to a new one
+stale_case() {
+    mkdir -p "$WORK/stale"
+    mv "$WORK"/dump.rdb.*.delta "$WORK/stale/"
+    rm -rf "$WORK"/dump.rdb*
+    start_delta || return
+    echo "MSET a fresh z 1" | run > /dev/null
+    save || return
+    read_delta_keys > "$WORK/before"
+    crash
+    cp "$WORK/stale/dump.rdb.1.delta" "$WORK/dump.rdb.1.delta"
+    start_delta || return
+    read_delta_keys > "$WORK/after"
+    crash
+    expect_same "stale delta ignored" "$WORK/before" "$WORK/after"
+}
+
+# Once the deltas outgrow delta-consolidate-percentage of the snapshot, the
+# next checkpoint is a full snapshot that removes them
+consolidate_case() {
+    rm -rf "$WORK"/dump.rdb*
+    start_delta --delta-consolidate-percentage 10 || return
+    write_bulk | sed -n '1,40p' | run > /dev/null
+    save || return
+    # 200 changed keys fit in one delta: nothing was on top of the snapshot
+    write_bulk | sed -n '1,8p' | run > /dev/null
+    wait_delta 1 || return
+    # That delta is past 10% of the snapshot, so the next checkpoint is full
+    echo "SET after consolidation" | run > /dev/null
+    wait_delta 0 || return
+    ls "$WORK"/dump.rdb.*.delta > /dev/null 2>&1 && fail "consolidate: delta files left behind"
+    echo "MGET bulk:0 bulk:100 after" | run > "$WORK/before"
+    crash
+    start_delta || return
+    echo "MGET bulk:0 bulk:100 after" | run > "$WORK/after"
+    crash
+    expect_same "consolidation" "$WORK/before" "$WORK/after"
+}
+
+[ -x "$SERVER" ] && [ -x "$CLI" ] || { echo "build the server and CLI first (make)"; exit 1; }
+
+snapshot_case "snapshot, chunks decoded on worker threads" --rdb-threads 4
+snapshot_case "snapshot, chunks decoded inline" --rdb-threads 1
+snapshot_case "snapshot, uncompressed strings" --rdbcompression no
+delta_case
+stale_case
+consolidate_case
+
+[ $FAILED = 0 ] && echo "all round trips passed"
+exit $FAILED